@@ -0,0 +1,577 @@
+#pragma once
+
+#include <glm.hpp>
+
+#include <Culling.hpp>
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Objects per leaf; leaves hold at most this many before the builder splits them
+#ifndef BVH_LEAF_SIZE
+
+    #define BVH_LEAF_SIZE 4
+
+#endif // BVH_LEAF_SIZE
+
+// Centroid bins per axis for the SAH split search
+#ifndef BVH_SAH_BINS
+
+    #define BVH_SAH_BINS 12
+
+#endif // BVH_SAH_BINS
+
+// refit() rebuilds instead once pending inserts plus stale removals exceed 1/N of the objects
+#ifndef BVH_REBUILD_FRACTION
+
+    #define BVH_REBUILD_FRACTION 8
+
+#endif // BVH_REBUILD_FRACTION
+
+namespace gl {
+
+    struct bvhHit {
+        uint32_t id = 0xFFFFFFFFu;
+        float distance = FLT_MAX;
+    };
+
+    // Scene-wide bounding volume hierarchy over object boxes. Nodes are 4 wide with their
+    // children's bounds stored SoA, so every query tests a whole node with one SSE op per
+    // plane or slab; nodes are 128 bytes, two cache lines, and children come after their
+    // parent in the array.
+    //
+    // Objects are handles from insert(). Moving objects call update() and then refit() once
+    // per frame, which recomputes node bounds bottom-up without touching the topology. New
+    // objects wait in a pending list that queries test linearly until the next build();
+    // removed ones are skipped in their leaves. refit() turns into a full SAH build() once
+    // those pile up.
+    class bvh {
+    public:
+        static constexpr uint32_t invalid = 0xFFFFFFFFu;
+
+    private:
+        // A child is an inner node (count == 0), a leaf (ids m_Prims[child, child + count))
+        // or empty (child == invalid, bounds inverted)
+        struct alignas(16) node {
+            float minX[4], minY[4], minZ[4];
+            float maxX[4], maxY[4], maxZ[4];
+            uint32_t child[4];
+            uint32_t count[4];
+
+            void set(int slot, const gl::aabb& box) {
+                minX[slot] = box.min.x;
+                minY[slot] = box.min.y;
+                minZ[slot] = box.min.z;
+                maxX[slot] = box.max.x;
+                maxY[slot] = box.max.y;
+                maxZ[slot] = box.max.z;
+            }
+
+            gl::aabb bounds() const {
+                gl::aabb box;
+                for (int i = 0; i < 4; ++i) {
+                    if (child[i] == invalid) continue;
+                    box.expand(gl::aabb{ { minX[i], minY[i], minZ[i] }, { maxX[i], maxY[i], maxZ[i] } });
+                }
+                return box;
+            }
+
+            // Bits of the non-empty slots
+            uint32_t valid() const {
+                __m128i c = _mm_load_si128(reinterpret_cast<const __m128i*>(child));
+                return ~static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(c, _mm_set1_epi32(-1))))) & 0xFu;
+            }
+        };
+
+        static_assert(sizeof(node) == 128);
+
+        struct range {
+            uint32_t begin, end;
+            gl::aabb bounds;
+        };
+
+        struct stackEntry {
+            uint32_t node;
+            float distance;
+        };
+
+        enum state : uint8_t { Free, Pending, InTree };
+
+        std::vector<gl::aabb> m_Boxes;          // by id
+        std::vector<uint8_t> m_State;
+        std::vector<uint32_t> m_Slot;           // position in m_Pending
+        std::vector<uint32_t> m_Free;
+        std::vector<uint32_t> m_Pending;
+        std::vector<uint32_t> m_Prims;          // ids in leaf order
+        std::vector<node> m_Nodes;
+        std::vector<glm::vec3> m_Centroids;     // build scratch, by id
+        size_t m_Alive = 0;
+        size_t m_Stale = 0;                     // removed ids still listed in leaves
+
+        static float area(const gl::aabb& box) {
+            glm::vec3 e = box.max - box.min;
+            return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+
+        static float distance2(const gl::aabb& box, const glm::vec3& point) {
+            glm::vec3 d = glm::max(glm::max(box.min - point, point - box.max), glm::vec3(0.0f));
+            return glm::dot(d, d);
+        }
+
+        // Slab test; `t` is the entry distance (0 when starting inside)
+        static bool slab(const gl::aabb& box, const glm::vec3& origin, const glm::vec3& invDir, float maxDistance, float& t) {
+            glm::vec3 t1 = (box.min - origin) * invDir, t2 = (box.max - origin) * invDir;
+            glm::vec3 tn = glm::min(t1, t2), tf = glm::max(t1, t2);
+            float enter = std::max(std::max(tn.x, tn.y), std::max(tn.z, 0.0f));
+            float exit = std::min(std::min(tf.x, tf.y), std::min(tf.z, maxDistance));
+            t = enter;
+            return enter <= exit;
+        }
+
+        // 1 / direction with zero components made tiny instead, so an axis-aligned ray starting
+        // on a box face gets 0 * huge = 0 in the slab test rather than 0 * inf = NaN
+        static glm::vec3 inverseDirection(const glm::vec3& direction) {
+            glm::vec3 d = direction;
+            for (int a = 0; a < 3; ++a)
+                if (std::abs(d[a]) < 1e-20f) d[a] = std::signbit(d[a]) ? -1e-20f : 1e-20f;
+            return 1.0f / d;
+        }
+
+        gl::aabb rangeBounds(uint32_t begin, uint32_t end) const {
+            gl::aabb box;
+            for (uint32_t i = begin; i < end; ++i) box.expand(m_Boxes[m_Prims[i]]);
+            return box;
+        }
+
+        // Binned SAH over centroids; falls back to a median split when centroids coincide
+        uint32_t split(const range& r) {
+            gl::aabb centroids;
+            for (uint32_t i = r.begin; i < r.end; ++i) centroids.expand(m_Centroids[m_Prims[i]]);
+
+            float bestCost = FLT_MAX;
+            int bestAxis = -1, bestBin = 0;
+            for (int axis = 0; axis < 3; ++axis) {
+                float extent = centroids.max[axis] - centroids.min[axis];
+                if (extent <= 0.0f) continue;
+
+                std::array<gl::aabb, BVH_SAH_BINS> boxes;
+                std::array<uint32_t, BVH_SAH_BINS> counts{};
+                float scale = BVH_SAH_BINS / extent;
+                for (uint32_t i = r.begin; i < r.end; ++i) {
+                    uint32_t id = m_Prims[i];
+                    int bin = std::min(static_cast<int>((m_Centroids[id][axis] - centroids.min[axis]) * scale), BVH_SAH_BINS - 1);
+                    boxes[bin].expand(m_Boxes[id]);
+                    counts[bin]++;
+                }
+
+                // Right-hand areas and counts for every split plane, then sweep from the left
+                std::array<float, BVH_SAH_BINS> rightArea;
+                std::array<uint32_t, BVH_SAH_BINS> rightCount;
+                gl::aabb right;
+                uint32_t count = 0;
+                for (int b = BVH_SAH_BINS - 1; b > 0; --b) {
+                    right.expand(boxes[b]);
+                    count += counts[b];
+                    rightArea[b] = right.empty() ? 0.0f : area(right);
+                    rightCount[b] = count;
+                }
+
+                gl::aabb left;
+                count = 0;
+                for (int b = 0; b < BVH_SAH_BINS - 1; ++b) {
+                    left.expand(boxes[b]);
+                    count += counts[b];
+                    if (count == 0 || rightCount[b + 1] == 0) continue;
+                    float cost = area(left) * count + rightArea[b + 1] * rightCount[b + 1];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = b;
+                    }
+                }
+            }
+
+            uint32_t mid = r.begin + (r.end - r.begin) / 2;
+            if (bestAxis >= 0) {
+                float scale = BVH_SAH_BINS / (centroids.max[bestAxis] - centroids.min[bestAxis]);
+                float origin = centroids.min[bestAxis];
+                auto it = std::partition(m_Prims.begin() + r.begin, m_Prims.begin() + r.end, [&](uint32_t id) {
+                    return std::min(static_cast<int>((m_Centroids[id][bestAxis] - origin) * scale), BVH_SAH_BINS - 1) <= bestBin;
+                });
+                uint32_t at = static_cast<uint32_t>(it - m_Prims.begin());
+                if (at != r.begin && at != r.end) mid = at;
+            }
+            return mid;
+        }
+
+        // Splits the largest child above the leaf size until there are four, then recurses
+        uint32_t buildNode(const range& r) {
+            uint32_t index = static_cast<uint32_t>(m_Nodes.size());
+            m_Nodes.emplace_back();
+
+            std::array<range, 4> children;
+            int count = 1;
+            children[0] = r;
+            while (count < 4) {
+                int pick = -1;
+                float largest = -1.0f;
+                for (int i = 0; i < count; ++i) {
+                    if (children[i].end - children[i].begin <= BVH_LEAF_SIZE) continue;
+                    float a = area(children[i].bounds);
+                    if (a > largest) {
+                        largest = a;
+                        pick = i;
+                    }
+                }
+                if (pick < 0) break;
+
+                range parent = children[pick];
+                uint32_t mid = split(parent);
+                children[pick] = { parent.begin, mid, rangeBounds(parent.begin, mid) };
+                children[count++] = { mid, parent.end, rangeBounds(mid, parent.end) };
+            }
+
+            for (int i = 0; i < 4; ++i) {
+                uint32_t child = invalid, leafCount = 0;
+                gl::aabb box;
+                if (i < count) {
+                    box = children[i].bounds;
+                    uint32_t size = children[i].end - children[i].begin;
+                    if (size <= BVH_LEAF_SIZE) {
+                        child = children[i].begin;
+                        leafCount = size;
+                    }
+                    else child = buildNode(children[i]);  // may reallocate m_Nodes
+                }
+                node& n = m_Nodes[index];
+                n.set(i, box);
+                n.child[i] = child;
+                n.count[i] = leafCount;
+            }
+            return index;
+        }
+
+        static std::vector<stackEntry>& stack() {
+            thread_local std::vector<stackEntry> entries;
+            entries.clear();
+            return entries;
+        }
+    public:
+        bvh() = default;
+
+        // Handle for the object, stable until remove()
+        uint32_t insert(const gl::aabb& box) {
+            uint32_t id;
+            if (!m_Free.empty()) {
+                id = m_Free.back();
+                m_Free.pop_back();
+            }
+            else {
+                id = static_cast<uint32_t>(m_Boxes.size());
+                m_Boxes.emplace_back();
+                m_State.push_back(Free);
+                m_Slot.push_back(0);
+            }
+            m_Boxes[id] = box;
+            m_State[id] = Pending;
+            m_Slot[id] = static_cast<uint32_t>(m_Pending.size());
+            m_Pending.push_back(id);
+            m_Alive++;
+            return id;
+        }
+
+        void remove(uint32_t id) {
+            if (id >= m_State.size() || m_State[id] == Free) return;
+            if (m_State[id] == Pending) {
+                uint32_t last = m_Pending.back();
+                m_Pending[m_Slot[id]] = last;
+                m_Slot[last] = m_Slot[id];
+                m_Pending.pop_back();
+            }
+            else m_Stale++;
+            m_State[id] = Free;
+            m_Free.push_back(id);
+            m_Alive--;
+        }
+
+        // New bounds for a moved object; visible to queries after the next refit()
+        void update(uint32_t id, const gl::aabb& box) { m_Boxes[id] = box; }
+
+        // Full binned-SAH build over every live object
+        void build() {
+            for (uint32_t id : m_Pending) m_State[id] = InTree;
+            m_Pending.clear();
+            m_Stale = 0;
+
+            m_Prims.clear();
+            m_Centroids.resize(m_Boxes.size());
+            for (uint32_t id = 0; id < m_Boxes.size(); ++id) {
+                if (m_State[id] != InTree) continue;
+                m_Prims.push_back(id);
+                m_Centroids[id] = m_Boxes[id].center();
+            }
+
+            m_Nodes.clear();
+            m_Nodes.reserve(m_Prims.size() / 2 + 1);
+            if (!m_Prims.empty()) buildNode({ 0, static_cast<uint32_t>(m_Prims.size()), rangeBounds(0, static_cast<uint32_t>(m_Prims.size())) });
+        }
+
+        // Bottom-up bounds update after update() calls. Rebuilds instead when inserts and
+        // removals since the last build exceed 1/BVH_REBUILD_FRACTION of the objects.
+        void refit() {
+            if ((m_Pending.size() + m_Stale) * BVH_REBUILD_FRACTION > m_Alive) {
+                build();
+                return;
+            }
+            for (size_t i = m_Nodes.size(); i-- > 0;) {
+                node& n = m_Nodes[i];
+                for (int c = 0; c < 4; ++c) {
+                    if (n.child[c] == invalid) continue;
+                    gl::aabb box;
+                    if (n.count[c]) {
+                        for (uint32_t p = n.child[c]; p < n.child[c] + n.count[c]; ++p)
+                            if (m_State[m_Prims[p]] == InTree) box.expand(m_Boxes[m_Prims[p]]);
+                    }
+                    else box = m_Nodes[n.child[c]].bounds();
+                    n.set(c, box);
+                }
+            }
+        }
+
+        // Ids of the objects whose box intersects the frustum
+        void query(const gl::frustum& f, std::vector<uint32_t>& out) const {
+            out.clear();
+            for (uint32_t id : m_Pending)
+                if (f.intersects(m_Boxes[id])) out.push_back(id);
+            if (m_Nodes.empty()) return;
+
+            __m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+            for (int p = 0; p < 6; ++p) {
+                const glm::vec4& plane = f.planes[p];
+                nx[p] = _mm_set1_ps(plane.x);
+                ny[p] = _mm_set1_ps(plane.y);
+                nz[p] = _mm_set1_ps(plane.z);
+                ax[p] = _mm_set1_ps(std::abs(plane.x));
+                ay[p] = _mm_set1_ps(std::abs(plane.y));
+                az[p] = _mm_set1_ps(std::abs(plane.z));
+                d[p] = _mm_set1_ps(plane.w);
+            }
+            const __m128 half = _mm_set1_ps(0.5f);
+
+            std::vector<stackEntry>& todo = stack();
+            todo.push_back({ 0, 0.0f });
+            while (!todo.empty()) {
+                const node& n = m_Nodes[todo.back().node];
+                todo.pop_back();
+
+                __m128 loX = _mm_load_ps(n.minX), loY = _mm_load_ps(n.minY), loZ = _mm_load_ps(n.minZ);
+                __m128 hiX = _mm_load_ps(n.maxX), hiY = _mm_load_ps(n.maxY), hiZ = _mm_load_ps(n.maxZ);
+                __m128 cx = _mm_mul_ps(_mm_add_ps(loX, hiX), half), ex = _mm_mul_ps(_mm_sub_ps(hiX, loX), half);
+                __m128 cy = _mm_mul_ps(_mm_add_ps(loY, hiY), half), ey = _mm_mul_ps(_mm_sub_ps(hiY, loY), half);
+                __m128 cz = _mm_mul_ps(_mm_add_ps(loZ, hiZ), half), ez = _mm_mul_ps(_mm_sub_ps(hiZ, loZ), half);
+
+                __m128 nearest = _mm_set1_ps(FLT_MAX);
+                for (int p = 0; p < 6; ++p) {
+                    __m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), d[p]));
+                    s = _mm_add_ps(s, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez)));
+                    nearest = _mm_min_ps(nearest, s);
+                }
+
+                uint32_t hit = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(nearest, _mm_setzero_ps()))) & n.valid();
+                while (hit) {
+                    int c = std::countr_zero(hit);
+                    hit &= hit - 1;
+                    if (!n.count[c]) {
+                        todo.push_back({ n.child[c], 0.0f });
+                        continue;
+                    }
+                    for (uint32_t p = n.child[c]; p < n.child[c] + n.count[c]; ++p) {
+                        uint32_t id = m_Prims[p];
+                        if (m_State[id] == InTree && f.intersects(m_Boxes[id])) out.push_back(id);
+                    }
+                }
+            }
+        }
+
+        // Ids of the objects whose box comes within `radius` of `center`, e.g. lit by a light
+        void query(const glm::vec3& center, float radius, std::vector<uint32_t>& out) const {
+            out.clear();
+            const float radius2 = radius * radius;
+            for (uint32_t id : m_Pending)
+                if (distance2(m_Boxes[id], center) <= radius2) out.push_back(id);
+            if (m_Nodes.empty()) return;
+
+            const __m128 px = _mm_set1_ps(center.x), py = _mm_set1_ps(center.y), pz = _mm_set1_ps(center.z);
+            const __m128 r2 = _mm_set1_ps(radius2), zero = _mm_setzero_ps();
+
+            std::vector<stackEntry>& todo = stack();
+            todo.push_back({ 0, 0.0f });
+            while (!todo.empty()) {
+                const node& n = m_Nodes[todo.back().node];
+                todo.pop_back();
+
+                __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(n.minX), px), _mm_sub_ps(px, _mm_load_ps(n.maxX))), zero);
+                __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(n.minY), py), _mm_sub_ps(py, _mm_load_ps(n.maxY))), zero);
+                __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(n.minZ), pz), _mm_sub_ps(pz, _mm_load_ps(n.maxZ))), zero);
+                __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+                uint32_t hit = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(dist2, r2))) & n.valid();
+                while (hit) {
+                    int c = std::countr_zero(hit);
+                    hit &= hit - 1;
+                    if (!n.count[c]) {
+                        todo.push_back({ n.child[c], 0.0f });
+                        continue;
+                    }
+                    for (uint32_t p = n.child[c]; p < n.child[c] + n.count[c]; ++p) {
+                        uint32_t id = m_Prims[p];
+                        if (m_State[id] == InTree && distance2(m_Boxes[id], center) <= radius2) out.push_back(id);
+                    }
+                }
+            }
+        }
+
+        // Nearest object box along the ray within `maxDistance`. `direction` need not be
+        // normalized; distances are in its units. A zero component counts as a tiny step in
+        // its sign, so a ray lying in a face plane hits when that step points into the box.
+        bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, bvhHit& hit) const {
+            hit = {};
+            hit.distance = maxDistance;
+            const glm::vec3 invDir = inverseDirection(direction);
+
+            float t;
+            for (uint32_t id : m_Pending)
+                if (slab(m_Boxes[id], origin, invDir, hit.distance, t) && t < hit.distance) hit = { id, t };
+
+            if (!m_Nodes.empty()) {
+                const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+                const __m128 ix = _mm_set1_ps(invDir.x), iy = _mm_set1_ps(invDir.y), iz = _mm_set1_ps(invDir.z);
+
+                std::vector<stackEntry>& todo = stack();
+                todo.push_back({ 0, 0.0f });
+                while (!todo.empty()) {
+                    stackEntry top = todo.back();
+                    todo.pop_back();
+                    if (top.distance > hit.distance) continue;
+                    const node& n = m_Nodes[top.node];
+
+                    __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.minX), ox), ix), t2x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.maxX), ox), ix);
+                    __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.minY), oy), iy), t2y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.maxY), oy), iy);
+                    __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.minZ), oz), iz), t2z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.maxZ), oz), iz);
+                    __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t1x, t2x), _mm_min_ps(t1y, t2y)), _mm_max_ps(_mm_min_ps(t1z, t2z), _mm_setzero_ps()));
+                    __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t1x, t2x), _mm_max_ps(t1y, t2y)), _mm_min_ps(_mm_max_ps(t1z, t2z), _mm_set1_ps(hit.distance)));
+
+                    uint32_t hits = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(enter, exit))) & n.valid();
+                    alignas(16) float entry[4];
+                    _mm_store_ps(entry, enter);
+
+                    // Inner children go on the stack farthest first, so the nearest is popped next
+                    std::array<stackEntry, 4> inner;
+                    int innerCount = 0;
+                    while (hits) {
+                        int c = std::countr_zero(hits);
+                        hits &= hits - 1;
+                        if (!n.count[c]) {
+                            inner[innerCount++] = { n.child[c], entry[c] };
+                            continue;
+                        }
+                        for (uint32_t p = n.child[c]; p < n.child[c] + n.count[c]; ++p) {
+                            uint32_t id = m_Prims[p];
+                            if (m_State[id] == InTree && slab(m_Boxes[id], origin, invDir, hit.distance, t) && t < hit.distance) hit = { id, t };
+                        }
+                    }
+                    std::sort(inner.begin(), inner.begin() + innerCount, [](const stackEntry& a, const stackEntry& b) { return a.distance > b.distance; });
+                    for (int i = 0; i < innerCount; ++i) todo.push_back(inner[i]);
+                }
+            }
+            return hit.id != invalid;
+        }
+
+        // Object whose box is closest to `point` (0 inside it), within `maxDistance`
+        bool nearest(const glm::vec3& point, float maxDistance, bvhHit& hit) const {
+            hit = {};
+            float best2 = maxDistance * maxDistance;
+            for (uint32_t id : m_Pending) {
+                float d2 = distance2(m_Boxes[id], point);
+                if (d2 < best2) {
+                    best2 = d2;
+                    hit.id = id;
+                }
+            }
+
+            if (!m_Nodes.empty()) {
+                const __m128 px = _mm_set1_ps(point.x), py = _mm_set1_ps(point.y), pz = _mm_set1_ps(point.z), zero = _mm_setzero_ps();
+
+                std::vector<stackEntry>& todo = stack();
+                todo.push_back({ 0, 0.0f });
+                while (!todo.empty()) {
+                    stackEntry top = todo.back();
+                    todo.pop_back();
+                    if (top.distance >= best2) continue;
+                    const node& n = m_Nodes[top.node];
+
+                    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(n.minX), px), _mm_sub_ps(px, _mm_load_ps(n.maxX))), zero);
+                    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(n.minY), py), _mm_sub_ps(py, _mm_load_ps(n.maxY))), zero);
+                    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(n.minZ), pz), _mm_sub_ps(pz, _mm_load_ps(n.maxZ))), zero);
+                    __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+                    uint32_t hits = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(dist2, _mm_set1_ps(best2)))) & n.valid();
+                    alignas(16) float distance[4];
+                    _mm_store_ps(distance, dist2);
+
+                    std::array<stackEntry, 4> inner;
+                    int innerCount = 0;
+                    while (hits) {
+                        int c = std::countr_zero(hits);
+                        hits &= hits - 1;
+                        if (!n.count[c]) {
+                            inner[innerCount++] = { n.child[c], distance[c] };
+                            continue;
+                        }
+                        for (uint32_t p = n.child[c]; p < n.child[c] + n.count[c]; ++p) {
+                            uint32_t id = m_Prims[p];
+                            if (m_State[id] != InTree) continue;
+                            float d2 = distance2(m_Boxes[id], point);
+                            if (d2 < best2) {
+                                best2 = d2;
+                                hit.id = id;
+                            }
+                        }
+                    }
+                    std::sort(inner.begin(), inner.begin() + innerCount, [](const stackEntry& a, const stackEntry& b) { return a.distance > b.distance; });
+                    for (int i = 0; i < innerCount; ++i) todo.push_back(inner[i]);
+                }
+            }
+
+            if (hit.id == invalid) return false;
+            hit.distance = std::sqrt(best2);
+            return true;
+        }
+
+        void clear() {
+            m_Boxes.clear();
+            m_State.clear();
+            m_Slot.clear();
+            m_Free.clear();
+            m_Pending.clear();
+            m_Prims.clear();
+            m_Nodes.clear();
+            m_Alive = m_Stale = 0;
+        }
+
+        const gl::aabb& bounds(uint32_t id) const { return m_Boxes[id]; }
+
+        // Live objects, pending ones included
+        const size_t size() const { return m_Alive; }
+
+        const size_t nodeCount() const { return m_Nodes.size(); }
+    };
+
+}
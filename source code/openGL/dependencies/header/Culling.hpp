@@ -0,0 +1,272 @@
+#pragma once
+
+#include <glm.hpp>
+
+#include <Jobs.hpp>
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Above this many boxes cullSet::cull splits the work across the job pool
+#ifndef CULL_PARALLEL_MIN_BOXES
+
+    #define CULL_PARALLEL_MIN_BOXES 8192
+
+#endif // CULL_PARALLEL_MIN_BOXES
+
+namespace gl {
+
+    struct aabb {
+        glm::vec3 min = glm::vec3(FLT_MAX);
+        glm::vec3 max = glm::vec3(-FLT_MAX);
+
+        void expand(const glm::vec3& point) {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+
+        void expand(const aabb& other) {
+            min = glm::min(min, other.min);
+            max = glm::max(max, other.max);
+        }
+
+        const bool empty() const { return min.x > max.x; }
+
+        const glm::vec3 center() const { return (min + max) * 0.5f; }
+
+        const glm::vec3 extents() const { return (max - min) * 0.5f; }
+
+        // Box around this one after `transform` (Arvo): exact for the transformed box's
+        // corners, so it never shrinks below the true bounds
+        aabb transformed(const glm::mat4& transform) const {
+            if (empty()) return *this;
+            glm::vec3 c = glm::vec3(transform * glm::vec4(center(), 1.0f));
+            glm::mat3 m = glm::mat3(transform);
+            glm::vec3 e = extents();
+            glm::vec3 r = glm::abs(m[0]) * e.x + glm::abs(m[1]) * e.y + glm::abs(m[2]) * e.z;
+            return { c - r, c + r };
+        }
+    };
+
+    struct boundingSphere {
+        glm::vec3 center = glm::vec3(0.0f);
+        float radius = 0.0f;
+    };
+
+    // Six planes (left, right, bottom, top, near, far) facing inwards, normalized so plane
+    // distances are world units
+    struct frustum {
+        std::array<glm::vec4, 6> planes;
+
+        // Gribb/Hartmann extraction for GL clip space (-w <= x, y, z <= w)
+        static frustum fromMatrix(const glm::mat4& viewProjection) {
+            glm::vec4 row[4];
+            for (int i = 0; i < 4; ++i) row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+            frustum f;
+            f.planes = { row[3] + row[0], row[3] - row[0], row[3] + row[1], row[3] - row[1], row[3] + row[2], row[3] - row[2] };
+            for (glm::vec4& p : f.planes) p /= glm::length(glm::vec3(p));
+            return f;
+        }
+
+        static frustum fromCamera(const glm::mat4& view, const glm::mat4& projection) { return fromMatrix(projection * view); }
+
+        // Scalar tests, for single objects; cullSet does the same box test in bulk
+        bool intersects(const aabb& box) const {
+            glm::vec3 c = box.center(), e = box.extents();
+            for (const glm::vec4& p : planes)
+                if (glm::dot(glm::vec3(p), c) + p.w + glm::dot(glm::abs(glm::vec3(p)), e) < 0.0f) return false;
+            return true;
+        }
+
+        bool intersects(const boundingSphere& sphere) const {
+            for (const glm::vec4& p : planes)
+                if (glm::dot(glm::vec3(p), sphere.center) + p.w < -sphere.radius) return false;
+            return true;
+        }
+    };
+
+    // Sphere centered on the vertices' box, radius to the farthest vertex
+    inline boundingSphere sphereAround(std::span<const glm::vec3> points, const aabb& box) {
+        boundingSphere sphere{ box.center(), 0.0f };
+        float radius2 = 0.0f;
+        for (const glm::vec3& p : points) {
+            glm::vec3 d = p - sphere.center;
+            radius2 = std::max(radius2, glm::dot(d, d));
+        }
+        sphere.radius = std::sqrt(radius2);
+        return sphere;
+    }
+
+    // SIMD lanes for the box test: 8 boxes per iteration, as one AVX register or two SSE ones
+    namespace cullLanes {
+
+        constexpr size_t batch = 8;
+
+#if defined(__AVX__)
+        using lane = __m256;
+        constexpr size_t width = 8;
+
+        inline lane load(const float* p) { return _mm256_loadu_ps(p); }
+        inline lane broadcast(float v) { return _mm256_set1_ps(v); }
+        inline lane madd(lane a, lane b, lane c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+        inline lane min(lane a, lane b) { return _mm256_min_ps(a, b); }
+        inline uint32_t nonNegative(lane v) { return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ))); }
+#else
+        using lane = __m128;
+        constexpr size_t width = 4;
+
+        inline lane load(const float* p) { return _mm_loadu_ps(p); }
+        inline lane broadcast(float v) { return _mm_set1_ps(v); }
+        inline lane madd(lane a, lane b, lane c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+        inline lane min(lane a, lane b) { return _mm_min_ps(a, b); }
+        inline uint32_t nonNegative(lane v) { return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(v, _mm_setzero_ps()))); }
+#endif
+
+        // A frustum's planes broadcast once per cull, not per batch
+        struct planes {
+            lane nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+
+            explicit planes(const frustum& f) {
+                for (int i = 0; i < 6; ++i) {
+                    const glm::vec4& p = f.planes[i];
+                    nx[i] = broadcast(p.x);
+                    ny[i] = broadcast(p.y);
+                    nz[i] = broadcast(p.z);
+                    ax[i] = broadcast(std::abs(p.x));
+                    ay[i] = broadcast(std::abs(p.y));
+                    az[i] = broadcast(std::abs(p.z));
+                    d[i] = broadcast(p.w);
+                }
+            }
+        };
+    }
+
+    // World-space boxes in SoA form (center and half extents per axis), padded to a multiple
+    // of 8. cull() tests them against any number of views in one pass over the data and
+    // returns the visible indices per view in ascending order.
+    class cullSet {
+    private:
+        std::vector<float> m_CX, m_CY, m_CZ, m_EX, m_EY, m_EZ;
+        size_t m_Count = 0;
+        mutable std::vector<std::vector<uint32_t>> m_ChunkVisible;
+
+        // Box i is visible in a view when, for every plane, center distance + projected
+        // extent >= 0
+        static void cullRange(const cullSet& set, size_t begin, size_t end, std::span<const cullLanes::planes> views, std::vector<uint32_t>* visible) {
+            using namespace cullLanes;
+            for (size_t i = begin; i < end; i += batch) {
+                uint32_t valid = end - i >= batch ? 0xFFu : (1u << (end - i)) - 1u;
+
+                lane cx[batch / width], cy[batch / width], cz[batch / width], ex[batch / width], ey[batch / width], ez[batch / width];
+                for (size_t h = 0; h < batch / width; ++h) {
+                    size_t o = i + h * width;
+                    cx[h] = load(&set.m_CX[o]);
+                    cy[h] = load(&set.m_CY[o]);
+                    cz[h] = load(&set.m_CZ[o]);
+                    ex[h] = load(&set.m_EX[o]);
+                    ey[h] = load(&set.m_EY[o]);
+                    ez[h] = load(&set.m_EZ[o]);
+                }
+
+                for (size_t v = 0; v < views.size(); ++v) {
+                    const planes& f = views[v];
+                    uint32_t inside = 0;
+                    for (size_t h = 0; h < batch / width; ++h) {
+                        lane nearest = broadcast(FLT_MAX);
+                        for (int p = 0; p < 6; ++p) {
+                            lane s = madd(f.nx[p], cx[h], madd(f.ny[p], cy[h], madd(f.nz[p], cz[h], f.d[p])));
+                            s = madd(f.ax[p], ex[h], madd(f.ay[p], ey[h], madd(f.az[p], ez[h], s)));
+                            nearest = min(nearest, s);
+                        }
+                        inside |= nonNegative(nearest) << (h * width);
+                    }
+
+                    inside &= valid;
+                    while (inside) {
+                        visible[v].push_back(static_cast<uint32_t>(i + std::countr_zero(inside)));
+                        inside &= inside - 1;
+                    }
+                }
+            }
+        }
+    public:
+        void clear() {
+            m_Count = 0;
+            for (auto* a : { &m_CX, &m_CY, &m_CZ, &m_EX, &m_EY, &m_EZ }) a->clear();
+        }
+
+        void reserve(size_t count) {
+            for (auto* a : { &m_CX, &m_CY, &m_CZ, &m_EX, &m_EY, &m_EZ }) a->reserve(count + cullLanes::batch);
+        }
+
+        // Index of the box, for the visible lists. An empty box is never visible.
+        uint32_t add(const aabb& box) {
+            size_t padded = (m_Count + 1 + cullLanes::batch - 1) / cullLanes::batch * cullLanes::batch;
+            if (padded > m_CX.size())
+                for (auto* a : { &m_CX, &m_CY, &m_CZ, &m_EX, &m_EY, &m_EZ }) a->resize(padded, 0.0f);
+
+            glm::vec3 c = box.empty() ? glm::vec3(0.0f) : box.center();
+            glm::vec3 e = box.empty() ? glm::vec3(-FLT_MAX) : box.extents();
+            m_CX[m_Count] = c.x;
+            m_CY[m_Count] = c.y;
+            m_CZ[m_Count] = c.z;
+            m_EX[m_Count] = e.x;
+            m_EY[m_Count] = e.y;
+            m_EZ[m_Count] = e.z;
+            return static_cast<uint32_t>(m_Count++);
+        }
+
+        const size_t size() const { return m_Count; }
+
+        // visible[v] receives the boxes that intersect views[v]
+        void cull(std::span<const frustum> views, std::vector<std::vector<uint32_t>>& visible) const {
+            visible.resize(views.size());
+            for (auto& list : visible) list.clear();
+            if (views.empty() || m_Count == 0) return;
+
+            std::vector<cullLanes::planes> lanes;
+            lanes.reserve(views.size());
+            for (const frustum& f : views) lanes.emplace_back(f);
+
+            if (m_Count < CULL_PARALLEL_MIN_BOXES || jobPool::get().size() == 1) {
+                cullRange(*this, 0, m_Count, lanes, visible.data());
+                return;
+            }
+
+            // Chunks write their own lists, concatenated in order afterwards
+            const size_t grain = CULL_PARALLEL_MIN_BOXES / 2;
+            const size_t chunks = (m_Count + grain - 1) / grain;
+            m_ChunkVisible.resize(chunks * views.size());
+            jobPool::get().parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; ++c) {
+                    std::vector<uint32_t>* lists = &m_ChunkVisible[c * views.size()];
+                    for (size_t v = 0; v < views.size(); ++v) lists[v].clear();
+                    cullRange(*this, c * grain, std::min(m_Count, (c + 1) * grain), lanes, lists);
+                }
+            });
+
+            for (size_t c = 0; c < chunks; ++c)
+                for (size_t v = 0; v < views.size(); ++v) {
+                    const std::vector<uint32_t>& part = m_ChunkVisible[c * views.size() + v];
+                    visible[v].insert(visible[v].end(), part.begin(), part.end());
+                }
+        }
+
+        void cull(const frustum& view, std::vector<uint32_t>& visible) const {
+            std::vector<std::vector<uint32_t>> lists(1);
+            lists[0].swap(visible);
+            cull(std::span<const frustum>(&view, 1), lists);
+            visible.swap(lists[0]);
+        }
+    };
+
+}
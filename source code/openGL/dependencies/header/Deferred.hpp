@@ -0,0 +1,314 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm.hpp>
+
+#include <Utils.hpp>
+#include <StateCache.hpp>
+#include <UniformBuffer.hpp>
+#include <Lighting.hpp>
+#include <RenderGraph.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <span>
+
+namespace gl {
+
+    enum class shadingMode : uint8_t {
+        Forward = 0,
+        Deferred = 1,
+        Visibility = 2,     // see gl::visibilityBuffer
+    };
+
+    // Attachment traffic of one frame, estimated from the target sizes at one surface per
+    // pixel; overdraw and light volume fragments come on top
+    struct shadingStats {
+        shadingMode mode = shadingMode::Forward;
+        unsigned width = 0, height = 0;
+        unsigned bytesPerPixel = 0;     // what one stored surface costs: the G-buffer, the visibility target plus depth, or color plus depth
+        uint64_t frameBytes = 0;        // written and read by all passes
+        unsigned lightVolumes = 0;
+        unsigned materialPasses = 0;    // visibility buffer only
+        double resolveMilliseconds = 0.0;
+    };
+
+    // Forward shading writes one color and one depth per pixel
+    inline shadingStats forwardShadingStats(int width, int height) {
+        shadingStats stats;
+        stats.width = static_cast<unsigned>(std::max(width, 0));
+        stats.height = static_cast<unsigned>(std::max(height, 0));
+        stats.bytesPerPixel = 4 + 4;
+        stats.frameBytes = uint64_t(stats.width) * stats.height * stats.bytesPerPixel;
+        return stats;
+    }
+
+    // Compact G-buffer plus the passes that light it, used by gl::renderQueue in
+    // shadingMode::Deferred. Opaque draws go through frag.glsl's DEFERRED variant into
+    //   0  RGBA8           base color (gamma encoded)
+    //   1  RG16            octahedral normal
+    //   2  RGBA8           metallic, roughness, ao
+    //   3  R11F_G11F_B10F  emission plus the object's own lights
+    //      DEPTH32F        positions are rebuilt from it
+    // 20 bytes per pixel. The targets are transients of a gl::renderGraph: declare() creates
+    // them, attach() hands them to the passes drawing geometry, and addResolve() adds the
+    // passes that light them into an RGBA16F accumulation target, either in one full-screen
+    // pass over the clustered light grid (the default) or with one depth-tested box per
+    // scene light, and composite the result with its depth into the scene framebuffer. The
+    // boxes test against a copy of the depth: the lighting samples the G-buffer depth, and a
+    // texture sampled while attached is a feedback loop even with depth writes off.
+    //
+    // The lighting program reads IBL like frag.glsl does; gl::renderQueue binds its
+    // environment to getLightingProgram().
+    class gBuffer {
+    public:
+        static constexpr int targetCount = 4;
+
+        // One frame's G-buffer
+        struct surface {
+            gl::renderGraph::resource targets[targetCount];
+            gl::renderGraph::resource depth;
+        };
+    private:
+        GLint m_Viewport[4] = {};
+        int m_Width = 0, m_Height = 0;
+
+        gl::shader m_Lighting;
+        gl::shader m_Volumes;
+        gl::shader m_Composite;
+        GLuint m_EmptyVAO = 0;
+        GLuint m_ReadFBO = 0;           // the G-buffer depth, for the light volume copy
+
+        bool m_LightVolumes = false;
+        shadingStats m_Stats;
+        std::chrono::high_resolution_clock::time_point m_ResolveStart;
+
+        // The G-buffer samplers and reconstruction inputs of gbuffer.glsl
+        struct surfaceUniforms {
+            gl::uniform<gl::sampler> albedo, normal, material, emissive, depth;
+            gl::uniform<glm::mat4> inverseViewProjection;
+            gl::uniform<glm::vec4> viewport;
+
+            surfaceUniforms(GLuint program)
+                : albedo(program, "gbufferAlbedo", { 0 }), normal(program, "gbufferNormal", { 1 }), material(program, "gbufferMaterial", { 2 }),
+                emissive(program, "gbufferEmissive", { 3 }), depth(program, "gbufferDepth", { 4 }),
+                inverseViewProjection(program, "inverseViewProjection"), viewport(program, "gbufferViewport")
+            {
+            }
+
+            void upload(const glm::mat4& inverse, const glm::vec4& view) {
+                albedo.upload();
+                normal.upload();
+                material.upload();
+                emissive.upload();
+                depth.upload();
+                inverseViewProjection.upload(inverse);
+                viewport.upload(view);
+            }
+        };
+
+        surfaceUniforms m_LightingUniforms;
+        surfaceUniforms m_VolumeUniforms;
+        gl::uniform<bool> m_ClusteredLighting;
+        gl::uniform<gl::sampler> m_Accumulation, m_CompositeDepth;
+
+        void bindSurface(const gl::renderGraph& graph, const surface& s) {
+            gl::stateCache& state = gl::stateCache::get();
+            for (int i = 0; i < targetCount; ++i) state.bindTexture(i, GL_TEXTURE_2D, graph.texture(s.targets[i]));
+            state.bindTexture(targetCount, GL_TEXTURE_2D, graph.texture(s.depth));
+        }
+
+        const glm::vec4 viewportUniform() const {
+            return glm::vec4(m_Viewport[0], m_Viewport[1], 1.0f / std::max(m_Viewport[2], 1), 1.0f / std::max(m_Viewport[3], 1));
+        }
+
+        // Ambient and emission, plus the clustered lights unless volumes draw them, into the
+        // bound accumulation target. The G-buffer depth is only sampled; with light volumes it
+        // is first copied into the bound depth attachment, which the boxes test against.
+        void light(const gl::renderGraph& graph, const surface& s) {
+            m_ResolveStart = std::chrono::high_resolution_clock::now();
+            gl::stateCache& state = gl::stateCache::get();
+            const glm::mat4 inverse = glm::inverse(gl::sceneUniforms::get().frame.get().viewProjection);
+
+            GLint depthFunc, cullMode;
+            glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+            glGetIntegerv(GL_CULL_FACE_MODE, &cullMode);
+            const bool depthTest = state.isEnabled(GL_DEPTH_TEST), cullFace = state.isEnabled(GL_CULL_FACE);
+
+            state.disable(GL_BLEND);
+            state.disable(GL_DEPTH_TEST);
+            state.depthMask(false);
+            state.bindVertexArray(m_EmptyVAO);
+            bindSurface(graph, s);
+
+            state.useProgram(m_Lighting.getProgram());
+            m_LightingUniforms.upload(inverse, viewportUniform());
+            m_ClusteredLighting.upload(!m_LightVolumes);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            // Back faces of each light's box that lie behind the scene: surfaces in front of
+            // the far side, with the camera inside or outside the box
+            const uint32_t lights = gl::clusteredLights::get().uploaded();
+            m_Stats.lightVolumes = 0;
+            if (m_LightVolumes && lights) {
+                GLint readFBO;
+                glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, m_ReadFBO);
+                glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, graph.texture(s.depth), 0);
+                state.depthMask(true);
+                glBlitFramebuffer(0, 0, m_Width, m_Height, 0, 0, m_Width, m_Height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                state.depthMask(false);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+
+                state.enable(GL_DEPTH_TEST);
+                state.depthFunc(GL_GREATER);
+                state.enable(GL_CULL_FACE);
+                state.cullFace(GL_FRONT);
+                state.enable(GL_BLEND);
+                state.blendFunc(GL_ONE, GL_ONE);
+                glEnable(GL_DEPTH_CLAMP);
+
+                state.useProgram(m_Volumes.getProgram());
+                m_VolumeUniforms.upload(inverse, viewportUniform());
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 14, static_cast<GLsizei>(lights));
+                m_Stats.lightVolumes = lights;
+
+                glDisable(GL_DEPTH_CLAMP);
+                state.disable(GL_BLEND);
+                state.cullFace(static_cast<GLenum>(cullMode));
+                state.setEnabled(GL_CULL_FACE, cullFace);
+            }
+
+            state.depthFunc(static_cast<GLenum>(depthFunc));
+            state.setEnabled(GL_DEPTH_TEST, depthTest);
+        }
+
+        // Gamma and depth into the bound scene framebuffer; the background keeps its clear.
+        // Leaves depth writes on and blending off.
+        void composite(const gl::renderGraph& graph, const surface& s, gl::renderGraph::resource accumulation) {
+            gl::stateCache& state = gl::stateCache::get();
+            GLint depthFunc;
+            glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+            const bool depthTest = state.isEnabled(GL_DEPTH_TEST);
+
+            state.disable(GL_BLEND);
+            state.enable(GL_DEPTH_TEST);
+            state.depthFunc(GL_ALWAYS);
+            state.depthMask(true);
+            state.bindVertexArray(m_EmptyVAO);
+            state.bindTexture(0, GL_TEXTURE_2D, graph.texture(accumulation));
+            state.bindTexture(1, GL_TEXTURE_2D, graph.texture(s.depth));
+            state.useProgram(m_Composite.getProgram());
+            m_Accumulation.upload();
+            m_CompositeDepth.upload();
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            state.depthFunc(static_cast<GLenum>(depthFunc));
+            state.setEnabled(GL_DEPTH_TEST, depthTest);
+
+            // Geometry writes the G-buffer; lighting reads it and writes the accumulation, and
+            // copies depth for light volumes; composite reads that plus depth and writes color
+            // and depth
+            const uint64_t pixels = uint64_t(m_Viewport[2]) * uint64_t(m_Viewport[3]);
+            m_Stats.mode = shadingMode::Deferred;
+            m_Stats.width = m_Viewport[2];
+            m_Stats.height = m_Viewport[3];
+            m_Stats.bytesPerPixel = bytesPerPixel;
+            m_Stats.frameBytes = pixels * (bytesPerPixel + (bytesPerPixel + 8) + (8 + 4 + 4 + 4) + (m_LightVolumes ? 4 + 4 : 0));
+            m_Stats.resolveMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_ResolveStart).count();
+        }
+    public:
+        static constexpr unsigned bytesPerPixel = 4 + 4 + 4 + 4 + 4;
+
+        gBuffer()
+            : m_Lighting("resource/shader/fullscreen_vert.glsl", "resource/shader/deferred_frag.glsl"),
+            m_Volumes("resource/shader/light_volume_vert.glsl", "resource/shader/light_volume_frag.glsl"),
+            m_Composite("resource/shader/fullscreen_vert.glsl", "resource/shader/deferred_composite_frag.glsl"),
+            m_LightingUniforms(m_Lighting.getProgram()), m_VolumeUniforms(m_Volumes.getProgram()),
+            m_ClusteredLighting(m_Lighting.getProgram(), "clusteredLighting"),
+            m_Accumulation(m_Composite.getProgram(), "accumulation", { 0 }), m_CompositeDepth(m_Composite.getProgram(), "gbufferDepth", { 1 })
+        {
+            glGenVertexArrays(1, &m_EmptyVAO);
+
+            GLint readFBO;
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+            glGenFramebuffers(1, &m_ReadFBO);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, m_ReadFBO);
+            glReadBuffer(GL_NONE);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+        }
+
+        gBuffer(const gBuffer&) = delete;
+        gBuffer& operator=(const gBuffer&) = delete;
+
+        ~gBuffer() {
+            gl::stateCache& state = gl::stateCache::get();
+            state.vertexArrayDeleted(m_EmptyVAO);
+            glDeleteVertexArrays(1, &m_EmptyVAO);
+            glDeleteFramebuffers(1, &m_ReadFBO);
+            for (GLuint program : { m_Lighting.getProgram(), m_Volumes.getProgram(), m_Composite.getProgram() }) {
+                state.programDeleted(program);
+                glDeleteProgram(program);
+            }
+        }
+
+        // Creates this frame's targets, sized to cover the viewport
+        surface declare(gl::renderGraph& graph) {
+            static const char* names[targetCount] = { "g-buffer albedo", "g-buffer normal", "g-buffer material", "g-buffer emissive" };
+            static const GLenum formats[targetCount] = { GL_RGBA8, GL_RG16, GL_RGBA8, GL_R11F_G11F_B10F };
+
+            glGetIntegerv(GL_VIEWPORT, m_Viewport);
+            m_Width = std::max(m_Viewport[0] + m_Viewport[2], 1);
+            m_Height = std::max(m_Viewport[1] + m_Viewport[3], 1);
+            surface s;
+            for (int i = 0; i < targetCount; ++i) s.targets[i] = graph.create(names[i], { m_Width, m_Height, formats[i] });
+            s.depth = graph.create("g-buffer depth", { m_Width, m_Height, GL_DEPTH_COMPONENT32F });
+            return s;
+        }
+
+        // Makes a pass draw its geometry into the G-buffer, the first one clearing it, or
+        // only bind it to read
+        static void attach(gl::renderGraph::builder& pass, const surface& s, bool clear, bool written = true) {
+            for (int i = 0; i < targetCount; ++i) pass.color(s.targets[i], i, clear, written);
+            pass.depth(s.depth, clear, written);
+        }
+
+        // Adds "deferred lighting" and "deferred composite" after the geometry passes. `inputs`
+        // are what the lighting samples besides the G-buffer, the light grid and shadow maps.
+        void addResolve(gl::renderGraph& graph, const surface& s, gl::renderGraph::resource scene, std::span<const gl::renderGraph::resource> inputs) {
+            const gl::renderGraph::resource accumulation = graph.create("light accumulation", { m_Width, m_Height, GL_RGBA16F });
+            graph.addPass("deferred lighting", [&](gl::renderGraph::builder& pass) {
+                for (gl::renderGraph::resource target : s.targets) pass.read(target);
+                pass.read(s.depth);
+                for (gl::renderGraph::resource input : inputs) pass.read(input);
+                pass.color(accumulation, 0, true);
+                // Written by the copy light() makes first
+                if (m_LightVolumes) pass.depth(pass.create("light volume depth", { m_Width, m_Height, GL_DEPTH_COMPONENT32F }), false);
+            }, [this, &graph, s]() { light(graph, s); });
+            graph.addPass("deferred composite", [&](gl::renderGraph::builder& pass) {
+                pass.read(accumulation);
+                pass.read(s.depth);
+                pass.target(scene);
+            }, [this, &graph, s, accumulation]() { composite(graph, s, accumulation); });
+        }
+
+        // Off (the default) shades the scene lights in the full-screen pass from the clustered
+        // grid; on draws a depth-tested box per light instead
+        void setLightVolumes(bool enabled) { m_LightVolumes = enabled; }
+
+        const bool lightVolumes() const { return m_LightVolumes; }
+
+        const GLuint getLightingProgram() const { return m_Lighting.getProgram(); }
+
+        // Of the last declare()
+        const int getWidth() const { return m_Width; }
+
+        const int getHeight() const { return m_Height; }
+
+        // For the last composite
+        const shadingStats& stats() const { return m_Stats; }
+    };
+
+}
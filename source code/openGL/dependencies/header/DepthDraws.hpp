@@ -0,0 +1,134 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm.hpp>
+
+#include <Utils.hpp>
+#include <Mesh.hpp>
+#include <StateCache.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace gl {
+
+    struct depthInstance {
+        gl::object* mesh;
+        glm::mat4 model;
+    };
+
+    // Depth-only draws shared by the shadow passes and the depth pre-pass: instances drawn
+    // from the geometry pool's position stream, one draw per run of the same mesh, their
+    // model matrices read from a buffer texture. Collect every pass of a frame, upload once,
+    // then draw the passes by range. The vertex shader decides where the view-projection
+    // comes from: shadow_vert.glsl takes setViewProjection, prepass_vert.glsl the camera's.
+    class depthDraws {
+    private:
+        // Instances [first, first + count) of the records, one mesh
+        struct draw {
+            const gl::object* mesh;
+            uint32_t first;
+            uint32_t count;
+        };
+
+        gl::shader m_Depth;
+        gl::uniform<glm::mat4> m_ViewProjection;
+        gl::uniform<int> m_DrawBase;
+        gl::uniform<gl::sampler> m_Models;
+        GLuint m_Buffer = 0, m_Texture = 0;
+
+        std::vector<glm::mat4> m_Records;
+        std::vector<draw> m_Draws;
+    public:
+        struct range {
+            uint32_t first = 0, count = 0;      // into the draws
+        };
+
+        explicit depthDraws(const char* vertexShader)
+            : m_Depth(vertexShader, "resource/shader/depth_frag.glsl"),
+            m_ViewProjection(m_Depth.getProgram(), "depthViewProjection"), m_DrawBase(m_Depth.getProgram(), "drawBase"),
+            m_Models(m_Depth.getProgram(), "depthModels", { 0 })
+        {
+            glGenBuffers(1, &m_Buffer);
+            glGenTextures(1, &m_Texture);
+
+            gl::stateCache& state = gl::stateCache::get();
+            state.bindBuffer(GL_TEXTURE_BUFFER, m_Buffer);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            state.bindTexture(GL_TEXTURE_BUFFER, m_Texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_Buffer);
+        }
+
+        depthDraws(const depthDraws&) = delete;
+        depthDraws& operator=(const depthDraws&) = delete;
+
+        ~depthDraws() {
+            gl::stateCache& state = gl::stateCache::get();
+            state.textureDeleted(m_Texture);
+            glDeleteTextures(1, &m_Texture);
+            state.bufferDeleted(m_Buffer);
+            glDeleteBuffers(1, &m_Buffer);
+            state.programDeleted(m_Depth.getProgram());
+            glDeleteProgram(m_Depth.getProgram());
+        }
+
+        void clear() {
+            m_Records.clear();
+            m_Draws.clear();
+        }
+
+        // Appends the visible instances `keep` accepts; `visible` ascending, `instances` sorted
+        // by mesh, so runs of one mesh become one draw
+        template<typename F>
+        range collect(std::span<const depthInstance> instances, const std::vector<uint32_t>& visible, F keep) {
+            range r{ static_cast<uint32_t>(m_Draws.size()), 0 };
+            for (uint32_t i : visible) {
+                if (!keep(i)) continue;
+                const depthInstance& instance = instances[i];
+                if (r.count && m_Draws.back().mesh == instance.mesh) m_Draws.back().count++;
+                else {
+                    m_Draws.push_back({ instance.mesh, static_cast<uint32_t>(m_Records.size()), 1 });
+                    r.count++;
+                }
+                m_Records.push_back(instance.model);
+            }
+            return r;
+        }
+
+        range collect(std::span<const depthInstance> instances, const std::vector<uint32_t>& visible) {
+            return collect(instances, visible, [](uint32_t) { return true; });
+        }
+
+        void upload() {
+            const size_t bytes = m_Records.size() * sizeof(glm::mat4);
+            gl::stateCache::get().bindBuffer(GL_TEXTURE_BUFFER, m_Buffer);
+            glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+            if (bytes) glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, m_Records.data());
+        }
+
+        // Binds the program, the position stream and the records (texture unit 0)
+        void begin() {
+            gl::stateCache& state = gl::stateCache::get();
+            state.useProgram(m_Depth.getProgram());
+            state.bindVertexArray(gl::geometryPool::get().getPositionVAO());
+            state.bindTexture(0, GL_TEXTURE_BUFFER, m_Texture);
+            m_Models.upload();
+        }
+
+        void setViewProjection(const glm::mat4& viewProjection) { m_ViewProjection.upload(viewProjection); }
+
+        void draw(const range& r, unsigned& draws, unsigned& instances) {
+            for (uint32_t d = r.first; d < r.first + r.count; ++d) {
+                const gl::meshRange& mesh = m_Draws[d].mesh->getRange();
+                m_DrawBase.upload(static_cast<int>(m_Draws[d].first));
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, mesh.offset(), static_cast<GLsizei>(m_Draws[d].count), mesh.baseVertex);
+                draws++;
+                instances += m_Draws[d].count;
+            }
+        }
+    };
+
+}
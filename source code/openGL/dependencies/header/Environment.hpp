@@ -0,0 +1,546 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <glm.hpp>
+#include <gtc/constants.hpp>
+#include <gtc/type_ptr.hpp>
+
+#include <Utils.hpp>
+#include <Jobs.hpp>
+
+#include <stb_image.h>
+
+#include <immintrin.h>
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef IBL_CACHE_PATH
+
+    #define IBL_CACHE_PATH "resource/cache/ibl"
+
+#endif // IBL_CACHE_PATH
+
+namespace gl {
+
+    struct environmentSettings {
+        int specularSize = 128;         // face size of the prefiltered cubemap mip 0
+        int specularLevels = 6;         // roughness 0 .. 1 across the mip chain
+        int specularSamples = 128;      // GGX samples per texel and mip
+        int lutSize = 128;
+        int lutSamples = 256;
+        bool useCache = true;
+    };
+
+    // Equirectangular float RGB image plus a box-filtered pyramid for filtered importance sampling
+    class hdrImage {
+    private:
+        struct level {
+            int width, height;
+            std::vector<float> rgb;
+        };
+        std::vector<level> m_Levels;
+
+        glm::vec3 fetch(const level& l, int x, int y) const {
+            x = ((x % l.width) + l.width) % l.width;
+            y = std::clamp(y, 0, l.height - 1);
+            const float* p = &l.rgb[(size_t(y) * l.width + x) * 3];
+            return glm::vec3(p[0], p[1], p[2]);
+        }
+
+        glm::vec3 bilinear(const level& l, float u, float v) const {
+            float x = u * l.width - 0.5f, y = v * l.height - 0.5f;
+            int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+            float fx = x - x0, fy = y - y0;
+            return glm::mix(
+                glm::mix(fetch(l, x0, y0), fetch(l, x0 + 1, y0), fx),
+                glm::mix(fetch(l, x0, y0 + 1), fetch(l, x0 + 1, y0 + 1), fx), fy);
+        }
+
+        void buildPyramid() {
+            while (m_Levels.back().width > 1 && m_Levels.back().height > 1) {
+                const level& src = m_Levels.back();
+                level dst{ src.width / 2, src.height / 2, {} };
+                dst.rgb.resize(size_t(dst.width) * dst.height * 3);
+                for (int y = 0; y < dst.height; ++y)
+                for (int x = 0; x < dst.width; ++x) {
+                    glm::vec3 c = (fetch(src, 2 * x, 2 * y) + fetch(src, 2 * x + 1, 2 * y) +
+                        fetch(src, 2 * x, 2 * y + 1) + fetch(src, 2 * x + 1, 2 * y + 1)) * 0.25f;
+                    float* p = &dst.rgb[(size_t(y) * dst.width + x) * 3];
+                    p[0] = c.r; p[1] = c.g; p[2] = c.b;
+                }
+                m_Levels.push_back(std::move(dst));
+            }
+        }
+    public:
+        hdrImage(const std::string& path) {
+            stbi_set_flip_vertically_on_load(false);
+            int width, height, channels;
+            float* data = stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+            if (!data) throw std::runtime_error("Failed to load HDR environment: " + path + "\n");
+
+            m_Levels.push_back({ width, height, std::vector<float>(data, data + size_t(width) * height * 3) });
+            stbi_image_free(data);
+            buildPyramid();
+        }
+
+        hdrImage(std::vector<float> rgb, int width, int height) {
+            if (rgb.size() != size_t(width) * height * 3) throw std::runtime_error("HDR data size does not match dimensions");
+            m_Levels.push_back({ width, height, std::move(rgb) });
+            buildPyramid();
+        }
+
+        const int getWidth() const { return m_Levels[0].width; }
+
+        const int getHeight() const { return m_Levels[0].height; }
+
+        const int getLevels() const { return static_cast<int>(m_Levels.size()); }
+
+        const float* getData() const { return m_Levels[0].rgb.data(); }
+
+        static glm::vec2 directionToUV(const glm::vec3& d) {
+            return glm::vec2(std::atan2(d.z, d.x) * (0.5f / glm::pi<float>()) + 0.5f,
+                std::acos(std::clamp(d.y, -1.0f, 1.0f)) / glm::pi<float>());
+        }
+
+        static glm::vec3 uvToDirection(float u, float v) {
+            float phi = (u - 0.5f) * 2.0f * glm::pi<float>();
+            float theta = v * glm::pi<float>();
+            return glm::vec3(std::cos(phi) * std::sin(theta), std::cos(theta), std::sin(phi) * std::sin(theta));
+        }
+
+        // Trilinear lookup, lod in pyramid levels
+        glm::vec3 sample(const glm::vec3& dir, float lod) const {
+            glm::vec2 uv = directionToUV(dir);
+            lod = std::clamp(lod, 0.0f, float(m_Levels.size() - 1));
+            int l0 = (int)lod;
+            int l1 = std::min(l0 + 1, (int)m_Levels.size() - 1);
+            glm::vec3 a = bilinear(m_Levels[l0], uv.x, uv.y);
+            if (l1 == l0) return a;
+            return glm::mix(a, bilinear(m_Levels[l1], uv.x, uv.y), lod - l0);
+        }
+    };
+
+    // Prefiltered results; everything here is plain CPU data so it can be cached and tested headless
+    struct environmentMap {
+        std::array<glm::vec3, 9> sh{};          // irradiance / pi, ready to multiply by albedo
+        int specularSize = 0;
+        int specularLevels = 0;
+        std::vector<std::vector<float>> specular; // [level * 6 + face], RGB floats
+        int lutSize = 0;
+        std::vector<float> lut;                 // RG: scale, bias on F0
+
+        // GL cube face order, st in [0, 1]
+        static glm::vec3 faceDirection(int face, float s, float t) {
+            float sc = s * 2.0f - 1.0f, tc = t * 2.0f - 1.0f;
+            switch (face) {
+            case 0: return glm::normalize(glm::vec3(1.0f, -tc, -sc));
+            case 1: return glm::normalize(glm::vec3(-1.0f, -tc, sc));
+            case 2: return glm::normalize(glm::vec3(sc, 1.0f, tc));
+            case 3: return glm::normalize(glm::vec3(sc, -1.0f, -tc));
+            case 4: return glm::normalize(glm::vec3(sc, -tc, 1.0f));
+            default: return glm::normalize(glm::vec3(-sc, -tc, -1.0f));
+            }
+        }
+
+        static std::array<float, 9> shBasis(const glm::vec3& n) {
+            return {
+                0.282095f,
+                0.488603f * n.y, 0.488603f * n.z, 0.488603f * n.x,
+                1.092548f * n.x * n.y, 1.092548f * n.y * n.z,
+                0.315392f * (3.0f * n.z * n.z - 1.0f),
+                1.092548f * n.x * n.z, 0.546274f * (n.x * n.x - n.y * n.y)
+            };
+        }
+
+        glm::vec3 irradiance(const glm::vec3& n) const {
+            std::array<float, 9> y = shBasis(n);
+            glm::vec3 e(0.0f);
+            for (int i = 0; i < 9; ++i) e += sh[i] * y[i];
+            return glm::max(e, glm::vec3(0.0f));
+        }
+
+        static glm::vec2 hammersley(unsigned i, unsigned n) {
+            unsigned bits = i;
+            bits = (bits << 16u) | (bits >> 16u);
+            bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+            bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+            bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+            bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+            return glm::vec2(float(i) / float(n), float(bits) * 2.3283064365386963e-10f);
+        }
+
+        // Tangent-space GGX half vector, N = +Z
+        static glm::vec3 importanceSampleGGX(const glm::vec2& xi, float roughness) {
+            float a = roughness * roughness;
+            float phi = 2.0f * glm::pi<float>() * xi.x;
+            float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+            float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+            return glm::vec3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+        }
+
+        void computeIrradiance(const hdrImage& image) {
+            const int width = image.getWidth(), height = image.getHeight();
+            const float* data = image.getData();
+
+            std::mutex mutex;
+            __m128 total[9];
+            for (__m128& t : total) t = _mm_setzero_ps();
+
+            jobPool::get().parallelFor(height, 16, [&](size_t begin, size_t end) {
+                __m128 acc[9];
+                for (__m128& a : acc) a = _mm_setzero_ps();
+
+                for (int y = (int)begin; y < (int)end; ++y) {
+                    float v = (y + 0.5f) / height;
+                    float weight = (2.0f * glm::pi<float>() / width) * (glm::pi<float>() / height) * std::sin(v * glm::pi<float>());
+
+                    for (int x = 0; x < width; ++x) {
+                        glm::vec3 n = hdrImage::uvToDirection((x + 0.5f) / width, v);
+                        std::array<float, 9> basis = shBasis(n);
+                        const float* p = &data[(size_t(y) * width + x) * 3];
+                        __m128 color = _mm_mul_ps(_mm_setr_ps(p[0], p[1], p[2], 0.0f), _mm_set1_ps(weight));
+                        for (int i = 0; i < 9; ++i)
+                            acc[i] = _mm_add_ps(acc[i], _mm_mul_ps(color, _mm_set1_ps(basis[i])));
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                for (int i = 0; i < 9; ++i) total[i] = _mm_add_ps(total[i], acc[i]);
+            });
+
+            // Cosine lobe convolution (pi, 2pi/3, pi/4) folded with the 1/pi of the Lambert BRDF
+            const float band[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+            for (int i = 0; i < 9; ++i) {
+                alignas(16) float c[4];
+                _mm_store_ps(c, total[i]);
+                sh[i] = glm::vec3(c[0], c[1], c[2]) * band[i];
+            }
+        }
+
+        void computeSpecular(const hdrImage& image, const environmentSettings& settings) {
+            specularSize = settings.specularSize;
+            specularLevels = settings.specularLevels;
+            specular.assign(size_t(specularLevels) * 6, {});
+
+            const int samples = (settings.specularSamples + 3) & ~3;
+            const float texelSolidAngle = 4.0f * glm::pi<float>() / (float(image.getWidth()) * image.getHeight());
+
+            for (int level = 0; level < specularLevels; ++level) {
+                int size = std::max(1, specularSize >> level);
+                float roughness = specularLevels > 1 ? float(level) / float(specularLevels - 1) : 0.0f;
+                for (int face = 0; face < 6; ++face)
+                    specular[level * 6 + face].resize(size_t(size) * size * 3);
+
+                // Mirror level: no convolution, just resample the source
+                if (level == 0) {
+                    jobPool::get().parallelFor(size_t(6) * size, 8, [&](size_t begin, size_t end) {
+                        for (size_t row = begin; row < end; ++row) {
+                            int face = int(row / size), y = int(row % size);
+                            for (int x = 0; x < size; ++x) {
+                                glm::vec3 c = image.sample(faceDirection(face, (x + 0.5f) / size, (y + 0.5f) / size), 0.0f);
+                                float* p = &specular[face][(size_t(y) * size + x) * 3];
+                                p[0] = c.r; p[1] = c.g; p[2] = c.b;
+                            }
+                        }
+                    });
+                    continue;
+                }
+
+                // N = V = R, so the reflected sample set is the same in tangent space for every texel.
+                // Precompute it SoA, then rotate four samples at a time per texel.
+                std::vector<float> lx(samples), ly(samples), lz(samples), lod(samples);
+                for (int i = 0; i < samples; ++i) {
+                    glm::vec3 h = importanceSampleGGX(hammersley(i, samples), roughness);
+                    glm::vec3 l = 2.0f * h.z * h - glm::vec3(0.0f, 0.0f, 1.0f);
+                    lx[i] = l.x; ly[i] = l.y; lz[i] = l.z;
+
+                    // Filtered importance sampling: pick the source mip matching the sample's solid angle
+                    float a = roughness * roughness;
+                    float d = (h.z * h.z * (a * a - 1.0f) + 1.0f);
+                    float D = (a * a) / (glm::pi<float>() * d * d);
+                    float pdf = D * 0.25f + 1e-4f;
+                    float sampleSolidAngle = 1.0f / (float(samples) * pdf);
+                    lod[i] = std::max(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f);
+                }
+
+                jobPool::get().parallelFor(size_t(6) * size, 4, [&](size_t begin, size_t end) {
+                    alignas(16) float wx[4], wy[4], wz[4], nl[4];
+                    for (size_t row = begin; row < end; ++row) {
+                        int face = int(row / size), y = int(row % size);
+                        for (int x = 0; x < size; ++x) {
+                            glm::vec3 n = faceDirection(face, (x + 0.5f) / size, (y + 0.5f) / size);
+                            glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                            glm::vec3 t = glm::normalize(glm::cross(up, n));
+                            glm::vec3 b = glm::cross(n, t);
+
+                            glm::vec3 sum(0.0f);
+                            float weight = 0.0f;
+
+                            for (int i = 0; i < samples; i += 4) {
+                                __m128 sx = _mm_loadu_ps(&lx[i]), sy = _mm_loadu_ps(&ly[i]), sz = _mm_loadu_ps(&lz[i]);
+                                __m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, _mm_set1_ps(t.x)), _mm_mul_ps(sy, _mm_set1_ps(b.x))), _mm_mul_ps(sz, _mm_set1_ps(n.x)));
+                                __m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, _mm_set1_ps(t.y)), _mm_mul_ps(sy, _mm_set1_ps(b.y))), _mm_mul_ps(sz, _mm_set1_ps(n.y)));
+                                __m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, _mm_set1_ps(t.z)), _mm_mul_ps(sy, _mm_set1_ps(b.z))), _mm_mul_ps(sz, _mm_set1_ps(n.z)));
+                                _mm_store_ps(wx, rx);
+                                _mm_store_ps(wy, ry);
+                                _mm_store_ps(wz, rz);
+                                _mm_store_ps(nl, _mm_max_ps(sz, _mm_setzero_ps()));
+
+                                for (int k = 0; k < 4; ++k) {
+                                    if (nl[k] <= 0.0f) continue;
+                                    sum += image.sample(glm::vec3(wx[k], wy[k], wz[k]), lod[i + k]) * nl[k];
+                                    weight += nl[k];
+                                }
+                            }
+
+                            glm::vec3 c = weight > 0.0f ? sum / weight : glm::vec3(0.0f);
+                            float* p = &specular[level * 6 + face][(size_t(y) * size + x) * 3];
+                            p[0] = c.r; p[1] = c.g; p[2] = c.b;
+                        }
+                    }
+                });
+            }
+        }
+
+        // Split-sum BRDF integration (x = NdotV, y = roughness), four samples per SSE iteration
+        void computeBrdfLUT(const environmentSettings& settings) {
+            lutSize = settings.lutSize;
+            lut.assign(size_t(lutSize) * lutSize * 2, 0.0f);
+            const int samples = (settings.lutSamples + 3) & ~3;
+
+            jobPool::get().parallelFor(lutSize, 4, [&](size_t begin, size_t end) {
+                std::vector<float> hx(samples), hy(samples), hz(samples);
+                for (int y = (int)begin; y < (int)end; ++y) {
+                    float roughness = (y + 0.5f) / lutSize;
+                    float k = roughness * roughness * 0.5f;
+                    for (int i = 0; i < samples; ++i) {
+                        glm::vec3 h = importanceSampleGGX(hammersley(i, samples), roughness);
+                        hx[i] = h.x; hy[i] = h.y; hz[i] = h.z;
+                    }
+
+                    for (int x = 0; x < lutSize; ++x) {
+                        float NdotV = (x + 0.5f) / lutSize;
+                        __m128 vx = _mm_set1_ps(std::sqrt(1.0f - NdotV * NdotV));
+                        __m128 vz = _mm_set1_ps(NdotV);
+                        __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), kk = _mm_set1_ps(k);
+                        __m128 gv = _mm_div_ps(vz, _mm_add_ps(_mm_mul_ps(vz, _mm_sub_ps(one, kk)), kk));
+                        __m128 A = zero, B = zero;
+
+                        for (int i = 0; i < samples; i += 4) {
+                            __m128 sx = _mm_loadu_ps(&hx[i]), sz = _mm_loadu_ps(&hz[i]);
+                            __m128 VdotH = _mm_max_ps(_mm_add_ps(_mm_mul_ps(vx, sx), _mm_mul_ps(vz, sz)), zero);
+                            __m128 NdotL = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2.0f), VdotH), sz), vz);
+                            __m128 mask = _mm_cmpgt_ps(NdotL, zero);
+                            NdotL = _mm_max_ps(NdotL, zero);
+
+                            __m128 gl = _mm_div_ps(NdotL, _mm_add_ps(_mm_mul_ps(NdotL, _mm_sub_ps(one, kk)), kk));
+                            __m128 gVis = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(gv, gl), VdotH), _mm_max_ps(_mm_mul_ps(sz, vz), _mm_set1_ps(1e-6f)));
+                            __m128 f = _mm_sub_ps(one, VdotH);
+                            __m128 f2 = _mm_mul_ps(f, f);
+                            __m128 fc = _mm_mul_ps(_mm_mul_ps(f2, f2), f);
+
+                            gVis = _mm_and_ps(gVis, mask);
+                            A = _mm_add_ps(A, _mm_mul_ps(_mm_sub_ps(one, fc), gVis));
+                            B = _mm_add_ps(B, _mm_mul_ps(fc, gVis));
+                        }
+
+                        alignas(16) float a[4], b[4];
+                        _mm_store_ps(a, A);
+                        _mm_store_ps(b, B);
+                        float* p = &lut[(size_t(y) * lutSize + x) * 2];
+                        p[0] = (a[0] + a[1] + a[2] + a[3]) / samples;
+                        p[1] = (b[0] + b[1] + b[2] + b[3]) / samples;
+                    }
+                }
+            });
+        }
+
+        static environmentMap compute(const hdrImage& image, const environmentSettings& settings = {}) {
+            environmentMap map;
+            map.computeIrradiance(image);
+            map.computeSpecular(image, settings);
+            map.computeBrdfLUT(settings);
+            return map;
+        }
+
+        // --- disk cache ---
+        static constexpr char CACHE_MAGIC[8] = { 'G', 'L', 'I', 'B', 'L', '0', '1', '\0' };
+
+        bool save(const std::filesystem::path& path, uint64_t key) const {
+            std::error_code ec;
+            std::filesystem::create_directories(path.parent_path(), ec);
+            std::ofstream file(path, std::ios::binary);
+            if (!file) return false;
+
+            int32_t header[3] = { specularSize, specularLevels, lutSize };
+            file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+            file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+            file.write(reinterpret_cast<const char*>(header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(sh.data()), sizeof(glm::vec3) * sh.size());
+            for (auto& face : specular)
+                file.write(reinterpret_cast<const char*>(face.data()), face.size() * sizeof(float));
+            file.write(reinterpret_cast<const char*>(lut.data()), lut.size() * sizeof(float));
+            return bool(file);
+        }
+
+        bool load(const std::filesystem::path& path, uint64_t key) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) return false;
+
+            char magic[8];
+            uint64_t storedKey = 0;
+            int32_t header[3];
+            file.read(magic, sizeof(magic));
+            file.read(reinterpret_cast<char*>(&storedKey), sizeof(storedKey));
+            file.read(reinterpret_cast<char*>(header), sizeof(header));
+            if (!file || std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 || storedKey != key) return false;
+            if (header[0] <= 0 || header[1] <= 0 || header[2] <= 0 || header[1] > 16) return false;
+
+            specularSize = header[0];
+            specularLevels = header[1];
+            lutSize = header[2];
+
+            file.read(reinterpret_cast<char*>(sh.data()), sizeof(glm::vec3) * sh.size());
+            specular.assign(size_t(specularLevels) * 6, {});
+            for (int level = 0; level < specularLevels; ++level) {
+                int size = std::max(1, specularSize >> level);
+                for (int face = 0; face < 6; ++face) {
+                    auto& data = specular[level * 6 + face];
+                    data.resize(size_t(size) * size * 3);
+                    file.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float));
+                }
+            }
+            lut.resize(size_t(lutSize) * lutSize * 2);
+            file.read(reinterpret_cast<char*>(lut.data()), lut.size() * sizeof(float));
+            return bool(file);
+        }
+    };
+
+    // Image-based lighting for frag.glsl: SH irradiance uniforms, GGX prefiltered cubemap and BRDF LUT.
+    // Prefiltering runs once per environment; later launches read the cached result.
+    class environment {
+    private:
+        environmentMap m_Map;
+        GLuint m_Prefiltered = 0;
+        GLuint m_BrdfLUT = 0;
+        bool m_FromCache = false;
+        double m_Milliseconds = 0.0;
+
+        // The environment whose uniforms each program holds
+        static std::unordered_map<GLuint, const environment*>& owners() {
+            static std::unordered_map<GLuint, const environment*> programs;
+            return programs;
+        }
+
+        static uint64_t cacheKey(const std::string& path, const environmentSettings& settings) {
+            std::error_code ec;
+            uint64_t key = hash64(std::filesystem::absolute(path, ec).string());
+            auto size = std::filesystem::file_size(path, ec);
+            key = hash64(&size, sizeof(size), key);
+            auto time = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+            key = hash64(&time, sizeof(time), key);
+            int fields[5] = { settings.specularSize, settings.specularLevels, settings.specularSamples, settings.lutSize, settings.lutSamples };
+            return hash64(fields, sizeof(fields), key);
+        }
+
+        void upload() {
+            glGenTextures(1, &m_Prefiltered);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_CUBE_MAP, m_Prefiltered);
+            for (int level = 0; level < m_Map.specularLevels; ++level) {
+                int size = std::max(1, m_Map.specularSize >> level);
+                for (int face = 0; face < 6; ++face)
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB16F, size, size, 0, GL_RGB, GL_FLOAT, m_Map.specular[level * 6 + face].data());
+            }
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, m_Map.specularLevels - 1);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+            glGenTextures(1, &m_BrdfLUT);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_2D, m_BrdfLUT);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, m_Map.lutSize, m_Map.lutSize, 0, GL_RG, GL_FLOAT, m_Map.lut.data());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+    public:
+        environment(const std::string& hdrPath, const environmentSettings& settings = {}) {
+            auto start = std::chrono::high_resolution_clock::now();
+
+            uint64_t key = cacheKey(hdrPath, settings);
+            std::filesystem::path cachePath = getShaderPath(IBL_CACHE_PATH) / (std::to_string(key) + ".ibl");
+
+            m_FromCache = settings.useCache && m_Map.load(cachePath, key);
+            if (!m_FromCache) {
+                m_Map = environmentMap::compute(hdrImage(hdrPath), settings);
+                if (settings.useCache && !m_Map.save(cachePath, key))
+                    std::cerr << "Failed to write IBL cache: " << cachePath << "\n";
+            }
+
+            m_Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            upload();
+        }
+
+        environment(const environment&) = delete;
+        environment& operator=(const environment&) = delete;
+
+        ~environment() {
+            std::erase_if(owners(), [this](const auto& entry) { return entry.second == this; });
+            for (GLuint texture : { m_Prefiltered, m_BrdfLUT }) {
+                if (!texture) continue;
+                gl::stateCache::get().textureDeleted(texture);
+                glDeleteTextures(1, &texture);
+            }
+        }
+
+        // Binds the maps to the reserved IBL units and sets the ibl.glsl uniforms of
+        // `shaderProgram`. Locations come from its reflection and the values are uploaded once
+        // per program, so calling this on every program switch only costs the unit binds.
+        void bind(GLuint shaderProgram) const {
+            static const gl::uniformID prefilterMapID = gl::internUniform("prefilterMap");
+            static const gl::uniformID brdfLUTID = gl::internUniform("brdfLUT");
+            static const gl::uniformID prefilterLevelsID = gl::internUniform("prefilterLevels");
+            static const gl::uniformID shCoeffsID = gl::internUniform("shCoeffs");
+            static const gl::uniformID hasEnvironmentID = gl::internUniform("hasEnvironment");
+
+            gl::stateCache& state = gl::stateCache::get();
+            state.bindTexture(IBL_PREFILTER_UNIT, GL_TEXTURE_CUBE_MAP, m_Prefiltered);
+            state.bindTexture(IBL_BRDF_LUT_UNIT, GL_TEXTURE_2D, m_BrdfLUT);
+            const environment*& owner = owners()[shaderProgram];
+            if (owner == this) return;
+            owner = this;
+
+            state.useProgram(shaderProgram);
+            gl::programReflection& uniforms = gl::programReflection::get(shaderProgram);
+            uniforms.setSampler(prefilterMapID, IBL_PREFILTER_UNIT);
+            uniforms.setSampler(brdfLUTID, IBL_BRDF_LUT_UNIT);
+            glUniform1f(uniforms.location(prefilterLevelsID), float(m_Map.specularLevels - 1));
+            glUniform3fv(uniforms.location(shCoeffsID), 9, glm::value_ptr(m_Map.sh[0]));
+            glUniform1i(uniforms.location(hasEnvironmentID), GL_TRUE);
+        }
+
+        const environmentMap& getMap() const { return m_Map; }
+
+        const bool loadedFromCache() const { return m_FromCache; }
+
+        const double getLoadTime() const { return m_Milliseconds; }
+    };
+
+}
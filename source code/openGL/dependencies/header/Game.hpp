@@ -12,6 +12,15 @@
 
 #include <Window.hpp>
 #include <Utils.hpp>
+#include <UniformBuffer.hpp>
+
+// The world camera's near plane. Held items go through gl::renderQueue::submitViewModel with
+// a near plane of their own, so this one can stay far enough out to keep depth precision
+#ifndef PLAYER_NEAR_PLANE
+
+    #define PLAYER_NEAR_PLANE 0.05f
+
+#endif // PLAYER_NEAR_PLANE
 
 namespace gl {
 
@@ -19,45 +28,51 @@ namespace gl {
 	private:
 		gl::camera m_Camera;
 		glm::vec3 m_Velocity;
-		gl::uniform m_Model;
-		gl::uniform m_View;
-		gl::uniform m_Proj;
+		gl::uniform<glm::mat4> m_Model;
+		gl::uniform<glm::mat4> m_View;
+		gl::uniform<glm::mat4> m_Proj;
 	public:
 		player(gl::camera cam) 
 			: m_Camera(cam), m_Velocity(glm::vec3(0.0f))
 		{
-			m_Model = gl::uniform(glm::mat4(1.0f), glGetUniformLocation(m_Camera.getShader(), "model"));
-			m_View = gl::uniform(glm::mat4(1.0f), glGetUniformLocation(m_Camera.getShader(), "view"));
-			m_Proj = gl::uniform(glm::mat4(1.0f), glGetUniformLocation(m_Camera.getShader(), "projection"));
+			m_Model = gl::uniform<glm::mat4>(m_Camera.getShader(), "model", glm::mat4(1.0f));
+			m_View = gl::uniform<glm::mat4>(m_Camera.getShader(), "view", glm::mat4(1.0f));
+			m_Proj = gl::uniform<glm::mat4>(m_Camera.getShader(), "projection", glm::mat4(1.0f));
 		}
 
 		player(gl::camera cam, gl::shader shader)
 			: m_Camera(cam), m_Velocity(glm::vec3(0.0f))
 		{
-			m_Model = gl::uniform(glm::mat4(1.0f), shader.getUniformLocation("model"));
-			m_View = gl::uniform(glm::mat4(1.0f), shader.getUniformLocation("view"));
-			m_Proj = gl::uniform(glm::mat4(1.0f), shader.getUniformLocation("projection"));
+			m_Model = gl::uniform<glm::mat4>(shader.getProgram(), "model", glm::mat4(1.0f));
+			m_View = gl::uniform<glm::mat4>(shader.getProgram(), "view", glm::mat4(1.0f));
+			m_Proj = gl::uniform<glm::mat4>(shader.getProgram(), "projection", glm::mat4(1.0f));
 		}
 
 		player(gl::camera cam, GLuint modelLoc, GLuint viewLoc, GLuint projLoc)
 			: m_Camera(cam), m_Velocity(glm::vec3(0.0f))
 		{
-			m_Model = gl::uniform(glm::mat4(1.0f), modelLoc);
-			m_View = gl::uniform(glm::mat4(1.0f), viewLoc);
-			m_Proj = gl::uniform(glm::mat4(1.0f), projLoc);
+			m_Model = gl::uniform<glm::mat4>(glm::mat4(1.0f), modelLoc);
+			m_View = gl::uniform<glm::mat4>(glm::mat4(1.0f), viewLoc);
+			m_Proj = gl::uniform<glm::mat4>(glm::mat4(1.0f), projLoc);
 		}
 
-		void update(gl::window& window, gl::shader shader) {
-			shader.useProgram();
-
+		// One FrameData upload shared by every program
+		void update(gl::window& window) {
 			m_Camera.processInput(window);
 
 			m_View = m_Camera.getViewMatrix();
-			m_Proj = glm::perspective(glm::radians(m_Camera.getFov()), (float)window.getWidth() / (float)window.getHeight(), 0.001f, 10000.0f);
+			m_Proj = glm::perspective(glm::radians(m_Camera.getFov()), (float)window.getWidth() / (float)window.getHeight(), PLAYER_NEAR_PLANE, 10000.0f);
 
-			m_Model.uniformMatrix4fv();
-			m_View.uniformMatrix4fv();
-			m_Proj.uniformMatrix4fv();
+			gl::sceneUniforms::get().setFrame(m_View.getValue(), m_Proj.getValue(), m_Camera.getPos(), (float)glfwGetTime());
+		}
+
+		// For shaders that still declare plain view/projection uniforms; skipped while the camera is still
+		void update(gl::window& window, gl::shader shader) {
+			shader.useProgram();
+			update(window);
+
+			m_View.uploadTo(shader.getProgram());
+			m_Proj.uploadTo(shader.getProgram());
 		}
 
 		void setFov(const float& fov, const float& aspect) { m_Camera.setFov(fov); }
@@ -74,6 +89,8 @@ namespace gl {
 
 		glm::mat4 getProj() const { return m_Proj.getValue(); }
 
+		glm::mat4 getView() const { return m_View.getValue(); }
+
 		gl::camera getCam() { return m_Camera; }
 
 		glm::vec3 getPos() const { return m_Camera.getPos(); }
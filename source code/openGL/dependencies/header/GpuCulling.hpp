@@ -0,0 +1,277 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm.hpp>
+
+#include <Utils.hpp>
+#include <Mesh.hpp>
+#include <StateCache.hpp>
+#include <RingBuffer.hpp>
+#include <Culling.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Instances the culling input ring is sized for per frame; it grows when a frame needs more
+#ifndef GPU_CULL_FRAME_INSTANCES
+
+    #define GPU_CULL_FRAME_INSTANCES 4096
+
+#endif // GPU_CULL_FRAME_INSTANCES
+
+namespace gl {
+
+    // Compute shaders, SSBOs, image load/store and multi-draw indirect
+    inline bool gpuCullingSupported() {
+        return GLEW_VERSION_4_3 != 0;
+    }
+
+    // Max-depth mip chain of the current framebuffer's depth, for conservative occlusion
+    // tests: a box whose nearest depth is behind the farthest depth under it is hidden.
+    // build() copies the depth of the bound draw framebuffer inside the viewport, so it works
+    // on the default framebuffer too.
+    class hiZPyramid {
+    private:
+        GLuint m_Program = 0;
+        GLuint m_Depth = 0;         // copy of the scene depth
+        GLuint m_Pyramid = 0;       // R32F, one mip per level
+        int m_Width = 0, m_Height = 0, m_Levels = 0;
+
+        gl::uniform<int32_t> m_Level;
+
+        void resize(int width, int height) {
+            if (width == m_Width && height == m_Height && m_Pyramid) return;
+            destroyTextures();
+
+            m_Width = width;
+            m_Height = height;
+            m_Levels = 1;
+            for (int size = std::max(width, height); size > 1; size >>= 1) m_Levels++;
+
+            gl::stateCache& state = gl::stateCache::get();
+            glGenTextures(1, &m_Depth);
+            state.bindTexture(GL_TEXTURE_2D, m_Depth);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+            glGenTextures(1, &m_Pyramid);
+            state.bindTexture(GL_TEXTURE_2D, m_Pyramid);
+            glTexStorage2D(GL_TEXTURE_2D, m_Levels, GL_R32F, width, height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+
+        void destroyTextures() {
+            for (GLuint texture : { m_Depth, m_Pyramid }) {
+                if (!texture) continue;
+                gl::stateCache::get().textureDeleted(texture);
+                glDeleteTextures(1, &texture);
+            }
+            m_Depth = m_Pyramid = 0;
+            m_Width = m_Height = m_Levels = 0;
+        }
+    public:
+        hiZPyramid()
+            : m_Program(gl::createComputeProgram("resource/shader/hiz_comp.glsl")), m_Level(m_Program, "level")
+        {
+        }
+
+        hiZPyramid(const hiZPyramid&) = delete;
+        hiZPyramid& operator=(const hiZPyramid&) = delete;
+
+        ~hiZPyramid() {
+            destroyTextures();
+            gl::stateCache::get().programDeleted(m_Program);
+            glDeleteProgram(m_Program);
+        }
+
+        void build() {
+            GLint viewport[4], drawFBO, readFBO;
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFBO);
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+            resize(std::max(viewport[2], 1), std::max(viewport[3], 1));
+
+            gl::stateCache& state = gl::stateCache::get();
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, drawFBO);
+            state.bindTexture(GL_TEXTURE_2D, m_Depth);
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], m_Width, m_Height);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+
+            state.useProgram(m_Program);
+            state.bindTexture(0, GL_TEXTURE_2D, m_Depth);
+            for (int level = 0; level < m_Levels; ++level) {
+                int width = std::max(m_Width >> level, 1), height = std::max(m_Height >> level, 1);
+                if (level > 0) glBindImageTexture(0, m_Pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+                glBindImageTexture(1, m_Pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+                m_Level.upload(level);
+                glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+                glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            }
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+
+        const GLuint getTexture() const { return m_Pyramid; }
+
+        const int getWidth() const { return m_Width; }
+
+        const int getHeight() const { return m_Height; }
+
+        const int levels() const { return m_Levels; }
+    };
+
+    // Per-instance input of the cull shader (cull_comp.glsl, std430)
+    struct cullBounds {
+        glm::vec4 boxMin;
+        glm::vec4 boxMax;
+        uint32_t instance;      // index in the instance stream upload
+        uint32_t command;       // index in the frame's indirect commands
+        uint32_t history;       // slot in the visibility history, stable across frames
+        uint32_t pad = 0;
+    };
+
+    // Compute culling into indirect commands, used by gl::renderQueue on GL 4.3. The
+    // renderQueue writes commands with instanceCount 0 and a baseInstance into visible();
+    // dispatch() appends each surviving instance to its command and copies it there, so the
+    // draws read their transforms from visible() instead of the instance stream.
+    //
+    // Visibility is two-phase. Phase 0 draws what was visible last frame (frustum only), the
+    // Hi-Z pyramid is built from the resulting depth, and phase 1 tests everything against it,
+    // stores the new visibility and draws what phase 0 missed. Nothing is ever read back.
+    class gpuCuller {
+    private:
+        GLuint m_Program = 0;
+        gl::ringBuffer m_Bounds;
+        std::vector<cullBounds> m_Staging;
+        gl::ringAllocation m_Slice;
+
+        GLuint m_Visible = 0;           // phase 0 and phase 1 halves
+        size_t m_VisibleCapacity = 0;
+        GLuint m_History = 0;
+        size_t m_HistorySize = 0;
+
+        gl::hiZPyramid m_HiZ;
+
+        struct cullUniforms {
+            gl::uniform<glm::mat4> viewProjection;
+            gl::uniform<std::array<glm::vec4, 6>> planes;
+            gl::uniform<uint32_t> count, streamBase, commandBase;
+            gl::uniform<int32_t> phase;
+
+            cullUniforms(GLuint program)
+                : viewProjection(program, "viewProjection"), planes(program, "planes"), count(program, "count"),
+                streamBase(program, "streamBase"), commandBase(program, "commandBase"), phase(program, "phase")
+            {
+            }
+        } m_Uniforms;
+
+        static void replaceBuffer(GLuint& buffer, size_t bytes, GLenum usage) {
+            gl::stateCache& state = gl::stateCache::get();
+            if (buffer) {
+                state.bufferDeleted(buffer);
+                glDeleteBuffers(1, &buffer);
+            }
+            glGenBuffers(1, &buffer);
+            state.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, nullptr, usage);
+        }
+    public:
+        gpuCuller()
+            : m_Program(gl::createComputeProgram("resource/shader/cull_comp.glsl")),
+            m_Bounds(GL_SHADER_STORAGE_BUFFER, GPU_CULL_FRAME_INSTANCES * sizeof(cullBounds)),
+            m_Uniforms(m_Program)
+        {
+        }
+
+        gpuCuller(const gpuCuller&) = delete;
+        gpuCuller& operator=(const gpuCuller&) = delete;
+
+        ~gpuCuller() {
+            gl::stateCache& state = gl::stateCache::get();
+            for (GLuint buffer : { m_Visible, m_History }) {
+                if (!buffer) continue;
+                state.bufferDeleted(buffer);
+                glDeleteBuffers(1, &buffer);
+            }
+            state.programDeleted(m_Program);
+            glDeleteProgram(m_Program);
+        }
+
+        // Scratch space callers fill before upload()
+        std::vector<cullBounds>& staging() { return m_Staging; }
+
+        // Starts a frame of `instances` candidates with a history of `historySize` slots. A
+        // history of a different size starts over with nothing visible, which phase 1 then
+        // draws. Clears staging().
+        void begin(size_t instances, size_t historySize) {
+            m_Staging.clear();
+
+            if (instances * 2 > m_VisibleCapacity) {
+                m_VisibleCapacity = std::max<size_t>(instances * 4, 256);
+                replaceBuffer(m_Visible, m_VisibleCapacity * sizeof(instance), GL_DYNAMIC_COPY);
+                gl::instanceStream::get().invalidate();
+            }
+
+            if (historySize != m_HistorySize) {
+                m_HistorySize = historySize;
+                replaceBuffer(m_History, std::max<size_t>(historySize, 1) * sizeof(uint32_t), GL_DYNAMIC_COPY);
+                GLuint zero = 0;
+                glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+            }
+        }
+
+        void upload() {
+            size_t bytes = m_Staging.size() * sizeof(cullBounds);
+            if (bytes == 0) return;
+            size_t alignment = gl::ringBuffer::storageAlignment();
+            if (bytes + alignment > m_Bounds.regionSize()) m_Bounds.reserve(2 * (bytes + alignment));
+            m_Slice = m_Bounds.allocate(m_Staging.data(), bytes, alignment);
+            m_Bounds.flush();
+        }
+
+        // Fills the commands at `commands` + commandBase for one phase. The commands must be in
+        // a buffer range aligned for SSBO binding. Without `barrier` the caller issues the one
+        // its draws and the next phase need, as gl::renderGraph does.
+        void dispatch(int phase, const glm::mat4& viewProjection, const gl::ringBuffer& stream, uint32_t streamBase,
+            GLuint commands, GLintptr commandsOffset, GLsizeiptr commandsSize, uint32_t commandBase, bool barrier = true)
+        {
+            if (m_Staging.empty()) return;
+            if (phase == 1) m_HiZ.build();
+
+            gl::stateCache& state = gl::stateCache::get();
+            state.useProgram(m_Program);
+
+            gl::frustum f = gl::frustum::fromMatrix(viewProjection);
+            m_Uniforms.viewProjection.upload(viewProjection);
+            m_Uniforms.planes.upload(f.planes);
+            m_Uniforms.count.upload(static_cast<uint32_t>(m_Staging.size()));
+            m_Uniforms.streamBase.upload(streamBase);
+            m_Uniforms.commandBase.upload(commandBase);
+            m_Uniforms.phase.upload(phase);
+
+            state.bindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, stream.getBuffer(), 0, stream.regionSize() * RING_BUFFER_FRAMES);
+            state.bindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, m_Slice.buffer, m_Slice.offset, m_Slice.size);
+            state.bindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, commands, commandsOffset, commandsSize);
+            state.bindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, m_Visible, 0, m_VisibleCapacity * sizeof(instance));
+            state.bindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, m_History, 0, std::max<size_t>(m_HistorySize, 1) * sizeof(uint32_t));
+            if (phase == 1) state.bindTexture(0, GL_TEXTURE_2D, m_HiZ.getTexture());
+
+            glDispatchCompute(static_cast<GLuint>((m_Staging.size() + 63) / 64), 1, 1);
+            if (barrier) glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+
+        // Instance buffer the culled commands draw from; phase 1 starts at half its capacity
+        const GLuint visible() const { return m_Visible; }
+
+        const uint32_t phaseOffset() const { return static_cast<uint32_t>(m_VisibleCapacity / 2); }
+
+        const gl::hiZPyramid& hiZ() const { return m_HiZ; }
+    };
+
+}
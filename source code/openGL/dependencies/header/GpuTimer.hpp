@@ -0,0 +1,124 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Timestamp sets in flight; a frame whose set is still unread goes untimed
+#ifndef GPU_TIMER_FRAMES
+
+    #define GPU_TIMER_FRAMES 3
+
+#endif // GPU_TIMER_FRAMES
+
+namespace gl {
+
+    // GL_TIMESTAMP queries marking points in a frame's GPU work, read a frame or two later
+    // without waiting. A frame's marks, from begin() through end(), go into one of
+    // GPU_TIMER_FRAMES sets; a frame whose set is still in flight records nothing. Timestamps
+    // do not nest like GL_TIME_ELAPSED, so timers can run inside each other's intervals and
+    // alongside any other query.
+    //
+    // Callers keeping data beside a set (pass names, other queries) index it by slot(), which
+    // poll() hands back with the set's timestamps.
+    class gpuTimer {
+    private:
+        struct markSet {
+            std::vector<GLuint> queries;
+            bool issued = false;
+        };
+
+        std::array<markSet, GPU_TIMER_FRAMES> m_Sets;
+        std::vector<GLuint> m_Free;
+        std::vector<GLuint64> m_Stamps;
+        size_t m_Next = 0;
+        bool m_Recording = false;
+        double m_Milliseconds = 0.0;
+
+        void recycle(markSet& set) {
+            m_Free.insert(m_Free.end(), set.queries.begin(), set.queries.end());
+            set.queries.clear();
+            set.issued = false;
+        }
+    public:
+        gpuTimer() = default;
+
+        ~gpuTimer() {
+            for (markSet& set : m_Sets) recycle(set);
+            if (!m_Free.empty()) glDeleteQueries(static_cast<GLsizei>(m_Free.size()), m_Free.data());
+        }
+
+        gpuTimer(const gpuTimer&) = delete;
+        gpuTimer& operator=(const gpuTimer&) = delete;
+
+        // Reads the sets that arrived, oldest first, calling read(slot, timestamps) with the
+        // timestamps in nanoseconds, one per mark
+        template <typename Read>
+        void poll(Read&& read) {
+            for (size_t n = 0; n < GPU_TIMER_FRAMES; ++n) {
+                const size_t slot = (m_Next + n) % GPU_TIMER_FRAMES;
+                markSet& set = m_Sets[slot];
+                if (!set.issued) continue;
+                GLuint available = 0;
+                glGetQueryObjectuiv(set.queries.back(), GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) continue;
+
+                m_Stamps.resize(set.queries.size());
+                for (size_t i = 0; i < set.queries.size(); ++i) glGetQueryObjectui64v(set.queries[i], GL_QUERY_RESULT, &m_Stamps[i]);
+                m_Milliseconds = double(m_Stamps.back() - m_Stamps.front()) / 1.0e6;
+                read(slot, std::span<const GLuint64>(m_Stamps));
+                recycle(set);
+            }
+        }
+
+        void poll() { poll([](size_t, std::span<const GLuint64>) {}); }
+
+        // Starts this frame's set with its first mark. Returns false, and records nothing until
+        // the next begin(), when the set is still in flight. A set begun but never ended is
+        // dropped.
+        bool begin() {
+            markSet& set = m_Sets[m_Next];
+            m_Recording = !set.issued;
+            if (!m_Recording) return false;
+            recycle(set);
+            mark();
+            return true;
+        }
+
+        void mark() {
+            if (!m_Recording) return;
+            GLuint query;
+            if (m_Free.empty()) glGenQueries(1, &query);
+            else {
+                query = m_Free.back();
+                m_Free.pop_back();
+            }
+            glQueryCounter(query, GL_TIMESTAMP);
+            m_Sets[m_Next].queries.push_back(query);
+        }
+
+        // Closes the set with a last mark
+        void end() {
+            if (!m_Recording) return;
+            mark();
+            m_Sets[m_Next].issued = true;
+            m_Next = (m_Next + 1) % GPU_TIMER_FRAMES;
+            m_Recording = false;
+        }
+
+        // Whether begin() would record
+        const bool ready() const { return !m_Sets[m_Next].issued; }
+
+        const bool recording() const { return m_Recording; }
+
+        // The set begin() records into
+        const size_t slot() const { return m_Next; }
+
+        // First to last mark of the newest set read
+        const double milliseconds() const { return m_Milliseconds; }
+    };
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gl {
+
+    // Small fixed-size worker pool shared by the CPU-side passes (volume reference,
+    // prefiltering, culling, light binning). parallelFor blocks until every chunk ran.
+    class jobPool {
+    private:
+        std::vector<std::thread> m_Workers;
+        std::deque<std::function<void()>> m_Queue;
+        std::mutex m_Mutex;
+        std::condition_variable m_Condition;
+        bool m_Stop = false;
+
+        struct batch {
+            std::function<void(size_t, size_t)> fn;
+            size_t count = 0;
+            size_t grain = 1;
+            size_t chunks = 0;
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> done{ 0 };
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+
+        static void runChunks(batch& b) {
+            size_t chunk;
+            while ((chunk = b.next.fetch_add(1)) < b.chunks) {
+                size_t begin = chunk * b.grain;
+                size_t end = std::min(begin + b.grain, b.count);
+                b.fn(begin, end);
+
+                if (b.done.fetch_add(1) + 1 == b.chunks) {
+                    std::lock_guard<std::mutex> lock(b.mutex);
+                    b.finished.notify_all();
+                }
+            }
+        }
+
+        void workerLoop() {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(m_Mutex);
+                    m_Condition.wait(lock, [this] { return m_Stop || !m_Queue.empty(); });
+                    if (m_Stop && m_Queue.empty()) return;
+                    job = std::move(m_Queue.front());
+                    m_Queue.pop_front();
+                }
+                job();
+            }
+        }
+    public:
+        jobPool(unsigned threads = std::max(1u, std::thread::hardware_concurrency())) {
+            // The calling thread always takes part in parallelFor, so spawn one less
+            for (unsigned i = 1; i < threads; ++i)
+                m_Workers.emplace_back([this] { workerLoop(); });
+        }
+
+        ~jobPool() {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Stop = true;
+            }
+            m_Condition.notify_all();
+            for (auto& w : m_Workers) w.join();
+        }
+
+        jobPool(const jobPool&) = delete;
+        jobPool& operator=(const jobPool&) = delete;
+
+        static jobPool& get() {
+            static jobPool pool;
+            return pool;
+        }
+
+        const unsigned size() const { return static_cast<unsigned>(m_Workers.size()) + 1; }
+
+        void submit(std::function<void()> job) {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Queue.push_back(std::move(job));
+            }
+            m_Condition.notify_one();
+        }
+
+        // Calls fn(begin, end) over [0, count) in chunks of `grain`. Safe to nest: the
+        // caller drains chunks itself, so it never waits on a helper that is not running.
+        void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+            if (count == 0) return;
+            grain = std::max<size_t>(1, grain);
+
+            size_t chunks = (count + grain - 1) / grain;
+            if (chunks == 1 || m_Workers.empty()) {
+                fn(0, count);
+                return;
+            }
+
+            auto b = std::make_shared<batch>();
+            b->fn = fn;
+            b->count = count;
+            b->grain = grain;
+            b->chunks = chunks;
+
+            size_t helpers = std::min(chunks - 1, m_Workers.size());
+            for (size_t i = 0; i < helpers; ++i)
+                submit([b] { runChunks(*b); });
+
+            runChunks(*b);
+
+            std::unique_lock<std::mutex> lock(b->mutex);
+            b->finished.wait(lock, [&] { return b->done.load() == b->chunks; });
+        }
+    };
+
+}
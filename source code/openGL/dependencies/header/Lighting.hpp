@@ -0,0 +1,404 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm.hpp>
+
+#include <Utils.hpp>
+#include <StateCache.hpp>
+#include <UniformBuffer.hpp>
+#include <Jobs.hpp>
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Froxel grid of gl::clusteredLights: tiles across the viewport and exponential depth slices
+#ifndef CLUSTER_GRID_X
+
+    #define CLUSTER_GRID_X 16
+
+#endif // CLUSTER_GRID_X
+
+#ifndef CLUSTER_GRID_Y
+
+    #define CLUSTER_GRID_Y 9
+
+#endif // CLUSTER_GRID_Y
+
+#ifndef CLUSTER_GRID_Z
+
+    #define CLUSTER_GRID_Z 24
+
+#endif // CLUSTER_GRID_Z
+
+// View depth the exponential slices start at; everything closer shares the first slice, so
+// a tiny near plane does not spend half the slices on the first few centimetres
+#ifndef CLUSTER_MIN_DEPTH
+
+    #define CLUSTER_MIN_DEPTH 0.1f
+
+#endif // CLUSTER_MIN_DEPTH
+
+namespace gl {
+
+    // A scene light. It lights every surface within `radius`, falling off smoothly to zero there.
+    // A shadowPriority above 0 asks gl::renderQueue's point shadows for a shadow.
+    struct pointLight {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 color;
+        float shadowPriority = 0.0f;
+    };
+
+    struct clusterStats {
+        unsigned lights = 0;
+        unsigned visible = 0;           // lights in at least one cell
+        unsigned entries = 0;           // light indices over all cells
+        unsigned maxPerCluster = 0;
+        double binMilliseconds = 0.0;
+    };
+
+    // Scene-level point lights assigned to a view-space froxel grid on the CPU, so each
+    // fragment only loops over the lights of its cell (clusters.glsl). build() runs once per
+    // frame: the lights go to view space, each depth slice is binned on the job pool with
+    // 4-wide sphere/box tests against that slice's cells, and the cells' offset and count,
+    // the flat index list and the light data are uploaded to texture buffers on
+    // CLUSTER_GRID_UNIT, CLUSTER_INDEX_UNIT and CLUSTER_LIGHT_UNIT. The grid parameters go to
+    // the ClusterData block. Texture buffers keep it on GL 3.3.
+    //
+    // Light ids returned by add() stay valid until remove(); freed ids are reused.
+    class clusteredLights {
+    private:
+        static constexpr uint32_t cellsPerSlice = CLUSTER_GRID_X * CLUSTER_GRID_Y;
+        static constexpr uint32_t paddedSlice = (cellsPerSlice + 3) & ~3u;
+
+        struct slot {
+            pointLight light;
+            bool alive;
+            int32_t shadow = -1;        // point shadow atlas slot
+        };
+
+        // View-space sphere plus the slices it can touch
+        struct viewLight {
+            glm::vec3 center;
+            float radius;
+            uint32_t firstSlice, lastSlice;
+        };
+
+        // Cell boxes of one slice, SoA and padded to 4 with boxes nothing reaches
+        struct sliceBounds {
+            alignas(16) float minX[paddedSlice], minY[paddedSlice], minZ[paddedSlice];
+            alignas(16) float maxX[paddedSlice], maxY[paddedSlice], maxZ[paddedSlice];
+        };
+
+        struct sliceBins {
+            std::vector<uint32_t> counts;       // per cell
+            std::vector<uint32_t> indices;      // grouped by cell
+            std::vector<std::pair<uint32_t, uint32_t>> hits;    // (cell, light)
+        };
+
+        std::vector<slot> m_Slots;
+        std::vector<uint32_t> m_Free;
+        bool m_LightsDirty = true;
+
+        std::vector<uint32_t> m_Packed;         // alive slots, in GPU order
+        std::vector<glm::vec4> m_LightData;
+        std::vector<viewLight> m_ViewLights;
+
+        std::vector<sliceBounds> m_Bounds;
+        glm::mat4 m_BoundsProjection = glm::mat4(0.0f);
+        glm::mat4 m_BuiltView = glm::mat4(0.0f);    // grid below is binned for this view
+        bool m_Built = false;
+        float m_Scale = 0.0f, m_Bias = 0.0f, m_Near = 0.0f, m_Far = 0.0f;
+
+        std::vector<sliceBins> m_Bins;
+        std::vector<glm::uvec2> m_Grid;
+        std::vector<uint32_t> m_Indices;
+
+        GLuint m_Buffers[3] = {};               // grid, indices, light data
+        GLuint m_Textures[3] = {};
+
+        clusterStats m_Stats;
+
+        clusteredLights() {
+            glGenBuffers(3, m_Buffers);
+            glGenTextures(3, m_Textures);
+            const GLenum formats[3] = { GL_RG32UI, GL_R32UI, GL_RGBA32F };
+            for (int i = 0; i < 3; ++i) {
+                gl::stateCache::get().bindBuffer(GL_TEXTURE_BUFFER, m_Buffers[i]);
+                glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+                gl::stateCache::get().bindTexture(GL_TEXTURE_BUFFER, m_Textures[i]);
+                glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_Buffers[i]);
+            }
+            m_Bins.resize(CLUSTER_GRID_Z);
+        }
+
+        ~clusteredLights() {
+            gl::stateCache& state = gl::stateCache::get();
+            for (int i = 0; i < 3; ++i) {
+                state.textureDeleted(m_Textures[i]);
+                state.bufferDeleted(m_Buffers[i]);
+            }
+            glDeleteTextures(3, m_Textures);
+            glDeleteBuffers(3, m_Buffers);
+        }
+
+        // Point on the view ray through an NDC position at view depth `depth`; works for
+        // perspective and orthographic projections alike
+        static glm::vec3 unproject(const glm::mat4& inverse, float x, float y, float depth) {
+            glm::vec4 n = inverse * glm::vec4(x, y, -1.0f, 1.0f), f = inverse * glm::vec4(x, y, 1.0f, 1.0f);
+            glm::vec3 nearPoint = glm::vec3(n) / n.w, farPoint = glm::vec3(f) / f.w;
+            float t = (-depth - nearPoint.z) / (farPoint.z - nearPoint.z);
+            return glm::mix(nearPoint, farPoint, t);
+        }
+
+        float sliceDepth(uint32_t slice) const {
+            if (slice == 0) return m_Near;
+            if (slice >= CLUSTER_GRID_Z) return m_Far;
+            return std::exp((float(slice) - m_Bias) / m_Scale);
+        }
+
+        uint32_t sliceOf(float depth) const {
+            float slice = std::log(std::max(depth, 1e-6f)) * m_Scale + m_Bias;
+            return static_cast<uint32_t>(std::clamp(slice, 0.0f, float(CLUSTER_GRID_Z - 1)));
+        }
+
+        // Cell boxes are in NDC tiles, so only the projection changes them
+        void computeBounds(const glm::mat4& projection) {
+            const glm::mat4 inverse = glm::inverse(projection);
+            glm::vec4 nearPoint = inverse * glm::vec4(0.0f, 0.0f, -1.0f, 1.0f), farPoint = inverse * glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+            m_Near = std::max(-nearPoint.z / nearPoint.w, 0.0f);
+            m_Far = -farPoint.z / farPoint.w;
+
+            const float minDepth = std::clamp(CLUSTER_MIN_DEPTH, m_Near, m_Far * 0.5f);
+            const float range = std::log(m_Far / std::max(minDepth, 1e-6f));
+            m_Scale = CLUSTER_GRID_Z / range;
+            m_Bias = -CLUSTER_GRID_Z * std::log(std::max(minDepth, 1e-6f)) / range;
+
+            m_Bounds.resize(CLUSTER_GRID_Z);
+            for (uint32_t z = 0; z < CLUSTER_GRID_Z; ++z) {
+                sliceBounds& b = m_Bounds[z];
+                const float depths[2] = { sliceDepth(z), sliceDepth(z + 1) };
+                for (uint32_t c = 0; c < paddedSlice; ++c) {
+                    if (c >= cellsPerSlice) {
+                        b.minX[c] = b.minY[c] = b.minZ[c] = FLT_MAX;
+                        b.maxX[c] = b.maxY[c] = b.maxZ[c] = -FLT_MAX;
+                        continue;
+                    }
+                    const uint32_t x = c % CLUSTER_GRID_X, y = c / CLUSTER_GRID_X;
+                    const float x0 = -1.0f + 2.0f * x / CLUSTER_GRID_X, x1 = -1.0f + 2.0f * (x + 1) / CLUSTER_GRID_X;
+                    const float y0 = -1.0f + 2.0f * y / CLUSTER_GRID_Y, y1 = -1.0f + 2.0f * (y + 1) / CLUSTER_GRID_Y;
+
+                    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+                    for (float depth : depths)
+                        for (glm::vec2 corner : { glm::vec2(x0, y0), glm::vec2(x1, y0), glm::vec2(x0, y1), glm::vec2(x1, y1) }) {
+                            glm::vec3 p = unproject(inverse, corner.x, corner.y, depth);
+                            lo = glm::min(lo, p);
+                            hi = glm::max(hi, p);
+                        }
+                    b.minX[c] = lo.x; b.minY[c] = lo.y; b.minZ[c] = lo.z;
+                    b.maxX[c] = hi.x; b.maxY[c] = hi.y; b.maxZ[c] = hi.z;
+                }
+            }
+        }
+
+        // Every light touching a cell of slice z, grouped by cell in m_Bins[z]
+        void binSlice(uint32_t z) {
+            sliceBins& bins = m_Bins[z];
+            const sliceBounds& b = m_Bounds[z];
+            bins.hits.clear();
+
+            const __m128 zero = _mm_setzero_ps();
+            for (uint32_t l = 0; l < m_ViewLights.size(); ++l) {
+                const viewLight& light = m_ViewLights[l];
+                if (z < light.firstSlice || z > light.lastSlice) continue;
+
+                const __m128 cx = _mm_set1_ps(light.center.x), cy = _mm_set1_ps(light.center.y), cz = _mm_set1_ps(light.center.z);
+                const __m128 r2 = _mm_set1_ps(light.radius * light.radius);
+                for (uint32_t c = 0; c < paddedSlice; c += 4) {
+                    // Distance from the center to the box, per axis, zero inside
+                    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(b.minX + c), cx), _mm_sub_ps(cx, _mm_load_ps(b.maxX + c))), zero);
+                    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(b.minY + c), cy), _mm_sub_ps(cy, _mm_load_ps(b.maxY + c))), zero);
+                    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(b.minZ + c), cz), _mm_sub_ps(cz, _mm_load_ps(b.maxZ + c))), zero);
+                    __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+                    for (uint32_t hit = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(d2, r2))); hit; hit &= hit - 1)
+                        bins.hits.emplace_back(c + std::countr_zero(hit), l);
+                }
+            }
+
+            // Counting sort by cell; lights stay in index order within a cell
+            bins.counts.assign(cellsPerSlice + 1, 0);
+            for (const auto& [cell, light] : bins.hits) bins.counts[cell + 1]++;
+            for (uint32_t c = 0; c < cellsPerSlice; ++c) bins.counts[c + 1] += bins.counts[c];
+            bins.indices.resize(bins.hits.size());
+            std::vector<uint32_t> cursor(bins.counts.begin(), bins.counts.end() - 1);
+            for (const auto& [cell, light] : bins.hits) bins.indices[cursor[cell]++] = light;
+        }
+
+        void upload(GLuint buffer, const void* data, size_t bytes) {
+            gl::stateCache::get().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+            glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+            if (bytes) glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+        }
+    public:
+        clusteredLights(const clusteredLights&) = delete;
+        clusteredLights& operator=(const clusteredLights&) = delete;
+
+        // Created on first use, so a context must be current
+        static clusteredLights& get() {
+            static clusteredLights lights;
+            return lights;
+        }
+
+        uint32_t add(const pointLight& light) {
+            m_LightsDirty = true;
+            if (!m_Free.empty()) {
+                uint32_t id = m_Free.back();
+                m_Free.pop_back();
+                m_Slots[id] = { light, true, -1 };
+                return id;
+            }
+            m_Slots.push_back({ light, true, -1 });
+            return static_cast<uint32_t>(m_Slots.size() - 1);
+        }
+
+        uint32_t add(const glm::vec3& position, const glm::vec3& color, float radius) { return add({ position, radius, color }); }
+
+        // For moving lights: cheap, the data is re-uploaded once at the next build()
+        void set(uint32_t id, const pointLight& light) {
+            m_Slots[id].light = light;
+            m_LightsDirty = true;
+        }
+
+        const pointLight& light(uint32_t id) const { return m_Slots[id].light; }
+
+        // Ids below this may be alive; removed ones are skipped by alive()
+        const uint32_t capacity() const { return static_cast<uint32_t>(m_Slots.size()); }
+
+        const bool alive(uint32_t id) const { return id < m_Slots.size() && m_Slots[id].alive; }
+
+        // Point shadow atlas slot of a light, -1 for none. Set by gl::renderQueue each frame;
+        // a change re-uploads the light data at the next build().
+        void setShadow(uint32_t id, int32_t slot) {
+            if (m_Slots[id].shadow == slot) return;
+            m_Slots[id].shadow = slot;
+            m_LightsDirty = true;
+        }
+
+        void remove(uint32_t id) {
+            if (id >= m_Slots.size() || !m_Slots[id].alive) return;
+            m_Slots[id].alive = false;
+            m_Free.push_back(id);
+            m_LightsDirty = true;
+        }
+
+        void clear() {
+            m_Slots.clear();
+            m_Free.clear();
+            m_LightsDirty = true;
+        }
+
+        const size_t size() const { return m_Slots.size() - m_Free.size(); }
+
+        // Lights in the data buffer as of the last build(), in the order shaders index them
+        const uint32_t uploaded() const { return static_cast<uint32_t>(m_Packed.size()); }
+
+        // Bins the lights for this view and uploads the grid. gl::renderQueue::flush calls it
+        // with the current FrameData; code drawing gl::objects directly calls it after setFrame.
+        // Nothing is rebinned while the lights, view and projection stay the same.
+        void build(const glm::mat4& view, const glm::mat4& projection) {
+            auto start = std::chrono::high_resolution_clock::now();
+
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            bool rebin = !m_Built || view != m_BuiltView || m_LightsDirty;
+            if (projection != m_BoundsProjection || m_Bounds.empty()) {
+                computeBounds(projection);
+                m_BoundsProjection = projection;
+                rebin = true;
+            }
+
+            if (m_LightsDirty) {
+                m_Packed.clear();
+                m_LightData.clear();
+                for (uint32_t id = 0; id < m_Slots.size(); ++id) {
+                    if (!m_Slots[id].alive) continue;
+                    const pointLight& light = m_Slots[id].light;
+                    m_Packed.push_back(id);
+                    m_LightData.push_back(glm::vec4(light.position, light.radius));
+                    m_LightData.push_back(glm::vec4(light.color, float(m_Slots[id].shadow + 1)));
+                }
+                upload(m_Buffers[2], m_LightData.data(), m_LightData.size() * sizeof(glm::vec4));
+                m_LightsDirty = false;
+            }
+            clusterData data{};
+            data.clusterSize = glm::ivec4(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, static_cast<int32_t>(m_Packed.size()));
+            data.clusterDepth = glm::vec4(m_Scale, m_Bias, m_Near, m_Far);
+            data.clusterViewport = glm::vec4(viewport[0], viewport[1], 1.0f / std::max(viewport[2], 1), 1.0f / std::max(viewport[3], 1));
+            gl::sceneUniforms::get().clusters.update(0, data);
+            gl::sceneUniforms::get().clusters.bind(0);
+            gl::stateCache& state = gl::stateCache::get();
+            state.bindTexture(CLUSTER_GRID_UNIT, GL_TEXTURE_BUFFER, m_Textures[0]);
+            state.bindTexture(CLUSTER_INDEX_UNIT, GL_TEXTURE_BUFFER, m_Textures[1]);
+            state.bindTexture(CLUSTER_LIGHT_UNIT, GL_TEXTURE_BUFFER, m_Textures[2]);
+            if (!rebin || m_Packed.empty()) return;     // the shader skips the grid at a light count of 0
+
+            m_Stats = {};
+            m_Stats.lights = static_cast<unsigned>(m_Packed.size());
+            m_BuiltView = view;
+            m_Built = true;
+
+            m_ViewLights.clear();
+            for (uint32_t i = 0; i < m_Packed.size(); ++i) {
+                const pointLight& light = m_Slots[m_Packed[i]].light;
+                glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+                float nearest = -center.z - light.radius, farthest = -center.z + light.radius;
+                if (farthest < m_Near || nearest > m_Far || light.radius <= 0.0f) {
+                    // Keeps indices matching m_LightData; an empty slice range skips it
+                    m_ViewLights.push_back({ center, light.radius, 1, 0 });
+                    continue;
+                }
+                m_ViewLights.push_back({ center, light.radius, sliceOf(nearest), sliceOf(farthest) });
+            }
+
+            jobPool::get().parallelFor(CLUSTER_GRID_Z, 1, [this](size_t begin, size_t end) {
+                for (size_t z = begin; z < end; ++z) binSlice(static_cast<uint32_t>(z));
+            });
+
+            m_Grid.resize(cellsPerSlice * CLUSTER_GRID_Z);
+            m_Indices.clear();
+            std::vector<bool> touched(m_Packed.size(), false);
+            for (uint32_t z = 0; z < CLUSTER_GRID_Z; ++z) {
+                const sliceBins& bins = m_Bins[z];
+                const uint32_t offset = static_cast<uint32_t>(m_Indices.size());
+                for (uint32_t c = 0; c < cellsPerSlice; ++c) {
+                    uint32_t count = bins.counts[c + 1] - bins.counts[c];
+                    m_Grid[z * cellsPerSlice + c] = glm::uvec2(offset + bins.counts[c], count);
+                    m_Stats.maxPerCluster = std::max(m_Stats.maxPerCluster, count);
+                }
+                m_Indices.insert(m_Indices.end(), bins.indices.begin(), bins.indices.end());
+                for (uint32_t light : bins.indices) touched[light] = true;
+            }
+            m_Stats.entries = static_cast<unsigned>(m_Indices.size());
+            m_Stats.visible = static_cast<unsigned>(std::count(touched.begin(), touched.end(), true));
+
+            upload(m_Buffers[0], m_Grid.data(), m_Grid.size() * sizeof(glm::uvec2));
+            upload(m_Buffers[1], m_Indices.data(), m_Indices.size() * sizeof(uint32_t));
+
+            m_Stats.binMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // Counters for the last build
+        const clusterStats& stats() const { return m_Stats; }
+    };
+
+}
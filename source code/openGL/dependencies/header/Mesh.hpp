@@ -14,17 +14,45 @@
 
 #include <Window.hpp>
 #include <Utils.hpp>
+#include <ShaderLibrary.hpp>
+#include <UniformBuffer.hpp>
+#include <StateCache.hpp>
+#include <RingBuffer.hpp>
+#include <Culling.hpp>
 
 #include <fstream>
 #include <filesystem>
 #include <string>
 #include <iostream>
 #include <vector>
+#include <span>
 #include <stdexcept>
 #include <unordered_map>
+#include <algorithm>
+#include <cctype>
 
 #define MAX_TEXTURE_UNITS 32
 
+// First vertex attribute of the per-instance data (INSTANCED in vert.glsl)
+#define INSTANCE_ATTRIB_LOCATION 6
+
+// Instances the stream's ring holds per frame before it grows
+#ifndef INSTANCE_STREAM_FRAME_INSTANCES
+
+    #define INSTANCE_STREAM_FRAME_INSTANCES 4096
+
+#endif // INSTANCE_STREAM_FRAME_INSTANCES
+
+// Meshes with at least this many triangles get hardware occlusion queries in gl::renderQueue
+#ifndef OCCLUSION_QUERY_MIN_TRIANGLES
+
+    #define OCCLUSION_QUERY_MIN_TRIANGLES 20000
+
+#endif // OCCLUSION_QUERY_MIN_TRIANGLES
+
+// Units object::draw owns; the ones above are left for scene-wide textures (IBL, shadows)
+#define MATERIAL_TEXTURE_UNITS 16
+
 #ifndef MODEL_PATH
 
     #define MODEL_PATH "resource/model"
@@ -48,6 +76,273 @@ namespace gl {
     struct Light {
         glm::vec3 position;
         glm::vec3 color;
+        float shadowPriority = 0.0f;    // 0 casts no shadow, see gl::pointShadows
+        int32_t shadow = -1;            // slot in the point shadow atlas, set by gl::renderQueue
+    };
+
+    // Translate, then rotate about x, y, z (degrees), then scale
+    inline glm::mat4 modelMatrix(const glm::vec3& pos, const glm::vec3& scale, const glm::vec3& rotation) {
+        return glm::scale(glm::rotate(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0f), pos), glm::radians(rotation.x), glm::vec3(1, 0, 0)), glm::radians(rotation.y), glm::vec3(0, 1, 0)), glm::radians(rotation.z), glm::vec3(0, 0, 1)), scale);
+    }
+
+    // What vert.glsl reads per instance: the model matrix at INSTANCE_ATTRIB_LOCATION..+3
+    // and a color the base color is multiplied by at +4
+    struct instance {
+        glm::mat4 model;
+        glm::vec4 color = glm::vec4(1.0f);
+    };
+
+    // Where an object's geometry lives in gl::geometryPool. Indices are local to the mesh
+    // and draws add baseVertex.
+    struct meshRange {
+        GLuint firstIndex = 0;
+        GLsizei indexCount = 0;
+        GLint baseVertex = 0;
+
+        // For the `indices` argument of the glDrawElements family
+        void* offset() const { return (void*)(size_t(firstIndex) * sizeof(GLuint)); }
+    };
+
+    // One vertex and one index buffer behind a single VAO that every object's geometry is
+    // appended to, so draws of different objects share the VAO and can go out together in
+    // one glMultiDrawElementsIndirect. Append-only: destroyed objects leave their range behind.
+    class geometryPool {
+    private:
+        GLuint m_VAO = 0, m_VBO = 0, m_EBO = 0;
+        GLuint m_PositionVAO = 0, m_PositionVBO = 0;      // tightly packed vec3 copy for depth-only passes
+        size_t m_VertexCount = 0, m_VertexCapacity = 0;
+        size_t m_IndexCount = 0, m_IndexCapacity = 0;
+        std::vector<glm::vec3> m_Positions;
+
+        geometryPool() {
+            glGenVertexArrays(1, &m_VAO);
+            glGenVertexArrays(1, &m_PositionVAO);
+        }
+
+        // Replaces `buffer` with one of `capacity` bytes holding its first `used` bytes
+        static void grow(GLuint& buffer, size_t used, size_t capacity) {
+            gl::stateCache& state = gl::stateCache::get();
+            GLuint grown;
+            glGenBuffers(1, &grown);
+            state.bindBuffer(GL_COPY_WRITE_BUFFER, grown);
+            glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+            if (buffer) {
+                state.bindBuffer(GL_COPY_READ_BUFFER, buffer);
+                if (used) glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+                state.bufferDeleted(buffer);
+                glDeleteBuffers(1, &buffer);
+            }
+            buffer = grown;
+        }
+
+        void setupAttributes() {
+            gl::stateCache& state = gl::stateCache::get();
+            state.bindVertexArray(m_VAO);
+            state.bindBuffer(GL_ARRAY_BUFFER, m_VBO);
+            state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+
+            // Position
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
+
+            // Normal
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, Normal));
+
+            // TexCoords
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, TexCoords));
+
+            // Tangent
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, Tangent));
+
+            // Position only, 12 bytes a vertex instead of sizeof(vertex)
+            state.bindVertexArray(m_PositionVAO);
+            state.bindBuffer(GL_ARRAY_BUFFER, m_PositionVBO);
+            state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+            state.bindVertexArray(0);
+        }
+    public:
+        ~geometryPool() {
+            gl::stateCache& state = gl::stateCache::get();
+            state.vertexArrayDeleted(m_VAO);
+            state.vertexArrayDeleted(m_PositionVAO);
+            state.bufferDeleted(m_VBO);
+            state.bufferDeleted(m_PositionVBO);
+            glDeleteVertexArrays(1, &m_VAO);
+            glDeleteVertexArrays(1, &m_PositionVAO);
+            glDeleteBuffers(1, &m_VBO);
+            glDeleteBuffers(1, &m_PositionVBO);
+            glDeleteBuffers(1, &m_EBO);
+        }
+
+        geometryPool(const geometryPool&) = delete;
+        geometryPool& operator=(const geometryPool&) = delete;
+
+        // Created on first use, so a context must be current
+        static geometryPool& get() {
+            static geometryPool pool;
+            return pool;
+        }
+
+        // Copies a mesh in, growing the buffers by doubling when it does not fit
+        meshRange allocate(const std::vector<vertex>& vertices, const std::vector<unsigned int>& indices) {
+            bool grown = false;
+            if (m_VertexCount + vertices.size() > m_VertexCapacity) {
+                size_t capacity = std::max(m_VertexCount + vertices.size(), m_VertexCapacity * 2);
+                grow(m_VBO, m_VertexCount * sizeof(vertex), capacity * sizeof(vertex));
+                grow(m_PositionVBO, m_VertexCount * sizeof(glm::vec3), capacity * sizeof(glm::vec3));
+                m_VertexCapacity = capacity;
+                grown = true;
+            }
+            if (m_IndexCount + indices.size() > m_IndexCapacity) {
+                size_t capacity = std::max(m_IndexCount + indices.size(), m_IndexCapacity * 2);
+                grow(m_EBO, m_IndexCount * sizeof(GLuint), capacity * sizeof(GLuint));
+                m_IndexCapacity = capacity;
+                grown = true;
+            }
+            if (grown) setupAttributes();
+
+            gl::stateCache& state = gl::stateCache::get();
+            state.bindBuffer(GL_COPY_WRITE_BUFFER, m_VBO);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, m_VertexCount * sizeof(vertex), vertices.size() * sizeof(vertex), vertices.data());
+            m_Positions.resize(vertices.size());
+            for (size_t i = 0; i < vertices.size(); ++i) m_Positions[i] = vertices[i].Position;
+            state.bindBuffer(GL_COPY_WRITE_BUFFER, m_PositionVBO);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, m_VertexCount * sizeof(glm::vec3), m_Positions.size() * sizeof(glm::vec3), m_Positions.data());
+            state.bindBuffer(GL_COPY_WRITE_BUFFER, m_EBO);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, m_IndexCount * sizeof(GLuint), indices.size() * sizeof(GLuint), indices.data());
+
+            meshRange range{ static_cast<GLuint>(m_IndexCount), static_cast<GLsizei>(indices.size()), static_cast<GLint>(m_VertexCount) };
+            m_VertexCount += vertices.size();
+            m_IndexCount += indices.size();
+            return range;
+        }
+
+        const GLuint getVAO() const { return m_VAO; }
+
+        // Positions at attribute 0 over the shared index buffer, for depth-only passes. Same
+        // ranges and base vertices as getVAO(), without the instance attributes.
+        const GLuint getPositionVAO() const { return m_PositionVAO; }
+
+        // Replaced when the pool grows, so compare before reusing a name
+        const GLuint getVertexBuffer() const { return m_VBO; }
+
+        const GLuint getIndexBuffer() const { return m_EBO; }
+    };
+
+    // Per-instance vertex data shared by every instanced draw. Each upload takes a fresh
+    // slice of a gl::ringBuffer, so draws still in flight keep the data they were issued with
+    // and the CPU never waits on them. Slices are aligned to sizeof(instance), making their
+    // start an instance index in the whole buffer. The instance attributes live on the
+    // geometry pool's VAO.
+    class instanceStream {
+    private:
+        gl::ringBuffer m_Ring;
+        uint32_t m_Base = 0;        // first instance of the last upload
+        bool m_BaseInstance;
+        GLuint m_Pointed = 0;       // buffer the attributes point at from instance 0, base instance draws only
+        std::vector<instance> m_Staging;
+
+        instanceStream()
+            : m_Ring(GL_ARRAY_BUFFER, INSTANCE_STREAM_FRAME_INSTANCES * sizeof(instance))
+        {
+            m_BaseInstance = GLEW_VERSION_4_2 || GLEW_ARB_base_instance;
+        }
+
+        // Points the instance attributes of the bound VAO at instance `first` of `buffer`
+        void point(uint32_t first, GLuint buffer) {
+            gl::stateCache::get().bindBuffer(GL_ARRAY_BUFFER, buffer);
+            size_t base = size_t(first) * sizeof(instance);
+            for (GLuint c = 0; c < 4; ++c) {
+                GLuint location = INSTANCE_ATTRIB_LOCATION + c;
+                glEnableVertexAttribArray(location);
+                glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(instance), (void*)(base + c * sizeof(glm::vec4)));
+                glVertexAttribDivisor(location, 1);
+            }
+            GLuint colorLocation = INSTANCE_ATTRIB_LOCATION + 4;
+            glEnableVertexAttribArray(colorLocation);
+            glVertexAttribPointer(colorLocation, 4, GL_FLOAT, GL_FALSE, sizeof(instance), (void*)(base + offsetof(instance, color)));
+            glVertexAttribDivisor(colorLocation, 1);
+        }
+    public:
+        instanceStream(const instanceStream&) = delete;
+        instanceStream& operator=(const instanceStream&) = delete;
+
+        // Created on first use, so a context must be current
+        static instanceStream& get() {
+            static instanceStream stream;
+            return stream;
+        }
+
+        // Scratch space callers fill before upload()
+        std::vector<instance>& staging() { return m_Staging; }
+
+        void upload(const instance* data, size_t count) {
+            if (count == 0) return;
+
+            // A slice plus its alignment has to fit in one frame region
+            size_t bytes = count * sizeof(instance);
+            if (bytes + sizeof(instance) > m_Ring.regionSize()) {
+                m_Ring.reserve(2 * (bytes + sizeof(instance)));
+                m_Pointed = 0;
+            }
+
+            gl::ringAllocation slice = m_Ring.allocate(data, bytes, sizeof(instance));
+            m_Ring.flush();
+            m_Base = static_cast<uint32_t>(slice.offset / sizeof(instance));
+        }
+
+        void upload() { upload(m_Staging.data(), m_Staging.size()); }
+
+        const bool baseInstance() const { return m_BaseInstance; }
+
+        // Instance index of the last upload's first entry, to add to indirect base instances
+        const uint32_t base() const { return m_Base; }
+
+        const gl::ringBuffer& ring() const { return m_Ring; }
+
+        // Binds the pool VAO with the instance attributes at the start of the ring, for
+        // indirect draws whose commands carry base() + first. Needs baseInstance(). Another
+        // buffer of instances can be given instead, e.g. one filled by gl::gpuCuller.
+        void bindForIndirect(GLuint buffer = 0) {
+            if (!buffer) buffer = m_Ring.getBuffer();
+            gl::stateCache::get().bindVertexArray(gl::geometryPool::get().getVAO());
+            if (m_Pointed != buffer) {
+                point(0, buffer);
+                m_Pointed = buffer;
+            }
+        }
+
+        // Call after deleting a buffer given to bindForIndirect; GL may hand its name out again
+        void invalidate() { m_Pointed = 0; }
+
+        // Draws `count` instances of the bound program starting at instance `first` of the last
+        // upload. With base instance support the attribute pointers are set once and the draw
+        // carries the offset; on plain 3.3 they are re-pointed per draw.
+        void draw(const meshRange& range, uint32_t first, GLsizei count) {
+            if (m_BaseInstance) {
+                bindForIndirect();
+                glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, range.offset(), count, range.baseVertex, m_Base + first);
+            }
+            else {
+                gl::stateCache::get().bindVertexArray(gl::geometryPool::get().getVAO());
+                point(m_Base + first, m_Ring.getBuffer());
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, range.offset(), count, range.baseVertex);
+            }
+        }
+    };
+
+    // One aiMesh of a model: its slice of the object's indices and its bounds in model space
+    struct submesh {
+        GLuint firstIndex;
+        GLsizei indexCount;
+        gl::aabb bounds;
+        gl::boundingSphere sphere;
     };
 
     class object {
@@ -55,8 +350,26 @@ namespace gl {
         std::vector<vertex> vertices;
         std::vector<unsigned int> indices;
         std::vector<Light> lights;
+        std::vector<submesh> submeshes;
+
+        gl::meshRange range;
+        gl::aabb bounds;
+        gl::boundingSphere sphere;
+
+        // Stand-in drawn into the CPU occlusion buffer: meshes named "occluder" in the model
+        // file (a simplified LOD inside the visible one), or the render mesh via setOccluder
+        std::vector<glm::vec3> occluderPositions;
+        std::vector<uint32_t> occluderIndices;
+        bool occluder = false;
 
-        GLuint VAO, VBO, EBO;
+        bool occlusionQuery = false;
+
+        bool shadowCaster = true;
+        bool staticTransform = false;
+
+        bool lightsDirty = true;
+
+        uint32_t features = 0;
 
         enum class TextureType {
             BaseColor,
@@ -70,6 +383,7 @@ namespace gl {
         struct TexEntry {
             std::string name;          // logical name (e.g. "baseColor", "normal")
             gl::texture2D* text;    // pointer to texture
+            gl::uniformID id = 0;   // interned sampler name, resolved after loading
         };
 
         std::vector<TexEntry> textures;
@@ -77,26 +391,40 @@ namespace gl {
         Assimp::Importer* importer{ nullptr }; // keep alive for embedded textures
 
     public:
-        void uploadLights(GLuint shaderProgram) {
-            glUseProgram(shaderProgram);
-
-            GLint numLoc = glGetUniformLocation(shaderProgram, "numLights");
-            glUniform1i(numLoc, (GLint)lights.size());
-
-            for (size_t i = 0; i < lights.size(); ++i) {
-                std::string posName = "lightPos[" + std::to_string(i) + "]";
-                std::string colName = "lightColor[" + std::to_string(i) + "]";
-
-                GLint posLoc = glGetUniformLocation(shaderProgram, posName.c_str());
-                GLint colLoc = glGetUniformLocation(shaderProgram, colName.c_str());
-
-                glUniform3fv(posLoc, 1, glm::value_ptr(lights[i].position));
-                glUniform3fv(colLoc, 1, glm::value_ptr(lights[i].color));
+        // Lights live in the LightData block, so any program sees the same slot. It is only
+        // rewritten after addLight or when another object's lights are in it.
+        void uploadLights() {
+            gl::sceneUniforms& uniforms = gl::sceneUniforms::get();
+            if (lightsDirty || uniforms.lightsOwner != this) {
+                gl::lightData data;
+                std::memset(&data, 0, sizeof(data));
+                data.numLights = static_cast<int32_t>(std::min<size_t>(lights.size(), MAX_LIGHTS));
+                for (int32_t i = 0; i < MAX_LIGHTS; ++i) data.lightShadow[i] = -1;
+                for (int32_t i = 0; i < data.numLights; ++i) {
+                    data.lightPos[i] = lights[i].position;
+                    data.lightColor[i] = lights[i].color;
+                    data.lightShadow[i] = lights[i].shadow;
+                }
+                uniforms.lights.update(0, data);
+                uniforms.lightsOwner = this;
+                lightsDirty = false;
             }
         }
 
-        void addLight(const glm::vec3& pos, const glm::vec3& color) {
-            lights.push_back({ pos, color });
+        // A shadowPriority above 0 asks gl::renderQueue's point shadows for a shadow; higher
+        // priorities get more of the atlas
+        void addLight(const glm::vec3& pos, const glm::vec3& color, float shadowPriority = 0.0f) {
+            lights.push_back({ pos, color, shadowPriority });
+            lightsDirty = true;
+        }
+
+        const std::vector<Light>& getLights() const { return lights; }
+
+        // Atlas slot of light i, -1 for none. Set by gl::renderQueue each frame.
+        void setLightShadow(size_t i, int32_t slot) {
+            if (lights[i].shadow == slot) return;
+            lights[i].shadow = slot;
+            lightsDirty = true;
         }
 
         object(const std::string& glbPath) {
@@ -178,21 +506,38 @@ namespace gl {
                 loadTexture(aiTextureType_AMBIENT_OCCLUSION, "occlusion");
                 loadTexture(aiTextureType_EMISSIVE, "emissive");
             }
+
+            for (auto& t : textures) t.id = gl::internUniform(t.name);
+            updateFeatures();
         }
 
         ~object() {
+            if (gl::sceneUniforms::get().lightsOwner == this) gl::sceneUniforms::get().lightsOwner = nullptr;
             for (auto& t : textures) {
                 delete t.text;
             }
             textures.clear();
             if (importer) delete importer;
-            if (VAO) glDeleteVertexArrays(1, &VAO);
-            if (VBO) glDeleteBuffers(1, &VBO);
-            if (EBO) glDeleteBuffers(1, &EBO);
         }
 
         void setTexture2D(gl::texture2D* tex, unsigned index) {
             textures[index].text = tex;
+            updateFeatures();
+        }
+
+        // Shader features this model's material actually uses
+        uint32_t getFeatures() const { return features; }
+
+        uint64_t getPermutationKey() const {
+            return gl::permutationKey(getFeatures(), static_cast<uint32_t>(std::min<size_t>(lights.size(), MAX_LIGHTS)));
+        }
+
+        void draw(gl::shaderLibrary& library, const glm::vec3& pos, const glm::vec3& scale, const glm::vec3& rotation) {
+            draw(library.use(getPermutationKey()), pos, scale, rotation);
+        }
+
+        void draw(gl::shaderLibrary& library, const glm::mat4& model) {
+            draw(library.use(getPermutationKey()), model);
         }
 
         // In gl::object
@@ -201,61 +546,153 @@ namespace gl {
             const glm::vec3& scale,
             const glm::vec3& rotation) // new optional param
         {
-            glUseProgram(shaderProgram);
-            GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(glm::scale(glm::rotate(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0f), pos), glm::radians(rotation.x), glm::vec3(1, 0, 0)), glm::radians(rotation.y), glm::vec3(0, 1, 0)), glm::radians(rotation.z), glm::vec3(0, 0, 1)), scale)));
+            draw(shaderProgram, gl::modelMatrix(pos, scale, rotation));
+        }
 
-            // --- bind textures, upload lights, draw VAO ---
-            for (int i = 0; i < MAX_TEXTURE_UNITS; ++i) {
-                glActiveTexture(GL_TEXTURE0 + i);
-                if (i < textures.size() && textures[i].text) {
-                    textures[i].text->bind(GL_TEXTURE_2D);
-                    std::string uniformName = textures[i].name;
-                    GLint loc = glGetUniformLocation(shaderProgram, uniformName.c_str());
-                    if (loc >= 0) glUniform1i(loc, i);
-                }
-                else glBindTexture(GL_TEXTURE_2D, 0);
-            }
 
-            uploadLights(shaderProgram);
+        void draw(GLuint shaderProgram, const glm::mat4& model) {
+            static const gl::uniformID modelID = gl::internUniform("model");
+
+            gl::stateCache::get().useProgram(shaderProgram);
+            gl::programReflection& uniforms = gl::programReflection::get(shaderProgram);
 
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, 0);
-            glBindVertexArray(0);
+            // Upload model matrix
+            glUniformMatrix4fv(uniforms.location(modelID), 1, GL_FALSE, glm::value_ptr(model));
 
-            glActiveTexture(GL_TEXTURE0);
+            bindMaterial(shaderProgram);
+            uploadLights();
+            drawGeometry();
         }
 
+        // Draws one instance per transform in a single call with the INSTANCED permutation.
+        // `colors` is optional and multiplies the base color per instance. Until the variant
+        // is linked the instances are drawn one by one with the plain one.
+        void drawInstanced(gl::shaderLibrary& library, std::span<const glm::mat4> models, std::span<const glm::vec4> colors = {}) {
+            if (models.empty()) return;
+
+            uint64_t key = getPermutationKey() | FEATURE_INSTANCED;
+            library.get(key);
+            if (!library.ready(key)) {
+                for (const glm::mat4& model : models) draw(library, model);
+                return;
+            }
+            drawInstanced(library.use(key), models, colors);
+        }
 
-        void draw(GLuint shaderProgram, const glm::mat4& model) {
-            glUseProgram(shaderProgram);
+        // `instancedProgram` must be built with INSTANCED
+        void drawInstanced(GLuint instancedProgram, std::span<const glm::mat4> models, std::span<const glm::vec4> colors = {}) {
+            if (models.empty()) return;
 
-            // Upload model matrix
-            GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+            gl::instanceStream& stream = gl::instanceStream::get();
+            std::vector<instance>& staging = stream.staging();
+            staging.resize(models.size());
+            for (size_t i = 0; i < models.size(); ++i) {
+                staging[i].model = models[i];
+                staging[i].color = i < colors.size() ? colors[i] : glm::vec4(1.0f);
+            }
+            stream.upload();
+
+            gl::stateCache::get().useProgram(instancedProgram);
+            bindMaterial(instancedProgram);
+            uploadLights();
+            stream.draw(range, 0, static_cast<GLsizei>(models.size()));
+        }
+
+        // The pieces of draw(), for callers that batch and skip unchanged state (gl::renderQueue).
+        // bindMaterial expects `shaderProgram` to be in use.
+        void bindMaterial(GLuint shaderProgram) {
+            gl::programReflection& uniforms = gl::programReflection::get(shaderProgram);
 
             // Bind textures sequentially
-            for (int i = 0; i < MAX_TEXTURE_UNITS; ++i) {
-                glActiveTexture(GL_TEXTURE0 + i);
+            for (int i = 0; i < MATERIAL_TEXTURE_UNITS; ++i) {
                 if (i < textures.size() && textures[i].text) {
-                    textures[i].text->bind(GL_TEXTURE_2D);
-                    std::string uniformName = textures[i].name;
-                    GLint loc = glGetUniformLocation(shaderProgram, uniformName.c_str());
-                    if (loc >= 0) glUniform1i(loc, i);
+                    textures[i].text->bind(GL_TEXTURE0 + i);
+                    uniforms.setSampler(textures[i].id, i);
+                }
+                else {
+                    // Skipped by the state cache once the unit is already empty
+                    gl::stateCache::get().bindTexture(i, GL_TEXTURE_2D, 0);
                 }
-                else glBindTexture(GL_TEXTURE_2D, 0);
             }
+        }
+
+        // Every object draws from the pool VAO, so after the first draw the bind is skipped
+        void drawGeometry() {
+            gl::stateCache::get().bindVertexArray(gl::geometryPool::get().getVAO());
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, range.offset(), range.baseVertex);
+        }
+
+        const gl::meshRange& getRange() const { return range; }
+
+        // Model-space bounds of the whole object, computed at import
+        const gl::aabb& getBounds() const { return bounds; }
+
+        const gl::boundingSphere& getSphere() const { return sphere; }
+
+        const std::vector<submesh>& getSubmeshes() const { return submeshes; }
+
+        // Makes this object hide what is behind it in the occlusion buffer. Without an imported
+        // occluder mesh the render mesh is used, which is exact but costs more to rasterize.
+        void setOccluder(bool enabled) {
+            occluder = enabled;
+            if (!enabled || !occluderIndices.empty()) return;
+            occluderPositions.resize(vertices.size());
+            for (size_t i = 0; i < vertices.size(); i++) occluderPositions[i] = vertices[i].Position;
+            occluderIndices.assign(indices.begin(), indices.end());
+        }
 
-            uploadLights(shaderProgram);
+        const bool isOccluder() const { return occluder && !occluderIndices.empty(); }
 
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, 0);
-            glBindVertexArray(0);
+        // Whether gl::renderQueue tests this object's box with an occlusion query and draws it
+        // under conditional rendering. On by default above OCCLUSION_QUERY_MIN_TRIANGLES; turn
+        // it on for cheap meshes with expensive materials.
+        void setOcclusionQuery(bool enabled) { occlusionQuery = enabled; }
 
-            glActiveTexture(GL_TEXTURE0);
+        const bool usesOcclusionQuery() const { return occlusionQuery; }
+
+        // Whether gl::renderQueue draws this object into the shadow maps
+        void setCastShadows(bool enabled) { shadowCaster = enabled; }
+
+        const bool castsShadows() const { return shadowCaster; }
+
+        // Promises that every submission of this object keeps its transform from frame to
+        // frame. Cached shadow cascades keep static objects in their cached layer and only
+        // redraw the others each frame; moving a static object costs a cascade refresh.
+        void setStatic(bool enabled) { staticTransform = enabled; }
+
+        const bool isStatic() const { return staticTransform; }
+
+        const std::vector<glm::vec3>& getOccluderPositions() const { return occluderPositions; }
+
+        const std::vector<uint32_t>& getOccluderIndices() const { return occluderIndices; }
+
+        // Same textures in every slot and the same lights, so one bindMaterial/uploadLights
+        // serves both and their draws can share a multi-draw
+        bool sharesMaterial(const object& other) const {
+            if (&other == this) return true;
+            if (textures.size() != other.textures.size() || lights.size() != other.lights.size()) return false;
+            for (size_t i = 0; i < textures.size(); ++i)
+                if (textures[i].text != other.textures[i].text || textures[i].id != other.textures[i].id) return false;
+            for (size_t i = 0; i < lights.size(); ++i)
+                if (lights[i].position != other.lights[i].position || lights[i].color != other.lights[i].color) return false;
+            return true;
         }
 
+        const GLsizei getIndexCount() const { return range.indexCount; }
+
     private:
+        void updateFeatures() {
+            features = 0;
+            for (const auto& t : textures) {
+                if (!t.text) continue;
+                if (t.name == "baseColor") features |= FEATURE_BASE_COLOR_MAP;
+                else if (t.name == "normal") features |= FEATURE_NORMAL_MAP;
+                else if (t.name == "metallicRoughness") features |= FEATURE_METALLIC_ROUGHNESS_MAP;
+                else if (t.name == "occlusion") features |= FEATURE_OCCLUSION_MAP;
+                else if (t.name == "emissive") features |= FEATURE_EMISSIVE;
+            }
+        }
+
         inline std::filesystem::path getPath(const std::string& relativePath) {
             std::filesystem::path exePath = std::filesystem::current_path();
             return exePath / relativePath;
@@ -278,19 +715,43 @@ namespace gl {
         void processNode(aiNode* node, const aiScene* scene) {
             for (unsigned int i = 0; i < node->mNumMeshes; i++) {
                 aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-                processMesh(mesh);
+                if (isOccluderMesh(mesh)) processOccluder(mesh);
+                else processMesh(mesh);
             }
             for (unsigned int i = 0; i < node->mNumChildren; i++) {
                 processNode(node->mChildren[i], scene);
             }
         }
 
+        // Occluder LODs are flagged in the model by name ("occluder", any case) and not drawn
+        static bool isOccluderMesh(const aiMesh* mesh) {
+            std::string name = mesh->mName.C_Str();
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            return name.find("occluder") != std::string::npos;
+        }
+
+        void processOccluder(aiMesh* mesh) {
+            const uint32_t baseVertex = static_cast<uint32_t>(occluderPositions.size());
+            for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+                occluderPositions.emplace_back(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+                const aiFace& face = mesh->mFaces[i];
+                if (face.mNumIndices != 3) continue;
+                for (unsigned int j = 0; j < 3; j++) occluderIndices.push_back(baseVertex + face.mIndices[j]);
+            }
+            occluder = true;
+        }
+
+        // Appends the mesh to the object's vertices and indices; its indices are offset by the
+        // vertices already there
         void processMesh(aiMesh* mesh) {
-            vertices.resize(mesh->mNumVertices);
+            const unsigned int baseVertex = static_cast<unsigned int>(vertices.size());
+            const GLuint firstIndex = static_cast<GLuint>(indices.size());
+            vertices.resize(baseVertex + mesh->mNumVertices);
 
             // Step 1: copy positions, normals, UVs
             for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-                vertex& v = vertices[i];
+                vertex& v = vertices[baseVertex + i];
                 v.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
 
                 // Normals
@@ -314,9 +775,9 @@ namespace gl {
                 aiFace face = mesh->mFaces[i];
                 if (face.mNumIndices != 3) continue;
 
-                vertex& v0 = vertices[face.mIndices[0]];
-                vertex& v1 = vertices[face.mIndices[1]];
-                vertex& v2 = vertices[face.mIndices[2]];
+                vertex& v0 = vertices[baseVertex + face.mIndices[0]];
+                vertex& v1 = vertices[baseVertex + face.mIndices[1]];
+                vertex& v2 = vertices[baseVertex + face.mIndices[2]];
 
                 glm::vec3 edge1 = v1.Position - v0.Position;
                 glm::vec3 edge2 = v2.Position - v0.Position;
@@ -338,16 +799,36 @@ namespace gl {
             }
 
             // Step 3: normalize tangents
-            for (auto& v : vertices) {
-                v.Tangent = glm::normalize(v.Tangent);
+            for (size_t i = baseVertex; i < vertices.size(); i++) {
+                vertices[i].Tangent = glm::normalize(vertices[i].Tangent);
             }
 
             // Step 4: store indices
             for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
                 aiFace face = mesh->mFaces[i];
                 for (unsigned int j = 0; j < face.mNumIndices; j++)
-                    indices.push_back(face.mIndices[j]);
+                    indices.push_back(baseVertex + face.mIndices[j]);
+            }
+
+            // Step 5: bounds
+            submesh part{ firstIndex, static_cast<GLsizei>(indices.size() - firstIndex), gl::aabb{}, gl::boundingSphere{} };
+            std::vector<glm::vec3> points(mesh->mNumVertices);
+            for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
+                points[i] = vertices[baseVertex + i].Position;
+                part.bounds.expand(points[i]);
+            }
+            part.sphere = gl::sphereAround(points, part.bounds);
+            submeshes.push_back(part);
+        }
+
+        void computeBounds() {
+            bounds = {};
+            std::vector<glm::vec3> points(vertices.size());
+            for (size_t i = 0; i < vertices.size(); i++) {
+                points[i] = vertices[i].Position;
+                bounds.expand(points[i]);
             }
+            sphere = gl::sphereAround(points, bounds);
         }
 
         void loadTextures(const aiScene* scene, const std::string& modelPath) {
@@ -403,35 +884,9 @@ namespace gl {
         }
 
         void setupMesh() {
-            glGenVertexArrays(1, &VAO);
-            glGenBuffers(1, &VBO);
-            glGenBuffers(1, &EBO);
-
-            glBindVertexArray(VAO);
-
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex), vertices.data(), GL_STATIC_DRAW);
-
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
-
-            // Position
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
-
-            // Normal
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, Normal));
-
-            // TexCoords
-            glEnableVertexAttribArray(2);
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, TexCoords));
-
-            // Tangent
-            glEnableVertexAttribArray(3);
-            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, Tangent));
-
-            glBindVertexArray(0);
+            computeBounds();
+            occlusionQuery = indices.size() / 3 >= OCCLUSION_QUERY_MIN_TRIANGLES;
+            range = gl::geometryPool::get().allocate(vertices, indices);
         }
     };
 
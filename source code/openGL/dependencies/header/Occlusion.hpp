@@ -0,0 +1,272 @@
+#pragma once
+
+#include <glm.hpp>
+
+#include <Culling.hpp>
+#include <Jobs.hpp>
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Occlusion buffer size; the width has to be a multiple of 4 (one SSE span) and both a
+// multiple of OCCLUSION_TILE_SIZE
+#ifndef OCCLUSION_BUFFER_WIDTH
+
+    #define OCCLUSION_BUFFER_WIDTH 256
+    #define OCCLUSION_BUFFER_HEIGHT 128
+
+#endif // OCCLUSION_BUFFER_WIDTH
+
+// Edge of the square tiles of the depth hierarchy
+#ifndef OCCLUSION_TILE_SIZE
+
+    #define OCCLUSION_TILE_SIZE 8
+
+#endif // OCCLUSION_TILE_SIZE
+
+// Rows each worker rasterizes; bands never share pixels, so no locking
+#ifndef OCCLUSION_BAND_ROWS
+
+    #define OCCLUSION_BAND_ROWS 16
+
+#endif // OCCLUSION_BAND_ROWS
+
+namespace gl {
+
+    struct occlusionStats {
+        unsigned occluderTriangles = 0;
+        unsigned tested = 0;
+        unsigned occluded = 0;
+        double rasterMilliseconds = 0.0;
+    };
+
+    // CPU occlusion culling: occluder meshes are rasterized into a small 1/w buffer, then
+    // bounding boxes are tested against it before anything is submitted to GL. Nothing is
+    // read back from the GPU.
+    //
+    // Rasterization is conservative in the direction that matters. A pixel only takes an
+    // occluder's depth when the triangle covers all of it, and it takes the farthest depth
+    // the triangle has inside the pixel. An occludee's box is tested with its nearest corner
+    // against every pixel it touches, so anything partly visible is kept. An 8x8 tile
+    // hierarchy holding each tile's farthest depth settles most boxes without touching the
+    // pixels.
+    class occlusionBuffer {
+    private:
+        static constexpr int width = OCCLUSION_BUFFER_WIDTH, height = OCCLUSION_BUFFER_HEIGHT;
+        static constexpr int tilesX = width / OCCLUSION_TILE_SIZE, tilesY = height / OCCLUSION_TILE_SIZE;
+        static constexpr float nearW = 1e-3f;
+
+        static_assert(width % 4 == 0 && width % OCCLUSION_TILE_SIZE == 0 && height % OCCLUSION_TILE_SIZE == 0);
+        static_assert(OCCLUSION_BAND_ROWS % OCCLUSION_TILE_SIZE == 0);
+
+        // Screen-space setup: edge functions a*x + b*y + c >= 0 inside, shrunk by half a pixel
+        // diagonal, and 1/w as a plane lowered to the pixel's farthest point
+        struct triangle {
+            float a[3], b[3], c[3];
+            float zx, zy, z0;
+            int minX, maxX, minY, maxY;
+        };
+
+        std::vector<float> m_Depth;         // 1/w, 0 where no occluder
+        std::vector<float> m_TileFarthest;
+        std::vector<triangle> m_Triangles;
+        glm::mat4 m_ViewProjection = glm::mat4(1.0f);
+
+        mutable occlusionStats m_Stats;
+
+        void setup(glm::vec4 v0, glm::vec4 v1, glm::vec4 v2) {
+            glm::vec3 s[3];
+            const glm::vec4* v[3] = { &v0, &v1, &v2 };
+            for (int i = 0; i < 3; ++i) {
+                float inv = 1.0f / v[i]->w;
+                s[i] = glm::vec3((v[i]->x * inv * 0.5f + 0.5f) * width, (v[i]->y * inv * 0.5f + 0.5f) * height, inv);
+            }
+
+            float area = (s[1].x - s[0].x) * (s[2].y - s[0].y) - (s[2].x - s[0].x) * (s[1].y - s[0].y);
+            if (std::abs(area) < 1e-8f) return;
+            if (area < 0.0f) {
+                std::swap(s[1], s[2]);
+                area = -area;
+            }
+
+            triangle t;
+            for (int e = 0; e < 3; ++e) {
+                const glm::vec3& p = s[e];
+                const glm::vec3& q = s[(e + 1) % 3];
+                t.a[e] = p.y - q.y;
+                t.b[e] = q.x - p.x;
+                t.c[e] = p.x * q.y - p.y * q.x - 0.5f * (std::abs(t.a[e]) + std::abs(t.b[e]));
+            }
+
+            // 1/w is affine in screen space
+            float inv = 1.0f / area;
+            t.zx = ((s[1].z - s[0].z) * (s[2].y - s[0].y) - (s[2].z - s[0].z) * (s[1].y - s[0].y)) * inv;
+            t.zy = ((s[2].z - s[0].z) * (s[1].x - s[0].x) - (s[1].z - s[0].z) * (s[2].x - s[0].x)) * inv;
+            t.z0 = s[0].z - t.zx * s[0].x - t.zy * s[0].y - 0.5f * (std::abs(t.zx) + std::abs(t.zy));
+
+            t.minX = std::max(0, static_cast<int>(std::floor(std::min({ s[0].x, s[1].x, s[2].x }))));
+            t.maxX = std::min(width - 1, static_cast<int>(std::ceil(std::max({ s[0].x, s[1].x, s[2].x }))));
+            t.minY = std::max(0, static_cast<int>(std::floor(std::min({ s[0].y, s[1].y, s[2].y }))));
+            t.maxY = std::min(height - 1, static_cast<int>(std::ceil(std::max({ s[0].y, s[1].y, s[2].y }))));
+            if (t.minX > t.maxX || t.minY > t.maxY) return;
+
+            m_Triangles.push_back(t);
+        }
+
+        // Clips against w >= nearW; the other planes are handled by the screen bounds
+        void clipAndSetup(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2) {
+            std::array<glm::vec4, 4> out;
+            int count = 0;
+            const glm::vec4* in[3] = { &v0, &v1, &v2 };
+            for (int i = 0; i < 3; ++i) {
+                const glm::vec4& p = *in[i];
+                const glm::vec4& q = *in[(i + 1) % 3];
+                bool pIn = p.w >= nearW, qIn = q.w >= nearW;
+                if (pIn) out[count++] = p;
+                if (pIn != qIn) out[count++] = glm::mix(p, q, (nearW - p.w) / (q.w - p.w));
+            }
+            if (count >= 3) setup(out[0], out[1], out[2]);
+            if (count == 4) setup(out[0], out[2], out[3]);
+        }
+
+        void rasterizeBand(int rowBegin, int rowEnd) {
+            const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            for (const triangle& t : m_Triangles) {
+                int y0 = std::max(t.minY, rowBegin), y1 = std::min(t.maxY, rowEnd - 1);
+                if (y0 > y1) continue;
+
+                const __m128 a0 = _mm_set1_ps(t.a[0]), a1 = _mm_set1_ps(t.a[1]), a2 = _mm_set1_ps(t.a[2]), zx = _mm_set1_ps(t.zx);
+                const int x0 = t.minX & ~3;
+                for (int y = y0; y <= y1; ++y) {
+                    float py = y + 0.5f;
+                    const __m128 r0 = _mm_set1_ps(t.b[0] * py + t.c[0]);
+                    const __m128 r1 = _mm_set1_ps(t.b[1] * py + t.c[1]);
+                    const __m128 r2 = _mm_set1_ps(t.b[2] * py + t.c[2]);
+                    const __m128 rz = _mm_set1_ps(t.zy * py + t.z0);
+                    float* row = &m_Depth[size_t(y) * width];
+
+                    for (int x = x0; x <= t.maxX; x += 4) {
+                        __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+                        __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+                        __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+                        __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+                        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, _mm_setzero_ps()), _mm_cmpge_ps(e1, _mm_setzero_ps())), _mm_cmpge_ps(e2, _mm_setzero_ps()));
+                        if (_mm_movemask_ps(inside) == 0) continue;
+
+                        __m128 depth = _mm_loadu_ps(row + x);
+                        __m128 z = _mm_max_ps(depth, _mm_add_ps(_mm_mul_ps(zx, px), rz));
+                        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, depth)));
+                    }
+                }
+            }
+
+            for (int ty = rowBegin / OCCLUSION_TILE_SIZE; ty < rowEnd / OCCLUSION_TILE_SIZE; ++ty)
+                for (int tx = 0; tx < tilesX; ++tx) {
+                    float farthest = FLT_MAX;
+                    for (int y = ty * OCCLUSION_TILE_SIZE; y < (ty + 1) * OCCLUSION_TILE_SIZE; ++y) {
+                        const float* row = &m_Depth[size_t(y) * width + tx * OCCLUSION_TILE_SIZE];
+                        for (int x = 0; x < OCCLUSION_TILE_SIZE; ++x) farthest = std::min(farthest, row[x]);
+                    }
+                    m_TileFarthest[size_t(ty) * tilesX + tx] = farthest;
+                }
+        }
+    public:
+        occlusionBuffer()
+            : m_Depth(size_t(width) * height, 0.0f), m_TileFarthest(size_t(tilesX) * tilesY, 0.0f)
+        {
+        }
+
+        // Starts a frame: clears the buffer and the occluder list
+        void begin(const glm::mat4& viewProjection) {
+            m_ViewProjection = viewProjection;
+            m_Triangles.clear();
+            m_Stats = {};
+        }
+
+        // Queues an occluder mesh for rasterize(); both windings are drawn
+        void addOccluder(std::span<const glm::vec3> positions, std::span<const uint32_t> indices, const glm::mat4& model) {
+            const glm::mat4 mvp = m_ViewProjection * model;
+            thread_local std::vector<glm::vec4> clip;
+            clip.resize(positions.size());
+            for (size_t i = 0; i < positions.size(); ++i) clip[i] = mvp * glm::vec4(positions[i], 1.0f);
+
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                const glm::vec4& v0 = clip[indices[i]];
+                const glm::vec4& v1 = clip[indices[i + 1]];
+                const glm::vec4& v2 = clip[indices[i + 2]];
+                if (v0.w < nearW && v1.w < nearW && v2.w < nearW) continue;
+                if (v0.w >= nearW && v1.w >= nearW && v2.w >= nearW) setup(v0, v1, v2);
+                else clipAndSetup(v0, v1, v2);
+            }
+        }
+
+        // Draws the queued occluders, one band of rows per job
+        void rasterize() {
+            auto start = std::chrono::high_resolution_clock::now();
+            std::fill(m_Depth.begin(), m_Depth.end(), 0.0f);
+
+            const int bands = (height + OCCLUSION_BAND_ROWS - 1) / OCCLUSION_BAND_ROWS;
+            jobPool::get().parallelFor(bands, 1, [this](size_t begin, size_t end) {
+                for (size_t band = begin; band < end; ++band)
+                    rasterizeBand(static_cast<int>(band) * OCCLUSION_BAND_ROWS, std::min(height, static_cast<int>(band + 1) * OCCLUSION_BAND_ROWS));
+            });
+
+            m_Stats.occluderTriangles = static_cast<unsigned>(m_Triangles.size());
+            m_Stats.rasterMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // False only when every pixel the box covers has an occluder in front of its nearest
+        // corner. Boxes crossing the near plane are always visible.
+        bool visible(const gl::aabb& box) const {
+            m_Stats.tested++;
+            if (box.empty()) return true;
+
+            glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+            float nearest = 0.0f;
+            for (int i = 0; i < 8; ++i) {
+                glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+                glm::vec4 clip = m_ViewProjection * glm::vec4(corner, 1.0f);
+                if (clip.w < nearW) return true;
+                float inv = 1.0f / clip.w;
+                glm::vec2 screen((clip.x * inv * 0.5f + 0.5f) * width, (clip.y * inv * 0.5f + 0.5f) * height);
+                lo = glm::min(lo, screen);
+                hi = glm::max(hi, screen);
+                nearest = std::max(nearest, inv);
+            }
+
+            int x0 = std::max(0, static_cast<int>(std::floor(lo.x))), x1 = std::min(width - 1, static_cast<int>(std::floor(hi.x)));
+            int y0 = std::max(0, static_cast<int>(std::floor(lo.y))), y1 = std::min(height - 1, static_cast<int>(std::floor(hi.y)));
+            if (x0 > x1 || y0 > y1) return true;    // off screen, the frustum test's call
+
+            for (int ty = y0 / OCCLUSION_TILE_SIZE; ty <= y1 / OCCLUSION_TILE_SIZE; ++ty)
+                for (int tx = x0 / OCCLUSION_TILE_SIZE; tx <= x1 / OCCLUSION_TILE_SIZE; ++tx) {
+                    if (m_TileFarthest[size_t(ty) * tilesX + tx] > nearest) continue;
+
+                    int px0 = std::max(x0, tx * OCCLUSION_TILE_SIZE), px1 = std::min(x1, (tx + 1) * OCCLUSION_TILE_SIZE - 1);
+                    int py0 = std::max(y0, ty * OCCLUSION_TILE_SIZE), py1 = std::min(y1, (ty + 1) * OCCLUSION_TILE_SIZE - 1);
+                    for (int y = py0; y <= py1; ++y) {
+                        const float* row = &m_Depth[size_t(y) * width];
+                        for (int x = px0; x <= px1; ++x)
+                            if (row[x] <= nearest) return true;
+                    }
+                }
+
+            m_Stats.occluded++;
+            return false;
+        }
+
+        // 1/w of the nearest occluder at a pixel, 0 for none
+        const float depth(int x, int y) const { return m_Depth[size_t(y) * width + x]; }
+
+        const occlusionStats& stats() const { return m_Stats; }
+    };
+
+}
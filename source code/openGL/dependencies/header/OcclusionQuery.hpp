@@ -0,0 +1,233 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm.hpp>
+
+#include <Utils.hpp>
+#include <Mesh.hpp>
+#include <StateCache.hpp>
+#include <UniformBuffer.hpp>
+#include <Culling.hpp>
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Query objects kept per box. A result is read back this many frames after it was issued
+// at the latest; one still not available by then is dropped instead of waited on.
+#ifndef OCCLUSION_QUERY_FRAMES
+
+    #define OCCLUSION_QUERY_FRAMES 3
+
+#endif // OCCLUSION_QUERY_FRAMES
+
+// Frames an object can go without a query before its entry and query objects are dropped
+#ifndef OCCLUSION_QUERY_KEEP_FRAMES
+
+    #define OCCLUSION_QUERY_KEEP_FRAMES 60
+
+#endif // OCCLUSION_QUERY_KEEP_FRAMES
+
+namespace gl {
+
+    // Counters for the current frame: queries issued, results that came back (from earlier
+    // frames), and boxes drawn without a query
+    struct occlusionQueryStats {
+        unsigned queries = 0;
+        unsigned visible = 0;
+        unsigned occluded = 0;
+        unsigned skipped = 0;       // camera inside the box, drawn unconditionally
+        unsigned dropped = 0;       // query reused before its result arrived
+    };
+
+    // Read-back results of one object, summed over all of its instances
+    struct objectQueryStats {
+        uint64_t visible = 0;
+        uint64_t occluded = 0;
+        uint64_t lastFrame = 0;     // frame the newest result was issued in
+        bool lastVisible = true;
+    };
+
+    // Hardware occlusion queries on world-space boxes, used by gl::renderQueue for objects with
+    // gl::object::setOcclusionQuery. Each frame the boxes are drawn with color and depth writes
+    // off, each inside its own query, and the objects are then drawn under
+    // glBeginConditionalRender(GL_QUERY_NO_WAIT): the GPU skips an object whose box had no
+    // samples pass, and draws it anyway when the result is not ready yet.
+    //
+    // The CPU never waits. Queries are kept per (object, n-th submission of it in the frame)
+    // in rings of OCCLUSION_QUERY_FRAMES, and beginFrame() only reads the ones whose
+    // GL_QUERY_RESULT_AVAILABLE is set, so stats() trail the GPU by a frame or two.
+    //
+    // Entries are keyed by object address. One not tested for OCCLUSION_QUERY_KEEP_FRAMES is
+    // dropped by beginFrame(), so destroyed objects do not pile up and an object allocated at
+    // a freed address later starts from a clean history; release() drops one at once.
+    class occlusionQueries {
+    private:
+        struct slot {
+            std::array<GLuint, OCCLUSION_QUERY_FRAMES> queries{};
+            std::array<uint64_t, OCCLUSION_QUERY_FRAMES> issued{};     // frame, 0 when idle
+        };
+
+        struct objectSlots {
+            std::vector<slot> slots;
+            uint32_t used = 0;          // this frame
+            uint64_t tested = 0;        // last frame with a query
+            objectQueryStats stats;
+        };
+
+        gl::shader m_Box;
+        GLuint m_EmptyVAO = 0;
+        GLenum m_Target;
+        gl::uniform<glm::vec3> m_BoxMin;
+        gl::uniform<glm::vec3> m_BoxMax;
+
+        std::unordered_map<const gl::object*, objectSlots> m_Objects;
+        uint64_t m_Frame = 0;
+        occlusionQueryStats m_Stats;
+        bool m_CullFace = false;        // restored by endBoxes()
+
+        // Near plane distance of a GL perspective projection, 0 for an orthographic one
+        static float nearPlane(const glm::mat4& projection) {
+            if (projection[3][3] != 0.0f) return 0.0f;
+            return projection[3][2] / (projection[2][2] - 1.0f);
+        }
+
+        void read(objectSlots& object, slot& s, size_t index) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(s.queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) return;
+
+            GLuint passed = 0;
+            glGetQueryObjectuiv(s.queries[index], GL_QUERY_RESULT, &passed);
+            if (passed) {
+                object.stats.visible++;
+                m_Stats.visible++;
+            }
+            else {
+                object.stats.occluded++;
+                m_Stats.occluded++;
+            }
+            if (s.issued[index] >= object.stats.lastFrame) {
+                object.stats.lastFrame = s.issued[index];
+                object.stats.lastVisible = passed != 0;
+            }
+            s.issued[index] = 0;
+        }
+    public:
+        occlusionQueries()
+            : m_Box("resource/shader/bbox_vert.glsl", "resource/shader/bbox_frag.glsl"),
+              m_Target((GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility) ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED),
+              m_BoxMin(m_Box.getProgram(), "boxMin"), m_BoxMax(m_Box.getProgram(), "boxMax")
+        {
+            glGenVertexArrays(1, &m_EmptyVAO);
+        }
+
+        occlusionQueries(const occlusionQueries&) = delete;
+        occlusionQueries& operator=(const occlusionQueries&) = delete;
+
+        ~occlusionQueries() {
+            for (auto& [object, slots] : m_Objects)
+                for (slot& s : slots.slots) glDeleteQueries(OCCLUSION_QUERY_FRAMES, s.queries.data());
+            gl::stateCache& state = gl::stateCache::get();
+            state.vertexArrayDeleted(m_EmptyVAO);
+            glDeleteVertexArrays(1, &m_EmptyVAO);
+            state.programDeleted(m_Box.getProgram());
+            glDeleteProgram(m_Box.getProgram());
+        }
+
+        // Collects whatever results have arrived, drops objects gone untested for
+        // OCCLUSION_QUERY_KEEP_FRAMES and starts a new frame of queries
+        void beginFrame() {
+            m_Frame++;
+            m_Stats = {};
+            for (auto it = m_Objects.begin(); it != m_Objects.end();) {
+                objectSlots& slots = it->second;
+                if (m_Frame - slots.tested > OCCLUSION_QUERY_KEEP_FRAMES) {
+                    for (slot& s : slots.slots) glDeleteQueries(OCCLUSION_QUERY_FRAMES, s.queries.data());
+                    it = m_Objects.erase(it);
+                    continue;
+                }
+                slots.used = 0;
+                for (slot& s : slots.slots)
+                    for (size_t i = 0; i < OCCLUSION_QUERY_FRAMES; ++i)
+                        if (s.issued[i]) read(slots, s, i);
+                ++it;
+            }
+        }
+
+        // Sets up the box pass: the box program, no color or depth writes, no face culling
+        void beginBoxes() {
+            gl::stateCache& state = gl::stateCache::get();
+            state.useProgram(m_Box.getProgram());
+            state.bindVertexArray(m_EmptyVAO);
+            state.depthMask(false);
+            m_CullFace = state.isEnabled(GL_CULL_FACE);
+            state.disable(GL_CULL_FACE);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        }
+
+        void endBoxes() {
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            gl::stateCache& state = gl::stateCache::get();
+            state.depthMask(true);
+            state.setEnabled(GL_CULL_FACE, m_CullFace);
+        }
+
+        // Draws the box inside a query and returns the query to condition the object's draw
+        // on, or 0 when the camera is inside the box (a clipped box would read as occluded).
+        // Call between beginBoxes() and endBoxes().
+        GLuint test(const gl::object& mesh, const gl::aabb& box, const gl::frameData& frame) {
+            // Twice the near distance covers the near plane's corners up to a 90 degree fov
+            const float margin = nearPlane(frame.projection) * 2.0f;
+            if (glm::all(glm::greaterThanEqual(frame.camPos, box.min - margin)) && glm::all(glm::lessThanEqual(frame.camPos, box.max + margin))) {
+                m_Stats.skipped++;
+                return 0;
+            }
+
+            objectSlots& object = m_Objects[&mesh];
+            if (object.used == object.slots.size()) {
+                object.slots.emplace_back();
+                glGenQueries(OCCLUSION_QUERY_FRAMES, object.slots.back().queries.data());
+            }
+            slot& s = object.slots[object.used++];
+            object.tested = m_Frame;
+
+            const size_t index = m_Frame % OCCLUSION_QUERY_FRAMES;
+            if (s.issued[index]) {
+                read(object, s, index);
+                if (s.issued[index]) m_Stats.dropped++;
+            }
+
+            m_BoxMin.upload(box.min);
+            m_BoxMax.upload(box.max);
+            glBeginQuery(m_Target, s.queries[index]);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 14);
+            glEndQuery(m_Target);
+            s.issued[index] = m_Frame;
+            m_Stats.queries++;
+            return s.queries[index];
+        }
+
+        // Forgets an object's queries, e.g. before it is destroyed
+        void release(const gl::object& mesh) {
+            auto it = m_Objects.find(&mesh);
+            if (it == m_Objects.end()) return;
+            for (slot& s : it->second.slots) glDeleteQueries(OCCLUSION_QUERY_FRAMES, s.queries.data());
+            m_Objects.erase(it);
+        }
+
+        // GL_ANY_SAMPLES_PASSED_CONSERVATIVE where available, else GL_ANY_SAMPLES_PASSED
+        const GLenum target() const { return m_Target; }
+
+        const occlusionQueryStats& stats() const { return m_Stats; }
+
+        // Zeroed for objects that never had a query
+        const objectQueryStats stats(const gl::object& mesh) const {
+            auto it = m_Objects.find(&mesh);
+            return it == m_Objects.end() ? objectQueryStats{} : it->second.stats;
+        }
+    };
+
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm.hpp>
+
+#include <Utils.hpp>
+#include <Mesh.hpp>
+#include <StateCache.hpp>
+#include <UniformBuffer.hpp>
+#include <DepthDraws.hpp>
+#include <GpuTimer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace gl {
+
+    enum class prePassMode : uint8_t {
+        Off,
+        On,         // every eligible object, whatever it covers
+        Auto,       // objects covering enough of the screen, while overdraw makes it pay
+    };
+
+    // Counters for the current frame. The measurements come from queries issued a frame or
+    // two ago, each from the newest frame drawn that way.
+    struct prePassStats {
+        bool active = false;                    // this frame drew a pre-pass
+        bool probe = false;                     // drawn the other way than Auto prefers, to measure it
+        unsigned objects = 0;                   // distinct objects in the pre-pass
+        unsigned instances = 0;
+        unsigned draws = 0;
+        float overdraw = 0.0f;                  // opaque fragments shaded per pixel, with the pre-pass
+        float overdrawWithout = 0.0f;           // the same without it
+        double prePassMilliseconds = 0.0;
+        double opaqueMilliseconds = 0.0;        // opaque batches, with the pre-pass
+        double opaqueWithoutMilliseconds = 0.0; // opaque batches, without it
+    };
+
+    // Optional depth pre-pass, used by gl::renderQueue through prePass(). The chosen opaque
+    // items are drawn depth-only first, instanced from the geometry pool's position stream
+    // with color writes off; the main pass then draws them with GL_EQUAL and depth writes
+    // off, so each pixel runs the material shader once. prepass_vert.glsl and vert.glsl
+    // compute an invariant gl_Position the same way, which is what makes EQUAL hold.
+    //
+    // Every measured frame times the opaque batches and counts the samples they shade, which
+    // over the viewport's pixels is the overdraw. In Auto the pre-pass is used while the
+    // overdraw of frames without it reaches setThresholds' minOverdraw, for the objects whose
+    // instances together cover minCoverage of the screen, and only as long as pre-pass plus
+    // opaque time stays under the opaque time without it. Every probe interval one frame is
+    // drawn the other way, so both measurements stay current.
+    class depthPrePass {
+    private:
+        // Kept beside each of the timer's sets. With the pre-pass timed the set's marks are
+        // pre-pass start and end, then opaque start and end; without it only the last two.
+        struct measurement {
+            GLuint samples = 0;
+            bool withPrePass = false;
+            bool prePassTimed = false;
+            double pixels = 1.0;
+        };
+
+        gl::depthDraws m_Draws{ "resource/shader/prepass_vert.glsl" };
+        gl::gpuTimer m_Timer;
+        std::array<measurement, GPU_TIMER_FRAMES> m_Measurements;
+        bool m_Measured = false;        // this frame
+        bool m_PrePassTimed = false;    // this frame
+        bool m_Measuring = false;
+
+        prePassMode m_Mode = prePassMode::Auto;
+        float m_MinCoverage = 0.02f;
+        float m_MinOverdraw = 1.5f;
+        unsigned m_ProbeInterval = 60;
+
+        bool m_Active = false;
+        uint64_t m_Frame = 0;
+        bool m_MeasuredWith = false, m_MeasuredWithout = false;
+
+        std::unordered_map<const gl::object*, float> m_Coverage;
+        std::vector<gl::depthInstance> m_Instances;
+        std::vector<float> m_Distances;
+        std::vector<uint32_t> m_Order;
+        prePassStats m_Stats;
+
+        // Collects the measurements that arrived. The samples query ended before the set's last
+        // timestamp, so its result is there once the timestamps are.
+        void poll() {
+            m_Timer.poll([&](size_t slot, std::span<const GLuint64> stamps) {
+                const measurement& q = m_Measurements[slot];
+                GLuint64 samples = 0;
+                glGetQueryObjectui64v(q.samples, GL_QUERY_RESULT, &samples);
+                const GLuint64 opaque = stamps[stamps.size() - 1] - stamps[stamps.size() - 2];
+                const GLuint64 prePass = q.prePassTimed ? stamps[1] - stamps[0] : 0;
+                const float overdraw = static_cast<float>(double(samples) / q.pixels);
+                if (q.withPrePass) {
+                    m_Stats.overdraw = overdraw;
+                    m_Stats.opaqueMilliseconds = double(opaque) / 1.0e6;
+                    m_Stats.prePassMilliseconds = double(prePass) / 1.0e6;
+                    m_MeasuredWith = true;
+                }
+                else {
+                    m_Stats.overdrawWithout = overdraw;
+                    m_Stats.opaqueWithoutMilliseconds = double(opaque) / 1.0e6;
+                    m_MeasuredWithout = true;
+                }
+            });
+        }
+
+        // Auto's choice before probing: nothing until a frame without the pre-pass was
+        // measured, then the overdraw and time tests
+        bool preferred() const {
+            if (!m_MeasuredWithout || m_Stats.overdrawWithout < m_MinOverdraw) return false;
+            return !m_MeasuredWith || m_Stats.prePassMilliseconds + m_Stats.opaqueMilliseconds <= m_Stats.opaqueWithoutMilliseconds;
+        }
+    public:
+        depthPrePass() {
+            for (measurement& q : m_Measurements) glGenQueries(1, &q.samples);
+        }
+
+        ~depthPrePass() {
+            for (measurement& q : m_Measurements) glDeleteQueries(1, &q.samples);
+        }
+
+        depthPrePass(const depthPrePass&) = delete;
+        depthPrePass& operator=(const depthPrePass&) = delete;
+
+        void setMode(prePassMode mode) { m_Mode = mode; }
+
+        const prePassMode getMode() const { return m_Mode; }
+
+        // Auto only: the share of the screen an object's instances must cover together, and
+        // the overdraw a frame without the pre-pass must show
+        void setThresholds(float minCoverage, float minOverdraw) {
+            m_MinCoverage = minCoverage;
+            m_MinOverdraw = minOverdraw;
+        }
+
+        // Auto only: frames between two drawn the other way; 0 never probes
+        void setProbeInterval(unsigned frames) { m_ProbeInterval = frames; }
+
+        // Share of the viewport a sphere around the instance covers, from its distance to the
+        // camera; 1 once the camera is inside it
+        static float coverage(const gl::object& mesh, const glm::mat4& model, const gl::frameData& frame) {
+            const gl::boundingSphere& sphere = mesh.getSphere();
+            const float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+            const float radius = sphere.radius * scale;
+            const float distance = glm::length(glm::vec3(model * glm::vec4(sphere.center, 1.0f)) - frame.camPos);
+            if (distance <= radius) return 1.0f;
+            const float r = radius / distance;
+            return std::min(3.14159265f * r * r * std::abs(frame.projection[0][0] * frame.projection[1][1]) * 0.25f, 1.0f);
+        }
+
+        // Reads the measurements that arrived and decides whether this frame draws a pre-pass.
+        // Returns false when the mode is Off or the frame is not `allowed`; it is then neither
+        // drawn nor measured.
+        bool beginFrame(bool allowed) {
+            m_Stats.active = m_Stats.probe = false;
+            m_Stats.objects = m_Stats.instances = m_Stats.draws = 0;
+            m_Instances.clear();
+            m_Coverage.clear();
+            m_Active = false;
+            m_Measured = allowed && m_Mode != prePassMode::Off;
+            if (!m_Measured) return false;
+
+            poll();
+            m_PrePassTimed = false;
+            m_Frame++;
+            if (m_Mode == prePassMode::On) m_Active = true;
+            else {
+                const bool prefer = preferred();
+                // Probing the pre-pass is pointless while overdraw rules it out
+                const bool worthProbing = prefer || (m_MeasuredWithout && m_Stats.overdrawWithout >= m_MinOverdraw);
+                m_Stats.probe = worthProbing && m_ProbeInterval && m_Frame % m_ProbeInterval == 0;
+                m_Active = prefer != m_Stats.probe;
+            }
+            return true;
+        }
+
+        void addCoverage(const gl::object* mesh, float coverage) {
+            if (m_Active && m_Mode == prePassMode::Auto) m_Coverage[mesh] += coverage;
+        }
+
+        // After every addCoverage of the frame
+        bool wants(const gl::object* mesh) const {
+            if (!m_Active) return false;
+            if (m_Mode == prePassMode::On) return true;
+            auto it = m_Coverage.find(mesh);
+            return it != m_Coverage.end() && it->second >= m_MinCoverage;
+        }
+
+        void add(gl::object* mesh, const glm::mat4& model) { m_Instances.push_back({ mesh, model }); }
+
+        // Draws the added instances' depth into the bound framebuffer with the current depth
+        // test, runs of one mesh nearest first. Color writes are restored after.
+        void render(const gl::frameData& frame) {
+            m_Stats.active = m_Active;
+            if (!m_Active || m_Instances.empty()) return;
+
+            m_Distances.resize(m_Instances.size());
+            m_Order.resize(m_Instances.size());
+            for (uint32_t i = 0; i < m_Instances.size(); ++i) {
+                m_Distances[i] = glm::length(glm::vec3(m_Instances[i].model[3]) - frame.camPos);
+                m_Order[i] = i;
+            }
+            std::sort(m_Order.begin(), m_Order.end(), [&](uint32_t a, uint32_t b) {
+                if (m_Instances[a].mesh != m_Instances[b].mesh) return m_Instances[a].mesh < m_Instances[b].mesh;
+                return m_Distances[a] < m_Distances[b];
+            });
+            for (size_t i = 1; i < m_Order.size(); ++i)
+                if (m_Instances[m_Order[i]].mesh != m_Instances[m_Order[i - 1]].mesh) m_Stats.objects++;
+            m_Stats.objects++;
+
+            m_Draws.clear();
+            const gl::depthDraws::range all = m_Draws.collect(m_Instances, m_Order);
+            m_Draws.upload();
+
+            m_PrePassTimed = m_Timer.begin();
+
+            GLboolean colorMask[4];
+            glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            gl::stateCache& state = gl::stateCache::get();
+            state.disable(GL_BLEND);
+            state.depthMask(true);
+            m_Draws.begin();
+            m_Draws.draw(all, m_Stats.draws, m_Stats.instances);
+            glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+
+            if (m_PrePassTimed) m_Timer.mark();
+        }
+
+        // Around the opaque batches of a measured frame; the queried items and the deferred
+        // lighting stay outside, their queries would overlap
+        void beginOpaque() {
+            m_Measuring = m_Measured && (m_PrePassTimed || m_Timer.ready());
+            if (!m_Measuring) return;
+            if (m_PrePassTimed) m_Timer.mark();
+            else m_Timer.begin();
+
+            measurement& q = m_Measurements[m_Timer.slot()];
+            GLint viewport[4], samples = 0;
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glGetIntegerv(GL_SAMPLES, &samples);
+            q.pixels = std::max(double(viewport[2]) * double(viewport[3]) * double(std::max(samples, 1)), 1.0);
+            q.withPrePass = m_Active;
+            q.prePassTimed = m_PrePassTimed;
+            glBeginQuery(GL_SAMPLES_PASSED, q.samples);
+        }
+
+        void endOpaque() {
+            if (!m_Measuring) return;
+            glEndQuery(GL_SAMPLES_PASSED);
+            m_Timer.end();
+            m_Measuring = false;
+        }
+
+        // Whether this frame draws a pre-pass, from beginFrame
+        const bool active() const { return m_Active; }
+
+        const prePassStats& stats() const { return m_Stats; }
+    };
+
+}
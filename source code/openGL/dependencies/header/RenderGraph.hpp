@@ -0,0 +1,661 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <Utils.hpp>
+#include <StateCache.hpp>
+#include <GpuTimer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Frames a pooled target may sit unused before it is freed, so a resize or a shading mode
+// switched back and forth does not reallocate
+#ifndef RENDER_GRAPH_KEEP_FRAMES
+
+    #define RENDER_GRAPH_KEEP_FRAMES 60
+
+#endif // RENDER_GRAPH_KEEP_FRAMES
+
+namespace gl {
+
+    // A 2D target the graph allocates
+    struct textureDesc {
+        int width = 0, height = 0;
+        GLenum format = GL_RGBA8;
+
+        bool operator==(const textureDesc&) const = default;
+
+        // Bytes per texel of the formats render targets use
+        static unsigned texelBytes(GLenum format) {
+            switch (format) {
+            case GL_R8: return 1;
+            case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16: return 2;
+            case GL_RGBA16F: case GL_RG32F: case GL_RG32UI: return 8;
+            case GL_RGBA32F: case GL_RGBA32UI: return 16;
+            case GL_DEPTH32F_STENCIL8: return 8;
+            default: return 4;
+            }
+        }
+
+        const uint64_t bytes() const { return uint64_t(std::max(width, 0)) * uint64_t(std::max(height, 0)) * texelBytes(format); }
+    };
+
+    // How a pass touches a resource. Image and Storage writes are incoherent, so a later pass
+    // reading the resource gets the glMemoryBarrier bit of its own access first.
+    enum class graphAccess : uint8_t {
+        Attachment,     // render target
+        Sampled,        // texture lookups
+        Image,          // image load/store
+        Uniform,        // uniform buffer
+        Storage,        // shader storage buffer
+        Indirect,       // draw or dispatch arguments
+        Vertex,         // vertex attributes
+    };
+
+    // One pass of the compiled graph, for inspection
+    struct renderGraphPass {
+        std::string name;
+        bool culled = false;                // nothing alive reads what it writes
+        std::vector<std::string> reads, writes;
+        std::string target;                 // attachments or imported framebuffer, empty if it keeps the bound one
+        bool framebufferSwitch = false;     // the graph bound a different framebuffer for it
+        GLbitfield barrier = 0;             // glMemoryBarrier issued before it
+        double gpuMilliseconds = 0.0;       // newest result for a pass of this name
+    };
+
+    struct renderGraphStats {
+        unsigned passes = 0;
+        unsigned culled = 0;
+        unsigned transients = 0;            // transient targets declared
+        unsigned textures = 0;              // pooled targets they were given
+        unsigned framebufferSwitches = 0;
+        unsigned barriers = 0;
+        uint64_t transientBytes = 0;        // the transients, each in its own target
+        uint64_t aliasedBytes = 0;          // the targets they shared after aliasing
+        uint64_t pooledBytes = 0;           // the whole pool, idle targets included
+        double compileMilliseconds = 0.0;
+    };
+
+    // Declarative frame graph. Each frame passes are added with a setup function, which
+    // declares what the pass reads and writes through a builder, and an execute function,
+    // which draws. compile() then
+    //   - culls passes whose writes nothing alive reads; passes that write an imported
+    //     resource, or declare a side effect, are what the frame is for
+    //   - orders the rest topologically, from the dependencies their declaration order
+    //     implies, preferring among the ready passes one with the render target already bound
+    //   - gives every transient target a pooled texture for its lifetime, from its first to
+    //     its last use; targets with the same description and disjoint lifetimes alias
+    //   - places the fewest glMemoryBarrier calls that make every Image or Storage write
+    //     visible to the later passes reading it, each with the bits of their accesses
+    // and execute() runs the passes, binding a pass's framebuffer (cached per attachment set)
+    // only when it differs from the bound one and clearing the attachments declared cleared.
+    // The viewport is the caller's throughout; passes that change it restore it.
+    //
+    // Every pass is bracketed by gl::gpuTimer marks (timestamps, so the timers passes use
+    // themselves run inside them), read a frame or two later without waiting. passes(),
+    // stats() and describe() show the compiled graph of the last frame.
+    class renderGraph {
+    public:
+        struct resource {
+            uint32_t id = UINT32_MAX;
+
+            const bool valid() const { return id != UINT32_MAX; }
+        };
+
+    private:
+        enum class resourceKind : uint8_t { Transient, Texture, Framebuffer, Buffer };
+
+        struct resourceNode {
+            std::string name;
+            resourceKind kind;
+            textureDesc desc;
+            GLuint object = 0;                  // imported, or the pooled texture once compiled
+            uint32_t first = UINT32_MAX;        // execution positions of its first and last use
+            uint32_t last = 0;
+        };
+
+        struct use {
+            uint32_t resource;
+            graphAccess access;
+            bool write;
+            bool load;                          // a write that keeps the previous contents
+        };
+
+        struct attachment {
+            uint32_t resource;
+            GLenum point;
+            bool clear;
+        };
+
+        struct passNode {
+            std::string name;
+            std::vector<use> uses;
+            std::vector<attachment> attachments;
+            uint32_t framebuffer = UINT32_MAX;  // imported framebuffer it draws to
+            bool sideEffect = false;
+            bool alive = false;
+            std::vector<uint32_t> needs;        // earlier passes whose writes it reads
+            std::vector<uint32_t> after;        // earlier passes it must follow
+            std::function<void()> execute;
+        };
+
+        struct pooledTexture {
+            textureDesc desc;
+            GLuint texture = 0;
+            uint64_t lastFrame = 0;
+            bool inUse = false;
+        };
+
+        std::vector<resourceNode> m_Resources;
+        std::vector<passNode> m_Passes;
+        std::vector<uint32_t> m_Order;          // alive passes, execution order
+        std::vector<GLbitfield> m_Barriers;     // issued before each of them
+        std::unordered_map<std::string, GLbitfield> m_Synced;  // imported resources written incoherently: bits issued since
+
+        std::vector<pooledTexture> m_Pool;
+        std::map<std::vector<std::pair<GLenum, GLuint>>, GLuint> m_Framebuffers;
+
+        gl::gpuTimer m_Timer;                   // a mark before every pass and one after the last
+        std::array<std::vector<std::string>, GPU_TIMER_FRAMES> m_TimedNames;   // per timer set
+        std::unordered_map<std::string, double> m_Timings;
+
+        std::vector<renderGraphPass> m_Compiled;
+        renderGraphStats m_Stats;
+        uint64_t m_Frame = 0;
+        bool m_Ready = false;
+
+        static GLbitfield barrierBit(graphAccess access) {
+            switch (access) {
+            case graphAccess::Attachment: return GL_FRAMEBUFFER_BARRIER_BIT;
+            case graphAccess::Sampled: return GL_TEXTURE_FETCH_BARRIER_BIT;
+            case graphAccess::Image: return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+            case graphAccess::Uniform: return GL_UNIFORM_BARRIER_BIT;
+            case graphAccess::Storage: return GL_SHADER_STORAGE_BARRIER_BIT;
+            case graphAccess::Indirect: return GL_COMMAND_BARRIER_BIT;
+            case graphAccess::Vertex: return GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT;
+            }
+            return 0;
+        }
+
+        static bool incoherent(graphAccess access) { return access == graphAccess::Image || access == graphAccess::Storage; }
+
+        uint32_t addResource(const char* name, resourceKind kind, GLuint object, const textureDesc& desc) {
+            m_Resources.push_back({ name, kind, desc, object });
+            return static_cast<uint32_t>(m_Resources.size() - 1);
+        }
+
+        // What a pass renders to, comparable between passes; empty when it keeps the bound one
+        std::vector<std::pair<GLenum, GLuint>> targetKey(const passNode& pass) const {
+            std::vector<std::pair<GLenum, GLuint>> key;
+            if (pass.framebuffer != UINT32_MAX) key.push_back({ GL_FRAMEBUFFER, pass.framebuffer });
+            for (const attachment& a : pass.attachments) key.push_back({ a.point, a.resource });
+            return key;
+        }
+
+        GLuint framebufferFor(const passNode& pass) {
+            if (pass.framebuffer != UINT32_MAX) return m_Resources[pass.framebuffer].object;
+
+            std::vector<std::pair<GLenum, GLuint>> key;
+            for (const attachment& a : pass.attachments) key.push_back({ a.point, m_Resources[a.resource].object });
+            std::sort(key.begin(), key.end());
+            auto it = m_Framebuffers.find(key);
+            if (it != m_Framebuffers.end()) return it->second;
+
+            GLuint fbo;
+            glGenFramebuffers(1, &fbo);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+            // Draw buffer i is color attachment i, which is what the clears in execute() index
+            std::vector<GLenum> buffers;
+            for (const auto& [point, texture] : key) {
+                glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, point, GL_TEXTURE_2D, texture, 0);
+                if (point < GL_COLOR_ATTACHMENT0 || point > GL_COLOR_ATTACHMENT15) continue;
+                const size_t index = point - GL_COLOR_ATTACHMENT0;
+                if (buffers.size() <= index) buffers.resize(index + 1, GL_NONE);
+                buffers[index] = point;
+            }
+            if (buffers.empty()) glDrawBuffer(GL_NONE);
+            else glDrawBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+            if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                throw std::runtime_error("render graph framebuffer for \"" + pass.name + "\" incomplete");
+            m_Framebuffers.emplace(std::move(key), fbo);
+            return fbo;
+        }
+
+        GLuint acquire(const textureDesc& desc) {
+            for (pooledTexture& p : m_Pool)
+                if (!p.inUse && p.desc == desc) {
+                    p.inUse = true;
+                    p.lastFrame = m_Frame;
+                    return p.texture;
+                }
+
+            GLuint texture;
+            glGenTextures(1, &texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_2D, texture);
+            gl::textureStorage2D(GL_TEXTURE_2D, desc.format, desc.width, desc.height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            m_Pool.push_back({ desc, texture, m_Frame, true });
+            return texture;
+        }
+
+        void release(GLuint texture) {
+            for (pooledTexture& p : m_Pool)
+                if (p.texture == texture) p.inUse = false;
+        }
+
+        void destroyTexture(GLuint texture) {
+            for (auto it = m_Framebuffers.begin(); it != m_Framebuffers.end();) {
+                bool uses = false;
+                for (const auto& [point, attached] : it->first) uses |= attached == texture;
+                if (uses) {
+                    glDeleteFramebuffers(1, &it->second);
+                    it = m_Framebuffers.erase(it);
+                }
+                else ++it;
+            }
+            gl::stateCache::get().textureDeleted(texture);
+            glDeleteTextures(1, &texture);
+        }
+
+        // Reads the timestamp sets that arrived
+        void pollTimings() {
+            m_Timer.poll([&](size_t slot, std::span<const GLuint64> stamps) {
+                const std::vector<std::string>& names = m_TimedNames[slot];
+                for (size_t i = 0; i < names.size(); ++i) m_Timings[names[i]] = double(stamps[i + 1] - stamps[i]) / 1.0e6;
+            });
+        }
+
+    public:
+        // Declares what one pass touches, during its setup
+        class builder {
+        private:
+            renderGraph& m_Graph;
+            passNode& m_Pass;
+
+            void add(resource r, graphAccess access, bool write, bool load) {
+                if (!r.valid()) throw std::runtime_error("render graph pass \"" + m_Pass.name + "\" uses an invalid resource");
+                m_Pass.uses.push_back({ r.id, access, write, load });
+            }
+        public:
+            builder(renderGraph& graph, passNode& pass) : m_Graph(graph), m_Pass(pass) {}
+
+            resource create(const char* name, const textureDesc& desc) { return m_Graph.create(name, desc); }
+
+            void read(resource r, graphAccess access = graphAccess::Sampled) { add(r, access, false, false); }
+
+            // Through shaders or copies; `load` keeps what earlier passes wrote
+            void write(resource r, graphAccess access, bool load = true) { add(r, access, true, load); }
+
+            // Color attachment `index`, cleared to zero or loaded; not written when only bound
+            // for the pass to read, e.g. by a copy
+            void color(resource r, uint32_t index, bool clear, bool written = true) {
+                if (written) add(r, graphAccess::Attachment, true, !clear);
+                else add(r, graphAccess::Attachment, false, false);
+                m_Pass.attachments.push_back({ r.id, GL_COLOR_ATTACHMENT0 + index, clear });
+            }
+
+            // Depth attachment, cleared to 1 or loaded; not written when only tested against
+            // or read
+            void depth(resource r, bool clear, bool written = true) {
+                if (written) add(r, graphAccess::Attachment, true, !clear);
+                else add(r, graphAccess::Attachment, false, false);
+                m_Pass.attachments.push_back({ r.id, GL_DEPTH_ATTACHMENT, clear });
+            }
+
+            // Draws into an imported framebuffer, keeping its contents, or only reads it bound
+            void target(resource framebuffer, bool written = true) {
+                add(framebuffer, graphAccess::Attachment, written, written);
+                m_Pass.framebuffer = framebuffer.id;
+            }
+
+            // Kept even when nothing reads what it writes
+            void sideEffect() { m_Pass.sideEffect = true; }
+        };
+
+        renderGraph() = default;
+
+        renderGraph(const renderGraph&) = delete;
+        renderGraph& operator=(const renderGraph&) = delete;
+
+        ~renderGraph() {
+            for (const auto& [key, fbo] : m_Framebuffers) glDeleteFramebuffers(1, &fbo);
+            for (const pooledTexture& p : m_Pool) {
+                gl::stateCache::get().textureDeleted(p.texture);
+                glDeleteTextures(1, &p.texture);
+            }
+        }
+
+        // Starts a new frame's declarations; the pool, framebuffers and timings stay
+        void reset() {
+            m_Resources.clear();
+            m_Passes.clear();
+            m_Order.clear();
+            m_Ready = false;
+        }
+
+        // A transient target, alive from its first use to its last, in the pool meanwhile
+        resource create(const char* name, const textureDesc& desc) {
+            return { addResource(name, resourceKind::Transient, 0, desc) };
+        }
+
+        resource importTexture(const char* name, GLuint texture, const textureDesc& desc = {}) {
+            return { addResource(name, resourceKind::Texture, texture, desc) };
+        }
+
+        resource importFramebuffer(const char* name, GLuint framebuffer) {
+            return { addResource(name, resourceKind::Framebuffer, framebuffer, {}) };
+        }
+
+        // Buffers, or CPU-side state uploaded by a pass, which only order the passes
+        resource importBuffer(const char* name, GLuint buffer = 0) {
+            return { addResource(name, resourceKind::Buffer, buffer, {}) };
+        }
+
+        // setup(builder&) runs now, execute() during execute()
+        template<typename S>
+        void addPass(const char* name, S setup, std::function<void()> execute) {
+            passNode& pass = m_Passes.emplace_back();
+            pass.name = name;
+            pass.execute = std::move(execute);
+            builder b(*this, pass);
+            setup(b);
+        }
+
+        void compile() {
+            auto start = std::chrono::high_resolution_clock::now();
+            m_Frame++;
+            m_Stats = {};
+            m_Stats.passes = static_cast<unsigned>(m_Passes.size());
+
+            // Dependencies in declaration order: reads follow the last write, writes follow the
+            // last write and the reads since
+            std::vector<uint32_t> lastWriter(m_Resources.size(), UINT32_MAX);
+            std::vector<std::vector<uint32_t>> readers(m_Resources.size());
+            for (uint32_t p = 0; p < m_Passes.size(); ++p) {
+                passNode& pass = m_Passes[p];
+                for (const use& u : pass.uses) {
+                    const uint32_t writer = lastWriter[u.resource];
+                    if ((!u.write || u.load) && writer != UINT32_MAX && writer != p) pass.needs.push_back(writer);
+                    if (writer != UINT32_MAX && writer != p) pass.after.push_back(writer);
+                    if (u.write) {
+                        for (uint32_t r : readers[u.resource])
+                            if (r != p) pass.after.push_back(r);
+                    }
+                }
+                for (const use& u : pass.uses) {
+                    if (u.write) {
+                        lastWriter[u.resource] = p;
+                        readers[u.resource].clear();
+                    }
+                    else readers[u.resource].push_back(p);
+                }
+            }
+
+            // Cull backwards from what the frame is for
+            for (uint32_t p = static_cast<uint32_t>(m_Passes.size()); p-- > 0;) {
+                passNode& pass = m_Passes[p];
+                if (pass.sideEffect) pass.alive = true;
+                for (const use& u : pass.uses)
+                    if (u.write && m_Resources[u.resource].kind != resourceKind::Transient) pass.alive = true;
+                if (!pass.alive) continue;
+                for (uint32_t n : pass.needs) m_Passes[n].alive = true;
+            }
+
+            // Kahn's algorithm; among the ready passes the one drawing where the last one did
+            // goes first, then declaration order
+            std::vector<unsigned> blockers(m_Passes.size(), 0);
+            std::vector<std::vector<uint32_t>> unblocks(m_Passes.size());
+            for (uint32_t p = 0; p < m_Passes.size(); ++p) {
+                if (!m_Passes[p].alive) continue;
+                std::vector<uint32_t> after = m_Passes[p].after;
+                std::sort(after.begin(), after.end());
+                after.erase(std::unique(after.begin(), after.end()), after.end());
+                for (uint32_t a : after) {
+                    if (!m_Passes[a].alive) continue;
+                    blockers[p]++;
+                    unblocks[a].push_back(p);
+                }
+            }
+            std::vector<uint32_t> ready;
+            for (uint32_t p = 0; p < m_Passes.size(); ++p)
+                if (m_Passes[p].alive && !blockers[p]) ready.push_back(p);
+            std::vector<std::vector<std::pair<GLenum, GLuint>>> keys(m_Passes.size());
+            for (uint32_t p = 0; p < m_Passes.size(); ++p) keys[p] = targetKey(m_Passes[p]);
+            std::vector<std::pair<GLenum, GLuint>> bound;
+            auto drawsWhereBound = [&](uint32_t p) { return !keys[p].empty() && keys[p] == bound; };
+            while (!ready.empty()) {
+                size_t pick = 0;
+                for (size_t i = 1; i < ready.size(); ++i) {
+                    const bool same = drawsWhereBound(ready[i]), pickSame = drawsWhereBound(ready[pick]);
+                    if (same != pickSame ? same : ready[i] < ready[pick]) pick = i;
+                }
+                const uint32_t p = ready[pick];
+                ready.erase(ready.begin() + pick);
+                m_Order.push_back(p);
+                if (!keys[p].empty()) bound = keys[p];
+                for (uint32_t n : unblocks[p])
+                    if (--blockers[n] == 0) ready.push_back(n);
+            }
+
+            // Lifetimes, then pooled targets handed out and taken back in execution order
+            for (uint32_t position = 0; position < m_Order.size(); ++position)
+                for (const use& u : m_Passes[m_Order[position]].uses) {
+                    resourceNode& r = m_Resources[u.resource];
+                    r.first = std::min(r.first, position);
+                    r.last = std::max(r.last, position);
+                }
+            std::vector<GLuint> given;
+            for (uint32_t position = 0; position < m_Order.size(); ++position) {
+                for (resourceNode& r : m_Resources)
+                    if (r.kind == resourceKind::Transient && r.first == position) {
+                        r.object = acquire(r.desc);
+                        m_Stats.transients++;
+                        m_Stats.transientBytes += r.desc.bytes();
+                        if (std::find(given.begin(), given.end(), r.object) == given.end()) {
+                            given.push_back(r.object);
+                            m_Stats.aliasedBytes += r.desc.bytes();
+                        }
+                    }
+                for (resourceNode& r : m_Resources)
+                    if (r.kind == resourceKind::Transient && r.first != UINT32_MAX && r.last == position) release(r.object);
+            }
+            m_Stats.textures = static_cast<unsigned>(given.size());
+
+            // Every read of an incoherent write needs its access's bit in a barrier somewhere
+            // between the two. Placing each at the end of the earliest span still open lets one
+            // barrier serve every span it falls in. An imported resource written after its
+            // last read is expected to be read the same ways next frame, so a span to the end
+            // of the frame lets a late barrier take those bits too; what is still owed is
+            // carried into the next frame's graph, by name.
+            struct span {
+                uint32_t first, last;
+                GLbitfield bits;
+            };
+            std::vector<span> spans;
+            const int64_t none = -2;
+            std::vector<int64_t> written(m_Resources.size(), none);
+            std::vector<GLbitfield> synced(m_Resources.size(), 0), readAs(m_Resources.size(), 0);
+            for (uint32_t r = 0; r < m_Resources.size(); ++r) {
+                auto it = m_Resources[r].kind == resourceKind::Transient ? m_Synced.end() : m_Synced.find(m_Resources[r].name);
+                if (it == m_Synced.end()) continue;
+                written[r] = -1;
+                synced[r] = it->second;
+            }
+            for (uint32_t position = 0; position < m_Order.size(); ++position) {
+                const passNode& pass = m_Passes[m_Order[position]];
+                for (const use& u : pass.uses) {
+                    if (u.write && !u.load) continue;
+                    const GLbitfield bit = barrierBit(u.access);
+                    readAs[u.resource] |= bit;
+                    if (written[u.resource] == none || (synced[u.resource] & bit)) continue;
+                    spans.push_back({ static_cast<uint32_t>(written[u.resource] + 1), position, bit });
+                    synced[u.resource] |= bit;
+                }
+                for (const use& u : pass.uses)
+                    if (u.write && incoherent(u.access)) {
+                        written[u.resource] = position;
+                        synced[u.resource] = 0;
+                    }
+            }
+            for (uint32_t r = 0; r < m_Resources.size(); ++r) {
+                if (written[r] == none || m_Resources[r].kind == resourceKind::Transient) continue;
+                const GLbitfield owed = readAs[r] & ~synced[r];
+                if (owed && written[r] + 1 < int64_t(m_Order.size())) {
+                    spans.push_back({ static_cast<uint32_t>(written[r] + 1), static_cast<uint32_t>(m_Order.size() - 1), owed });
+                    synced[r] |= owed;
+                }
+                m_Synced[m_Resources[r].name] = synced[r];
+            }
+
+            std::sort(spans.begin(), spans.end(), [](const span& a, const span& b) { return a.last < b.last; });
+            m_Barriers.assign(m_Order.size(), 0);
+            int64_t placed = -1;
+            for (const span& sp : spans) {
+                if (placed < int64_t(sp.first)) placed = sp.last;
+                m_Barriers[placed] |= sp.bits;
+            }
+
+            // Targets idle for too long go
+            for (size_t i = 0; i < m_Pool.size();) {
+                if (!m_Pool[i].inUse && m_Frame - m_Pool[i].lastFrame > RENDER_GRAPH_KEEP_FRAMES) {
+                    destroyTexture(m_Pool[i].texture);
+                    m_Pool.erase(m_Pool.begin() + i);
+                }
+                else m_Stats.pooledBytes += m_Pool[i++].desc.bytes();
+            }
+
+            m_Compiled.clear();
+            auto describePass = [&](const passNode& pass, bool culled) {
+                renderGraphPass info;
+                info.name = pass.name;
+                info.culled = culled;
+                for (const use& u : pass.uses) (u.write ? info.writes : info.reads).push_back(m_Resources[u.resource].name);
+                if (pass.framebuffer != UINT32_MAX) info.target = m_Resources[pass.framebuffer].name;
+                for (const attachment& a : pass.attachments) info.target += (info.target.empty() ? "" : "+") + m_Resources[a.resource].name;
+                auto timing = m_Timings.find(pass.name);
+                if (timing != m_Timings.end()) info.gpuMilliseconds = timing->second;
+                m_Compiled.push_back(std::move(info));
+            };
+            for (uint32_t position = 0; position < m_Order.size(); ++position) {
+                describePass(m_Passes[m_Order[position]], false);
+                m_Compiled.back().barrier = m_Barriers[position];
+            }
+            for (const passNode& pass : m_Passes)
+                if (!pass.alive) {
+                    describePass(pass, true);
+                    m_Stats.culled++;
+                }
+
+            m_Ready = true;
+            m_Stats.compileMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // Runs the compiled passes and rebinds the draw framebuffer found bound
+        void execute() {
+            if (!m_Ready) compile();
+            pollTimings();
+
+            GLint previous = 0;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+            GLuint bound = static_cast<GLuint>(previous);
+
+            const bool timed = m_Timer.ready();
+            std::vector<std::string>& names = m_TimedNames[m_Timer.slot()];
+            if (timed) names.clear();
+
+            for (uint32_t position = 0; position < m_Order.size(); ++position) {
+                passNode& pass = m_Passes[m_Order[position]];
+                renderGraphPass& info = m_Compiled[position];
+
+                if (m_Barriers[position]) {
+                    glMemoryBarrier(m_Barriers[position]);
+                    m_Stats.barriers++;
+                }
+
+                if (pass.framebuffer != UINT32_MAX || !pass.attachments.empty()) {
+                    // A framebuffer created here is new, so it differs from the bound one too
+                    const GLuint fbo = framebufferFor(pass);
+                    if (fbo != bound) {
+                        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+                        bound = fbo;
+                        info.framebufferSwitch = true;
+                        m_Stats.framebufferSwitches++;
+                    }
+                    for (const attachment& a : pass.attachments) {
+                        if (!a.clear) continue;
+                        if (a.point == GL_DEPTH_ATTACHMENT) {
+                            const GLfloat far = 1.0f;
+                            gl::stateCache::get().depthMask(true);
+                            glClearBufferfv(GL_DEPTH, 0, &far);
+                        }
+                        else {
+                            const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                            glClearBufferfv(GL_COLOR, static_cast<GLint>(a.point - GL_COLOR_ATTACHMENT0), zero);
+                        }
+                    }
+                }
+
+                if (timed) {
+                    if (names.empty()) m_Timer.begin();
+                    else m_Timer.mark();
+                    names.push_back(pass.name);
+                }
+                pass.execute();
+            }
+
+            if (timed && !names.empty()) m_Timer.end();
+            if (bound != static_cast<GLuint>(previous)) glBindFramebuffer(GL_DRAW_FRAMEBUFFER, static_cast<GLuint>(previous));
+        }
+
+        // The texture a transient got, or an imported object; valid from compile() until reset()
+        const GLuint texture(resource r) const { return m_Resources[r.id].object; }
+
+        const textureDesc& desc(resource r) const { return m_Resources[r.id].desc; }
+
+        // Execution order, then the culled passes
+        const std::vector<renderGraphPass>& passes() const { return m_Compiled; }
+
+        const renderGraphStats& stats() const { return m_Stats; }
+
+        // One line per pass plus the memory footprint
+        std::string describe() const {
+            std::string text;
+            char line[256];
+            for (const renderGraphPass& pass : m_Compiled) {
+                std::snprintf(line, sizeof(line), "%-20s %-7s %6.3f ms%s  -> %s", pass.name.c_str(), pass.culled ? "culled" : "", pass.gpuMilliseconds,
+                    pass.framebufferSwitch ? "  [bind]" : "", pass.target.empty() ? "-" : pass.target.c_str());
+                text += line;
+                if (pass.barrier) {
+                    std::snprintf(line, sizeof(line), "  [barrier 0x%x]", pass.barrier);
+                    text += line;
+                }
+                text += "\n    reads:";
+                for (const std::string& r : pass.reads) text += " " + r;
+                text += "\n    writes:";
+                for (const std::string& w : pass.writes) text += " " + w;
+                text += "\n";
+            }
+            std::snprintf(line, sizeof(line), "%u passes, %u culled, %u framebuffer switches, %u barriers; %u transients in %u targets, %.2f MB (%.2f MB unaliased, pool %.2f MB)\n",
+                m_Stats.passes, m_Stats.culled, m_Stats.framebufferSwitches, m_Stats.barriers, m_Stats.transients, m_Stats.textures,
+                double(m_Stats.aliasedBytes) / (1 << 20), double(m_Stats.transientBytes) / (1 << 20), double(m_Stats.pooledBytes) / (1 << 20));
+            text += line;
+            return text;
+        }
+    };
+
+}
@@ -0,0 +1,1126 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <GL/glew.h>
+
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <gtc/type_ptr.hpp>
+
+#include <Utils.hpp>
+#include <ShaderLibrary.hpp>
+#include <UniformBuffer.hpp>
+#include <Mesh.hpp>
+#include <StateCache.hpp>
+#include <RingBuffer.hpp>
+#include <Culling.hpp>
+#include <Occlusion.hpp>
+#include <GpuCulling.hpp>
+#include <OcclusionQuery.hpp>
+#include <Lighting.hpp>
+#include <Environment.hpp>
+#include <Deferred.hpp>
+#include <Visibility.hpp>
+#include <Shadows.hpp>
+#include <PrePass.hpp>
+#include <RenderGraph.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+// Untinted runs shorter than this are drawn one by one with the plain permutation
+// (without multi-draw; with it every run goes through the instanced variant)
+#ifndef RENDER_QUEUE_MIN_INSTANCES
+
+    #define RENDER_QUEUE_MIN_INSTANCES 2
+
+#endif // RENDER_QUEUE_MIN_INSTANCES
+
+namespace gl {
+
+    enum class renderPass : uint8_t {
+        Opaque = 0,
+        Transparent = 1,
+    };
+
+    // 64-bit draw keys, most significant field first:
+    //   opaque       pass:2 | written:1 | program:12 | material:12 | geometry:12 | depth:25
+    //   transparent  pass:2 | ~depth:26  | program:12 | material:12 | geometry:12
+    // Opaque draws group by state and go front to back inside a group, transparent ones go
+    // strictly back to front and only group when they happen to be adjacent. written is
+    // clear for opaque items whose depth the pre-pass laid down, so they come first.
+    namespace sortKey {
+
+        constexpr uint64_t idBits = 12, depthBits = 26;
+        constexpr uint64_t idMask = (1ull << idBits) - 1, depthMask = (1ull << depthBits) - 1;
+
+        // Non-negative floats order the same as their bit patterns
+        inline uint64_t depth(float distance) {
+            uint32_t bits;
+            distance = std::max(distance, 0.0f);
+            std::memcpy(&bits, &distance, sizeof(bits));
+            return (bits >> (31 - depthBits)) & depthMask;
+        }
+
+        inline uint64_t opaque(uint32_t program, uint32_t material, uint32_t geometry, float distance, bool prePassed = false) {
+            return (uint64_t(renderPass::Opaque) << 62) | (uint64_t(!prePassed) << 61) | ((program & idMask) << 49) | ((material & idMask) << 37)
+                | ((geometry & idMask) << 25) | (depth(distance) >> 1);
+        }
+
+        inline uint64_t transparent(uint32_t program, uint32_t material, uint32_t geometry, float distance) {
+            return (uint64_t(renderPass::Transparent) << 62) | ((~depth(distance) & depthMask) << 36)
+                | ((program & idMask) << 24) | ((material & idMask) << 12) | (geometry & idMask);
+        }
+    }
+
+    // LSD radix sort on `key`, 8 bits per pass. Bytes every key shares are skipped, which
+    // is most of them for a typical frame.
+    template <class T>
+    void radixSort(std::vector<T>& entries, std::vector<T>& scratch) {
+        if (entries.size() < 2) return;
+        scratch.resize(entries.size());
+
+        std::array<std::array<uint32_t, 256>, 8> counts{};
+        for (const T& e : entries)
+            for (int b = 0; b < 8; ++b) counts[b][(e.key >> (b * 8)) & 0xFF]++;
+
+        for (int b = 0; b < 8; ++b) {
+            std::array<uint32_t, 256>& count = counts[b];
+            if (count[(entries[0].key >> (b * 8)) & 0xFF] == entries.size()) continue;
+
+            uint32_t offset = 0;
+            for (uint32_t& c : count) {
+                uint32_t n = c;
+                c = offset;
+                offset += n;
+            }
+            for (const T& e : entries) scratch[count[(e.key >> (b * 8)) & 0xFF]++] = e;
+            entries.swap(scratch);
+        }
+    }
+
+    struct renderQueueStats {
+        unsigned submitted = 0;
+        unsigned culled = 0;            // outside the view frustum, not drawn
+        unsigned occluded = 0;          // inside it but behind occluders, not drawn either
+        unsigned occluders = 0;
+        unsigned drawCalls = 0;
+        unsigned instancedDraws = 0;
+        unsigned instances = 0;         // items drawn through instanced calls
+        unsigned multiDraws = 0;        // glMultiDrawElementsIndirect calls, also in drawCalls
+        unsigned indirectCommands = 0;
+        unsigned gpuCandidates = 0;     // instances left to gl::gpuCuller, drawn count not read back
+        unsigned queried = 0;           // drawn under conditional rendering, see gl::occlusionQueries
+        unsigned viewModel = 0;         // items drawn by submitViewModel, also in drawCalls
+        unsigned programBinds = 0;
+        unsigned materialBinds = 0;
+        gl::shadingStats shading;       // the mode this frame was actually shaded with
+        gl::shadowStats shadows;        // zeroed until shadows() is used
+        gl::pointShadowStats pointShadows;      // zeroed until pointShadows() is used
+        gl::prePassStats prePass;               // zeroed until prePass() is used
+        gl::renderGraphStats graph;
+        double cullMilliseconds = 0.0;
+        double occlusionMilliseconds = 0.0;
+        double sortMilliseconds = 0.0;
+    };
+
+    // Deferred submission for gl::object. Items are collected with submit(), then flush()
+    // drops the ones whose world-space box is outside the camera frustum, builds sort keys
+    // for the rest, radix sorts them and walks the result changing only the state that
+    // differs from the previous draw. Runs of the same object and permutation become one
+    // glDrawElementsInstanced with the INSTANCED variant once the library has it linked.
+    // Items with a color other than white always go through the instanced variant, which is
+    // the only one that reads it.
+    //
+    // On GL 4.3 (or ARB_multi_draw_indirect) with base instance support every run is drawn
+    // instanced and its DrawElementsIndirectCommand written to a gl::ringBuffer of indirect
+    // commands; consecutive runs with the same program, pass and material (gl::object::
+    // sharesMaterial) then go out as one glMultiDrawElementsIndirect over the geometry pool.
+    // The base instance of each command indexes the instance stream, which carries the
+    // per-draw transform and color. Otherwise the 3.3 path above is used.
+    //
+    // When opaque items that are occluders (gl::object::setOccluder, or an occluder mesh in the
+    // model) survive the frustum test, they are rasterized into a gl::occlusionBuffer and
+    // every surviving box is tested against it before sorting.
+    //
+    // Opaque items of objects with gl::object::usesOcclusionQuery (big meshes by default) are
+    // kept out of the batches. After the other opaque draws their boxes are tested with
+    // hardware occlusion queries, then each is drawn on its own under conditional rendering.
+    //
+    // In shadingMode::Deferred the opaque items draw their DEFERRED variants into a gl::gBuffer,
+    // which is lit and composited into the bound framebuffer before the transparent items are
+    // drawn forward on top. Frames stay forward until every opaque variant is linked.
+    //
+    // In shadingMode::Visibility all opaque items, queried ones included, go to a
+    // gl::visibilityBuffer instead, with the CPU frustum and occlusion tests even when GPU
+    // culling is on. The same fallback applies while its material variants compile.
+    //
+    // Once shadows() was used, every flush starts by drawing the submitted opaque items into
+    // its cascaded shadow maps, whatever the shading mode. Once pointShadows() was used, the
+    // point lights with a shadow priority, the submitted objects' and the clustered ones, get
+    // their atlas slots first.
+    //
+    // Once prePass() was used, forward and deferred frames drawn without GPU culling lay down
+    // the depth of the opaque items it picks first; those then draw with GL_EQUAL and depth
+    // writes off, ahead of the other opaque items. Queried items never take part.
+    //
+    // Items from submitViewModel (a first-person weapon) are drawn one by one with their own
+    // fixed projection into the front of the depth range, before anything else in forward
+    // frames, so world fragments under them fail the depth test early. Deferred and
+    // visibility frames draw them right after the opaque lighting instead, which keeps them
+    // in front but saves nothing. They cast no shadows and take the clustered lights found
+    // at their screen position, which is only exact when both projections match.
+    //
+    // The GPU work of a flush is declared as passes of a gl::renderGraph once the items are
+    // culled, sorted and uploaded: the shadow maps and the light grid, then the passes of
+    // the shading mode. The graph orders them, takes the G-buffer from its pool of transient
+    // targets, binds framebuffers and places the GPU culling barriers; graph() shows what it
+    // compiled, with per-pass GPU times.
+    class renderQueue {
+    private:
+        // Layout glMultiDrawElementsIndirect reads
+        struct drawElementsIndirectCommand {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint baseInstance;
+        };
+
+        struct item {
+            gl::object* mesh;
+            uint64_t permutation;
+            glm::mat4 model;
+            glm::vec4 color;
+            renderPass pass;
+            bool prePassed = false;     // its depth is drawn by gl::depthPrePass
+        };
+
+        struct sortEntry {
+            uint64_t key;
+            uint32_t item;
+        };
+
+        struct batch {
+            uint32_t first;             // into m_Sorted
+            uint32_t count;
+            uint32_t instanceBase;      // into the instance stream, when instanced
+            GLuint program;
+            bool instanced;
+            bool gpu = false;           // culled by gl::gpuCuller, drawn from its visible buffer
+            uint32_t command = 0;       // into m_Commands, multi-draw only
+            uint32_t group = 1;         // batches drawn by this one's multi-draw, itself included
+        };
+
+        std::vector<item> m_Items;
+        std::vector<sortEntry> m_Sorted;
+        std::vector<sortEntry> m_Scratch;
+        std::vector<batch> m_Batches;
+        uint32_t m_FirstTransparent = 0;    // into m_Batches, the opaque ones come first
+        std::vector<drawElementsIndirectCommand> m_Commands;
+
+        std::unique_ptr<gl::ringBuffer> m_Indirect;     // created on the first multi-draw flush
+        GLintptr m_IndirectOffset = 0;
+        GLsizeiptr m_IndirectSize = 0;
+        bool m_MultiDrawEnabled = true;
+
+        gl::cullSet m_Bounds;
+        std::vector<uint32_t> m_Visible;
+        bool m_Culling = true;
+
+        std::unique_ptr<gl::occlusionBuffer> m_Occlusion;   // created on the first frame with occluders
+        bool m_OcclusionCulling = true;
+
+        std::unique_ptr<gl::gpuCuller> m_Gpu;               // created on the first GPU-culled flush
+        bool m_GpuCulling = false;
+
+        std::unique_ptr<gl::occlusionQueries> m_Queries;    // created on the first frame with queried items
+        std::vector<uint32_t> m_Queried;                    // items, front to back
+        std::vector<GLuint> m_QueryIDs;
+        bool m_OcclusionQueries = true;
+
+        const gl::environment* m_Environment = nullptr;     // IBL for every shading program, or flat ambient
+
+        std::unique_ptr<gl::gBuffer> m_Deferred;            // created on first use
+        gl::shadingMode m_ShadingMode = gl::shadingMode::Forward;
+        bool m_DeferredFrame = false;
+
+        std::unique_ptr<gl::visibilityBuffer> m_Visibility; // created on first use
+        std::vector<gl::visibilityDraw> m_VisibilityDraws;
+        bool m_VisibilityFrame = false;
+
+        std::unique_ptr<gl::cascadedShadows> m_Shadows;    // created on first use
+        std::vector<gl::depthInstance> m_Casters;
+
+        std::unique_ptr<gl::pointShadows> m_PointShadows;  // created on first use
+        std::vector<gl::shadowLight> m_ShadowLights;
+        std::vector<gl::object*> m_LightOwners;
+
+        std::unique_ptr<gl::depthPrePass> m_PrePass;       // created on first use
+        bool m_PrePassFrame = false;
+
+        std::vector<item> m_ViewModel;
+        float m_ViewModelFov = 60.0f;
+        float m_ViewModelNear = 0.01f, m_ViewModelFar = 10.0f;
+        float m_ViewModelDepth = 0.05f;     // depth range [0, this] the viewmodel is squeezed into
+
+        // Small stable ids for the key fields; wrapping past 4096 only costs sort quality
+        std::unordered_map<GLuint, uint32_t> m_ProgramIDs;
+        std::unordered_map<const gl::object*, uint32_t> m_MaterialIDs;
+        std::unordered_map<GLuint, uint32_t> m_GeometryIDs;     // by first index in the pool
+
+        gl::renderGraph m_Graph;
+        renderQueueStats m_Stats;
+
+        template <class K>
+        static uint32_t idFor(std::unordered_map<K, uint32_t>& ids, const K& value) {
+            auto it = ids.find(value);
+            if (it != ids.end()) return it->second;
+            uint32_t id = static_cast<uint32_t>(ids.size());
+            ids.emplace(value, id);
+            return id;
+        }
+
+        // Objects sharing a material get the same id, so their runs sort next to each other
+        uint32_t materialID(const gl::object* mesh) {
+            auto it = m_MaterialIDs.find(mesh);
+            if (it != m_MaterialIDs.end()) return it->second;
+            uint32_t id = static_cast<uint32_t>(m_MaterialIDs.size());
+            for (const auto& [other, otherID] : m_MaterialIDs)
+                if (mesh->sharesMaterial(*other)) {
+                    id = otherID;
+                    break;
+                }
+            m_MaterialIDs.emplace(mesh, id);
+            return id;
+        }
+
+        // Groups consecutive instanced batches that one multi-draw can cover and writes their
+        // commands to the indirect ring. With GPU culling the commands are written twice, one
+        // set per phase, and the GPU-culled ones start empty with gl::gpuCuller's bounds staged
+        // for each of their instances.
+        void buildCommands(uint32_t instanceBase, bool gpu) {
+            m_Commands.clear();
+            for (uint32_t i = 0; i < m_Batches.size();) {
+                batch& leader = m_Batches[i];
+                if (!leader.instanced) {
+                    i++;
+                    continue;
+                }
+
+                const item& first = m_Items[m_Sorted[leader.first].item];
+                leader.command = static_cast<uint32_t>(m_Commands.size());
+                uint32_t end = i;
+                while (end < m_Batches.size()) {
+                    const batch& b = m_Batches[end];
+                    const item& it = m_Items[m_Sorted[b.first].item];
+                    if (end != i && (!b.instanced || b.program != leader.program || it.pass != first.pass || it.prePassed != first.prePassed || !it.mesh->sharesMaterial(*first.mesh))) break;
+
+                    const gl::meshRange& range = it.mesh->getRange();
+                    m_Batches[end].command = static_cast<uint32_t>(m_Commands.size());
+                    m_Commands.push_back({ static_cast<GLuint>(range.indexCount), b.count, range.firstIndex, range.baseVertex, instanceBase + b.instanceBase });
+                    end++;
+                }
+                leader.group = end - i;
+                i = end;
+            }
+            if (m_Commands.empty()) return;
+
+            if (gpu) {
+                const size_t commands = m_Commands.size();
+                m_Commands.resize(2 * commands);
+                std::copy(m_Commands.begin(), m_Commands.begin() + commands, m_Commands.begin() + commands);
+
+                std::vector<gl::cullBounds>& bounds = m_Gpu->staging();
+                for (const batch& b : m_Batches) {
+                    if (!b.gpu) continue;
+                    drawElementsIndirectCommand& phase0 = m_Commands[b.command];
+                    drawElementsIndirectCommand& phase1 = m_Commands[commands + b.command];
+                    phase0.instanceCount = phase1.instanceCount = 0;
+                    phase0.baseInstance = b.instanceBase;
+                    phase1.baseInstance = m_Gpu->phaseOffset() + b.instanceBase;
+
+                    for (uint32_t j = b.first; j < b.first + b.count; ++j) {
+                        const uint32_t i = m_Sorted[j].item;
+                        const gl::aabb& box = m_Items[i].mesh->getBounds();
+                        bounds.push_back({ glm::vec4(box.min, 1.0f), glm::vec4(box.max, 1.0f), b.instanceBase + (j - b.first), b.command, i });
+                    }
+                }
+                m_Gpu->upload();
+                m_Stats.gpuCandidates = static_cast<unsigned>(bounds.size());
+            }
+
+            size_t bytes = m_Commands.size() * sizeof(drawElementsIndirectCommand);
+            size_t alignment = gpu ? gl::ringBuffer::storageAlignment() : sizeof(GLuint);
+            if (!m_Indirect) m_Indirect = std::make_unique<gl::ringBuffer>(GL_DRAW_INDIRECT_BUFFER, 2 * (bytes + alignment));
+            m_Indirect->reserve(2 * (bytes + alignment));
+
+            m_IndirectOffset = m_Indirect->allocate(m_Commands.data(), bytes, alignment).offset;
+            m_IndirectSize = static_cast<GLsizeiptr>(bytes);
+            m_Indirect->flush();
+        }
+
+        void setPass(renderPass pass) {
+            gl::stateCache& state = gl::stateCache::get();
+            if (pass == renderPass::Transparent) {
+                state.enable(GL_BLEND);
+                state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                state.depthMask(false);
+            }
+            else {
+                state.disable(GL_BLEND);
+                state.depthMask(true);
+            }
+        }
+
+        // Walks batches [begin, end), all of one pass, changing only the state that differs
+        // from the previous draw. phase -1 draws them as built; with GPU culling phase 0 draws
+        // only the GPU-culled groups and phase 1 all of them, each GPU-culled group from that
+        // phase's commands. Leaves the opaque pass state set.
+        void drawBatches(gl::shaderLibrary& library, bool multiDraw, int phase, uint32_t begin, uint32_t end) {
+            static const gl::uniformID modelID = gl::internUniform("model");
+            gl::instanceStream& stream = gl::instanceStream::get();
+            const size_t phaseCommands = phase == 1 ? m_Commands.size() / 2 : 0;
+
+            GLuint currentProgram = 0;
+            const gl::object* currentMaterial = nullptr;
+            const renderPass pass = m_Items[m_Sorted[m_Batches[begin].first].item].pass;
+            setPass(pass);
+
+            // Pre-passed items test against their own depth, the rest with the caller's test
+            GLint depthFunc = GL_LESS;
+            if (m_PrePassFrame) glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+            bool depthEqual = false;
+            auto setDepthEqual = [&](bool equal) {
+                gl::stateCache& state = gl::stateCache::get();
+                state.depthFunc(equal ? GL_EQUAL : static_cast<GLenum>(depthFunc));
+                state.depthMask(!equal);
+                depthEqual = equal;
+            };
+
+            for (uint32_t i = begin; i < end; i += m_Batches[i].group) {
+                const batch& b = m_Batches[i];
+                const item& first = m_Items[m_Sorted[b.first].item];
+                if (phase == 0 && !b.gpu) continue;
+
+                if (pass == renderPass::Opaque && first.prePassed != depthEqual) setDepthEqual(first.prePassed);
+
+                if (b.program != currentProgram) {
+                    library.use(first.permutation | (b.instanced ? uint32_t(FEATURE_INSTANCED) : 0u));
+                    currentProgram = b.program;
+                    if (m_Environment) m_Environment->bind(currentProgram);
+                    currentMaterial = nullptr;  // sampler uniforms are per program
+                    m_Stats.programBinds++;
+                }
+
+                if (first.mesh != currentMaterial) {
+                    first.mesh->bindMaterial(currentProgram);
+                    first.mesh->uploadLights();
+                    currentMaterial = first.mesh;
+                    m_Stats.materialBinds++;
+                }
+
+                if (b.instanced && multiDraw) {
+                    uint32_t instances = 0;
+                    for (uint32_t g = i; g < i + b.group; ++g) instances += m_Batches[g].count;
+
+                    stream.bindForIndirect(b.gpu ? m_Gpu->visible() : 0);
+                    m_Indirect->bind();
+                    size_t command = (b.gpu ? phaseCommands : 0) + b.command;
+                    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                        (const void*)(m_IndirectOffset + command * sizeof(drawElementsIndirectCommand)), static_cast<GLsizei>(b.group), 0);
+
+                    m_Stats.drawCalls++;
+                    m_Stats.multiDraws++;
+                    m_Stats.indirectCommands += b.group;
+                    m_Stats.instancedDraws += b.group;
+                    if (!b.gpu) m_Stats.instances += instances;
+                    continue;
+                }
+
+                if (b.instanced) {
+                    stream.draw(first.mesh->getRange(), b.instanceBase, b.count);
+
+                    m_Stats.drawCalls++;
+                    m_Stats.instancedDraws++;
+                    m_Stats.instances += b.count;
+                    continue;
+                }
+
+                GLint modelLocation = gl::programReflection::get(currentProgram).location(modelID);
+                for (uint32_t j = b.first; j < b.first + b.count; ++j) {
+                    glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(m_Items[m_Sorted[j].item].model));
+                    first.mesh->drawGeometry();
+                    m_Stats.drawCalls++;
+                }
+            }
+
+            if (depthEqual) setDepthEqual(false);
+            if (pass != renderPass::Opaque) setPass(renderPass::Opaque);
+        }
+
+        // Moves the visible opaque items that use occlusion queries to m_Queried, nearest first.
+        // Tinted ones stay batched, only the instanced variant reads the color.
+        void splitQueried(const glm::vec3& camPos) {
+            m_Queried.clear();
+            if (!m_OcclusionQueries) return;
+
+            size_t kept = 0;
+            for (uint32_t i : m_Visible) {
+                const item& it = m_Items[i];
+                if (it.pass == renderPass::Opaque && it.mesh->usesOcclusionQuery() && it.color == glm::vec4(1.0f)) m_Queried.push_back(i);
+                else m_Visible[kept++] = i;
+            }
+            m_Visible.resize(kept);
+
+            auto distance = [&](uint32_t i) { return glm::length(glm::vec3(m_Items[i].model[3]) - camPos); };
+            std::sort(m_Queried.begin(), m_Queried.end(), [&](uint32_t a, uint32_t b) { return distance(a) < distance(b); });
+            m_Stats.queried = static_cast<unsigned>(m_Queried.size());
+        }
+
+        // Tests every queried box against the depth so far, then draws the items each under its
+        // own query. Issuing all the queries first gives the GPU time to finish them before the
+        // conditional draws reach it. Runs once per flush, after the other opaque draws.
+        void drawQueried(gl::shaderLibrary& library) {
+            if (m_Queried.empty()) return;
+            static const gl::uniformID modelID = gl::internUniform("model");
+            const gl::frameData& frame = gl::sceneUniforms::get().frame.get();
+
+            if (!m_Queries) m_Queries = std::make_unique<gl::occlusionQueries>();
+            setPass(renderPass::Opaque);
+            m_Queries->beginFrame();
+            m_Queries->beginBoxes();
+            m_QueryIDs.clear();
+            for (uint32_t i : m_Queried) m_QueryIDs.push_back(m_Queries->test(*m_Items[i].mesh, m_Items[i].mesh->getBounds().transformed(m_Items[i].model), frame));
+            m_Queries->endBoxes();
+
+            GLuint currentProgram = 0;
+            const gl::object* currentMaterial = nullptr;
+            for (size_t q = 0; q < m_Queried.size(); ++q) {
+                const item& it = m_Items[m_Queried[q]];
+                GLuint program = library.get(it.permutation);
+                if (program != currentProgram) {
+                    library.use(it.permutation);
+                    currentProgram = program;
+                    if (m_Environment) m_Environment->bind(currentProgram);
+                    currentMaterial = nullptr;
+                    m_Stats.programBinds++;
+                }
+                if (it.mesh != currentMaterial) {
+                    it.mesh->bindMaterial(currentProgram);
+                    it.mesh->uploadLights();
+                    currentMaterial = it.mesh;
+                    m_Stats.materialBinds++;
+                }
+
+                glUniformMatrix4fv(gl::programReflection::get(currentProgram).location(modelID), 1, GL_FALSE, glm::value_ptr(it.model));
+                if (m_QueryIDs[q]) glBeginConditionalRender(m_QueryIDs[q], GL_QUERY_NO_WAIT);
+                it.mesh->drawGeometry();
+                if (m_QueryIDs[q]) glEndConditionalRender();
+                m_Stats.drawCalls++;
+            }
+            m_Queried.clear();
+        }
+
+        // Every submitted opaque caster, visible or not: shadows fall from outside the view
+        void collectCasters() {
+            m_Casters.clear();
+            for (const item& it : m_Items)
+                if (it.pass == renderPass::Opaque && it.mesh->castsShadows()) m_Casters.push_back({ it.mesh, it.model });
+        }
+
+        void renderShadows(const gl::frameData& frame) {
+            m_Shadows->render(m_Casters, frame.view, frame.projection);
+            m_Stats.shadows = m_Shadows->stats();
+        }
+
+        // Lights asking for a shadow: those of every submitted object, whose 1/d^2 falloff
+        // ends at POINT_SHADOW_CUTOFF, and the clustered ones. Runs before the clustered
+        // lights are built, so the slots go out with them.
+        void renderPointShadows(const gl::frameData& frame) {
+            m_ShadowLights.clear();
+            m_LightOwners.clear();
+            for (const item& it : m_Items)
+                if (!it.mesh->getLights().empty()) m_LightOwners.push_back(it.mesh);
+            std::sort(m_LightOwners.begin(), m_LightOwners.end());
+            m_LightOwners.erase(std::unique(m_LightOwners.begin(), m_LightOwners.end()), m_LightOwners.end());
+            for (gl::object* owner : m_LightOwners) {
+                const std::vector<gl::Light>& lights = owner->getLights();
+                for (size_t i = 0; i < std::min<size_t>(lights.size(), MAX_LIGHTS); ++i) {
+                    const gl::Light& light = lights[i];
+                    const float brightest = std::max(light.color.r, std::max(light.color.g, light.color.b));
+                    if (light.shadowPriority > 0.0f) m_ShadowLights.push_back({ owner, static_cast<uint32_t>(i), light.position, std::sqrt(brightest / POINT_SHADOW_CUTOFF), light.shadowPriority });
+                }
+            }
+            gl::clusteredLights& clustered = gl::clusteredLights::get();
+            for (uint32_t id = 0; id < clustered.capacity(); ++id) {
+                if (!clustered.alive(id)) continue;
+                const gl::pointLight& light = clustered.light(id);
+                if (light.shadowPriority > 0.0f) m_ShadowLights.push_back({ &clustered, id, light.position, light.radius, light.shadowPriority });
+            }
+
+            m_PointShadows->render(m_ShadowLights, m_Casters, frame.view, frame.projection);
+            m_Stats.pointShadows = m_PointShadows->stats();
+
+            for (gl::object* owner : m_LightOwners)
+                for (size_t i = 0; i < std::min<size_t>(owner->getLights().size(), MAX_LIGHTS); ++i)
+                    owner->setLightShadow(i, m_PointShadows->slot(owner, static_cast<uint32_t>(i)));
+            for (uint32_t id = 0; id < clustered.capacity(); ++id)
+                if (clustered.alive(id)) clustered.setShadow(id, m_PointShadows->slot(&clustered, id));
+        }
+
+        // Attachment traffic of the frame in the mode it was drawn in
+        void finishShading() {
+            if (m_DeferredFrame) {
+                m_Stats.shading = m_Deferred->stats();
+                return;
+            }
+            if (m_VisibilityFrame) {
+                m_Stats.shading = m_Visibility->stats();
+                return;
+            }
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            m_Stats.shading = gl::forwardShadingStats(viewport[2], viewport[3]);
+        }
+
+        // Switches the visible opaque items to their DEFERRED variants when all of them are
+        // linked, requesting the missing ones otherwise. Returns whether the frame goes deferred.
+        bool prepareDeferred(gl::shaderLibrary& library) {
+            if (m_ShadingMode != gl::shadingMode::Deferred) return false;
+
+            bool any = false, ready = true;
+            auto check = [&](uint32_t i) {
+                const item& it = m_Items[i];
+                if (it.pass != renderPass::Opaque) return;
+                const uint64_t key = it.permutation | FEATURE_DEFERRED;
+                library.get(key);
+                ready &= library.ready(key);
+                any = true;
+            };
+            for (uint32_t i : m_Visible) check(i);
+            for (uint32_t i : m_Queried) check(i);
+            if (!any || !ready) return false;
+
+            for (uint32_t i : m_Visible)
+                if (m_Items[i].pass == renderPass::Opaque) m_Items[i].permutation |= FEATURE_DEFERRED;
+            for (uint32_t i : m_Queried) m_Items[i].permutation |= FEATURE_DEFERRED;
+            return true;
+        }
+
+        // Takes the visible opaque items, queried ones included, out of the batches when the
+        // visibility buffer can shade all of them this frame
+        bool prepareVisibility() {
+            if (m_ShadingMode != gl::shadingMode::Visibility) return false;
+
+            m_VisibilityDraws.clear();
+            for (uint32_t i : m_Visible)
+                if (m_Items[i].pass == renderPass::Opaque) m_VisibilityDraws.push_back({ m_Items[i].mesh, m_Items[i].model, m_Items[i].color });
+            for (uint32_t i : m_Queried) m_VisibilityDraws.push_back({ m_Items[i].mesh, m_Items[i].model, m_Items[i].color });
+            if (m_VisibilityDraws.empty() || !visibility().prepare(m_VisibilityDraws)) return false;
+
+            size_t kept = 0;
+            for (uint32_t i : m_Visible)
+                if (m_Items[i].pass != renderPass::Opaque) m_Visible[kept++] = i;
+            m_Visible.resize(kept);
+            m_Queried.clear();
+            m_Stats.queried = 0;
+            return true;
+        }
+
+        // Marks the visible opaque items the pre-pass takes this frame and hands it their
+        // instances. Returns whether the frame draws a pre-pass.
+        bool preparePrePass(const gl::frameData& frame, bool allowed) {
+            if (!m_PrePass->beginFrame(allowed)) return false;
+            auto eligible = [&](const item& it) { return it.pass == renderPass::Opaque; };
+            for (uint32_t i : m_Visible)
+                if (eligible(m_Items[i])) m_PrePass->addCoverage(m_Items[i].mesh, gl::depthPrePass::coverage(*m_Items[i].mesh, m_Items[i].model, frame));
+
+            bool any = false;
+            for (uint32_t i : m_Visible) {
+                item& it = m_Items[i];
+                if (!eligible(it) || !m_PrePass->wants(it.mesh)) continue;
+                it.prePassed = true;
+                m_PrePass->add(it.mesh, it.model);
+                any = true;
+            }
+            return any;
+        }
+
+        // Draws the viewmodel items with the viewmodel camera into [0, m_ViewModelDepth] of the
+        // depth range. The world's own near plane keeps it out of that sliver in practice.
+        void drawViewModel(gl::shaderLibrary& library) {
+            if (m_ViewModel.empty()) return;
+            static const gl::uniformID modelID = gl::internUniform("model");
+            gl::sceneUniforms& uniforms = gl::sceneUniforms::get();
+
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            const float aspect = float(std::max(viewport[2], 1)) / float(std::max(viewport[3], 1));
+            uniforms.setViewModelFrame(glm::perspective(glm::radians(m_ViewModelFov), aspect, m_ViewModelNear, m_ViewModelFar));
+            uniforms.frame.bind(1);
+
+            GLfloat depthRange[2];
+            glGetFloatv(GL_DEPTH_RANGE, depthRange);
+            glDepthRange(0.0, m_ViewModelDepth);
+            setPass(renderPass::Opaque);
+
+            GLuint currentProgram = 0;
+            const gl::object* currentMaterial = nullptr;
+            for (const item& it : m_ViewModel) {
+                GLuint program = library.get(it.permutation);
+                if (program != currentProgram) {
+                    library.use(it.permutation);
+                    currentProgram = program;
+                    if (m_Environment) m_Environment->bind(currentProgram);
+                    currentMaterial = nullptr;
+                    m_Stats.programBinds++;
+                }
+                if (it.mesh != currentMaterial) {
+                    it.mesh->bindMaterial(currentProgram);
+                    it.mesh->uploadLights();
+                    currentMaterial = it.mesh;
+                    m_Stats.materialBinds++;
+                }
+
+                glUniformMatrix4fv(gl::programReflection::get(currentProgram).location(modelID), 1, GL_FALSE, glm::value_ptr(it.model));
+                it.mesh->drawGeometry();
+                m_Stats.drawCalls++;
+                m_Stats.viewModel++;
+            }
+
+            glDepthRange(depthRange[0], depthRange[1]);
+            uniforms.frame.bind(0);
+            m_ViewModel.clear();
+        }
+
+        // Rasterizes the visible opaque occluders and drops the visible items behind them
+        void cullOccluded(const glm::mat4& viewProjection) {
+            auto start = std::chrono::high_resolution_clock::now();
+            bool any = false;
+            for (uint32_t i : m_Visible) {
+                const item& it = m_Items[i];
+                if (it.pass != renderPass::Opaque || !it.mesh->isOccluder()) continue;
+                if (!any) {
+                    if (!m_Occlusion) m_Occlusion = std::make_unique<gl::occlusionBuffer>();
+                    m_Occlusion->begin(viewProjection);
+                    any = true;
+                }
+                m_Occlusion->addOccluder(it.mesh->getOccluderPositions(), it.mesh->getOccluderIndices(), it.model);
+                m_Stats.occluders++;
+            }
+            if (!any) return;
+            m_Occlusion->rasterize();
+
+            size_t kept = 0;
+            for (uint32_t i : m_Visible)
+                if (m_Occlusion->visible(m_Items[i].mesh->getBounds().transformed(m_Items[i].model))) m_Visible[kept++] = i;
+            m_Stats.occluded = static_cast<unsigned>(m_Visible.size() - kept);
+            m_Visible.resize(kept);
+            m_Stats.occlusionMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // Sorts the visible items and splits them into batches, uploading their instances and
+        // indirect commands
+        void buildBatches(gl::shaderLibrary& library, const glm::vec3& camPos, bool gpu, bool multiDraw) {
+            m_Batches.clear();
+            m_FirstTransparent = 0;
+            if (m_Visible.empty()) return;
+
+            auto start = std::chrono::high_resolution_clock::now();
+            m_Sorted.resize(m_Visible.size());
+            for (uint32_t v = 0; v < m_Visible.size(); ++v) {
+                const uint32_t i = m_Visible[v];
+                const item& it = m_Items[i];
+                uint32_t program = idFor(m_ProgramIDs, library.get(it.permutation));
+                uint32_t material = materialID(it.mesh);
+                uint32_t geometry = idFor(m_GeometryIDs, it.mesh->getRange().firstIndex);
+                float distance = glm::length(glm::vec3(it.model[3]) - camPos);
+
+                m_Sorted[v].key = it.pass == renderPass::Opaque
+                    ? sortKey::opaque(program, material, geometry, distance, it.prePassed)
+                    : sortKey::transparent(program, material, geometry, distance);
+                m_Sorted[v].item = i;
+            }
+            radixSort(m_Sorted, m_Scratch);
+
+            m_Stats.sortMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+            // Split into runs of the same object, permutation, pass and pre-pass
+            gl::instanceStream& stream = gl::instanceStream::get();
+            const uint32_t minInstances = multiDraw ? 1 : RENDER_QUEUE_MIN_INSTANCES;
+            std::vector<instance>& instances = stream.staging();
+            instances.clear();
+            for (uint32_t i = 0; i < m_Sorted.size();) {
+                const item& first = m_Items[m_Sorted[i].item];
+                bool tinted = first.color != glm::vec4(1.0f);
+                uint32_t end = i + 1;
+                while (end < m_Sorted.size()) {
+                    const item& next = m_Items[m_Sorted[end].item];
+                    if (next.mesh != first.mesh || next.permutation != first.permutation || next.pass != first.pass || next.prePassed != first.prePassed) break;
+                    tinted |= next.color != glm::vec4(1.0f);
+                    end++;
+                }
+
+                uint64_t instancedKey = first.permutation | FEATURE_INSTANCED;
+                uint32_t count = end - i;
+                GLuint instancedProgram = count >= minInstances || tinted ? library.get(instancedKey) : 0;
+                if (instancedProgram && library.ready(instancedKey)) {
+                    m_Batches.push_back({ i, count, static_cast<uint32_t>(instances.size()), instancedProgram, true, gpu && first.pass == renderPass::Opaque });
+                    for (uint32_t j = i; j < end; ++j) {
+                        const item& it = m_Items[m_Sorted[j].item];
+                        instances.push_back({ it.model, it.color });
+                    }
+                }
+                else {
+                    // Single draws, or the instanced variant is still compiling
+                    m_Batches.push_back({ i, count, 0, library.get(first.permutation), false });
+                }
+                i = end;
+            }
+            m_FirstTransparent = static_cast<uint32_t>(m_Batches.size());
+            for (uint32_t b = 0; b < m_Batches.size(); ++b)
+                if (m_Items[m_Sorted[m_Batches[b].first].item].pass == renderPass::Transparent) {
+                    m_FirstTransparent = b;
+                    break;
+                }
+
+            stream.upload();
+            if (gpu) {
+                if (!m_Gpu) m_Gpu = std::make_unique<gl::gpuCuller>();
+                m_Gpu->begin(instances.size(), m_Items.size());
+            }
+            if (multiDraw) buildCommands(stream.base(), gpu);
+        }
+
+        // Declares this frame's passes on m_Graph, drawing what was prepared above. Shadow maps
+        // and the light grid come first, then by shading mode:
+        //   forward      viewmodel, pre-pass, opaque, queried, transparent
+        //   deferred     pre-pass, opaque, queried into the G-buffer, deferred lighting and
+        //                composite, viewmodel, transparent
+        //   visibility   visibility, viewmodel, transparent
+        // With GPU culling the opaque pass becomes cull phase 0, opaque phase 0, cull phase 1
+        // and opaque, the graph placing the barriers between the dispatches and the draws.
+        void buildGraph(gl::shaderLibrary& library, const gl::frameData& frame, bool gpu, bool multiDraw) {
+            using resource = gl::renderGraph::resource;
+            using builder = gl::renderGraph::builder;
+            m_Graph.reset();
+
+            GLint sceneFBO = 0;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &sceneFBO);
+            const resource scene = m_Graph.importFramebuffer("scene", static_cast<GLuint>(sceneFBO));
+            const resource clusters = m_Graph.importBuffer("light clusters");
+
+            // What the material shaders sample besides their own textures
+            std::array<resource, 3> inputs{ clusters };
+            uint32_t inputCount = 1;
+
+            resource slots;
+            if (m_PointShadows) {
+                const resource atlas = m_Graph.importTexture("point shadow atlas", m_PointShadows->getAtlas());
+                slots = m_Graph.importBuffer("point shadow slots");
+                m_Graph.addPass("point shadows", [&](builder& pass) {
+                    pass.write(atlas, gl::graphAccess::Attachment);
+                    pass.write(slots, gl::graphAccess::Uniform);
+                }, [this, &frame]() { renderPointShadows(frame); });
+                inputs[inputCount++] = atlas;
+            }
+            m_Graph.addPass("light clusters", [&](builder& pass) {
+                if (slots.valid()) pass.read(slots, gl::graphAccess::Uniform);
+                pass.write(clusters, gl::graphAccess::Uniform);
+            }, [&frame]() { gl::clusteredLights::get().build(frame.view, frame.projection); });
+            if (m_Shadows) {
+                const resource cascades = m_Graph.importTexture("shadow cascades", m_Shadows->getMap());
+                m_Graph.addPass("cascades", [&](builder& pass) { pass.write(cascades, gl::graphAccess::Attachment); }, [this, &frame]() { renderShadows(frame); });
+                inputs[inputCount++] = cascades;
+            }
+            const std::span<const resource> lighting(inputs.data(), inputCount);
+
+            // Forward geometry draws into the scene, deferred into the G-buffer, the first pass
+            // clearing it
+            gl::gBuffer::surface surface;
+            if (m_DeferredFrame) surface = deferred().declare(m_Graph);
+            bool cleared = false;
+            auto geometry = [&](builder& pass, bool shaded) {
+                if (!m_DeferredFrame) pass.target(scene);
+                else {
+                    gl::gBuffer::attach(pass, surface, !cleared);
+                    cleared = true;
+                }
+                if (shaded)
+                    for (resource input : lighting) pass.read(input);
+            };
+            auto viewModel = [&]() {
+                if (m_ViewModel.empty()) return;
+                m_Graph.addPass("viewmodel", [&](builder& pass) {
+                    pass.target(scene);
+                    for (resource input : lighting) pass.read(input);
+                }, [this, &library]() { drawViewModel(library); });
+            };
+
+            if (m_VisibilityFrame)
+                m_Graph.addPass("visibility", [&](builder& pass) {
+                    pass.target(scene);
+                    for (resource input : lighting) pass.read(input);
+                }, [this]() { m_Visibility->render(m_VisibilityDraws, m_Environment); });
+            if (!m_DeferredFrame) viewModel();
+
+            if (m_PrePassFrame) m_Graph.addPass("pre-pass", [&](builder& pass) { geometry(pass, false); }, [this, &frame]() { m_PrePass->render(frame); });
+
+            const uint32_t opaqueEnd = m_FirstTransparent, batchEnd = static_cast<uint32_t>(m_Batches.size());
+            resource commands;
+            if (gpu && m_Stats.gpuCandidates) {
+                // Phase 0 draws last frame's visible set, phase 1 tests the rest against the
+                // Hi-Z pyramid of that depth, read from the bound target
+                commands = m_Graph.importBuffer("indirect commands", m_Indirect->getBuffer());
+                const resource visible = m_Graph.importBuffer("culled instances", m_Gpu->visible());
+                const resource history = m_Graph.importBuffer("cull history");
+                auto cull = [&](const char* name, int phase) {
+                    m_Graph.addPass(name, [&](builder& pass) {
+                        if (phase == 1) {
+                            if (m_DeferredFrame) gl::gBuffer::attach(pass, surface, false, false);
+                            else pass.target(scene, false);
+                        }
+                        pass.read(history, gl::graphAccess::Storage);
+                        pass.write(commands, gl::graphAccess::Storage);
+                        pass.write(visible, gl::graphAccess::Storage);
+                        pass.write(history, gl::graphAccess::Storage);
+                    }, [this, &frame, phase]() {
+                        gl::instanceStream& stream = gl::instanceStream::get();
+                        const uint32_t base = phase == 1 ? static_cast<uint32_t>(m_Commands.size() / 2) : 0;
+                        m_Gpu->dispatch(phase, frame.viewProjection, stream.ring(), stream.base(), m_Indirect->getBuffer(), m_IndirectOffset, m_IndirectSize, base, false);
+                    });
+                };
+                auto draw = [&](const char* name, int phase) {
+                    m_Graph.addPass(name, [&](builder& pass) {
+                        geometry(pass, true);
+                        pass.read(commands, gl::graphAccess::Indirect);
+                        pass.read(visible, gl::graphAccess::Vertex);
+                    }, [this, &library, phase, opaqueEnd]() { drawBatches(library, true, phase, 0, opaqueEnd); });
+                };
+                cull("cull phase 0", 0);
+                draw("opaque phase 0", 0);
+                cull("cull phase 1", 1);
+                draw("opaque", 1);
+            }
+            else if (opaqueEnd)
+                m_Graph.addPass("opaque", [&](builder& pass) { geometry(pass, true); }, [this, &library, multiDraw, opaqueEnd]() {
+                    if (m_PrePass) m_PrePass->beginOpaque();
+                    drawBatches(library, multiDraw, -1, 0, opaqueEnd);
+                    if (m_PrePass) m_PrePass->endOpaque();
+                });
+
+            if (!m_Queried.empty()) m_Graph.addPass("queried", [&](builder& pass) { geometry(pass, true); }, [this, &library]() { drawQueried(library); });
+
+            if (m_DeferredFrame) {
+                if (m_Environment) m_Environment->bind(m_Deferred->getLightingProgram());
+                m_Deferred->addResolve(m_Graph, surface, scene, lighting);
+                viewModel();
+            }
+
+            if (opaqueEnd < batchEnd)
+                m_Graph.addPass("transparent", [&](builder& pass) {
+                    pass.target(scene);
+                    for (resource input : lighting) pass.read(input);
+                    if (commands.valid()) pass.read(commands, gl::graphAccess::Indirect);
+                }, [this, &library, multiDraw, opaqueEnd, batchEnd]() { drawBatches(library, multiDraw, -1, opaqueEnd, batchEnd); });
+        }
+    public:
+        renderQueue() = default;
+
+        renderQueue(const renderQueue&) = delete;
+        renderQueue& operator=(const renderQueue&) = delete;
+
+        void submit(gl::object& mesh, const glm::mat4& model, renderPass pass = renderPass::Opaque) {
+            m_Items.push_back({ &mesh, mesh.getPermutationKey(), model, glm::vec4(1.0f), pass });
+        }
+
+        // Tinted: the color multiplies the material's base color
+        void submit(gl::object& mesh, const glm::mat4& model, const glm::vec4& color, renderPass pass = renderPass::Opaque) {
+            m_Items.push_back({ &mesh, mesh.getPermutationKey(), model, color, pass });
+        }
+
+        void submit(gl::object& mesh, const glm::vec3& pos, const glm::vec3& scale, const glm::vec3& rotation, renderPass pass = renderPass::Opaque) {
+            submit(mesh, gl::modelMatrix(pos, scale, rotation), pass);
+        }
+
+        // Opaque, in world space like the rest (gl::getItemModel), but seen through the
+        // viewmodel projection from setViewModel
+        void submitViewModel(gl::object& mesh, const glm::mat4& model) {
+            m_ViewModel.push_back({ &mesh, mesh.getPermutationKey(), model, glm::vec4(1.0f), renderPass::Opaque });
+        }
+
+        // Vertical field of view in degrees, clip planes, and the share of the depth range at
+        // its front the viewmodel gets. The FOV stays put while the world's zooms.
+        void setViewModel(float fov, float nearPlane, float farPlane, float depthRange) {
+            m_ViewModelFov = fov;
+            m_ViewModelNear = nearPlane;
+            m_ViewModelFar = farPlane;
+            m_ViewModelDepth = depthRange;
+        }
+
+        // Culls, sorts and draws everything submitted since the last flush. The frustum and
+        // distances come from the camera in the current FrameData, so call it after the
+        // player update. The scene lights are binned for the same camera first.
+        void flush(gl::shaderLibrary& library) {
+            m_Stats = {};
+            m_Stats.submitted = static_cast<unsigned>(m_Items.size() + m_ViewModel.size());
+            if (m_Items.empty() && m_ViewModel.empty()) return;
+
+            const gl::frameData& frame = gl::sceneUniforms::get().frame.get();
+            const glm::vec3 camPos = frame.camPos;
+            if (m_Shadows || m_PointShadows) collectCasters();
+
+            const bool gpu = gpuCullingActive() && m_ShadingMode != gl::shadingMode::Visibility;
+            auto start = std::chrono::high_resolution_clock::now();
+            if (gpu) {
+                // Opaque items go to the GPU untested; transparent ones keep their CPU test, as
+                // their draw order has to survive
+                const gl::frustum view = gl::frustum::fromMatrix(frame.viewProjection);
+                m_Visible.clear();
+                for (uint32_t i = 0; i < m_Items.size(); ++i) {
+                    const item& it = m_Items[i];
+                    if (it.pass == renderPass::Opaque || !m_Culling || view.intersects(it.mesh->getBounds().transformed(it.model))) m_Visible.push_back(i);
+                }
+            }
+            else if (m_Culling) {
+                m_Bounds.clear();
+                m_Bounds.reserve(m_Items.size());
+                for (const item& it : m_Items) m_Bounds.add(it.mesh->getBounds().transformed(it.model));
+                m_Bounds.cull(gl::frustum::fromMatrix(frame.viewProjection), m_Visible);
+            }
+            else {
+                m_Visible.resize(m_Items.size());
+                for (uint32_t i = 0; i < m_Items.size(); ++i) m_Visible[i] = i;
+            }
+            m_Stats.culled = static_cast<unsigned>(m_Items.size() - m_Visible.size());
+            m_Stats.cullMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+            if (m_OcclusionCulling && !gpu) cullOccluded(frame.viewProjection);
+            if (!gpu) splitQueried(camPos);
+
+            m_VisibilityFrame = prepareVisibility();
+            m_DeferredFrame = prepareDeferred(library);
+            m_PrePassFrame = m_PrePass && preparePrePass(frame, !gpu && !m_VisibilityFrame);
+            const bool multiDraw = multiDrawActive();
+            buildBatches(library, camPos, gpu, multiDraw);
+
+            buildGraph(library, frame, gpu, multiDraw);
+            m_Graph.compile();
+            m_Graph.execute();
+            m_Stats.graph = m_Graph.stats();
+            if (m_PrePass) m_Stats.prePass = m_PrePass->stats();
+
+            finishShading();
+            m_Items.clear();
+        }
+
+        // Off draws every item, e.g. when the caller culled already
+        void setCulling(bool enabled) { m_Culling = enabled; }
+
+        // Off skips the occlusion buffer even when occluders are submitted
+        void setOcclusionCulling(bool enabled) { m_OcclusionCulling = enabled; }
+
+        // The last frame's buffer, null until a frame had occluders
+        const gl::occlusionBuffer* occlusion() const { return m_Occlusion.get(); }
+
+        // Off forces the 3.3 path even where multi-draw is supported
+        void setMultiDraw(bool enabled) { m_MultiDrawEnabled = enabled; }
+
+        const bool multiDrawActive() const {
+            return m_MultiDrawEnabled && (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect) && gl::instanceStream::get().baseInstance();
+        }
+
+        // On moves opaque visibility to gl::gpuCuller (frustum plus a Hi-Z pyramid of this
+        // frame's depth) where GL 4.3 and multi-draw are available. The CPU frustum and
+        // occlusion tests are skipped for opaque items. History is kept per submission index,
+        // so submit in a stable order; a reordered frame only costs phase 0 its hits.
+        void setGpuCulling(bool enabled) { m_GpuCulling = enabled; }
+
+        const bool gpuCullingActive() const { return m_GpuCulling && gl::gpuCullingSupported() && multiDrawActive(); }
+
+        // Null until the first GPU-culled flush
+        const gl::gpuCuller* gpuCulling() const { return m_Gpu.get(); }
+
+        // Off draws objects that use occlusion queries with the rest, without queries. With GPU
+        // culling on they always are, the Hi-Z test covers them.
+        void setOcclusionQueries(bool enabled) { m_OcclusionQueries = enabled; }
+
+        // Null until a flush had queried items
+        const gl::occlusionQueries* queries() const { return m_Queries.get(); }
+
+        // Query results read back for one object so far, summed over its instances
+        const gl::objectQueryStats queryStats(const gl::object& mesh) const {
+            return m_Queries ? m_Queries->stats(mesh) : gl::objectQueryStats{};
+        }
+
+        // Deferred draws opaque items through a gl::gBuffer once their DEFERRED variants are
+        // linked, Visibility through a gl::visibilityBuffer once its material variants are;
+        // stats().shading tells which mode a frame ended up in
+        void setShadingMode(gl::shadingMode mode) { m_ShadingMode = mode; }
+
+        const gl::shadingMode getShadingMode() const { return m_ShadingMode; }
+
+        // Image-based lighting for forward, deferred and visibility shading; nullptr (the default)
+        // keeps the flat ambient term. Programs keep the last environment bound to them.
+        void setEnvironment(const gl::environment* environment) { m_Environment = environment; }
+
+        const gl::environment* getEnvironment() const { return m_Environment; }
+
+        // Created on first use, so a context must be current. Use it to switch light volumes on.
+        gl::gBuffer& deferred() {
+            if (!m_Deferred) m_Deferred = std::make_unique<gl::gBuffer>();
+            return *m_Deferred;
+        }
+
+        // Created on first use, so a context must be current
+        gl::visibilityBuffer& visibility() {
+            if (!m_Visibility) m_Visibility = std::make_unique<gl::visibilityBuffer>();
+            return *m_Visibility;
+        }
+
+        // Created on first use, so a context must be current. Give it a light with setLight to
+        // shadow the scene with it; the cascades are drawn at the start of every flush.
+        gl::cascadedShadows& shadows() {
+            if (!m_Shadows) m_Shadows = std::make_unique<gl::cascadedShadows>();
+            return *m_Shadows;
+        }
+
+        // Created on first use, so a context must be current. Lights get a shadow from it by
+        // asking with a shadow priority, in gl::object::addLight or gl::pointLight.
+        gl::pointShadows& pointShadows() {
+            if (!m_PointShadows) m_PointShadows = std::make_unique<gl::pointShadows>();
+            return *m_PointShadows;
+        }
+
+        // Created on first use, so a context must be current; prePassMode::Auto until setMode
+        // says otherwise. GPU-culled and visibility-buffer frames skip it.
+        gl::depthPrePass& prePass() {
+            if (!m_PrePass) m_PrePass = std::make_unique<gl::depthPrePass>();
+            return *m_PrePass;
+        }
+
+        // The last flush's passes, see gl::renderGraph::passes and describe
+        const gl::renderGraph& graph() const { return m_Graph; }
+
+        // Drops submitted items without drawing them
+        void clear() {
+            m_Items.clear();
+            m_ViewModel.clear();
+        }
+
+        const size_t size() const { return m_Items.size(); }
+
+        // Counters for the last flush
+        const renderQueueStats& stats() const { return m_Stats; }
+    };
+
+}
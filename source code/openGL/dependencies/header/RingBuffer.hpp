@@ -0,0 +1,262 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <StateCache.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Regions a ring buffer cycles through; the CPU can run this many frames ahead of the GPU
+#ifndef RING_BUFFER_FRAMES
+
+    #define RING_BUFFER_FRAMES 3
+
+#endif // RING_BUFFER_FRAMES
+
+namespace gl {
+
+    // A slice of a ring buffer. `data` is written by the CPU and read by GL at `offset` in
+    // `buffer` (after ringBuffer::flush on the fallback path). It stays valid until its
+    // region comes round again, RING_BUFFER_FRAMES frames later.
+    struct ringAllocation {
+        unsigned char* data = nullptr;
+        GLuint buffer = 0;
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+    };
+
+    struct ringBufferStats {
+        unsigned allocations = 0;
+        size_t bytes = 0;
+        unsigned fenceWaits = 0;                // region switches that found the GPU still reading
+        double fenceWaitMilliseconds = 0.0;
+        unsigned overruns = 0;                  // frames that came back to a region they had written
+    };
+
+    // Streaming buffer for data written once per frame (instances, indirect commands, UBO/SSBO
+    // slices). With GL 4.4 or ARB_buffer_storage the storage is mapped persistent and coherent,
+    // so allocate() hands out pointers into GPU-visible memory: no driver copy and no implicit
+    // sync. The buffer is split into RING_BUFFER_FRAMES regions; entering one waits on the fence
+    // left there, which is the only place the CPU can block. Regions are left at endFrame() or
+    // when one fills up, but are only fenced at endFrame(), after the draws reading them have
+    // been submitted. Without buffer storage, writes go to a CPU copy and flush() uploads them
+    // with glBufferSubData.
+    class ringBuffer {
+    private:
+        GLenum m_Target;
+        GLuint m_Buffer = 0;
+        size_t m_RegionSize = 0;
+        unsigned m_Region = 0;
+        size_t m_Head = 0;                      // within the current region
+        size_t m_Flushed = 0;
+        unsigned char* m_Mapped = nullptr;      // persistent mapping, or m_Shadow
+        std::vector<unsigned char> m_Shadow;
+        std::array<GLsync, RING_BUFFER_FRAMES> m_Fences{};
+        std::array<bool, RING_BUFFER_FRAMES> m_Used{};  // written this frame, fenced at endFrame()
+        bool m_Persistent;
+
+        ringBufferStats m_Stats;
+        ringBufferStats m_LastFrame;
+
+        static std::vector<ringBuffer*>& live() {
+            static std::vector<ringBuffer*> buffers;
+            return buffers;
+        }
+
+        static size_t alignUp(size_t value, size_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+        void create(size_t regionSize) {
+            m_RegionSize = regionSize;
+            m_Region = 0;
+            m_Head = m_Flushed = 0;
+            m_Used = {};
+            size_t size = m_RegionSize * RING_BUFFER_FRAMES;
+
+            glGenBuffers(1, &m_Buffer);
+            gl::stateCache& state = gl::stateCache::get();
+            state.bindBuffer(GL_COPY_WRITE_BUFFER, m_Buffer);
+            if (m_Persistent) {
+                const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+                m_Mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+                if (!m_Mapped) throw std::runtime_error("Failed to map ring buffer");
+            }
+            else {
+                glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+                m_Shadow.assign(size, 0);
+                m_Mapped = m_Shadow.data();
+            }
+        }
+
+        // Outstanding draws keep the old storage alive in GL, so nothing has to be waited for
+        void destroy() {
+            for (GLsync& fence : m_Fences) {
+                if (fence) glDeleteSync(fence);
+                fence = nullptr;
+            }
+            if (!m_Buffer) return;
+            if (m_Persistent) {
+                gl::stateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, m_Buffer);
+                glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            }
+            gl::stateCache::get().bufferDeleted(m_Buffer);
+            glDeleteBuffers(1, &m_Buffer);
+            m_Buffer = 0;
+            m_Mapped = nullptr;
+        }
+
+        void wait(GLsync& fence) {
+            if (!fence) return;
+            GLenum result = glClientWaitSync(fence, 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED) {
+                auto start = std::chrono::high_resolution_clock::now();
+                do result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+                while (result == GL_TIMEOUT_EXPIRED);
+                m_Stats.fenceWaits++;
+                m_Stats.fenceWaitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            }
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+
+        void fenceUsed() {
+            for (unsigned region = 0; region < RING_BUFFER_FRAMES; region++) {
+                if (!m_Used[region]) continue;
+                if (m_Persistent) m_Fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                m_Used[region] = false;
+            }
+        }
+
+        // Moves to the next region once the GPU is done with it. The region left behind is not
+        // fenced here: draws reading it may still be issued later in the frame. A frame that
+        // laps the whole ring can only fence what has been submitted so far and wait on it;
+        // that is counted as an overrun and means the regions need reserve()ing larger.
+        void advance() {
+            flush();
+            m_Used[m_Region] = true;
+            m_Region = (m_Region + 1) % RING_BUFFER_FRAMES;
+            m_Head = m_Flushed = 0;
+            if (m_Used[m_Region]) {
+                m_Stats.overruns++;
+                fenceUsed();
+            }
+            wait(m_Fences[m_Region]);
+        }
+    public:
+        ringBuffer(GLenum target, size_t bytesPerFrame)
+            : m_Target(target)
+        {
+            m_Persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+            create(std::max<size_t>(bytesPerFrame, 256));
+            live().push_back(this);
+        }
+
+        ~ringBuffer() {
+            destroy();
+            live().erase(std::find(live().begin(), live().end(), this));
+        }
+
+        ringBuffer(const ringBuffer&) = delete;
+        ringBuffer& operator=(const ringBuffer&) = delete;
+
+        // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, for allocations bound with glBindBufferRange
+        static size_t uniformAlignment() {
+            GLint alignment = 256;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            return static_cast<size_t>(std::max(alignment, 1));
+        }
+
+        // GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT where SSBOs exist (4.3), else the UBO one
+        static size_t storageAlignment() {
+            if (!(GLEW_VERSION_4_3 || GLEW_ARB_shader_storage_buffer_object)) return uniformAlignment();
+            GLint alignment = 256;
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            return static_cast<size_t>(std::max(alignment, 1));
+        }
+
+        // `alignment` applies to the offset in the whole buffer and need not be a power of
+        // two, so vertex data can be aligned to its stride and addressed by base instance
+        ringAllocation allocate(size_t size, size_t alignment = 16) {
+            if (size + alignment > m_RegionSize)
+                throw std::runtime_error("Ring buffer allocation larger than a frame region, reserve() more");
+
+            size_t regionStart = size_t(m_Region) * m_RegionSize;
+            size_t offset = alignUp(regionStart + m_Head, alignment);
+            if (offset + size > regionStart + m_RegionSize) {
+                advance();
+                regionStart = size_t(m_Region) * m_RegionSize;
+                offset = alignUp(regionStart, alignment);
+            }
+            m_Head = offset + size - regionStart;
+
+            m_Stats.allocations++;
+            m_Stats.bytes += size;
+            return { m_Mapped + offset, m_Buffer, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size) };
+        }
+
+        ringAllocation allocate(const void* data, size_t size, size_t alignment = 16) {
+            ringAllocation allocation = allocate(size, alignment);
+            std::memcpy(allocation.data, data, size);
+            return allocation;
+        }
+
+        // Fallback path: uploads what was written since the last flush. Call before drawing
+        // from the allocations; a no-op on persistent storage.
+        void flush() {
+            if (m_Persistent || m_Head == m_Flushed) return;
+            size_t regionStart = size_t(m_Region) * m_RegionSize;
+            gl::stateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, m_Buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, regionStart + m_Flushed, m_Head - m_Flushed, m_Shadow.data() + regionStart + m_Flushed);
+            m_Flushed = m_Head;
+        }
+
+        // Replaces the storage when a frame region is smaller than `bytesPerFrame`. The buffer
+        // name changes and allocations not drawn from yet are lost.
+        void reserve(size_t bytesPerFrame) {
+            if (bytesPerFrame <= m_RegionSize) return;
+            destroy();
+            create(std::max(bytesPerFrame, m_RegionSize * 2));
+        }
+
+        void bind() const { gl::stateCache::get().bindBuffer(m_Target, m_Buffer); }
+
+        // Binds an allocation to an indexed UBO/SSBO binding point
+        void bindRange(GLuint index, const ringAllocation& allocation) const {
+            gl::stateCache::get().bindBufferRange(m_Target, index, allocation.buffer, allocation.offset, allocation.size);
+        }
+
+        // Fences every region written this frame, now that everything reading them is submitted
+        void endFrame() {
+            flush();
+            m_Used[m_Region] = true;
+            fenceUsed();
+            m_Region = (m_Region + 1) % RING_BUFFER_FRAMES;
+            m_Head = m_Flushed = 0;
+            wait(m_Fences[m_Region]);
+            m_LastFrame = m_Stats;
+            m_Stats = {};
+        }
+
+        // Called once per frame by gl::window::swapBuffers
+        static void endFrameAll() {
+            for (ringBuffer* buffer : live()) buffer->endFrame();
+        }
+
+        const GLuint getBuffer() const { return m_Buffer; }
+
+        const size_t regionSize() const { return m_RegionSize; }
+
+        const bool persistent() const { return m_Persistent; }
+
+        const ringBufferStats& stats() const { return m_Stats; }
+
+        const ringBufferStats& lastFrame() const { return m_LastFrame; }
+    };
+
+}
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <GL/glew.h>
+
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+
+#include <Utils.hpp>
+#include <StateCache.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Light count meaning "loop over the numLights uniform" instead of a compile-time constant
+#define SHADER_DYNAMIC_LIGHTS 0xFFFFFFFFu
+
+// Variants built per poll() when the driver can't compile in the background
+#define SHADER_SYNC_COMPILES_PER_FRAME 1
+
+namespace gl {
+
+    // Material features, each one maps to a HAS_* / INSTANCED / DEFERRED define in the shaders
+    enum shaderFeature : uint32_t {
+        FEATURE_BASE_COLOR_MAP = 1u << 0,
+        FEATURE_NORMAL_MAP = 1u << 1,
+        FEATURE_METALLIC_ROUGHNESS_MAP = 1u << 2,
+        FEATURE_OCCLUSION_MAP = 1u << 3,
+        FEATURE_EMISSIVE = 1u << 4,
+        FEATURE_INSTANCED = 1u << 5,     // model matrix comes from a per-instance attribute
+        FEATURE_DEFERRED = 1u << 6,      // writes gl::gBuffer's targets instead of a color
+    };
+
+    // Feature bits in the low half, light count in the high half
+    inline uint64_t permutationKey(uint32_t features, uint32_t lightCount = SHADER_DYNAMIC_LIGHTS) {
+        return (uint64_t(lightCount) << 32) | features;
+    }
+
+    inline std::vector<std::string> permutationDefines(uint64_t key) {
+        static const std::pair<uint32_t, const char*> names[] = {
+            { FEATURE_BASE_COLOR_MAP, "HAS_BASE_COLOR_MAP" },
+            { FEATURE_NORMAL_MAP, "HAS_NORMAL_MAP" },
+            { FEATURE_METALLIC_ROUGHNESS_MAP, "HAS_METALLIC_ROUGHNESS_MAP" },
+            { FEATURE_OCCLUSION_MAP, "HAS_OCCLUSION_MAP" },
+            { FEATURE_EMISSIVE, "HAS_EMISSIVE" },
+            { FEATURE_INSTANCED, "INSTANCED" },
+            { FEATURE_DEFERRED, "DEFERRED" },
+        };
+
+        uint32_t features = uint32_t(key);
+        uint32_t lightCount = uint32_t(key >> 32);
+
+        std::vector<std::string> defines = { "PERMUTATION" };
+        for (auto& [bit, name] : names)
+            if (features & bit) defines.push_back(name);
+        if (lightCount != SHADER_DYNAMIC_LIGHTS)
+            defines.push_back("LIGHT_COUNT " + std::to_string(lightCount));
+        return defines;
+    }
+
+    // Lazily built shader permutations of one vertex/fragment pair. A variant is compiled the
+    // first time it is asked for; until it is linked, get() hands out the full-featured fallback
+    // so nothing stalls. With GL_KHR/ARB_parallel_shader_compile the driver compiles on its own
+    // threads and poll() only checks GL_COMPLETION_STATUS, otherwise poll() builds a few
+    // variants per frame. Linked variants go through gl::programCache like gl::shader does.
+    class shaderLibrary {
+    private:
+        enum class state { Queued, Compiling, Linking, Ready, Failed };
+
+        struct variant {
+            state status = state::Queued;
+            GLuint program = 0;
+            GLuint vertexShader = 0;
+            GLuint fragmentShader = 0;
+            uint64_t cacheKey = 0;
+            std::string vertexSource;
+            std::string fragmentSource;
+        };
+
+        std::string m_VertexPath;
+        std::string m_FragmentPath;
+        GLuint m_Fallback;
+        bool m_Parallel;
+
+        std::unordered_map<uint64_t, variant> m_Variants;
+        std::vector<uint64_t> m_Pending;
+
+        // Uniforms every variant shares (view, projection, ...), pushed when a program is used
+        std::unordered_map<uniformID, glm::mat4> m_SharedMat4;
+        std::unordered_map<uniformID, glm::vec3> m_SharedVec3;
+        std::unordered_map<GLuint, uint64_t> m_AppliedVersion;
+        uint64_t m_SharedVersion = 1;
+
+        static bool isComplete(GLuint object, bool program) {
+            GLint done = GL_TRUE;
+            if (program) glGetProgramiv(object, GL_COMPLETION_STATUS_KHR, &done);
+            else glGetShaderiv(object, GL_COMPLETION_STATUS_KHR, &done);
+            return done == GL_TRUE;
+        }
+
+        static std::string infoLog(GLuint object, bool program) {
+            GLint logLength = 0;
+            if (program) glGetProgramiv(object, GL_INFO_LOG_LENGTH, &logLength);
+            else glGetShaderiv(object, GL_INFO_LOG_LENGTH, &logLength);
+            std::string log(logLength > 0 ? logLength : 0, ' ');
+            if (logLength > 0) {
+                if (program) glGetProgramInfoLog(object, logLength, nullptr, log.data());
+                else glGetShaderInfoLog(object, logLength, nullptr, log.data());
+            }
+            return log;
+        }
+
+        static GLuint beginCompile(const std::string& source, GLenum type) {
+            const char* str = source.c_str();
+            GLuint shader = glCreateShader(type);
+            glShaderSource(shader, 1, &str, nullptr);
+            glCompileShader(shader);
+            return shader;
+        }
+
+        void fail(uint64_t key, variant& v, const std::string& log) {
+            std::cerr << "Shader permutation " << std::hex << key << std::dec << " failed, using fallback: " << log << "\n";
+            if (v.vertexShader) glDeleteShader(v.vertexShader);
+            if (v.fragmentShader) glDeleteShader(v.fragmentShader);
+            if (v.program) {
+                gl::programReflection::release(v.program);
+                gl::stateCache::get().programDeleted(v.program);
+                glDeleteProgram(v.program);
+            }
+            v.vertexShader = v.fragmentShader = v.program = 0;
+            v.vertexSource.clear();
+            v.fragmentSource.clear();
+            v.status = state::Failed;
+        }
+
+        void finish(variant& v) {
+            gl::assignReservedSamplers(v.program);
+            gl::assignReservedBlocks(v.program);
+            gl::programReflection::get(v.program);
+            v.vertexSource.clear();
+            v.fragmentSource.clear();
+            v.status = state::Ready;
+        }
+
+        void request(uint64_t key) {
+            variant& v = m_Variants[key];
+
+            std::vector<std::string> defines = permutationDefines(key);
+            try {
+                v.vertexSource = gl::preprocessShader(m_VertexPath, defines);
+                v.fragmentSource = gl::preprocessShader(m_FragmentPath, defines);
+            }
+            catch (const std::exception& e) {
+                fail(key, v, e.what());
+                return;
+            }
+
+            programCache& cache = programCache::get();
+            if (cache.supported()) {
+                v.cacheKey = cache.key(v.vertexSource, v.fragmentSource);
+                if ((v.program = cache.load(v.cacheKey))) {
+                    cache.stats().hits++;
+                    finish(v);
+                    return;
+                }
+            }
+
+            if (m_Parallel) {
+                v.vertexShader = beginCompile(v.vertexSource, GL_VERTEX_SHADER);
+                v.fragmentShader = beginCompile(v.fragmentSource, GL_FRAGMENT_SHADER);
+                v.status = state::Compiling;
+            }
+            m_Pending.push_back(key);
+        }
+
+        // Advances one variant; returns true once it has left the pending list
+        bool advance(uint64_t key, variant& v, unsigned& syncBudget) {
+            programCache& cache = programCache::get();
+
+            if (v.status == state::Queued) {
+                if (syncBudget == 0) return false;
+                syncBudget--;
+
+                auto start = std::chrono::high_resolution_clock::now();
+                try {
+                    GLuint vertexShader = gl::compileShaderSource(v.vertexSource, GL_VERTEX_SHADER, m_VertexPath);
+                    GLuint fragmentShader = gl::compileShaderSource(v.fragmentSource, GL_FRAGMENT_SHADER, m_FragmentPath);
+                    v.program = gl::createProgram(vertexShader, fragmentShader, v.cacheKey != 0);
+                }
+                catch (const std::exception& e) {
+                    fail(key, v, e.what());
+                    return true;
+                }
+                cache.stats().misses++;
+                cache.stats().compileMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+                if (v.cacheKey) cache.store(v.cacheKey, v.program);
+                finish(v);
+                return true;
+            }
+
+            if (v.status == state::Compiling) {
+                if (!isComplete(v.vertexShader, false) || !isComplete(v.fragmentShader, false)) return false;
+
+                for (GLuint shader : { v.vertexShader, v.fragmentShader }) {
+                    GLint success;
+                    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+                    if (!success) {
+                        fail(key, v, infoLog(shader, false));
+                        return true;
+                    }
+                }
+
+                v.program = glCreateProgram();
+                glAttachShader(v.program, v.vertexShader);
+                glAttachShader(v.program, v.fragmentShader);
+                if (v.cacheKey) glProgramParameteri(v.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+                glLinkProgram(v.program);
+                v.status = state::Linking;
+                return false;
+            }
+
+            if (v.status == state::Linking) {
+                if (!isComplete(v.program, true)) return false;
+
+                GLint success;
+                glGetProgramiv(v.program, GL_LINK_STATUS, &success);
+                if (!success) {
+                    fail(key, v, infoLog(v.program, true));
+                    return true;
+                }
+
+                glDeleteShader(v.vertexShader);
+                glDeleteShader(v.fragmentShader);
+                v.vertexShader = v.fragmentShader = 0;
+
+                cache.stats().misses++;
+                if (v.cacheKey) cache.store(v.cacheKey, v.program);
+                finish(v);
+                return true;
+            }
+
+            return true;
+        }
+
+        void applyShared(GLuint program) {
+            uint64_t& applied = m_AppliedVersion[program];
+            if (applied == m_SharedVersion) return;
+            applied = m_SharedVersion;
+
+            const gl::programReflection& uniforms = gl::programReflection::get(program);
+            for (auto& [id, value] : m_SharedMat4) {
+                GLint loc = uniforms.location(id);
+                if (loc >= 0) glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(value));
+            }
+            for (auto& [id, value] : m_SharedVec3) {
+                GLint loc = uniforms.location(id);
+                if (loc >= 0) glUniform3fv(loc, 1, glm::value_ptr(value));
+            }
+        }
+    public:
+        shaderLibrary(const std::string& vertexShaderName, const std::string& fragmentShaderName)
+            : m_VertexPath(vertexShaderName), m_FragmentPath(fragmentShaderName)
+        {
+            // The fallback is built up front and synchronously; everything else is on demand
+            m_Fallback = gl::createCachedProgram(gl::preprocessShader(m_VertexPath), gl::preprocessShader(m_FragmentPath), m_VertexPath, m_FragmentPath);
+            gl::assignReservedSamplers(m_Fallback);
+            gl::assignReservedBlocks(m_Fallback);
+            gl::programReflection::get(m_Fallback);
+
+            m_Parallel = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+            if (GLEW_KHR_parallel_shader_compile) glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+            else if (GLEW_ARB_parallel_shader_compile) glMaxShaderCompilerThreadsARB(0xFFFFFFFFu);
+        }
+
+        ~shaderLibrary() {
+            for (auto& [key, v] : m_Variants) {
+                if (v.vertexShader) glDeleteShader(v.vertexShader);
+                if (v.fragmentShader) glDeleteShader(v.fragmentShader);
+                if (v.program) {
+                    gl::programReflection::release(v.program);
+                    gl::stateCache::get().programDeleted(v.program);
+                    glDeleteProgram(v.program);
+                }
+            }
+            gl::programReflection::release(m_Fallback);
+            gl::stateCache::get().programDeleted(m_Fallback);
+            glDeleteProgram(m_Fallback);
+        }
+
+        shaderLibrary(const shaderLibrary&) = delete;
+        shaderLibrary& operator=(const shaderLibrary&) = delete;
+
+        // The variant for `key` if it is linked, the fallback otherwise. Never blocks.
+        GLuint get(uint64_t key) {
+            auto it = m_Variants.find(key);
+            if (it == m_Variants.end()) {
+                request(key);
+                it = m_Variants.find(key);
+            }
+            return it->second.status == state::Ready ? it->second.program : m_Fallback;
+        }
+
+        // get() plus glUseProgram and any shared uniforms the program hasn't seen yet
+        GLuint use(uint64_t key) {
+            GLuint program = get(key);
+            gl::stateCache::get().useProgram(program);
+            applyShared(program);
+            return program;
+        }
+
+        // Call once per frame to move pending compiles along
+        void poll() {
+            unsigned syncBudget = SHADER_SYNC_COMPILES_PER_FRAME;
+            size_t kept = 0;
+            for (size_t i = 0; i < m_Pending.size(); ++i) {
+                uint64_t key = m_Pending[i];
+                if (!advance(key, m_Variants[key], syncBudget)) m_Pending[kept++] = key;
+            }
+            m_Pending.resize(kept);
+        }
+
+        // Blocks until every requested variant is built, e.g. behind a loading screen
+        void finishAll() {
+            while (!m_Pending.empty()) {
+                unsigned syncBudget = ~0u;
+                size_t kept = 0;
+                for (size_t i = 0; i < m_Pending.size(); ++i) {
+                    uint64_t key = m_Pending[i];
+                    if (!advance(key, m_Variants[key], syncBudget)) m_Pending[kept++] = key;
+                }
+                m_Pending.resize(kept);
+            }
+        }
+
+        void setShared(uniformID id, const glm::mat4& value) {
+            auto it = m_SharedMat4.find(id);
+            if (it != m_SharedMat4.end() && it->second == value) return;
+            m_SharedMat4[id] = value;
+            m_SharedVersion++;
+        }
+
+        void setShared(uniformID id, const glm::vec3& value) {
+            auto it = m_SharedVec3.find(id);
+            if (it != m_SharedVec3.end() && it->second == value) return;
+            m_SharedVec3[id] = value;
+            m_SharedVersion++;
+        }
+
+        void setShared(const std::string& name, const glm::mat4& value) { setShared(gl::internUniform(name), value); }
+
+        void setShared(const std::string& name, const glm::vec3& value) { setShared(gl::internUniform(name), value); }
+
+        bool ready(uint64_t key) const {
+            auto it = m_Variants.find(key);
+            return it != m_Variants.end() && it->second.status == state::Ready;
+        }
+
+        const GLuint getFallback() const { return m_Fallback; }
+
+        const bool isParallel() const { return m_Parallel; }
+
+        const size_t getPendingCount() const { return m_Pending.size(); }
+
+        const size_t getVariantCount() const { return m_Variants.size(); }
+    };
+
+}
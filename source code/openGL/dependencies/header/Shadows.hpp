@@ -0,0 +1,1228 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+
+#include <Utils.hpp>
+#include <Mesh.hpp>
+#include <StateCache.hpp>
+#include <UniformBuffer.hpp>
+#include <Culling.hpp>
+#include <Bvh.hpp>
+#include <DepthDraws.hpp>
+#include <GpuTimer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Width and height of every cascade
+#ifndef SHADOW_MAP_SIZE
+
+    #define SHADOW_MAP_SIZE 2048
+
+#endif // SHADOW_MAP_SIZE
+
+// A cached cascade is rendered this much wider than its slice needs, so the camera can move
+// a while before the slice leaves what the cache covers
+#ifndef SHADOW_CACHE_MARGIN
+
+    #define SHADOW_CACHE_MARGIN 0.25f
+
+#endif // SHADOW_CACHE_MARGIN
+
+// Point light shadow atlas: its size, the tile sizes a cube face can get, and the texels
+// around each face so filtering never reads a neighbouring tile
+#ifndef POINT_SHADOW_ATLAS_SIZE
+
+    #define POINT_SHADOW_ATLAS_SIZE 4096
+
+#endif // POINT_SHADOW_ATLAS_SIZE
+
+#ifndef POINT_SHADOW_MIN_TILE
+
+    #define POINT_SHADOW_MIN_TILE 64
+
+#endif // POINT_SHADOW_MIN_TILE
+
+#ifndef POINT_SHADOW_MAX_TILE
+
+    #define POINT_SHADOW_MAX_TILE 512
+
+#endif // POINT_SHADOW_MAX_TILE
+
+#ifndef POINT_SHADOW_BORDER
+
+    #define POINT_SHADOW_BORDER 2
+
+#endif // POINT_SHADOW_BORDER
+
+// A light without a radius (gl::object's lights fall off with 1/d^2) ends where its
+// brightest channel drops below this
+#ifndef POINT_SHADOW_CUTOFF
+
+    #define POINT_SHADOW_CUTOFF (1.0f / 256.0f)
+
+#endif // POINT_SHADOW_CUTOFF
+
+// Frames a light out of view keeps its tiles, in case it comes back
+#ifndef POINT_SHADOW_KEEP_FRAMES
+
+    #define POINT_SHADOW_KEEP_FRAMES 120
+
+#endif // POINT_SHADOW_KEEP_FRAMES
+
+static_assert((POINT_SHADOW_ATLAS_SIZE & (POINT_SHADOW_ATLAS_SIZE - 1)) == 0 && (POINT_SHADOW_MIN_TILE & (POINT_SHADOW_MIN_TILE - 1)) == 0
+    && (POINT_SHADOW_MAX_TILE & (POINT_SHADOW_MAX_TILE - 1)) == 0, "the atlas is split in powers of two");
+
+namespace gl {
+
+    // Counters for the current frame. gpuMilliseconds comes from a timer query issued a frame
+    // or two ago.
+    struct shadowStats {
+        unsigned cascades = 0;
+        unsigned rendered = 0;          // cascades drawn from scratch, every caster
+        unsigned refreshed = 0;         // cached cascades whose static layer was redrawn
+        unsigned cached = 0;            // cached cascades that only drew their dynamic casters
+        unsigned postponed = 0;         // refreshes the budget pushed to a later frame
+        unsigned draws = 0;
+        unsigned instances = 0;         // caster instances drawn, over all cascades
+        unsigned casters = 0;
+        double cpuMilliseconds = 0.0;
+        double gpuMilliseconds = 0.0;
+    };
+
+    // Cascaded shadow maps for one directional light, used by gl::renderQueue through
+    // shadows(). The view range up to setMaxDistance is split into cascades, each fit with a
+    // bounding sphere of its slice, so its size does not change as the camera turns, and
+    // snapped to whole texels, so edges do not shimmer as it moves. Casters are culled per
+    // cascade in one pass over their boxes and drawn instanced from the geometry pool's
+    // position stream, with depth clamping so casters behind the light's near plane still
+    // land in the map.
+    //
+    // Cascades from setCachedFrom on are cached: their static objects (gl::object::setStatic)
+    // sit in a separate layer that is redrawn only when the static set or the light changes,
+    // when the camera leaves the margin the layer was drawn with, or every refresh interval.
+    // Each frame the layer is copied into the sampled map and the dynamic casters drawn on
+    // top. At most setBudget refreshes happen per frame; the rest wait, keeping the old layer.
+    class cascadedShadows {
+    private:
+        struct cascade {
+            glm::mat4 viewProjection{ 1.0f };   // what the layer holds
+            glm::vec3 center{ 0.0f };           // light space
+            float radius = 0.0f;
+            uint64_t frame = 0;                 // static layer drawn, 0 = never
+            bool stale = true;                  // static layer no longer matches the scene
+        };
+
+        struct fit {
+            glm::vec3 center;                   // light space
+            float radius;
+        };
+
+        gl::depthDraws m_Draws{ "resource/shader/shadow_vert.glsl" };
+
+        GLuint m_Map = 0;               // sampled, with comparison
+        GLuint m_Static = 0;            // static layers of the cached cascades
+        GLuint m_FBO = 0, m_ReadFBO = 0;
+        int m_StaticLayers = 0;
+
+        std::array<cascade, SHADOW_CASCADES> m_Cascades;
+        std::array<float, SHADOW_CASCADES> m_Splits{};
+        std::array<gl::depthDraws::range, SHADOW_CASCADES> m_StaticPasses, m_DynamicPasses;
+
+        glm::vec3 m_Direction{ 0.0f };
+        glm::vec3 m_Color{ 0.0f };
+        glm::mat3 m_LightView{ 1.0f };
+        int m_Count = SHADOW_CASCADES;
+        int m_FirstCached = SHADOW_CASCADES > 2 ? 2 : SHADOW_CASCADES;
+        float m_Lambda = 0.75f;
+        float m_MaxDistance = 100.0f;
+        std::vector<float> m_FixedSplits;
+        float m_NormalOffset = 1.5f;
+        float m_SlopeBias = 2.0f;
+        unsigned m_RefreshInterval = 120;
+        unsigned m_Budget = 1;
+        double m_GpuBudget = 0.0;
+
+        uint64_t m_Frame = 0;
+        uint64_t m_StaticHash = 0;
+
+        std::vector<depthInstance> m_Casters;        // sorted by mesh
+        std::vector<uint8_t> m_CasterStatic;
+        gl::cullSet m_Bounds;
+        std::vector<std::vector<uint32_t>> m_Visible;
+        std::vector<gl::frustum> m_Views;
+
+        gl::gpuTimer m_Timer;
+
+        shadowStats m_Stats;
+
+        static float nearPlane(const glm::mat4& projection) { return projection[3][2] / (projection[2][2] - 1.0f); }
+
+        static float farPlane(const glm::mat4& projection) { return projection[3][2] / (projection[2][2] + 1.0f); }
+
+        void allocate() {
+            gl::stateCache& state = gl::stateCache::get();
+            const int staticLayers = std::max(m_Count - m_FirstCached, 0);
+            if (!m_Map) {
+                glGenTextures(1, &m_Map);
+                state.bindTexture(GL_TEXTURE_2D_ARRAY, m_Map);
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+            }
+            if (staticLayers == m_StaticLayers) return;
+
+            if (m_Static) {
+                state.textureDeleted(m_Static);
+                glDeleteTextures(1, &m_Static);
+                m_Static = 0;
+            }
+            m_StaticLayers = staticLayers;
+            for (cascade& c : m_Cascades) c.frame = 0;
+            if (!staticLayers) return;
+
+            glGenTextures(1, &m_Static);
+            state.bindTexture(GL_TEXTURE_2D_ARRAY, m_Static);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, staticLayers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        }
+
+        // Far view depth of each cascade: Zhang's practical split, a blend of logarithmic and
+        // uniform by the lambda, unless fixed splits were given
+        void computeSplits(float nearDepth, float farDepth) {
+            for (int i = 0; i < m_Count; ++i) {
+                if (!m_FixedSplits.empty()) {
+                    m_Splits[i] = std::min(m_FixedSplits[std::min<size_t>(i, m_FixedSplits.size() - 1)], farDepth);
+                    continue;
+                }
+                const float t = float(i + 1) / float(m_Count);
+                const float logarithmic = nearDepth * std::pow(farDepth / nearDepth, t);
+                const float uniform = nearDepth + (farDepth - nearDepth) * t;
+                m_Splits[i] = m_Lambda * logarithmic + (1.0f - m_Lambda) * uniform;
+            }
+        }
+
+        // Sphere around the view slice between two view depths, in light space. The radius
+        // depends only on the slice's shape, so it holds still while the camera turns.
+        fit fitSlice(const glm::mat4& inverseViewProjection, const glm::mat4& projection, float nearDepth, float farDepth) const {
+            std::array<glm::vec3, 8> corners;
+            for (int d = 0; d < 2; ++d) {
+                const glm::vec4 clip = projection * glm::vec4(0.0f, 0.0f, -(d ? farDepth : nearDepth), 1.0f);
+                const float z = clip.z / clip.w;
+                for (int i = 0; i < 4; ++i) {
+                    glm::vec4 world = inverseViewProjection * glm::vec4(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, z, 1.0f);
+                    corners[d * 4 + i] = glm::vec3(world) / world.w;
+                }
+            }
+
+            glm::vec3 center(0.0f);
+            for (const glm::vec3& c : corners) center += c / 8.0f;
+            float radius = 0.0f;
+            for (const glm::vec3& c : corners) radius = std::max(radius, glm::length(c - center));
+            return { m_LightView * center, std::ceil(radius * 16.0f) / 16.0f };
+        }
+
+        // Moves the center to whole texels of a box of that radius, so the rasterized edges
+        // stay put while it moves
+        static glm::vec3 snap(glm::vec3 center, float radius) {
+            const float texel = 2.0f * radius / SHADOW_MAP_SIZE;
+            center.x = std::floor(center.x / texel) * texel;
+            center.y = std::floor(center.y / texel) * texel;
+            return center;
+        }
+
+        // Orthographic box around the sphere
+        static glm::mat4 boxMatrix(const glm::mat3& lightView, const glm::vec3& center, float radius) {
+            const glm::mat4 projection = glm::ortho(center.x - radius, center.x + radius, center.y - radius, center.y + radius, -(center.z + radius), -(center.z - radius));
+            return projection * glm::mat4(lightView);
+        }
+
+        // Whether the sphere is inside the box the cached layer was drawn with
+        static bool covers(const cascade& c, const fit& f) {
+            const glm::vec3 d = glm::abs(f.center - c.center) + f.radius;
+            return d.x <= c.radius && d.y <= c.radius && d.z <= c.radius;
+        }
+
+        void attach(GLuint texture, int layer) {
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+            const GLfloat far = 1.0f;
+            glClearBufferfv(GL_DEPTH, 0, &far);
+        }
+
+        void upload(bool lit) {
+            gl::shadowData data{};
+            if (lit) {
+                const glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+                for (int i = 0; i < m_Count; ++i) {
+                    data.cascadeMatrices[i] = bias * m_Cascades[i].viewProjection;
+                    data.cascadeSplits[i] = m_Splits[i];
+                    data.cascadeTexels[i] = 2.0f * m_Cascades[i].radius / SHADOW_MAP_SIZE;
+                }
+                data.sunDirection = glm::vec4(m_Direction, float(m_Count));
+                data.sunColor = glm::vec4(m_Color, 0.0f);
+                data.shadowParams = glm::vec4(1.0f / SHADOW_MAP_SIZE, m_NormalOffset, 0.0f, 0.0f);
+                gl::stateCache::get().bindTexture(SHADOW_MAP_UNIT, GL_TEXTURE_2D_ARRAY, m_Map);
+            }
+            gl::sceneUniforms::get().shadows.update(0, data);
+        }
+    public:
+        cascadedShadows() {
+            glGenFramebuffers(1, &m_FBO);
+            glGenFramebuffers(1, &m_ReadFBO);
+
+            // Depth only
+            GLint drawFBO, readFBO;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFBO);
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_FBO);
+            glDrawBuffer(GL_NONE);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, m_ReadFBO);
+            glReadBuffer(GL_NONE);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFBO);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+
+            setLight(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f));
+            upload(false);
+        }
+
+        cascadedShadows(const cascadedShadows&) = delete;
+        cascadedShadows& operator=(const cascadedShadows&) = delete;
+
+        ~cascadedShadows() {
+            gl::stateCache& state = gl::stateCache::get();
+            for (GLuint texture : { m_Map, m_Static }) {
+                if (!texture) continue;
+                state.textureDeleted(texture);
+                glDeleteTextures(1, &texture);
+            }
+            glDeleteFramebuffers(1, &m_FBO);
+            glDeleteFramebuffers(1, &m_ReadFBO);
+            gl::sceneUniforms::get().shadows.update(0, gl::shadowData{});
+        }
+
+        // `direction` points toward the light. A black color turns the light and the shadow
+        // pass off. Turning the light invalidates every cached layer.
+        void setLight(const glm::vec3& direction, const glm::vec3& color) {
+            const glm::vec3 d = glm::normalize(direction);
+            if (d != m_Direction) {
+                m_Direction = d;
+                const glm::vec3 up = std::abs(d.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+                m_LightView = glm::mat3(glm::lookAt(glm::vec3(0.0f), -d, up));
+                invalidate();
+            }
+            m_Color = color;
+        }
+
+        const glm::vec3& getDirection() const { return m_Direction; }
+
+        const glm::vec3& getColor() const { return m_Color; }
+
+        // 1 to SHADOW_CASCADES
+        void setCascadeCount(int count) {
+            m_Count = std::clamp(count, 1, SHADOW_CASCADES);
+            invalidate();
+        }
+
+        const int getCascadeCount() const { return m_Count; }
+
+        // Shadows end at this view depth, or the camera's far plane if that is closer
+        void setMaxDistance(float distance) {
+            m_MaxDistance = distance;
+            invalidate();
+        }
+
+        // 0 splits uniformly, 1 logarithmically
+        void setSplitLambda(float lambda) {
+            m_Lambda = std::clamp(lambda, 0.0f, 1.0f);
+            m_FixedSplits.clear();
+            invalidate();
+        }
+
+        // Far view depth of each cascade, ascending; empty returns to the lambda split
+        void setSplits(std::span<const float> splits) {
+            m_FixedSplits.assign(splits.begin(), splits.end());
+            invalidate();
+        }
+
+        // Cascades from `first` on are cached; SHADOW_CASCADES caches none
+        void setCachedFrom(int first) {
+            m_FirstCached = std::clamp(first, 0, SHADOW_CASCADES);
+            invalidate();
+        }
+
+        // Frames after which a cached layer is redrawn even if nothing invalidated it, to
+        // pick up static objects that moved without telling; 0 never
+        void setRefreshInterval(unsigned frames) { m_RefreshInterval = frames; }
+
+        // At most `refreshes` cached layers redrawn per frame (a layer never drawn is always
+        // drawn). With `gpuMilliseconds` above 0, interval refreshes also wait while the
+        // measured shadow pass is above it.
+        void setBudget(unsigned refreshes, double gpuMilliseconds = 0.0) {
+            m_Budget = refreshes;
+            m_GpuBudget = gpuMilliseconds;
+        }
+
+        // Slope-scaled polygon offset while drawing casters, and how many texels the lookup
+        // moves along the normal
+        void setBias(float slope, float normalOffset) {
+            m_SlopeBias = slope;
+            m_NormalOffset = normalOffset;
+        }
+
+        // Marks every cached layer for a refresh, e.g. after static objects were rebuilt
+        void invalidate() {
+            for (cascade& c : m_Cascades) c.stale = true;
+        }
+
+        const bool enabled() const { return m_Color != glm::vec3(0.0f); }
+
+        // Draws the cascades for a perspective camera and publishes them through ShadowData.
+        // Leaves the framebuffers, viewport and depth state as it found them.
+        void render(std::span<const depthInstance> casters, const glm::mat4& view, const glm::mat4& projection) {
+            auto start = std::chrono::high_resolution_clock::now();
+            m_Stats = {};
+            m_Timer.poll();
+            m_Stats.gpuMilliseconds = m_Timer.milliseconds();
+            if (!enabled()) {
+                upload(false);
+                return;
+            }
+            m_Frame++;
+            allocate();
+
+            // Casters grouped by mesh so culled lists come out in instanced runs
+            m_Casters.assign(casters.begin(), casters.end());
+            std::stable_sort(m_Casters.begin(), m_Casters.end(), [](const depthInstance& a, const depthInstance& b) { return a.mesh < b.mesh; });
+            m_CasterStatic.resize(m_Casters.size());
+            uint64_t staticHash = 14695981039346656037ull;
+            m_Bounds.clear();
+            m_Bounds.reserve(m_Casters.size());
+            for (size_t i = 0; i < m_Casters.size(); ++i) {
+                const depthInstance& caster = m_Casters[i];
+                m_CasterStatic[i] = caster.mesh->isStatic();
+                if (m_CasterStatic[i]) {
+                    staticHash = gl::hash64(&caster.mesh, sizeof(caster.mesh), staticHash);
+                    staticHash = gl::hash64(&caster.model, sizeof(caster.model), staticHash);
+                }
+                m_Bounds.add(caster.mesh->getBounds().transformed(caster.model));
+            }
+            if (staticHash != m_StaticHash) {
+                m_StaticHash = staticHash;
+                invalidate();
+            }
+            m_Stats.casters = static_cast<unsigned>(m_Casters.size());
+            m_Stats.cascades = static_cast<unsigned>(m_Count);
+
+            const float nearDepth = nearPlane(projection);
+            computeSplits(nearDepth, std::min(m_MaxDistance, farPlane(projection)));
+            const glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+
+            // Fit every cascade and pick which cached layers to refresh: the ones that must
+            // be first, then the most overdue, within the budget
+            std::array<bool, SHADOW_CASCADES> refresh{};
+            std::array<fit, SHADOW_CASCADES> fits;
+            unsigned budget = m_Budget;
+            for (int pass = 0; pass < 2; ++pass) {
+                for (int i = 0; i < m_Count; ++i) {
+                    cascade& c = m_Cascades[i];
+                    if (pass == 0) fits[i] = fitSlice(inverseViewProjection, projection, i ? m_Splits[i - 1] : nearDepth, m_Splits[i]);
+                    const fit& f = fits[i];
+                    if (i < m_FirstCached) {
+                        if (pass == 0) {
+                            c.center = snap(f.center, f.radius);
+                            c.radius = f.radius;
+                            c.viewProjection = boxMatrix(m_LightView, c.center, c.radius);
+                        }
+                        continue;
+                    }
+                    if (refresh[i]) continue;
+
+                    const bool required = !c.frame || c.stale || !covers(c, f);
+                    const bool overdue = m_RefreshInterval && m_Frame - c.frame >= m_RefreshInterval && (m_GpuBudget <= 0.0 || m_Stats.gpuMilliseconds <= m_GpuBudget);
+                    if (pass == 0 ? !required : !overdue) continue;
+                    if (c.frame && !budget) {
+                        if (pass == 0) m_Stats.postponed++;
+                        continue;
+                    }
+                    if (c.frame) budget--;
+                    refresh[i] = true;
+
+                    c.radius = std::ceil(f.radius * (1.0f + SHADOW_CACHE_MARGIN) * 16.0f) / 16.0f;
+                    c.center = snap(f.center, c.radius);
+                    c.viewProjection = boxMatrix(m_LightView, c.center, c.radius);
+                    c.frame = m_Frame;
+                    c.stale = false;
+                }
+            }
+
+            // Everything behind the near plane casts into the clamped depth
+            m_Views.resize(m_Count);
+            for (int i = 0; i < m_Count; ++i) {
+                m_Views[i] = gl::frustum::fromMatrix(m_Cascades[i].viewProjection);
+                m_Views[i].planes[4] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            }
+            m_Bounds.cull(m_Views, m_Visible);
+
+            auto isStatic = [this](uint32_t i) { return m_CasterStatic[i] != 0; };
+            auto isDynamic = [this](uint32_t i) { return m_CasterStatic[i] == 0; };
+            m_Draws.clear();
+            for (int i = 0; i < m_Count; ++i) {
+                const bool cached = i >= m_FirstCached;
+                m_StaticPasses[i] = !cached ? m_Draws.collect(m_Casters, m_Visible[i]) : refresh[i] ? m_Draws.collect(m_Casters, m_Visible[i], isStatic) : gl::depthDraws::range{};
+                m_DynamicPasses[i] = cached ? m_Draws.collect(m_Casters, m_Visible[i], isDynamic) : gl::depthDraws::range{};
+            }
+            m_Draws.upload();
+
+            gl::stateCache& state = gl::stateCache::get();
+
+            GLint drawFBO, readFBO, viewport[4], depthFunc;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFBO);
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+            const bool depthTest = state.isEnabled(GL_DEPTH_TEST), cullFace = state.isEnabled(GL_CULL_FACE), blend = state.isEnabled(GL_BLEND);
+
+            m_Timer.begin();
+
+            // Casters with one side only, like floors, still have to block the light
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_FBO);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, m_ReadFBO);
+            glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+            state.enable(GL_DEPTH_TEST);
+            state.depthFunc(GL_LESS);
+            state.depthMask(true);
+            state.disable(GL_CULL_FACE);
+            state.disable(GL_BLEND);
+            glEnable(GL_DEPTH_CLAMP);
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(m_SlopeBias, 1.0f);
+
+            m_Draws.begin();
+
+            for (int i = 0; i < m_Count; ++i) {
+                m_Draws.setViewProjection(m_Cascades[i].viewProjection);
+                if (i < m_FirstCached) {
+                    attach(m_Map, i);
+                    m_Draws.draw(m_StaticPasses[i], m_Stats.draws, m_Stats.instances);
+                    m_Stats.rendered++;
+                    continue;
+                }
+
+                const int layer = i - m_FirstCached;
+                if (refresh[i]) {
+                    attach(m_Static, layer);
+                    m_Draws.draw(m_StaticPasses[i], m_Stats.draws, m_Stats.instances);
+                    m_Stats.refreshed++;
+                }
+                else m_Stats.cached++;
+
+                glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_Map, 0, i);
+                glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_Static, 0, layer);
+                glBlitFramebuffer(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                m_Draws.draw(m_DynamicPasses[i], m_Stats.draws, m_Stats.instances);
+            }
+
+            m_Timer.end();
+
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glDisable(GL_DEPTH_CLAMP);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFBO);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            state.depthFunc(static_cast<GLenum>(depthFunc));
+            state.setEnabled(GL_DEPTH_TEST, depthTest);
+            state.setEnabled(GL_CULL_FACE, cullFace);
+            state.setEnabled(GL_BLEND, blend);
+
+            upload(true);
+            m_Stats.cpuMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // The sampled map, a GL_TEXTURE_2D_ARRAY with one layer per cascade
+        const GLuint getMap() const { return m_Map; }
+
+        // View-projection a cascade was last drawn with
+        const glm::mat4& getCascadeMatrix(int cascade) const { return m_Cascades[cascade].viewProjection; }
+
+        // Far view depth of each cascade, as of the last render
+        const std::array<float, SHADOW_CASCADES>& getSplits() const { return m_Splits; }
+
+        const shadowStats& stats() const { return m_Stats; }
+    };
+
+    // A point light asking for a shadow. `owner` and `index` name it from frame to frame: the
+    // gl::object and the index of its light, or gl::clusteredLights and the light's id.
+    struct shadowLight {
+        const void* owner;
+        uint32_t index;
+        glm::vec3 position;
+        float radius;                   // far plane, nothing past it is lit
+        float priority;                 // scales the screen size the tiles are sized by
+    };
+
+    // Counters for the current frame, in cube faces unless they say otherwise.
+    // gpuMilliseconds comes from a timer query issued a frame or two ago.
+    struct pointShadowStats {
+        unsigned lights = 0;            // asking for a shadow
+        unsigned visible = 0;           // lights whose sphere reaches the view
+        unsigned shadowed = 0;          // lights published
+        unsigned dropped = 0;           // lights the atlas had no room for
+        unsigned refreshed = 0;         // static layer redrawn
+        unsigned overlaid = 0;          // static layer copied in and dynamic casters drawn on top
+        unsigned cached = 0;            // left as they were
+        unsigned direct = 0;            // of lights without a finished static layer, drawn with every caster
+        unsigned postponed = 0;         // refreshes the budget pushed to a later frame
+        unsigned draws = 0;
+        unsigned instances = 0;
+        unsigned casters = 0;
+        float atlasUsed = 0.0f;         // fraction of the atlas handed out
+        double cpuMilliseconds = 0.0;
+        double gpuMilliseconds = 0.0;
+    };
+
+    // Cube shadow maps for point lights, packed as six square tiles per light into one depth
+    // atlas and used by gl::renderQueue through pointShadows(). Only lights whose sphere
+    // reaches the view get a shadow, with a tile size from their projected radius in pixels
+    // times their priority, rounded to a power of two between POINT_SHADOW_MIN_TILE and
+    // POINT_SHADOW_MAX_TILE, and capped so every light in view still fits. Tiles come from a
+    // buddy allocator; a light changes size only when it wants a bigger tile or a quarter of
+    // its own, and a light out of view keeps its tiles for POINT_SHADOW_KEEP_FRAMES unless
+    // one in view needs the room.
+    //
+    // Static casters (gl::object::setStatic) are drawn into a second atlas and cached there
+    // per face, checked against a hash of the static casters the face sees whenever the
+    // static set changes. Each frame a face with dynamic casters, now or last frame, gets
+    // its static tile copied in and the dynamic casters drawn on top; every other face is
+    // left alone. At most setBudget static faces are drawn per frame, most important light
+    // first. Until all six static faces of a light match it (it is new, moved, or changed
+    // tile size), its live tiles are redrawn every frame with static and dynamic casters
+    // alike; a light that moved this frame is left out of the static budget, so only lights
+    // that have stopped spend it. Moving lights are costly, so keep them few or their
+    // priority low.
+    class pointShadows {
+    private:
+        // Tile sizes POINT_SHADOW_MAX_TILE >> level
+        static constexpr int TILE_LEVELS = std::countr_zero(unsigned(POINT_SHADOW_MAX_TILE / POINT_SHADOW_MIN_TILE)) + 1;
+
+        struct face {
+            uint32_t tile = 0;                  // atlas texels, x | y << 16
+            glm::mat4 viewProjection{ 1.0f };
+            uint64_t staticHash = 0;            // of the static casters it was drawn with
+            bool staticDrawn = false;           // static tile matches the light
+            bool check = false;                 // static set changed, compare the hash
+            bool live = false;                  // live tile holds the static tile
+            bool dynamic = false;               // and dynamic casters on top
+        };
+
+        struct entry {
+            const void* owner = nullptr;
+            uint32_t index = 0;
+            glm::vec3 position{ 0.0f };
+            float radius = 0.0f;
+            int size = 0;                       // tile size, 0 without tiles
+            uint64_t seen = 0;                  // frame it was last asked for in view
+            bool moved = false;                 // position or radius changed this frame
+            bool published = false;
+            std::array<face, 6> faces;
+        };
+
+        // One face of an entry, in the per-frame face lists
+        struct faceView {
+            uint32_t entry;
+            int face;
+        };
+
+        struct request {
+            const shadowLight* light;
+            float score;
+            uint32_t slot = 0;
+            int size = 0;                       // tile size it gets, 0 for none
+        };
+
+        gl::depthDraws m_Draws{ "resource/shader/shadow_vert.glsl" };
+        gl::gpuTimer m_Timer;
+
+        GLuint m_Atlas = 0;             // sampled, with comparison
+        GLuint m_Static = 0;            // static casters of every face
+        GLuint m_FBO = 0, m_StaticFBO = 0;
+        GLuint m_Buffer = 0, m_Texture = 0;
+
+        std::array<std::vector<uint32_t>, TILE_LEVELS> m_FreeTiles;
+        unsigned m_TileArea = 0;
+
+        std::vector<entry> m_Entries;               // index = slot
+        std::vector<uint32_t> m_FreeEntries;
+        std::map<std::pair<const void*, uint32_t>, uint32_t> m_Lookup;
+        std::vector<request> m_Requests;
+
+        std::vector<depthInstance> m_StaticCasters, m_DynamicCasters;     // sorted by mesh
+        gl::bvh m_StaticTree;                   // ids index m_StaticCasters
+        gl::cullSet m_DynamicBounds;
+        std::vector<gl::frustum> m_Views;
+        std::vector<faceView> m_StaticFaces, m_LiveFaces, m_DirectFaces;
+        std::vector<std::vector<uint32_t>> m_Visible;
+        std::vector<gl::depthDraws::range> m_StaticPasses, m_DynamicPasses, m_DirectStatic, m_DirectDynamic;
+        std::vector<glm::vec4> m_Data;
+
+        uint64_t m_Frame = 0;
+        uint64_t m_StaticHash = 0;
+        unsigned m_Budget = 12;
+        float m_NormalOffset = 1.5f;
+        float m_SlopeBias = 2.0f;
+
+        pointShadowStats m_Stats;
+
+        static int level(int size) { return std::countr_zero(unsigned(POINT_SHADOW_MAX_TILE / size)); }
+
+        static glm::vec2 origin(uint32_t tile) { return glm::vec2(float(tile & 0xFFFF), float(tile >> 16)); }
+
+        void allocate() {
+            if (m_Atlas) return;
+            gl::stateCache& state = gl::stateCache::get();
+            for (GLuint* texture : { &m_Atlas, &m_Static }) {
+                glGenTextures(1, texture);
+                state.bindTexture(GL_TEXTURE_2D, *texture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, POINT_SHADOW_ATLAS_SIZE, POINT_SHADOW_ATLAS_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture == &m_Atlas ? GL_LINEAR : GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, texture == &m_Atlas ? GL_LINEAR : GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            }
+            state.bindTexture(GL_TEXTURE_2D, m_Atlas);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+            // Depth only
+            GLint drawFBO, readFBO;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFBO);
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+            for (auto [fbo, texture] : { std::pair{ m_FBO, m_Atlas }, std::pair{ m_StaticFBO, m_Static } }) {
+                glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+                glDrawBuffer(GL_NONE);
+                glReadBuffer(GL_NONE);
+                const GLfloat far = 1.0f;
+                glClearBufferfv(GL_DEPTH, 0, &far);
+            }
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFBO);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+        }
+
+        // Splits the smallest free tile big enough down to `size`
+        bool allocateTile(int size, uint32_t& tile) {
+            const int target = level(size);
+            int l = target;
+            while (l >= 0 && m_FreeTiles[l].empty()) l--;
+            if (l < 0) return false;
+            tile = m_FreeTiles[l].back();
+            m_FreeTiles[l].pop_back();
+            for (; l < target; ++l) {
+                const uint32_t half = uint32_t(POINT_SHADOW_MAX_TILE >> l) / 2;
+                m_FreeTiles[l + 1].push_back(tile + half);
+                m_FreeTiles[l + 1].push_back(tile + (half << 16));
+                m_FreeTiles[l + 1].push_back(tile + half + (half << 16));
+            }
+            m_TileArea += unsigned(size * size);
+            return true;
+        }
+
+        // Gives the tile back, merging it with its three buddies while they are all free
+        void freeTile(uint32_t tile, int size) {
+            m_TileArea -= unsigned(size * size);
+            for (int l = level(size); l > 0; --l) {
+                std::vector<uint32_t>& free = m_FreeTiles[l];
+                const uint32_t s = uint32_t(POINT_SHADOW_MAX_TILE >> l);
+                const uint32_t mask = ~(2 * s - 1) & 0xFFFFu;
+                const uint32_t parent = (tile & mask) | (tile & (mask << 16));
+                const std::array<uint32_t, 4> quarters = { parent, parent + s, parent + (s << 16), parent + s + (s << 16) };
+                bool merge = true;
+                for (uint32_t q : quarters)
+                    if (q != tile && std::find(free.begin(), free.end(), q) == free.end()) merge = false;
+                if (!merge) {
+                    free.push_back(tile);
+                    return;
+                }
+                std::erase_if(free, [&](uint32_t t) { return std::find(quarters.begin(), quarters.end(), t) != quarters.end(); });
+                tile = parent;
+            }
+            m_FreeTiles[0].push_back(tile);
+        }
+
+        bool allocateFaces(entry& e, int size) {
+            for (int f = 0; f < 6; ++f) {
+                if (allocateTile(size, e.faces[f].tile)) continue;
+                while (f--) freeTile(e.faces[f].tile, size);
+                return false;
+            }
+            e.size = size;
+            for (face& f : e.faces) {
+                f.staticDrawn = false;
+                f.live = false;
+            }
+            return true;
+        }
+
+        void freeFaces(entry& e) {
+            if (!e.size) return;
+            for (const face& f : e.faces) freeTile(f.tile, e.size);
+            e.size = 0;
+            e.published = false;
+        }
+
+        void release(uint32_t slot) {
+            entry& e = m_Entries[slot];
+            freeFaces(e);
+            m_Lookup.erase({ e.owner, e.index });
+            e = entry{};
+            m_FreeEntries.push_back(slot);
+        }
+
+        // Frees the tiles of the light out of view the longest
+        bool evictOne() {
+            uint32_t oldest = UINT32_MAX;
+            for (uint32_t i = 0; i < m_Entries.size(); ++i) {
+                const entry& e = m_Entries[i];
+                if (e.size && e.seen < m_Frame && (oldest == UINT32_MAX || e.seen < m_Entries[oldest].seen)) oldest = i;
+            }
+            if (oldest == UINT32_MAX) return false;
+            release(oldest);
+            return true;
+        }
+
+        // GL cube face order +X, -X, +Y, -Y, +Z, -Z, widened so the border texels of a tile
+        // still hold depth for the filter
+        void placeFaces(entry& e) {
+            static const std::array<glm::vec3, 6> forward = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+            static const std::array<glm::vec3, 6> up = { glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0) };
+            const float scale = faceScale(e.size);
+            const glm::mat4 projection = glm::perspective(2.0f * std::atan(scale), 1.0f, nearPlane(e.radius), e.radius);
+            for (int f = 0; f < 6; ++f)
+                e.faces[f].viewProjection = projection * glm::lookAt(e.position, e.position + forward[f], up[f]);
+        }
+
+        static float faceScale(int size) { return float(size) / float(size - 2 * POINT_SHADOW_BORDER); }
+
+        static float nearPlane(float radius) { return radius * 0.002f; }
+
+        // Culls `set` against the faces and keeps the lists in m_Visible
+        void cull(const gl::cullSet& set, const std::vector<faceView>& faces) {
+            m_Views.resize(faces.size());
+            for (size_t i = 0; i < faces.size(); ++i) m_Views[i] = gl::frustum::fromMatrix(m_Entries[faces[i].entry].faces[faces[i].face].viewProjection);
+            set.cull(m_Views, m_Visible);
+        }
+
+        // Static casters only change with the static set, so they are found through a BVH
+        // built then; a face sees a few of them out of many. Sorted, the lists still come
+        // out in instanced runs.
+        void cull(const gl::bvh& tree, const std::vector<faceView>& faces) {
+            m_Visible.resize(faces.size());
+            for (size_t i = 0; i < faces.size(); ++i) {
+                tree.query(gl::frustum::fromMatrix(m_Entries[faces[i].entry].faces[faces[i].face].viewProjection), m_Visible[i]);
+                std::sort(m_Visible[i].begin(), m_Visible[i].end());
+            }
+        }
+
+        uint64_t hashVisible(const std::vector<uint32_t>& visible) const {
+            uint64_t hash = 14695981039346656037ull;
+            for (uint32_t i : visible) {
+                hash = gl::hash64(&m_StaticCasters[i].mesh, sizeof(gl::object*), hash);
+                hash = gl::hash64(&m_StaticCasters[i].model, sizeof(glm::mat4), hash);
+            }
+            return hash;
+        }
+
+        void tile(const entry& e, const face& f) {
+            const glm::vec2 o = origin(f.tile);
+            glViewport(GLint(o.x), GLint(o.y), e.size, e.size);
+            glScissor(GLint(o.x), GLint(o.y), e.size, e.size);
+        }
+
+        // Five texels per slot: position and far plane; near plane, face scale, tile size and
+        // normal offset; the six tile origins, two per texel
+        void upload() {
+            m_Data.assign(m_Entries.size() * 5, glm::vec4(0.0f));
+            for (size_t i = 0; i < m_Entries.size(); ++i) {
+                const entry& e = m_Entries[i];
+                if (!e.published) continue;
+                const float scale = faceScale(e.size);
+                glm::vec4* texels = &m_Data[i * 5];
+                texels[0] = glm::vec4(e.position, e.radius);
+                texels[1] = glm::vec4(nearPlane(e.radius), 1.0f / scale, float(e.size) / POINT_SHADOW_ATLAS_SIZE, m_NormalOffset * 2.0f * scale / float(e.size));
+                for (int f = 0; f < 6; ++f) {
+                    const glm::vec2 o = origin(e.faces[f].tile) / float(POINT_SHADOW_ATLAS_SIZE);
+                    texels[2 + f / 2][(f & 1) * 2] = o.x;
+                    texels[2 + f / 2][(f & 1) * 2 + 1] = o.y;
+                }
+            }
+
+            gl::stateCache& state = gl::stateCache::get();
+            const size_t bytes = m_Data.size() * sizeof(glm::vec4);
+            state.bindBuffer(GL_TEXTURE_BUFFER, m_Buffer);
+            glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+            if (bytes) glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, m_Data.data());
+            state.bindTexture(POINT_SHADOW_DATA_UNIT, GL_TEXTURE_BUFFER, m_Texture);
+            if (m_Atlas) state.bindTexture(POINT_SHADOW_ATLAS_UNIT, GL_TEXTURE_2D, m_Atlas);
+        }
+    public:
+        pointShadows() {
+            glGenFramebuffers(1, &m_FBO);
+            glGenFramebuffers(1, &m_StaticFBO);
+            glGenBuffers(1, &m_Buffer);
+            glGenTextures(1, &m_Texture);
+
+            gl::stateCache& state = gl::stateCache::get();
+            state.bindBuffer(GL_TEXTURE_BUFFER, m_Buffer);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            state.bindTexture(GL_TEXTURE_BUFFER, m_Texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_Buffer);
+
+            for (uint32_t y = 0; y < POINT_SHADOW_ATLAS_SIZE; y += POINT_SHADOW_MAX_TILE)
+                for (uint32_t x = 0; x < POINT_SHADOW_ATLAS_SIZE; x += POINT_SHADOW_MAX_TILE) m_FreeTiles[0].push_back(x | (y << 16));
+        }
+
+        pointShadows(const pointShadows&) = delete;
+        pointShadows& operator=(const pointShadows&) = delete;
+
+        ~pointShadows() {
+            gl::stateCache& state = gl::stateCache::get();
+            for (GLuint texture : { m_Atlas, m_Static, m_Texture }) {
+                if (!texture) continue;
+                state.textureDeleted(texture);
+                glDeleteTextures(1, &texture);
+            }
+            state.bufferDeleted(m_Buffer);
+            glDeleteBuffers(1, &m_Buffer);
+            glDeleteFramebuffers(1, &m_FBO);
+            glDeleteFramebuffers(1, &m_StaticFBO);
+        }
+
+        // At most this many cube faces get their static casters drawn per frame
+        void setBudget(unsigned faces) { m_Budget = faces; }
+
+        // Slope-scaled polygon offset while drawing casters, and how many texels the lookup
+        // moves along the normal
+        void setBias(float slope, float normalOffset) {
+            m_SlopeBias = slope;
+            m_NormalOffset = normalOffset;
+        }
+
+        // Redraws every cached face, within the budget, e.g. after static objects were rebuilt
+        void invalidate() {
+            for (entry& e : m_Entries)
+                for (face& f : e.faces) {
+                    f.staticHash = 0;
+                    f.check = true;
+                }
+        }
+
+        // Assigns the atlas, draws the faces this frame needs and publishes the finished lights
+        // to pointShadowData; slot() then names each light's record. Leaves the framebuffers,
+        // viewport and depth state as it found them.
+        void render(std::span<const shadowLight> lights, std::span<const depthInstance> casters, const glm::mat4& view, const glm::mat4& projection) {
+            auto start = std::chrono::high_resolution_clock::now();
+            m_Stats = {};
+            m_Timer.poll();
+            m_Stats.gpuMilliseconds = m_Timer.milliseconds();
+            m_Frame++;
+
+            for (uint32_t i = 0; i < m_Entries.size(); ++i) {
+                entry& e = m_Entries[i];
+                e.published = false;
+                if (e.owner && m_Frame - e.seen > POINT_SHADOW_KEEP_FRAMES) release(i);
+            }
+
+            // Lights in view, most important first
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            const float pixels = projection[1][1] * float(viewport[3]) * 0.5f;
+            const glm::vec3 camPos = glm::vec3(glm::inverse(view)[3]);
+            const gl::frustum camera = gl::frustum::fromCamera(view, projection);
+            m_Requests.clear();
+            for (const shadowLight& light : lights) {
+                if (light.priority <= 0.0f || light.radius <= 0.0f) continue;
+                m_Stats.lights++;
+                if (!camera.intersects(gl::boundingSphere{ light.position, light.radius })) continue;
+                const float distance = glm::length(light.position - camPos);
+                const float projected = distance > light.radius ? light.radius / distance * pixels : float(POINT_SHADOW_MAX_TILE);
+                m_Requests.push_back({ &light, projected * light.priority });
+            }
+            m_Stats.visible = static_cast<unsigned>(m_Requests.size());
+            std::stable_sort(m_Requests.begin(), m_Requests.end(), [](const request& a, const request& b) { return a.score > b.score; });
+            if (!m_Requests.empty()) allocate();
+
+            // Casters grouped by mesh so culled lists come out in instanced runs
+            m_StaticCasters.clear();
+            m_DynamicCasters.clear();
+            for (const depthInstance& caster : casters) (caster.mesh->isStatic() ? m_StaticCasters : m_DynamicCasters).push_back(caster);
+            auto byMesh = [](const depthInstance& a, const depthInstance& b) { return a.mesh < b.mesh; };
+            std::stable_sort(m_StaticCasters.begin(), m_StaticCasters.end(), byMesh);
+            std::stable_sort(m_DynamicCasters.begin(), m_DynamicCasters.end(), byMesh);
+            m_Stats.casters = static_cast<unsigned>(casters.size());
+
+            uint64_t staticHash = 14695981039346656037ull;
+            for (const depthInstance& caster : m_StaticCasters) {
+                staticHash = gl::hash64(&caster.mesh, sizeof(caster.mesh), staticHash);
+                staticHash = gl::hash64(&caster.model, sizeof(caster.model), staticHash);
+            }
+            if (staticHash != m_StaticHash) {
+                m_StaticHash = staticHash;
+                m_StaticTree.clear();
+                for (const depthInstance& caster : m_StaticCasters) m_StaticTree.insert(caster.mesh->getBounds().transformed(caster.model));
+                m_StaticTree.build();
+                for (entry& e : m_Entries)
+                    for (face& f : e.faces) f.check = true;
+            }
+            m_DynamicBounds.clear();
+            m_DynamicBounds.reserve(m_DynamicCasters.size());
+            for (const depthInstance& caster : m_DynamicCasters) m_DynamicBounds.add(caster.mesh->getBounds().transformed(caster.model));
+
+            // Tile sizes, leaving room for every light after this one at the smallest size.
+            // A light keeps its tiles while they fit and are at most twice what it wants; the
+            // others are freed before anything is allocated.
+            int64_t left = int64_t(POINT_SHADOW_ATLAS_SIZE) * POINT_SHADOW_ATLAS_SIZE;
+            for (size_t i = 0; i < m_Requests.size(); ++i) {
+                request& r = m_Requests[i];
+                const shadowLight& light = *r.light;
+                auto it = m_Lookup.find({ light.owner, light.index });
+                if (it != m_Lookup.end()) r.slot = it->second;
+                else {
+                    if (!m_FreeEntries.empty()) {
+                        r.slot = m_FreeEntries.back();
+                        m_FreeEntries.pop_back();
+                    }
+                    else {
+                        r.slot = static_cast<uint32_t>(m_Entries.size());
+                        m_Entries.emplace_back();
+                    }
+                    m_Entries[r.slot].owner = light.owner;
+                    m_Entries[r.slot].index = light.index;
+                    m_Lookup[{ light.owner, light.index }] = r.slot;
+                }
+                entry& e = m_Entries[r.slot];
+                e.seen = m_Frame;
+                e.moved = e.position != light.position || e.radius != light.radius;
+                if (e.moved) {
+                    e.position = light.position;
+                    e.radius = light.radius;
+                    for (face& f : e.faces) f.staticDrawn = false;
+                }
+
+                const int64_t reserve = int64_t(m_Requests.size() - i - 1) * 6 * POINT_SHADOW_MIN_TILE * POINT_SHADOW_MIN_TILE;
+                int cap = POINT_SHADOW_MAX_TILE;
+                while (cap >= POINT_SHADOW_MIN_TILE && int64_t(6) * cap * cap + reserve > left) cap /= 2;
+                const int desired = std::min(cap, std::clamp(int(std::bit_ceil(std::max(1u, unsigned(r.score)))), POINT_SHADOW_MIN_TILE, POINT_SHADOW_MAX_TILE));
+                if (e.size && (e.size > cap || desired > e.size || desired * 4 <= e.size)) freeFaces(e);
+                r.size = e.size ? e.size : cap >= POINT_SHADOW_MIN_TILE ? desired : 0;
+                left -= int64_t(6) * r.size * r.size;
+            }
+
+            // Room the allocator cannot find comes from lights out of view, else the tiles get
+            // smaller
+            for (request& r : m_Requests) {
+                entry& e = m_Entries[r.slot];
+                for (int size = r.size; !e.size && size >= POINT_SHADOW_MIN_TILE;) {
+                    if (allocateFaces(e, size) || evictOne()) continue;
+                    size /= 2;
+                }
+                if (!e.size) {
+                    m_Stats.dropped++;
+                    continue;
+                }
+                placeFaces(e);
+            }
+
+            // Faces whose static tile is missing, or whose static casters may have changed. A
+            // light still moving would throw the tiles away next frame.
+            m_StaticFaces.clear();
+            for (const request& r : m_Requests) {
+                const entry& e = m_Entries[r.slot];
+                if (!e.size || e.moved) continue;
+                for (int f = 0; f < 6; ++f)
+                    if (!e.faces[f].staticDrawn || e.faces[f].check) m_StaticFaces.push_back({ r.slot, f });
+            }
+            cull(m_StaticTree, m_StaticFaces);
+
+            // The budget goes to missing faces before changed ones, in light order
+            std::vector<uint8_t> refresh(m_StaticFaces.size(), 0);
+            unsigned budget = m_Budget;
+            for (int pass = 0; pass < 2; ++pass) {
+                for (size_t i = 0; i < m_StaticFaces.size(); ++i) {
+                    face& f = m_Entries[m_StaticFaces[i].entry].faces[m_StaticFaces[i].face];
+                    if (pass == 0 ? f.staticDrawn : !f.staticDrawn) continue;
+                    const uint64_t hash = hashVisible(m_Visible[i]);
+                    if (f.staticDrawn && hash == f.staticHash) {
+                        f.check = false;
+                        continue;
+                    }
+                    if (!budget) {
+                        m_Stats.postponed++;
+                        continue;
+                    }
+                    budget--;
+                    refresh[i] = 1;
+                    f.staticHash = hash;
+                    f.staticDrawn = true;
+                    f.check = false;
+                    f.live = false;
+                }
+            }
+
+            m_Draws.clear();
+            m_StaticPasses.clear();
+            size_t kept = 0;
+            for (size_t i = 0; i < m_StaticFaces.size(); ++i) {
+                if (!refresh[i]) continue;
+                m_StaticPasses.push_back(m_Draws.collect(m_StaticCasters, m_Visible[i]));
+                m_StaticFaces[kept++] = m_StaticFaces[i];
+            }
+            m_StaticFaces.resize(kept);
+
+            // Every face of a finished light is culled against the dynamic casters; the ones
+            // with some, now or last frame, or with a newer static tile get their live tile
+            // redrawn. Unfinished lights draw all their casters straight into the live tiles.
+            m_LiveFaces.clear();
+            m_DirectFaces.clear();
+            for (const request& r : m_Requests) {
+                entry& e = m_Entries[r.slot];
+                e.published = e.size != 0;
+                if (!e.published) continue;
+                m_Stats.shadowed++;
+                const bool finished = std::all_of(e.faces.begin(), e.faces.end(), [](const face& f) { return f.staticDrawn; });
+                for (int f = 0; f < 6; ++f) (finished ? m_LiveFaces : m_DirectFaces).push_back({ r.slot, f });
+            }
+            cull(m_DynamicBounds, m_LiveFaces);
+
+            m_DynamicPasses.clear();
+            kept = 0;
+            for (size_t i = 0; i < m_LiveFaces.size(); ++i) {
+                face& f = m_Entries[m_LiveFaces[i].entry].faces[m_LiveFaces[i].face];
+                const bool dynamic = !m_Visible[i].empty();
+                if (f.live && !dynamic && !f.dynamic) {
+                    m_Stats.cached++;
+                    continue;
+                }
+                f.live = true;
+                f.dynamic = dynamic;
+                m_DynamicPasses.push_back(m_Draws.collect(m_DynamicCasters, m_Visible[i]));
+                m_LiveFaces[kept++] = m_LiveFaces[i];
+            }
+            m_LiveFaces.resize(kept);
+
+            // The live tile no longer holds the static one, so it is copied in again once the
+            // light is finished
+            cull(m_StaticTree, m_DirectFaces);
+            m_DirectStatic.clear();
+            for (size_t i = 0; i < m_DirectFaces.size(); ++i) {
+                face& f = m_Entries[m_DirectFaces[i].entry].faces[m_DirectFaces[i].face];
+                f.live = false;
+                m_DirectStatic.push_back(m_Draws.collect(m_StaticCasters, m_Visible[i]));
+            }
+            cull(m_DynamicBounds, m_DirectFaces);
+            m_DirectDynamic.clear();
+            for (size_t i = 0; i < m_DirectFaces.size(); ++i) m_DirectDynamic.push_back(m_Draws.collect(m_DynamicCasters, m_Visible[i]));
+            m_Draws.upload();
+
+            if (!m_StaticFaces.empty() || !m_LiveFaces.empty() || !m_DirectFaces.empty()) {
+                gl::stateCache& state = gl::stateCache::get();
+                GLint drawFBO, readFBO, depthFunc;
+                glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFBO);
+                glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+                glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+                const bool depthTest = state.isEnabled(GL_DEPTH_TEST), cullFace = state.isEnabled(GL_CULL_FACE), blend = state.isEnabled(GL_BLEND);
+
+                m_Timer.begin();
+
+                // Casters with one side only, like floors, still have to block the light
+                state.enable(GL_DEPTH_TEST);
+                state.depthFunc(GL_LESS);
+                state.depthMask(true);
+                state.disable(GL_CULL_FACE);
+                state.disable(GL_BLEND);
+                glEnable(GL_SCISSOR_TEST);
+                glEnable(GL_POLYGON_OFFSET_FILL);
+                glPolygonOffset(m_SlopeBias, 1.0f);
+                m_Draws.begin();
+
+                const GLfloat far = 1.0f;
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_StaticFBO);
+                for (size_t i = 0; i < m_StaticFaces.size(); ++i) {
+                    const entry& e = m_Entries[m_StaticFaces[i].entry];
+                    const face& f = e.faces[m_StaticFaces[i].face];
+                    tile(e, f);
+                    glClearBufferfv(GL_DEPTH, 0, &far);
+                    m_Draws.setViewProjection(f.viewProjection);
+                    m_Draws.draw(m_StaticPasses[i], m_Stats.draws, m_Stats.instances);
+                    m_Stats.refreshed++;
+                }
+
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_FBO);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, m_StaticFBO);
+                for (size_t i = 0; i < m_LiveFaces.size(); ++i) {
+                    const entry& e = m_Entries[m_LiveFaces[i].entry];
+                    const face& f = e.faces[m_LiveFaces[i].face];
+                    tile(e, f);
+                    const glm::ivec2 o = glm::ivec2(origin(f.tile));
+                    glBlitFramebuffer(o.x, o.y, o.x + e.size, o.y + e.size, o.x, o.y, o.x + e.size, o.y + e.size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                    m_Draws.setViewProjection(f.viewProjection);
+                    m_Draws.draw(m_DynamicPasses[i], m_Stats.draws, m_Stats.instances);
+                    m_Stats.overlaid++;
+                }
+
+                for (size_t i = 0; i < m_DirectFaces.size(); ++i) {
+                    const entry& e = m_Entries[m_DirectFaces[i].entry];
+                    const face& f = e.faces[m_DirectFaces[i].face];
+                    tile(e, f);
+                    glClearBufferfv(GL_DEPTH, 0, &far);
+                    m_Draws.setViewProjection(f.viewProjection);
+                    m_Draws.draw(m_DirectStatic[i], m_Stats.draws, m_Stats.instances);
+                    m_Draws.draw(m_DirectDynamic[i], m_Stats.draws, m_Stats.instances);
+                    m_Stats.direct++;
+                }
+
+                m_Timer.end();
+
+                glDisable(GL_POLYGON_OFFSET_FILL);
+                glDisable(GL_SCISSOR_TEST);
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFBO);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+                glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+                state.depthFunc(static_cast<GLenum>(depthFunc));
+                state.setEnabled(GL_DEPTH_TEST, depthTest);
+                state.setEnabled(GL_CULL_FACE, cullFace);
+                state.setEnabled(GL_BLEND, blend);
+            }
+
+            upload();
+            m_Stats.atlasUsed = float(m_TileArea) / float(POINT_SHADOW_ATLAS_SIZE * POINT_SHADOW_ATLAS_SIZE);
+            m_Stats.cpuMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // Record of a light in pointShadowData as of the last render, -1 when it has no shadow
+        const int32_t slot(const void* owner, uint32_t index) const {
+            auto it = m_Lookup.find({ owner, index });
+            return it != m_Lookup.end() && m_Entries[it->second].published ? static_cast<int32_t>(it->second) : -1;
+        }
+
+        // The sampled atlas, a GL_TEXTURE_2D of POINT_SHADOW_ATLAS_SIZE with comparison
+        const GLuint getAtlas() const { return m_Atlas; }
+
+        const pointShadowStats& stats() const { return m_Stats; }
+    };
+
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+#include <cstdint>
+
+// Texture units the cache shadows; binds past this go straight to GL
+#ifndef STATE_CACHE_TEXTURE_UNITS
+
+    #define STATE_CACHE_TEXTURE_UNITS 32
+
+#endif // STATE_CACHE_TEXTURE_UNITS
+
+namespace gl {
+
+    struct stateCacheStats {
+        unsigned issued = 0;
+        unsigned skipped = 0;
+    };
+
+    // Shadow copy of the binding and fixed-function state the renderer touches every draw.
+    // Each setter compares against the shadow and only calls GL on a change. Everything
+    // starts out unknown, so the first call always goes through; code that changes this
+    // state with raw GL calls must call invalidate() afterwards. One per context.
+    class stateCache {
+    private:
+        static constexpr GLuint unknown = 0xFFFFFFFFu;
+
+        enum textureTarget { Texture2D, Texture2DArray, Texture3D, TextureCubeMap, TextureBuffer, TextureTargetCount };
+
+        enum capability { Blend, DepthTest, CullFace, CapabilityCount };
+
+        GLuint m_Program;
+        GLuint m_VertexArray;
+        GLuint m_ArrayBuffer;
+        GLuint m_UniformBuffer;
+        GLuint m_ActiveUnit;
+        std::array<std::array<GLuint, TextureTargetCount>, STATE_CACHE_TEXTURE_UNITS> m_Textures;
+        std::array<GLuint, STATE_CACHE_TEXTURE_UNITS> m_Samplers;
+        std::array<GLuint, CapabilityCount> m_Capabilities;     // 0, 1 or unknown
+        GLuint m_DepthMask;
+        GLenum m_DepthFunc;
+        GLenum m_CullFace;
+        GLenum m_BlendSrc, m_BlendDst;
+
+        stateCacheStats m_Stats;
+        stateCacheStats m_LastFrame;
+
+        static int targetIndex(GLenum target) {
+            switch (target) {
+            case GL_TEXTURE_2D: return Texture2D;
+            case GL_TEXTURE_2D_ARRAY: return Texture2DArray;
+            case GL_TEXTURE_3D: return Texture3D;
+            case GL_TEXTURE_CUBE_MAP: return TextureCubeMap;
+            case GL_TEXTURE_BUFFER: return TextureBuffer;
+            default: return -1;
+            }
+        }
+
+        static int capabilityIndex(GLenum cap) {
+            switch (cap) {
+            case GL_BLEND: return Blend;
+            case GL_DEPTH_TEST: return DepthTest;
+            case GL_CULL_FACE: return CullFace;
+            default: return -1;
+            }
+        }
+
+        // True when `shadow` already holds `value`; otherwise stores it and counts an issued call
+        bool same(GLuint& shadow, GLuint value) {
+            if (shadow == value) {
+                m_Stats.skipped++;
+                return true;
+            }
+            shadow = value;
+            m_Stats.issued++;
+            return false;
+        }
+    public:
+        stateCache() { invalidate(); }
+
+        static stateCache& get() {
+            static stateCache cache;
+            return cache;
+        }
+
+        // Forget everything, e.g. after a third-party library (ImGui) touched GL state
+        void invalidate() {
+            m_Program = m_VertexArray = m_ArrayBuffer = m_UniformBuffer = m_ActiveUnit = unknown;
+            for (auto& unit : m_Textures) unit.fill(unknown);
+            m_Samplers.fill(unknown);
+            m_Capabilities.fill(unknown);
+            m_DepthMask = m_DepthFunc = m_CullFace = m_BlendSrc = m_BlendDst = unknown;
+        }
+
+        void useProgram(GLuint program) {
+            if (!same(m_Program, program)) glUseProgram(program);
+        }
+
+        void bindVertexArray(GLuint vertexArray) {
+            if (!same(m_VertexArray, vertexArray)) glBindVertexArray(vertexArray);
+        }
+
+        // GL_ELEMENT_ARRAY_BUFFER is VAO state, so it and other targets are passed through
+        void bindBuffer(GLenum target, GLuint buffer) {
+            if (target == GL_ARRAY_BUFFER) {
+                if (!same(m_ArrayBuffer, buffer)) glBindBuffer(target, buffer);
+            }
+            else if (target == GL_UNIFORM_BUFFER) {
+                if (!same(m_UniformBuffer, buffer)) glBindBuffer(target, buffer);
+            }
+            else {
+                m_Stats.issued++;
+                glBindBuffer(target, buffer);
+            }
+        }
+
+        // Indexed binds also replace the generic binding point
+        void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+            m_Stats.issued++;
+            glBindBufferRange(target, index, buffer, offset, size);
+            if (target == GL_UNIFORM_BUFFER) m_UniformBuffer = buffer;
+        }
+
+        void activeTexture(GLuint unit) {
+            if (!same(m_ActiveUnit, unit)) glActiveTexture(GL_TEXTURE0 + unit);
+        }
+
+        void bindTexture(GLuint unit, GLenum target, GLuint texture) {
+            int t = targetIndex(target);
+            if (unit >= STATE_CACHE_TEXTURE_UNITS || t < 0) {
+                activeTexture(unit);
+                m_Stats.issued++;
+                glBindTexture(target, texture);
+                return;
+            }
+
+            GLuint& shadow = m_Textures[unit][t];
+            if (shadow == texture) {
+                m_Stats.skipped++;
+                return;
+            }
+            activeTexture(unit);
+            shadow = texture;
+            m_Stats.issued++;
+            glBindTexture(target, texture);
+        }
+
+        // On whichever unit is active, for creating and uploading textures
+        void bindTexture(GLenum target, GLuint texture) {
+            if (m_ActiveUnit == unknown) activeTexture(0);
+            bindTexture(m_ActiveUnit, target, texture);
+        }
+
+        void bindSampler(GLuint unit, GLuint sampler) {
+            if (unit >= STATE_CACHE_TEXTURE_UNITS) {
+                m_Stats.issued++;
+                glBindSampler(unit, sampler);
+            }
+            else if (!same(m_Samplers[unit], sampler)) glBindSampler(unit, sampler);
+        }
+
+        void setEnabled(GLenum cap, bool enabled) {
+            int c = capabilityIndex(cap);
+            if (c >= 0 && same(m_Capabilities[c], enabled ? 1 : 0)) return;
+            if (c < 0) m_Stats.issued++;
+            if (enabled) glEnable(cap);
+            else glDisable(cap);
+        }
+
+        void enable(GLenum cap) { setEnabled(cap, true); }
+
+        void disable(GLenum cap) { setEnabled(cap, false); }
+
+        // Shadowed value, or GL's when it is unknown
+        bool isEnabled(GLenum cap) {
+            int c = capabilityIndex(cap);
+            if (c < 0) return glIsEnabled(cap) == GL_TRUE;
+            if (m_Capabilities[c] == unknown) m_Capabilities[c] = glIsEnabled(cap) == GL_TRUE ? 1 : 0;
+            return m_Capabilities[c] == 1;
+        }
+
+        void depthMask(bool write) {
+            if (!same(m_DepthMask, write ? GL_TRUE : GL_FALSE)) glDepthMask(write ? GL_TRUE : GL_FALSE);
+        }
+
+        void depthFunc(GLenum func) {
+            if (!same(m_DepthFunc, func)) glDepthFunc(func);
+        }
+
+        void cullFace(GLenum mode) {
+            if (!same(m_CullFace, mode)) glCullFace(mode);
+        }
+
+        void blendFunc(GLenum src, GLenum dst) {
+            if (m_BlendSrc == src && m_BlendDst == dst) {
+                m_Stats.skipped++;
+                return;
+            }
+            m_BlendSrc = src;
+            m_BlendDst = dst;
+            m_Stats.issued++;
+            glBlendFunc(src, dst);
+        }
+
+        // Deleting a bound object reverts its bindings to 0 in GL; the shadow has to follow
+        // or a recycled name would look already bound
+        void textureDeleted(GLuint texture) {
+            for (auto& unit : m_Textures)
+                for (GLuint& bound : unit)
+                    if (bound == texture) bound = 0;
+        }
+
+        void vertexArrayDeleted(GLuint vertexArray) {
+            if (m_VertexArray == vertexArray) m_VertexArray = 0;
+        }
+
+        void bufferDeleted(GLuint buffer) {
+            if (m_ArrayBuffer == buffer) m_ArrayBuffer = 0;
+            if (m_UniformBuffer == buffer) m_UniformBuffer = 0;
+        }
+
+        // A deleted program stays current until replaced, so only its name is unreliable
+        void programDeleted(GLuint program) {
+            if (m_Program == program) m_Program = unknown;
+        }
+
+        const GLuint getProgram() const { return m_Program; }
+
+        // The program in use, asked of the driver once when the cache does not know it
+        GLuint boundProgram() {
+            if (m_Program == unknown) {
+                GLint program = 0;
+                glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+                m_Program = static_cast<GLuint>(program);
+            }
+            return m_Program;
+        }
+
+        const GLuint getVertexArray() const { return m_VertexArray; }
+
+        // Called once per frame by gl::window::swapBuffers
+        void endFrame() {
+            m_LastFrame = m_Stats;
+            m_Stats = {};
+        }
+
+        const stateCacheStats& stats() const { return m_Stats; }
+
+        const stateCacheStats& lastFrame() const { return m_LastFrame; }
+    };
+
+}
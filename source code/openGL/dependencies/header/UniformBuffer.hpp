@@ -0,0 +1,265 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <GL/glew.h>
+
+#include <glm.hpp>
+
+#include <Utils.hpp>
+#include <StateCache.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Matches MAX_LIGHTS in uniforms.glsl
+#ifndef MAX_LIGHTS
+
+    #define MAX_LIGHTS 8
+
+#endif // MAX_LIGHTS
+
+// Matches SHADOW_CASCADES in uniforms.glsl, at most 4 so the splits fit a vec4
+#ifndef SHADOW_CASCADES
+
+    #define SHADOW_CASCADES 4
+
+#endif // SHADOW_CASCADES
+
+static_assert(SHADOW_CASCADES >= 1 && SHADOW_CASCADES <= 4, "cascade splits are packed in a vec4");
+
+namespace gl {
+
+    // std140 rules for the C++ side of a uniform block. Block structs declare their members
+    // with the same base alignment GLSL uses (alignas(16) on vec3s, std140::array for arrays)
+    // and the compiler inserts the padding. Each struct also lists its member types in a
+    // std140::layout so the offsets are checked against the spec with static_assert.
+    namespace std140 {
+
+        template <class T> struct rules;
+
+        template <> struct rules<float> { static constexpr size_t align = 4, size = 4; };
+        template <> struct rules<int32_t> { static constexpr size_t align = 4, size = 4; };
+        template <> struct rules<uint32_t> { static constexpr size_t align = 4, size = 4; };
+        template <> struct rules<glm::vec2> { static constexpr size_t align = 8, size = 8; };
+        template <> struct rules<glm::vec3> { static constexpr size_t align = 16, size = 12; };
+        template <> struct rules<glm::vec4> { static constexpr size_t align = 16, size = 16; };
+        template <> struct rules<glm::ivec4> { static constexpr size_t align = 16, size = 16; };
+        template <> struct rules<glm::mat4> { static constexpr size_t align = 16, size = 64; };
+
+        constexpr size_t roundUp(size_t value, size_t align) { return (value + align - 1) / align * align; }
+
+        // Array elements are padded to a vec4 stride
+        template <class T, size_t N>
+        struct array {
+            struct alignas(16) element { T value; };
+            element elements[N];
+
+            T& operator[](size_t i) { return elements[i].value; }
+            const T& operator[](size_t i) const { return elements[i].value; }
+
+            static constexpr size_t count = N;
+        };
+
+        template <class T, size_t N> struct rules<array<T, N>> {
+            static constexpr size_t align = 16;
+            static constexpr size_t size = N * roundUp(rules<T>::size, 16);
+        };
+
+        template <class... Ts>
+        struct layout {
+            static constexpr std::array<size_t, sizeof...(Ts)> offsets = [] {
+                std::array<size_t, sizeof...(Ts)> result{};
+                size_t offset = 0, i = 0;
+                ((offset = roundUp(offset, rules<Ts>::align), result[i++] = offset, offset += rules<Ts>::size), ...);
+                return result;
+            }();
+
+            // A block's size is rounded up to a vec4
+            static constexpr size_t size = [] {
+                size_t offset = 0;
+                ((offset = roundUp(offset, rules<Ts>::align) + rules<Ts>::size), ...);
+                return roundUp(offset, 16);
+            }();
+
+            template <size_t I>
+            static constexpr size_t offset = offsets[I];
+        };
+    }
+
+    struct frameData {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 viewProjection;
+        alignas(16) glm::vec3 camPos;
+        float time;
+
+        using layout = std140::layout<glm::mat4, glm::mat4, glm::mat4, glm::vec3, float>;
+    };
+
+    static_assert(offsetof(frameData, projection) == frameData::layout::offset<1>);
+    static_assert(offsetof(frameData, viewProjection) == frameData::layout::offset<2>);
+    static_assert(offsetof(frameData, camPos) == frameData::layout::offset<3>);
+    static_assert(offsetof(frameData, time) == frameData::layout::offset<4>);
+    static_assert(sizeof(frameData) == frameData::layout::size);
+
+    struct lightData {
+        std140::array<glm::vec3, MAX_LIGHTS> lightPos;
+        std140::array<glm::vec3, MAX_LIGHTS> lightColor;
+        std140::array<int32_t, MAX_LIGHTS> lightShadow;     // point shadow slot, -1 for none
+        int32_t numLights;
+
+        using layout = std140::layout<std140::array<glm::vec3, MAX_LIGHTS>, std140::array<glm::vec3, MAX_LIGHTS>, std140::array<int32_t, MAX_LIGHTS>, int32_t>;
+    };
+
+    static_assert(offsetof(lightData, lightColor) == lightData::layout::offset<1>);
+    static_assert(offsetof(lightData, lightShadow) == lightData::layout::offset<2>);
+    static_assert(offsetof(lightData, numLights) == lightData::layout::offset<3>);
+    static_assert(sizeof(lightData) == lightData::layout::size);
+
+    // Clustered light grid parameters, filled by gl::clusteredLights
+    struct clusterData {
+        glm::ivec4 clusterSize;         // x, y, z cells and the scene light count
+        glm::vec4 clusterDepth;         // slice = log(view depth) * x + y
+        glm::vec4 clusterViewport;      // origin in pixels, reciprocal size
+
+        using layout = std140::layout<glm::ivec4, glm::vec4, glm::vec4>;
+    };
+
+    static_assert(offsetof(clusterData, clusterDepth) == clusterData::layout::offset<1>);
+    static_assert(offsetof(clusterData, clusterViewport) == clusterData::layout::offset<2>);
+    static_assert(sizeof(clusterData) == clusterData::layout::size);
+
+    // Directional light and shadow cascades, filled by gl::cascadedShadows
+    struct shadowData {
+        std140::array<glm::mat4, SHADOW_CASCADES> cascadeMatrices;     // world to shadow map uv and depth
+        glm::vec4 cascadeSplits;        // far view depth of each cascade
+        glm::vec4 cascadeTexels;        // world size of a texel in each cascade
+        glm::vec4 sunDirection;         // toward the light, w = cascade count or 0 without a light
+        glm::vec4 sunColor;
+        glm::vec4 shadowParams;         // reciprocal map size, normal offset in texels
+
+        using layout = std140::layout<std140::array<glm::mat4, SHADOW_CASCADES>, glm::vec4, glm::vec4, glm::vec4, glm::vec4, glm::vec4>;
+    };
+
+    static_assert(offsetof(shadowData, cascadeSplits) == shadowData::layout::offset<1>);
+    static_assert(offsetof(shadowData, cascadeTexels) == shadowData::layout::offset<2>);
+    static_assert(offsetof(shadowData, sunDirection) == shadowData::layout::offset<3>);
+    static_assert(offsetof(shadowData, sunColor) == shadowData::layout::offset<4>);
+    static_assert(offsetof(shadowData, shadowParams) == shadowData::layout::offset<5>);
+    static_assert(sizeof(shadowData) == shadowData::layout::size);
+
+    // One GL uniform buffer holding `capacity` slots of T, each aligned to
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT so any slot can be bound with glBindBufferRange.
+    // A CPU shadow copy skips uploads when the data did not change. Meant for data that
+    // changes per frame or on events: rewriting a block between draws makes some drivers
+    // (Mesa llvmpipe) flush the pipeline, so per-draw values stay plain uniforms.
+    template <class T>
+    class uniformBuffer {
+    private:
+        GLuint m_Buffer = 0;
+        GLuint m_Binding;
+        GLsizeiptr m_Stride;
+        size_t m_Capacity;
+        std::vector<unsigned char> m_Shadow;
+
+        void allocateStorage(size_t capacity) {
+            std::vector<unsigned char> shadow(capacity * m_Stride, 0);
+            std::memcpy(shadow.data(), m_Shadow.data(), std::min(shadow.size(), m_Shadow.size()));
+            m_Shadow = std::move(shadow);
+            m_Capacity = capacity;
+
+            gl::stateCache::get().bindBuffer(GL_UNIFORM_BUFFER, m_Buffer);
+            glBufferData(GL_UNIFORM_BUFFER, m_Shadow.size(), m_Shadow.data(), GL_DYNAMIC_DRAW);
+        }
+    public:
+        uniformBuffer(GLuint binding, size_t capacity = 1)
+            : m_Binding(binding), m_Capacity(0)
+        {
+            GLint alignment = 256;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            m_Stride = (GLsizeiptr)std140::roundUp(sizeof(T), (size_t)std::max(alignment, 1));
+
+            glGenBuffers(1, &m_Buffer);
+            allocateStorage(std::max<size_t>(capacity, 1));
+            bind(0);
+        }
+
+        ~uniformBuffer() {
+            gl::stateCache::get().bufferDeleted(m_Buffer);
+            glDeleteBuffers(1, &m_Buffer);
+        }
+
+        uniformBuffer(const uniformBuffer&) = delete;
+        uniformBuffer& operator=(const uniformBuffer&) = delete;
+
+        // Uploads only when the contents differ from what the slot already holds
+        bool update(size_t slot, const T& data) {
+            unsigned char* shadow = m_Shadow.data() + slot * m_Stride;
+            if (std::memcmp(shadow, &data, sizeof(T)) == 0) return false;
+            std::memcpy(shadow, &data, sizeof(T));
+
+            gl::stateCache::get().bindBuffer(GL_UNIFORM_BUFFER, m_Buffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, slot * m_Stride, sizeof(T), &data);
+            return true;
+        }
+
+        void bind(size_t slot = 0) const {
+            gl::stateCache::get().bindBufferRange(GL_UNIFORM_BUFFER, m_Binding, m_Buffer, slot * m_Stride, sizeof(T));
+        }
+
+        const T& get(size_t slot = 0) const { return *reinterpret_cast<const T*>(m_Shadow.data() + slot * m_Stride); }
+
+        const GLuint getBuffer() const { return m_Buffer; }
+
+        const GLuint getBinding() const { return m_Binding; }
+
+        const size_t getCapacity() const { return m_Capacity; }
+    };
+
+    // The shared blocks from uniforms.glsl. Created on first use, so a context must be current.
+    class sceneUniforms {
+    public:
+        uniformBuffer<frameData> frame;         // slot 1 holds the viewmodel camera, see setViewModelFrame
+        uniformBuffer<lightData> lights;
+        uniformBuffer<clusterData> clusters;    // zeroed, i.e. no clustered lights, until the first build
+        uniformBuffer<shadowData> shadows;      // zeroed, i.e. no sun, until gl::cascadedShadows renders
+
+        // Object whose lights LightData currently holds
+        const void* lightsOwner = nullptr;
+
+        sceneUniforms()
+            : frame(UBO_FRAME_BINDING, 2), lights(UBO_LIGHTS_BINDING), clusters(UBO_CLUSTERS_BINDING), shadows(UBO_SHADOWS_BINDING)
+        {
+        }
+
+        static sceneUniforms& get() {
+            static sceneUniforms uniforms;
+            return uniforms;
+        }
+
+        // Once per frame, before drawing
+        void setFrame(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& camPos, float time) {
+            frameData data{};
+            data.view = view;
+            data.projection = projection;
+            data.viewProjection = projection * view;
+            data.camPos = camPos;
+            data.time = time;
+            frame.update(0, data);
+            frame.bind(0);
+        }
+
+        // The frame's view and camera position with a projection of its own, in slot 1. Draw
+        // between frame.bind(1) and frame.bind(0).
+        void setViewModelFrame(const glm::mat4& projection) {
+            frameData data = frame.get(0);
+            data.projection = projection;
+            data.viewProjection = projection * data.view;
+            frame.update(1, data);
+        }
+    };
+
+}
@@ -9,9 +9,17 @@
 
 #include <Window.hpp>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 #include <iostream>
 #include <stdexcept>
 #include <stb_image.h>
@@ -19,8 +27,51 @@
 #define FLOAT_SIZE sizeof(float)
 #define UINT_SIZE sizeof(unsigned)
 
+#ifndef SHADER_CACHE_PATH
+
+    #define SHADER_CACHE_PATH "resource/cache/shader"
+
+#endif // SHADER_CACHE_PATH
+
+#define SHADER_CACHE_MAX_BYTES (32ull * 1024 * 1024)
+
+// Scene-wide texture units, kept clear of the material units gl::object binds
+#define POINT_SHADOW_DATA_UNIT 19
+#define POINT_SHADOW_ATLAS_UNIT 20
+#define SHADOW_MAP_UNIT 21
+#define VISIBILITY_UNIT 22
+#define VISIBILITY_DRAW_UNIT 23
+#define VISIBILITY_DRAW_INFO_UNIT 24
+#define GEOMETRY_VERTEX_UNIT 25
+#define GEOMETRY_INDEX_UNIT 26
+#define CLUSTER_GRID_UNIT 27
+#define CLUSTER_INDEX_UNIT 28
+#define CLUSTER_LIGHT_UNIT 29
+#define IBL_PREFILTER_UNIT 30
+#define IBL_BRDF_LUT_UNIT 31
+
+// Uniform block binding points every program shares, see resource/shader/uniforms.glsl
+#define UBO_FRAME_BINDING 0
+#define UBO_LIGHTS_BINDING 1
+#define UBO_CLUSTERS_BINDING 2
+#define UBO_SHADOWS_BINDING 3
+
 namespace gl {
 
+    // 64-bit FNV-1a, used to key on-disk caches. Chain calls through `seed` to hash several fields.
+    inline uint64_t hash64(const void* data, size_t size, uint64_t seed = 14695981039346656037ull) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            seed ^= bytes[i];
+            seed *= 1099511628211ull;
+        }
+        return seed;
+    }
+
+    inline uint64_t hash64(const std::string& str, uint64_t seed = 14695981039346656037ull) {
+        return hash64(str.data(), str.size(), seed);
+    }
+
     inline std::filesystem::path getShaderPath(const std::string& relativePath) {
         std::filesystem::path exePath = std::filesystem::current_path();
         return exePath / relativePath;
@@ -43,8 +94,68 @@ namespace gl {
         return buffer;
     }
 
-    GLuint compileShader(const std::string& path, GLenum type) {
-        std::string sourceStr = gl::getShader(path);
+    // Expands `#include "file"` (relative to the including file, each file pulled in once) and
+    // injects `#define`s right after the #version line. `#line` directives keep compiler
+    // errors pointing at the right file index and line.
+    void expandShaderIncludes(const std::filesystem::path& path, std::string& out, std::vector<std::string>& files, std::vector<std::string>& stack) {
+        std::string key = path.lexically_normal().generic_string();
+        if (std::find(stack.begin(), stack.end(), key) != stack.end())
+            throw std::runtime_error("Recursive shader include: " + key + '\n');
+        if (std::find(files.begin(), files.end(), key) != files.end()) return;
+
+        files.push_back(key);
+        stack.push_back(key);
+        const size_t fileIndex = files.size() - 1;
+
+        std::string source = gl::getShader(key);
+        size_t lineNumber = 0, pos = 0;
+        while (pos < source.size()) {
+            size_t end = source.find('\n', pos);
+            if (end == std::string::npos) end = source.size();
+            std::string line = source.substr(pos, end - pos);
+            pos = end + 1;
+            lineNumber++;
+
+            size_t first = line.find_first_not_of(" \t");
+            if (first != std::string::npos && line.compare(first, 8, "#include") == 0) {
+                size_t open = line.find('"', first + 8);
+                size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+                if (close == std::string::npos)
+                    throw std::runtime_error("Malformed #include in " + key + ":" + std::to_string(lineNumber) + '\n');
+
+                std::filesystem::path include = path.parent_path() / line.substr(open + 1, close - open - 1);
+                out += "#line 1 " + std::to_string(files.size()) + "\n";
+                expandShaderIncludes(include, out, files, stack);
+                out += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+                continue;
+            }
+            out += line;
+            out += '\n';
+        }
+
+        stack.pop_back();
+    }
+
+    // defines: "NAME" or "NAME VALUE"
+    std::string preprocessShader(const std::string& path, const std::vector<std::string>& defines = {}) {
+        std::string expanded;
+        std::vector<std::string> files, stack;
+        expandShaderIncludes(std::filesystem::path(path), expanded, files, stack);
+
+        if (defines.empty()) return expanded;
+
+        std::string block;
+        for (const auto& define : defines) block += "#define " + define + "\n";
+
+        size_t version = expanded.find("#version");
+        if (version == std::string::npos) return block + expanded;
+
+        size_t lineEnd = expanded.find('\n', version);
+        block += "#line 2 0\n";
+        return expanded.insert(lineEnd == std::string::npos ? expanded.size() : lineEnd + 1, block);
+    }
+
+    GLuint compileShaderSource(const std::string& sourceStr, GLenum type, const std::string& path) {
         const char* source = sourceStr.c_str();
 
         GLuint shader = glCreateShader(type);
@@ -65,6 +176,10 @@ namespace gl {
         return shader;
     }
 
+    GLuint compileShader(const std::string& path, GLenum type) {
+        return compileShaderSource(gl::preprocessShader(path), type, path);
+    }
+
     void createProgram(GLuint& shaderProgram, GLuint vertexShader, GLuint fragmentShader) {
         shaderProgram = glCreateProgram();
         glAttachShader(shaderProgram, vertexShader);
@@ -87,10 +202,12 @@ namespace gl {
         glDeleteShader(fragmentShader);
     }
 
-    GLuint createProgram(GLuint vertexShader, GLuint fragmentShader) {
+    GLuint createProgram(GLuint vertexShader, GLuint fragmentShader, bool retrievable = false) {
         GLuint shaderProgram = glCreateProgram();
         glAttachShader(shaderProgram, vertexShader);
         glAttachShader(shaderProgram, fragmentShader);
+        if (retrievable && GLEW_ARB_get_program_binary)
+            glProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(shaderProgram);
 
         GLint success;
@@ -111,7 +228,437 @@ namespace gl {
         return shaderProgram;
     }
 
+    // Compute programs (GL 4.3) are small and built once, so they skip the binary cache
+    GLuint createComputeProgram(const std::string& path, const std::vector<std::string>& defines = {}) {
+        GLuint computeShader = gl::compileShaderSource(gl::preprocessShader(path, defines), GL_COMPUTE_SHADER, path);
+        GLuint shaderProgram = glCreateProgram();
+        glAttachShader(shaderProgram, computeShader);
+        glLinkProgram(shaderProgram);
+        glDeleteShader(computeShader);
+
+        GLint success;
+        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+        if (!success) {
+            GLint logLength;
+            glGetProgramiv(shaderProgram, GL_INFO_LOG_LENGTH, &logLength);
+            std::string log(logLength, ' ');
+            glGetProgramInfoLog(shaderProgram, logLength, nullptr, log.data());
+            glDeleteProgram(shaderProgram);
+            throw std::runtime_error("Compute program linking failed [" + path + "]: " + log + '\n');
+        }
+        return shaderProgram;
+    }
+
+    // Point scene-wide samplers at their reserved units right after linking. Left at the
+    // default of 0 they would alias baseColor with a different sampler type and fail the draw.
+    void assignReservedSamplers(GLuint shaderProgram) {
+        GLint prevProgram;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+        glUseProgram(shaderProgram);
+
+        GLint loc = glGetUniformLocation(shaderProgram, "prefilterMap");
+        if (loc >= 0) glUniform1i(loc, IBL_PREFILTER_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "brdfLUT");
+        if (loc >= 0) glUniform1i(loc, IBL_BRDF_LUT_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "clusterGrid");
+        if (loc >= 0) glUniform1i(loc, CLUSTER_GRID_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "clusterLightIndices");
+        if (loc >= 0) glUniform1i(loc, CLUSTER_INDEX_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "clusterLightData");
+        if (loc >= 0) glUniform1i(loc, CLUSTER_LIGHT_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "visibility");
+        if (loc >= 0) glUniform1i(loc, VISIBILITY_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "visibilityDraws");
+        if (loc >= 0) glUniform1i(loc, VISIBILITY_DRAW_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "visibilityDrawInfo");
+        if (loc >= 0) glUniform1i(loc, VISIBILITY_DRAW_INFO_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "geometryVertices");
+        if (loc >= 0) glUniform1i(loc, GEOMETRY_VERTEX_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "geometryIndices");
+        if (loc >= 0) glUniform1i(loc, GEOMETRY_INDEX_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "shadowMap");
+        if (loc >= 0) glUniform1i(loc, SHADOW_MAP_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "pointShadowAtlas");
+        if (loc >= 0) glUniform1i(loc, POINT_SHADOW_ATLAS_UNIT);
+        loc = glGetUniformLocation(shaderProgram, "pointShadowData");
+        if (loc >= 0) glUniform1i(loc, POINT_SHADOW_DATA_UNIT);
+
+        glUseProgram(prevProgram);
+    }
+
+    // GL 3.3 has no layout(binding = N) for blocks, so shared blocks are bound by name
+    void assignReservedBlocks(GLuint shaderProgram) {
+        static const std::pair<const char*, GLuint> blocks[] = {
+            { "FrameData", UBO_FRAME_BINDING },
+            { "LightData", UBO_LIGHTS_BINDING },
+            { "ClusterData", UBO_CLUSTERS_BINDING },
+            { "ShadowData", UBO_SHADOWS_BINDING },
+        };
+        for (auto& [name, binding] : blocks) {
+            GLuint index = glGetUniformBlockIndex(shaderProgram, name);
+            if (index != GL_INVALID_INDEX) glUniformBlockBinding(shaderProgram, index, binding);
+        }
+    }
+
+    struct shaderCacheStats {
+        unsigned hits = 0;
+        unsigned misses = 0;
+        unsigned rejected = 0;          // binaries the driver refused, recompiled from source
+        unsigned evicted = 0;
+        double compileMilliseconds = 0.0;
+        double loadMilliseconds = 0.0;
+    };
+
+    // On-disk glProgramBinary cache. Entries are keyed by the final shader sources plus the
+    // GL vendor/renderer/version, so a driver update simply misses. Oldest entries are evicted
+    // once the directory grows past SHADER_CACHE_MAX_BYTES.
+    class programCache {
+    private:
+        std::filesystem::path m_Directory;
+        uintmax_t m_MaxBytes;
+        shaderCacheStats m_Stats;
+        uint64_t m_DriverHash = 0;
+        int m_Supported = -1;
+
+        static constexpr char MAGIC[8] = { 'G', 'L', 'P', 'B', 'I', 'N', '0', '1' };
+
+        std::filesystem::path entryPath(uint64_t key) const {
+            return m_Directory / (std::to_string(key) + ".bin");
+        }
+
+        void enforceBudget() {
+            std::error_code ec;
+            std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+            uintmax_t total = 0;
+            for (auto& entry : std::filesystem::directory_iterator(m_Directory, ec)) {
+                if (!entry.is_regular_file(ec) || entry.path().extension() != ".bin") continue;
+                total += entry.file_size(ec);
+                entries.emplace_back(entry.last_write_time(ec), entry.path());
+            }
+            if (total <= m_MaxBytes) return;
+
+            std::sort(entries.begin(), entries.end());
+            for (auto& [time, path] : entries) {
+                if (total <= m_MaxBytes) break;
+                uintmax_t size = std::filesystem::file_size(path, ec);
+                if (std::filesystem::remove(path, ec)) {
+                    total -= size;
+                    m_Stats.evicted++;
+                }
+            }
+        }
+    public:
+        programCache(const std::filesystem::path& directory = getShaderPath(SHADER_CACHE_PATH), uintmax_t maxBytes = SHADER_CACHE_MAX_BYTES)
+            : m_Directory(directory), m_MaxBytes(maxBytes)
+        {
+        }
+
+        static programCache& get() {
+            static programCache cache;
+            return cache;
+        }
+
+        // Needs a current context; checked lazily for that reason
+        bool supported() {
+            if (m_Supported < 0) {
+                GLint formats = 0;
+                if (GLEW_ARB_get_program_binary) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+                m_Supported = formats > 0;
+            }
+            return m_Supported == 1;
+        }
+
+        uint64_t key(const std::string& vertexSource, const std::string& fragmentSource) {
+            if (!m_DriverHash) {
+                for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+                    const char* str = reinterpret_cast<const char*>(glGetString(name));
+                    m_DriverHash = hash64(str ? std::string(str) : std::string(), m_DriverHash ? m_DriverHash : 14695981039346656037ull);
+                }
+            }
+            uint64_t k = hash64(vertexSource, m_DriverHash);
+            k = hash64("\0", 1, k);
+            return hash64(fragmentSource, k);
+        }
+
+        // Returns a linked program or 0 on a miss / rejected binary
+        GLuint load(uint64_t key) {
+            std::filesystem::path path = entryPath(key);
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file) return 0;
+
+            std::streamsize size = file.tellg();
+            file.seekg(0, std::ios::beg);
+
+            char magic[8];
+            uint64_t storedKey = 0;
+            GLenum format = 0;
+            if (size <= (std::streamsize)(sizeof(magic) + sizeof(storedKey) + sizeof(format))) return 0;
+            file.read(magic, sizeof(magic));
+            file.read(reinterpret_cast<char*>(&storedKey), sizeof(storedKey));
+            file.read(reinterpret_cast<char*>(&format), sizeof(format));
+
+            std::vector<char> binary(size_t(size) - sizeof(magic) - sizeof(storedKey) - sizeof(format));
+            file.read(binary.data(), binary.size());
+            file.close();
+
+            std::error_code ec;
+            if (std::memcmp(magic, MAGIC, sizeof(magic)) != 0 || storedKey != key) {
+                std::filesystem::remove(path, ec);
+                m_Stats.rejected++;
+                return 0;
+            }
+
+            while (glGetError() != GL_NO_ERROR) {}
+
+            GLuint program = glCreateProgram();
+            glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+            GLint success = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+            if (glGetError() != GL_NO_ERROR || !success) {
+                glDeleteProgram(program);
+                std::filesystem::remove(path, ec);
+                m_Stats.rejected++;
+                return 0;
+            }
+
+            // Refresh the timestamp so eviction drops the least recently used entries first
+            std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+            return program;
+        }
+
+        void store(uint64_t key, GLuint program) {
+            GLint length = 0;
+            glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+            if (length <= 0) return;
+
+            std::vector<char> binary(length);
+            GLenum format = 0;
+            glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+            std::error_code ec;
+            std::filesystem::create_directories(m_Directory, ec);
+            std::ofstream file(entryPath(key), std::ios::binary);
+            if (!file) return;
+
+            file.write(MAGIC, sizeof(MAGIC));
+            file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+            file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+            file.write(binary.data(), binary.size());
+            file.close();
+
+            enforceBudget();
+        }
+
+        void clear() {
+            std::error_code ec;
+            for (auto& entry : std::filesystem::directory_iterator(m_Directory, ec))
+                if (entry.path().extension() == ".bin") std::filesystem::remove(entry.path(), ec);
+        }
+
+        const shaderCacheStats& stats() const { return m_Stats; }
+
+        shaderCacheStats& stats() { return m_Stats; }
+
+        void resetStats() { m_Stats = {}; }
+
+        void setMaxBytes(uintmax_t bytes) { m_MaxBytes = bytes; }
+    };
+
+    // Cached program build: binary hit when possible, otherwise compile, link and store
+    GLuint createCachedProgram(const std::string& vertexSource, const std::string& fragmentSource,
+        const std::string& vertexName = "vertex", const std::string& fragmentName = "fragment")
+    {
+        programCache& cache = programCache::get();
+        auto start = std::chrono::high_resolution_clock::now();
+        auto elapsed = [&start] { return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count(); };
+
+        bool useCache = cache.supported();
+        uint64_t key = 0;
+        if (useCache) {
+            key = cache.key(vertexSource, fragmentSource);
+            if (GLuint program = cache.load(key)) {
+                cache.stats().hits++;
+                cache.stats().loadMilliseconds += elapsed();
+                return program;
+            }
+        }
+
+        GLuint vertexShader = gl::compileShaderSource(vertexSource, GL_VERTEX_SHADER, vertexName);
+        GLuint fragmentShader = gl::compileShaderSource(fragmentSource, GL_FRAGMENT_SHADER, fragmentName);
+        GLuint program = gl::createProgram(vertexShader, fragmentShader, useCache);
+
+        cache.stats().misses++;
+        cache.stats().compileMilliseconds += elapsed();
+
+        if (useCache) cache.store(key, program);
+        return program;
+    }
+
+    // Interned uniform names. Each distinct name gets a small dense ID once, so the draw
+    // path indexes a per-program table instead of asking the driver with a string.
+    using uniformID = uint32_t;
+
+    class uniformNames {
+    private:
+        std::unordered_map<std::string, uniformID> m_IDs;
+        std::vector<std::string> m_Names;
+    public:
+        static uniformNames& get() {
+            static uniformNames names;
+            return names;
+        }
+
+        uniformID intern(const std::string& name) {
+            auto it = m_IDs.find(name);
+            if (it != m_IDs.end()) return it->second;
+            uniformID id = static_cast<uniformID>(m_Names.size());
+            m_IDs.emplace(name, id);
+            m_Names.push_back(name);
+            return id;
+        }
+
+        const std::string& name(uniformID id) const { return m_Names[id]; }
+
+        const size_t size() const { return m_Names.size(); }
+    };
+
+    inline uniformID internUniform(const std::string& name) {
+        return uniformNames::get().intern(name);
+    }
+
+    struct uniformInfo {
+        std::string name;
+        GLenum type;
+        GLint size;                     // array length, 1 for plain uniforms
+        GLint location;
+    };
+
+    struct uniformBlockInfo {
+        std::string name;
+        GLuint index;
+        GLint dataSize;
+    };
+
+    // Active uniforms and uniform blocks of a linked program, enumerated once. Array
+    // uniforms are registered under their base name and every "name[i]" element.
+    class programReflection {
+    private:
+        std::vector<uniformInfo> m_Uniforms;
+        std::vector<uniformBlockInfo> m_Blocks;
+        std::vector<GLint> m_Locations;         // indexed by uniformID
+        std::vector<GLint> m_SamplerUnits;      // last unit set per sampler, -1 when unknown
+
+        void add(const std::string& name, GLint location) {
+            uniformID id = gl::internUniform(name);
+            if (id >= m_Locations.size()) m_Locations.resize(id + 1, -1);
+            m_Locations[id] = location;
+        }
+
+        static std::unordered_map<GLuint, programReflection>& registry() {
+            static std::unordered_map<GLuint, programReflection> programs;
+            return programs;
+        }
+
+        static std::pair<GLuint, programReflection*>& last() {
+            static std::pair<GLuint, programReflection*> cached = { 0, nullptr };
+            return cached;
+        }
+    public:
+        programReflection() = default;
+
+        explicit programReflection(GLuint program) {
+            GLint count = 0, maxLength = 0;
+            glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+            std::vector<char> buffer(std::max(maxLength, 1));
+            for (GLuint i = 0; i < (GLuint)count; ++i) {
+                GLsizei length = 0;
+                GLint size = 0;
+                GLenum type = 0;
+                glGetActiveUniform(program, i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+
+                // Members of uniform blocks have no location
+                GLint block = -1;
+                glGetActiveUniformsiv(program, 1, &i, GL_UNIFORM_BLOCK_INDEX, &block);
+                if (block != -1) continue;
+
+                std::string name(buffer.data(), length);
+                GLint location = glGetUniformLocation(program, name.c_str());
+
+                if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+                    std::string base = name.substr(0, name.size() - 3);
+                    add(base, location);
+                    add(name, location);
+                    for (GLint e = 1; e < size; ++e) {
+                        std::string element = base + "[" + std::to_string(e) + "]";
+                        add(element, glGetUniformLocation(program, element.c_str()));
+                    }
+                    name = base;
+                }
+                else add(name, location);
+
+                m_Uniforms.push_back({ name, type, size, location });
+            }
+
+            GLint blocks = 0;
+            glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blocks);
+            glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+            buffer.resize(std::max(maxLength, 1));
+            for (GLuint i = 0; i < (GLuint)blocks; ++i) {
+                GLsizei length = 0;
+                GLint dataSize = 0;
+                glGetActiveUniformBlockName(program, i, (GLsizei)buffer.size(), &length, buffer.data());
+                glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+                m_Blocks.push_back({ std::string(buffer.data(), length), i, dataSize });
+            }
+
+            m_SamplerUnits.assign(m_Locations.size(), -1);
+        }
+
+        // -1 when the program has no such active uniform
+        GLint location(uniformID id) const { return id < m_Locations.size() ? m_Locations[id] : -1; }
+
+        // Sets a sampler's unit on the bound program, skipped when it already holds that unit
+        void setSampler(uniformID id, GLint unit) {
+            if (id >= m_Locations.size() || m_Locations[id] < 0 || m_SamplerUnits[id] == unit) return;
+            glUniform1i(m_Locations[id], unit);
+            m_SamplerUnits[id] = unit;
+        }
+
+        GLint blockIndex(const std::string& name) const {
+            for (const auto& block : m_Blocks)
+                if (block.name == name) return (GLint)block.index;
+            return -1;
+        }
+
+        const std::vector<uniformInfo>& getUniforms() const { return m_Uniforms; }
+
+        const std::vector<uniformBlockInfo>& getBlocks() const { return m_Blocks; }
+
+        // Reflection for `program`, built on first use
+        static programReflection& get(GLuint program) {
+            auto& cached = last();
+            if (cached.first == program && cached.second) return *cached.second;
+
+            auto& programs = registry();
+            auto it = programs.find(program);
+            if (it == programs.end()) it = programs.emplace(program, programReflection(program)).first;
+            cached = { program, &it->second };
+            return it->second;
+        }
+
+        // Call before deleting a program, its name may be reused by the driver
+        static void release(GLuint program) {
+            auto& cached = last();
+            if (cached.first == program) cached = { 0, nullptr };
+            registry().erase(program);
+        }
+    };
+
     void terminate(GLuint VAO, GLuint VBO, GLuint shaderProgram) {
+        gl::stateCache::get().invalidate();
         glDeleteVertexArrays(1, &VAO);
         glDeleteBuffers(1, &VBO);
         glDeleteProgram(shaderProgram);
@@ -121,12 +668,12 @@ namespace gl {
 
     void bindVertexArray(GLuint& VAO) {
         glGenVertexArrays(1, &VAO);
-        glBindVertexArray(VAO);
+        gl::stateCache::get().bindVertexArray(VAO);
     }
 
     void bindVertexBuffer(GLuint& VBO, const GLfloat* vertices, size_t size) {
         glGenBuffers(1, &VBO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        gl::stateCache::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW);
     }
 
@@ -156,7 +703,7 @@ namespace gl {
                 return;
             }
             glGenTextures(1, &m_Texture);
-            glBindTexture(GL_TEXTURE_2D, m_Texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_2D, m_Texture);
 
             GLenum format = m_NrChannels == 3 ? GL_RGB : GL_RGBA;
             glTexImage2D(GL_TEXTURE_2D, 0, format, m_Width, m_Height, 0, format, GL_UNSIGNED_BYTE, m_Data);
@@ -182,7 +729,7 @@ namespace gl {
             stbi_set_flip_vertically_on_load(true);
 
             glGenTextures(1, &m_Texture);
-            glBindTexture(GL_TEXTURE_2D, m_Texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_2D, m_Texture);
 
             GLenum format = GL_RGBA;
             if (channels == 3) format = GL_RGB;
@@ -198,11 +745,11 @@ namespace gl {
         }
 
         void bind(GLenum textureUnit = GL_TEXTURE0) const {
-            glActiveTexture(textureUnit);
-            glBindTexture(GL_TEXTURE_2D, m_Texture);
+            gl::stateCache::get().bindTexture(textureUnit - GL_TEXTURE0, GL_TEXTURE_2D, m_Texture);
         }
 
         ~texture2D() {
+            gl::stateCache::get().textureDeleted(m_Texture);
             glDeleteTextures(1, &m_Texture);
         }
 
@@ -243,7 +790,7 @@ namespace gl {
 
             // Generate texture
             glGenTextures(1, &m_Texture);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, m_Texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_2D_ARRAY, m_Texture);
 
             // Allocate storage for the array
             glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format, m_Width, m_Height, m_Layers, 0, format, GL_UNSIGNED_BYTE, nullptr);
@@ -276,8 +823,7 @@ namespace gl {
         }
 
         void bind(GLenum textureUnit = GL_TEXTURE0) const {
-            glActiveTexture(textureUnit);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, m_Texture);
+            gl::stateCache::get().bindTexture(textureUnit - GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, m_Texture);
         }
 
         GLuint id() const { return m_Texture; }
@@ -286,7 +832,10 @@ namespace gl {
         int layers() const { return m_Layers; }
 
         ~texture2DArray() {
-            if (m_Texture) glDeleteTextures(1, &m_Texture);
+            if (m_Texture) {
+                gl::stateCache::get().textureDeleted(m_Texture);
+                glDeleteTextures(1, &m_Texture);
+            }
         }
     };
 
@@ -320,7 +869,7 @@ namespace gl {
             }
 
             glGenTextures(1, &m_Texture);
-            glBindTexture(GL_TEXTURE_3D, m_Texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_3D, m_Texture);
 
             glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, width, height, static_cast<GLsizei>(paths.size()), 0, GL_RGBA, GL_UNSIGNED_BYTE, dataAll.data());
 
@@ -352,7 +901,7 @@ namespace gl {
             }
 
             glGenTextures(1, &m_Texture);
-            glBindTexture(GL_TEXTURE_3D, m_Texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_3D, m_Texture);
 
             glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, width, height, static_cast<GLsizei>(size), 0, GL_RGBA, GL_UNSIGNED_BYTE, dataAll.data());
 
@@ -386,7 +935,7 @@ namespace gl {
             }
 
             glGenTextures(1, &m_Texture);
-            glBindTexture(GL_TEXTURE_3D, m_Texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_3D, m_Texture);
 
             glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, width, height, static_cast<GLsizei>(paths.size()), 0, GL_RGBA, GL_UNSIGNED_BYTE, dataAll.data());
 
@@ -418,7 +967,7 @@ namespace gl {
             }
 
             glGenTextures(1, &m_Texture);
-            glBindTexture(GL_TEXTURE_3D, m_Texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_3D, m_Texture);
 
             glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, width, height, static_cast<GLsizei>(size), 0, GL_RGBA, GL_UNSIGNED_BYTE, dataAll.data());
 
@@ -429,13 +978,32 @@ namespace gl {
             glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         }
 
+        // Raw voxel upload (e.g. single channel density or a brick occupancy grid)
+        texture3D(const unsigned char* data, int width, int height, int depth, GLint internalFormat, GLenum format, GLenum filter, GLuint loc) {
+            m_Loc = loc;
+            if (!data) throw std::runtime_error("Texture data is null");
+
+            glGenTextures(1, &m_Texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_3D, m_Texture);
+
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, width, height, depth, 0, format, GL_UNSIGNED_BYTE, data);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+        }
+
         void bind(GLenum textureUnit = GL_TEXTURE0) {
-            glActiveTexture(textureUnit);
-            glBindTexture(GL_TEXTURE_3D, m_Texture);
+            gl::stateCache::get().bindTexture(textureUnit - GL_TEXTURE0, GL_TEXTURE_3D, m_Texture);
             glUniform1i(m_Loc, textureUnit - GL_TEXTURE0);
         }
 
         ~texture3D() {
+            gl::stateCache::get().textureDeleted(m_Texture);
             glDeleteTextures(1, &m_Texture);
         }
 
@@ -444,8 +1012,7 @@ namespace gl {
 
     void bindTexture(GLsizei n, GLuint& texture, GLenum mode) {
         glGenTextures(n, &texture);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(mode, texture);
+        gl::stateCache::get().bindTexture(0, mode, texture);
     }
 
     void generateTexture(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, unsigned char* data) {
@@ -454,6 +1021,47 @@ namespace gl {
         stbi_image_free(data);
     }
 
+    // Single-level storage for a render target on the bound `target`: immutable with GL 4.2 or
+    // ARB_texture_storage, otherwise glTexImage2D with a transfer format that `internalFormat`
+    // accepts, so 3.3 contexts get the same texture
+    void textureStorage2D(GLenum target, GLenum internalFormat, GLsizei width, GLsizei height) {
+        if (GLEW_VERSION_4_2 || GLEW_ARB_texture_storage) {
+            glTexStorage2D(target, 1, internalFormat, width, height);
+            return;
+        }
+
+        GLenum format = GL_RGBA, type = GL_FLOAT;
+        switch (internalFormat) {
+        case GL_DEPTH_COMPONENT16: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32: case GL_DEPTH_COMPONENT32F:
+            format = GL_DEPTH_COMPONENT; break;
+        case GL_DEPTH24_STENCIL8:
+            format = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; break;
+        case GL_DEPTH32F_STENCIL8:
+            format = GL_DEPTH_STENCIL; type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV; break;
+        case GL_R8: case GL_R16: case GL_R16F: case GL_R32F:
+            format = GL_RED; break;
+        case GL_RG8: case GL_RG16: case GL_RG16F: case GL_RG32F:
+            format = GL_RG; break;
+        case GL_RGB8: case GL_RGB16F: case GL_RGB32F: case GL_R11F_G11F_B10F:
+            format = GL_RGB; break;
+        case GL_R8UI: case GL_R16UI: case GL_R32UI:
+            format = GL_RED_INTEGER; type = GL_UNSIGNED_INT; break;
+        case GL_RG8UI: case GL_RG16UI: case GL_RG32UI:
+            format = GL_RG_INTEGER; type = GL_UNSIGNED_INT; break;
+        case GL_RGBA8UI: case GL_RGBA16UI: case GL_RGBA32UI:
+            format = GL_RGBA_INTEGER; type = GL_UNSIGNED_INT; break;
+        case GL_R32I:
+            format = GL_RED_INTEGER; type = GL_INT; break;
+        case GL_RG32I:
+            format = GL_RG_INTEGER; type = GL_INT; break;
+        case GL_RGBA32I:
+            format = GL_RGBA_INTEGER; type = GL_INT; break;
+        }
+        glTexImage2D(target, 0, internalFormat, width, height, 0, format, type, nullptr);
+        // A single level has to be the whole mip chain, or the texture is incomplete
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+
     class shader {
     private:
         GLuint m_VertexShader;
@@ -463,23 +1071,33 @@ namespace gl {
         friend void useProgram(const gl::shader& shader);
     public:
         shader(const char* vertexShaderName, const char* fragmentShaderName) {
-            m_VertexShader = gl::compileShader(vertexShaderName, GL_VERTEX_SHADER);
-            m_FragmentShader = gl::compileShader(fragmentShaderName, GL_FRAGMENT_SHADER);
-            m_ShaderProgram = gl::createProgram(m_VertexShader, m_FragmentShader);
+            // Shader objects are deleted after linking (or never created on a cache hit)
+            m_VertexShader = 0;
+            m_FragmentShader = 0;
+            m_ShaderProgram = gl::createCachedProgram(gl::preprocessShader(vertexShaderName), gl::preprocessShader(fragmentShaderName), vertexShaderName, fragmentShaderName);
+            gl::assignReservedSamplers(m_ShaderProgram);
+            gl::assignReservedBlocks(m_ShaderProgram);
+            gl::programReflection::get(m_ShaderProgram);
         }
         //vertexshader, fragmentshader
 
         const GLuint getProgram() const { return m_ShaderProgram; }
 
-        const void useProgram() { glUseProgram(m_ShaderProgram); }
+        const void useProgram() { gl::stateCache::get().useProgram(m_ShaderProgram); }
 
         const GLuint getUniformLocation(const char* name) const { return glGetUniformLocation(m_ShaderProgram, name); }
 
         void setUniformMatrix4fv(const char* name, glm::mat4 data) { glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, glm::value_ptr(data)); }
+
+        const GLint getUniformLocation(uniformID id) const { return gl::programReflection::get(m_ShaderProgram).location(id); }
+
+        void setUniformMatrix4fv(uniformID id, glm::mat4 data) { glUniformMatrix4fv(getUniformLocation(id), 1, GL_FALSE, glm::value_ptr(data)); }
+
+        gl::programReflection& getReflection() const { return gl::programReflection::get(m_ShaderProgram); }
     };
 
     void useProgram(const gl::shader& shader) {
-        glUseProgram(shader.m_ShaderProgram);
+        gl::stateCache::get().useProgram(shader.m_ShaderProgram);
     }
 
     class camera {
@@ -590,49 +1208,185 @@ namespace gl {
         const glm::vec3 getFront() const { return Front; }
     };
 
-    //template <class T>
+    struct uniformStats {
+        unsigned uploads = 0;
+        unsigned elided = 0;            // values the program already held
+
+        static uniformStats& get() {
+            static uniformStats stats;
+            return stats;
+        }
+
+        void reset() { uploads = elided = 0; }
+    };
+
+    // Texture unit for a sampler uniform
+    struct sampler {
+        GLint unit = 0;
+
+        bool operator==(const sampler&) const = default;
+    };
+
+    template <class T> struct isStdArray : std::false_type {};
+    template <class T, size_t N> struct isStdArray<std::array<T, N>> : std::true_type {};
+
+    // glProgramUniform* writes a program without binding it (GL 4.1 / ARB_separate_shader_objects)
+    inline bool hasProgramUniform() {
+        static const bool supported = GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects;
+        return supported;
+    }
+
+    // Picks the glUniform* entry point for T at compile time. With program == 0 the value
+    // goes to whatever program is bound. Without glProgramUniform* a nonzero program is
+    // bound first (through the state cache), so the value never lands in another program.
+    template <class T>
+    void uploadUniform(GLuint program, GLint location, GLsizei count, const T* data) {
+        const bool direct = program != 0 && hasProgramUniform();
+        if (program != 0 && !direct) gl::stateCache::get().useProgram(program);
+
+        if constexpr (std::is_same_v<T, float>) direct ? glProgramUniform1fv(program, location, count, data) : glUniform1fv(location, count, data);
+        else if constexpr (std::is_same_v<T, glm::vec2>) direct ? glProgramUniform2fv(program, location, count, glm::value_ptr(*data)) : glUniform2fv(location, count, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, glm::vec3>) direct ? glProgramUniform3fv(program, location, count, glm::value_ptr(*data)) : glUniform3fv(location, count, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, glm::vec4>) direct ? glProgramUniform4fv(program, location, count, glm::value_ptr(*data)) : glUniform4fv(location, count, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, int32_t>) direct ? glProgramUniform1iv(program, location, count, data) : glUniform1iv(location, count, data);
+        else if constexpr (std::is_same_v<T, glm::ivec2>) direct ? glProgramUniform2iv(program, location, count, glm::value_ptr(*data)) : glUniform2iv(location, count, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, glm::ivec3>) direct ? glProgramUniform3iv(program, location, count, glm::value_ptr(*data)) : glUniform3iv(location, count, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, glm::ivec4>) direct ? glProgramUniform4iv(program, location, count, glm::value_ptr(*data)) : glUniform4iv(location, count, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, uint32_t>) direct ? glProgramUniform1uiv(program, location, count, data) : glUniform1uiv(location, count, data);
+        else if constexpr (std::is_same_v<T, glm::uvec2>) direct ? glProgramUniform2uiv(program, location, count, glm::value_ptr(*data)) : glUniform2uiv(location, count, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, glm::uvec3>) direct ? glProgramUniform3uiv(program, location, count, glm::value_ptr(*data)) : glUniform3uiv(location, count, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, glm::uvec4>) direct ? glProgramUniform4uiv(program, location, count, glm::value_ptr(*data)) : glUniform4uiv(location, count, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, glm::mat2>) direct ? glProgramUniformMatrix2fv(program, location, count, GL_FALSE, glm::value_ptr(*data)) : glUniformMatrix2fv(location, count, GL_FALSE, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, glm::mat3>) direct ? glProgramUniformMatrix3fv(program, location, count, GL_FALSE, glm::value_ptr(*data)) : glUniformMatrix3fv(location, count, GL_FALSE, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, glm::mat4>) direct ? glProgramUniformMatrix4fv(program, location, count, GL_FALSE, glm::value_ptr(*data)) : glUniformMatrix4fv(location, count, GL_FALSE, glm::value_ptr(*data));
+        else if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, sampler>) {
+            // GLSL bools and samplers are set through the int entry points
+            std::vector<GLint> values(count);
+            for (GLsizei i = 0; i < count; i++) {
+                if constexpr (std::is_same_v<T, bool>) values[i] = data[i] ? 1 : 0;
+                else values[i] = data[i].unit;
+            }
+            uploadUniform<GLint>(program, location, count, values.data());
+        }
+        else static_assert(sizeof(T) == 0, "gl::uploadUniform: unsupported uniform type");
+    }
+
+    // A uniform value plus the location it lives at. upload() only reaches the driver when
+    // the value changed since that program last received it, so per-frame code can call it
+    // unconditionally. Each target program keeps its own location and last upload; a uniform
+    // built from a name looks the location up in every program it is sent to. T is a scalar,
+    // glm vector/matrix, gl::sampler, or a std::array of those for GLSL arrays.
+    template <class T = glm::mat4>
     class uniform {
     private:
-        glm::mat4 m_Data;
-        GLuint m_Location;
+        static constexpr uniformID unnamed = UINT32_MAX;
+
+        // What one program last received
+        struct target {
+            GLuint program;
+            GLint location;
+            T uploaded;
+            bool valid;
+        };
+
+        T m_Data{};
+        GLint m_Location = -1;
+        GLuint m_Program = 0;
+        uniformID m_Name = unnamed;
+        std::vector<target> m_Targets;
+
+        // program == 0 resolves to the bound one
+        target& find(GLuint program) {
+            if (program == 0) program = gl::stateCache::get().boundProgram();
+            for (target& t : m_Targets)
+                if (t.program == program) return t;
+
+            // Locations are per program: only the one this was built for, or a bound program
+            // with no program given, can take m_Location as is
+            GLint location = -1;
+            if (m_Name != unnamed) location = program ? gl::programReflection::get(program).location(m_Name) : -1;
+            else if (program == m_Program || m_Program == 0) location = m_Location;
+            return m_Targets.emplace_back(target{ program, location, T{}, false });
+        }
+
+        bool send(target& t) {
+            if (t.location < 0) return false;
+
+            if (t.valid && m_Data == t.uploaded) {
+                uniformStats::get().elided++;
+                return false;
+            }
+
+            if constexpr (isStdArray<T>::value) uploadUniform(t.program, t.location, (GLsizei)m_Data.size(), m_Data.data());
+            else uploadUniform(t.program, t.location, 1, &m_Data);
+            t.uploaded = m_Data;
+            t.valid = true;
+            uniformStats::get().uploads++;
+            return true;
+        }
     public:
         uniform() = default;
 
-        uniform(glm::mat4 value, GLuint location)
-            : m_Location(location), m_Data(value)
+        // program == 0 uploads to whichever program is bound at the time, at `location`
+        uniform(const T& value, GLint location, GLuint program = 0)
+            : m_Data(value), m_Location(location), m_Program(program)
         {
         }
 
-        uniform& operator=(const uniform& other) {
-            if (this != &other) {
-                this->m_Data = other.m_Data;
-                this->m_Location = other.m_Location;
-            }
-            return *this;
+        uniform(GLuint program, const char* name, const T& value = T{})
+            : m_Data(value), m_Program(program), m_Name(gl::internUniform(name))
+        {
+            if (program) m_Location = find(program).location;
         }
 
-        uniform& operator=(const glm::mat4& other) {
-            this->m_Data = other;
+        uniform& operator=(const T& other) {
+            m_Data = other;
             return *this;
         }
 
-        const glm::mat4 getValue() const { return m_Data; }
+        const T& getValue() const { return m_Data; }
+
+        void setValue(const T& value) { m_Data = value; }
+
+        const GLint getLocation() const { return m_Location; }
+
+        const GLint getlocation() const { return m_Location; }
+
+        const GLuint getProgram() const { return m_Program; }
+
+        // Whether upload() would reach the driver
+        bool dirty() {
+            const target& t = find(m_Program);
+            return t.location >= 0 && (!t.valid || !(m_Data == t.uploaded));
+        }
+
+        // Forgets every program's last upload, e.g. after a relink or a write elsewhere
+        void invalidate() { m_Targets.clear(); }
+
+        // Returns whether a GL call was made
+        bool upload() { return send(find(m_Program)); }
 
-        const GLuint getlocation() const { return m_Location; }
+        // The same uniform in another program, e.g. one shared by several permutations. Only
+        // uniforms built from a name can find their location there. Before GL 4.1 this binds
+        // `program`.
+        bool uploadTo(GLuint program) { return send(find(program)); }
 
-        void uniformMatrix4fv() { glUniformMatrix4fv(m_Location, 1, GL_FALSE, glm::value_ptr(m_Data)); }
+        bool upload(const T& value) {
+            m_Data = value;
+            return upload();
+        }
 
-        void setValue(glm::mat4 value) { m_Data = value; }
+        void uniformMatrix4fv() requires std::is_same_v<T, glm::mat4> { upload(); }
 
-        void translate(glm::vec3 value) { m_Data = glm::translate(m_Data, value); }
+        void translate(glm::vec3 value) requires std::is_same_v<T, glm::mat4> { m_Data = glm::translate(m_Data, value); }
 
-        void rotate(float radians, glm::vec3 pos) { m_Data = glm::rotate(m_Data, radians, pos); }
+        void rotate(float radians, glm::vec3 pos) requires std::is_same_v<T, glm::mat4> { m_Data = glm::rotate(m_Data, radians, pos); }
 
-        void scale(glm::vec3 value) { m_Data = glm::scale(m_Data, value); }
+        void scale(glm::vec3 value) requires std::is_same_v<T, glm::mat4> { m_Data = glm::scale(m_Data, value); }
 
-        void lookAt(glm::vec3 position, glm::vec3 target, glm::vec3 upVector) { m_Data = glm::lookAt(position, target, upVector); }
+        void lookAt(glm::vec3 position, glm::vec3 target, glm::vec3 upVector) requires std::is_same_v<T, glm::mat4> { m_Data = glm::lookAt(position, target, upVector); }
 
-        void lookAt(gl::camera camera) { m_Data = glm::lookAt(camera.getPos(), camera.getTarget(), camera.getUpVector()); }
+        void lookAt(gl::camera camera) requires std::is_same_v<T, glm::mat4> { m_Data = glm::lookAt(camera.getPos(), camera.getTarget(), camera.getUpVector()); }
     };
 
 }
@@ -0,0 +1,403 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm.hpp>
+
+#include <Utils.hpp>
+#include <Mesh.hpp>
+#include <ShaderLibrary.hpp>
+#include <StateCache.hpp>
+#include <UniformBuffer.hpp>
+#include <Culling.hpp>
+#include <Deferred.hpp>
+#include <Environment.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+namespace gl {
+
+    // One opaque draw handed to gl::visibilityBuffer
+    struct visibilityDraw {
+        gl::object* mesh;
+        glm::mat4 model;
+        glm::vec4 color = glm::vec4(1.0f);
+    };
+
+    // Visibility buffer shading, used by gl::renderQueue in shadingMode::Visibility. The
+    // geometry pass writes positions only, into an RG32UI target holding the draw record and
+    // gl_PrimitiveID of the nearest triangle (8 bytes per pixel plus depth). Everything else
+    // is rebuilt per pixel afterwards: the triangle's indices and vertices are read from the
+    // geometry pool through texture buffers and perspective-correct barycentrics (with their
+    // screen derivatives, for textureGrad) are solved for the pixel center. Overdraw only
+    // costs the position-only pass.
+    //
+    // Each object's textures are bound the usual way, so shading runs one pass per object: a
+    // classification pass writes every pixel's material number as depth, then each material
+    // draws a full-screen triangle at its own depth with GL_EQUAL, scissored to its objects'
+    // screen bounds. Early depth rejects the other pixels, and every covered pixel is shaded
+    // exactly once by visibility_resolve_frag.glsl, built per material permutation.
+    class visibilityBuffer {
+    private:
+        static constexpr uint32_t maxMaterials = 65534;    // 16-bit depth, 1.0 is the clear
+
+        struct drawRecord {
+            glm::mat4 model;
+            glm::vec4 color;
+        };
+
+        struct drawInfo {
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint material;
+            GLuint unused = 0;
+        };
+
+        struct materialPass {
+            gl::object* mesh;
+            uint32_t first, count;          // into m_Order
+            glm::ivec4 scissor;             // x0, y0, x1, y1 in window pixels
+        };
+
+        GLuint m_FBO = 0, m_ShadeFBO = 0;
+        GLuint m_Visibility = 0, m_Depth = 0, m_Color = 0, m_MaterialDepth = 0;
+        int m_Width = 0, m_Height = 0;
+
+        GLint m_SceneFBO = 0;
+        GLint m_Viewport[4] = {};
+
+        // Draw records (RGBA32F, 5 texels each) and draw info (RGBA32UI), refilled every frame
+        GLuint m_Buffers[2] = {};
+        GLuint m_Textures[2] = {};
+
+        // R32F and R32UI views of the geometry pool, re-pointed when it grows
+        GLuint m_PoolTextures[2] = {};
+        GLuint m_PoolBuffers[2] = {};
+
+        GLuint m_EmptyVAO = 0;
+
+        gl::shader m_Geometry;
+        gl::shader m_Classify;
+        gl::shader m_Composite;
+        gl::shaderLibrary m_Materials;
+        gl::uniform<int> m_DrawBase;
+        gl::uniform<gl::sampler> m_Accumulation, m_CompositeDepth;
+
+        std::vector<uint32_t> m_Order;
+        std::vector<drawRecord> m_Records;
+        std::vector<drawInfo> m_Info;
+        std::vector<materialPass> m_Passes;
+        std::unordered_set<const gl::object*> m_Objects;   // distinct meshes prepare() saw
+
+        shadingStats m_Stats;
+
+        static_assert(sizeof(vertex) == 11 * sizeof(float), "visibility.glsl reads gl::vertex as 11 floats");
+
+        static GLuint createTarget(GLenum format, int width, int height) {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_2D, texture);
+            gl::textureStorage2D(GL_TEXTURE_2D, format, width, height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            return texture;
+        }
+
+        // Only touches the draw binding, which render() rebinds; the read binding is the caller's
+        void resize(int width, int height) {
+            if (width == m_Width && height == m_Height && m_FBO) return;
+            destroyTargets();
+            m_Width = width;
+            m_Height = height;
+
+            m_Visibility = createTarget(GL_RG32UI, width, height);
+            m_Depth = createTarget(GL_DEPTH_COMPONENT32F, width, height);
+            m_Color = createTarget(GL_RGBA16F, width, height);
+            m_MaterialDepth = createTarget(GL_DEPTH_COMPONENT16, width, height);
+
+            glGenFramebuffers(1, &m_FBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_FBO);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_Visibility, 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_Depth, 0);
+            if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                throw std::runtime_error("Visibility framebuffer incomplete");
+
+            glGenFramebuffers(1, &m_ShadeFBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_ShadeFBO);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_Color, 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_MaterialDepth, 0);
+            if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                throw std::runtime_error("Visibility shading framebuffer incomplete");
+        }
+
+        void destroyTargets() {
+            if (m_FBO) glDeleteFramebuffers(1, &m_FBO);
+            if (m_ShadeFBO) glDeleteFramebuffers(1, &m_ShadeFBO);
+            for (GLuint texture : { m_Visibility, m_Depth, m_Color, m_MaterialDepth }) {
+                if (!texture) continue;
+                gl::stateCache::get().textureDeleted(texture);
+                glDeleteTextures(1, &texture);
+            }
+            m_FBO = m_ShadeFBO = m_Visibility = m_Depth = m_Color = m_MaterialDepth = 0;
+            m_Width = m_Height = 0;
+        }
+
+        // Window-space rectangle of a world box, the whole viewport when it crosses the camera plane
+        glm::ivec4 screenRect(const gl::aabb& box, const glm::mat4& viewProjection) const {
+            const glm::ivec4 full(m_Viewport[0], m_Viewport[1], m_Viewport[0] + m_Viewport[2], m_Viewport[1] + m_Viewport[3]);
+            glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+            for (int c = 0; c < 8; ++c) {
+                glm::vec3 corner((c & 1) ? box.max.x : box.min.x, (c & 2) ? box.max.y : box.min.y, (c & 4) ? box.max.z : box.min.z);
+                glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+                if (clip.w <= 1e-5f) return full;
+                glm::vec2 ndc = glm::vec2(clip) / clip.w;
+                lo = glm::min(lo, ndc);
+                hi = glm::max(hi, ndc);
+            }
+            glm::vec2 size(m_Viewport[2], m_Viewport[3]), origin(m_Viewport[0], m_Viewport[1]);
+            glm::ivec2 a = glm::ivec2(glm::floor(origin + (lo * 0.5f + 0.5f) * size));
+            glm::ivec2 b = glm::ivec2(glm::ceil(origin + (hi * 0.5f + 0.5f) * size));
+            return glm::ivec4(glm::max(glm::ivec2(full), a), glm::min(glm::ivec2(full.z, full.w), b));
+        }
+
+        // Sorts the draws by object, so each object is one instanced draw and one material
+        void build(const std::vector<visibilityDraw>& draws, const glm::mat4& viewProjection) {
+            m_Order.resize(draws.size());
+            for (uint32_t i = 0; i < draws.size(); ++i) m_Order[i] = i;
+            std::stable_sort(m_Order.begin(), m_Order.end(), [&](uint32_t a, uint32_t b) { return std::less<const gl::object*>()(draws[a].mesh, draws[b].mesh); });
+
+            m_Records.resize(draws.size());
+            m_Info.resize(draws.size());
+            m_Passes.clear();
+            for (uint32_t i = 0; i < m_Order.size(); ++i) {
+                const visibilityDraw& d = draws[m_Order[i]];
+                if (m_Passes.empty() || m_Passes.back().mesh != d.mesh)
+                    m_Passes.push_back({ d.mesh, i, 0, glm::ivec4(INT_MAX, INT_MAX, INT_MIN, INT_MIN) });
+                materialPass& pass = m_Passes.back();
+                pass.count++;
+
+                glm::ivec4 rect = screenRect(d.mesh->getBounds().transformed(d.model), viewProjection);
+                pass.scissor = glm::ivec4(glm::min(glm::ivec2(pass.scissor), glm::ivec2(rect)), glm::max(glm::ivec2(pass.scissor.z, pass.scissor.w), glm::ivec2(rect.z, rect.w)));
+
+                const gl::meshRange& range = d.mesh->getRange();
+                m_Records[i] = { d.model, d.color };
+                m_Info[i] = { range.firstIndex, range.baseVertex, static_cast<GLuint>(m_Passes.size()) };
+            }
+
+            upload(m_Buffers[0], m_Records.data(), m_Records.size() * sizeof(drawRecord));
+            upload(m_Buffers[1], m_Info.data(), m_Info.size() * sizeof(drawInfo));
+        }
+
+        static void upload(GLuint buffer, const void* data, size_t bytes) {
+            gl::stateCache::get().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+            glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+            if (bytes) glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+        }
+
+        // Follows the pool's buffers, which are replaced whenever it grows
+        void bindGeometry() {
+            gl::stateCache& state = gl::stateCache::get();
+            const gl::geometryPool& pool = gl::geometryPool::get();
+            const GLuint buffers[2] = { pool.getVertexBuffer(), pool.getIndexBuffer() };
+            const GLenum formats[2] = { GL_R32F, GL_R32UI };
+
+            for (int i = 0; i < 2; ++i) {
+                if (buffers[i] == m_PoolBuffers[i]) continue;
+                state.bindTexture(GL_TEXTURE_BUFFER, m_PoolTextures[i]);
+                glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+                m_PoolBuffers[i] = buffers[i];
+            }
+
+            state.bindTexture(VISIBILITY_DRAW_UNIT, GL_TEXTURE_BUFFER, m_Textures[0]);
+            state.bindTexture(VISIBILITY_DRAW_INFO_UNIT, GL_TEXTURE_BUFFER, m_Textures[1]);
+            state.bindTexture(GEOMETRY_VERTEX_UNIT, GL_TEXTURE_BUFFER, m_PoolTextures[0]);
+            state.bindTexture(GEOMETRY_INDEX_UNIT, GL_TEXTURE_BUFFER, m_PoolTextures[1]);
+        }
+    public:
+        // Geometry pass, composite and the visibility target plus depth
+        static constexpr unsigned bytesPerPixel = 8 + 4;
+
+        visibilityBuffer()
+            : m_Geometry("resource/shader/visibility_vert.glsl", "resource/shader/visibility_frag.glsl"),
+            m_Classify("resource/shader/fullscreen_vert.glsl", "resource/shader/visibility_classify_frag.glsl"),
+            m_Composite("resource/shader/fullscreen_vert.glsl", "resource/shader/deferred_composite_frag.glsl"),
+            m_Materials("resource/shader/visibility_resolve_vert.glsl", "resource/shader/visibility_resolve_frag.glsl"),
+            m_DrawBase(m_Geometry.getProgram(), "drawBase"),
+            m_Accumulation(m_Composite.getProgram(), "accumulation", { 0 }), m_CompositeDepth(m_Composite.getProgram(), "gbufferDepth", { 1 })
+        {
+            glGenVertexArrays(1, &m_EmptyVAO);
+
+            glGenBuffers(2, m_Buffers);
+            glGenTextures(2, m_Textures);
+            const GLenum formats[2] = { GL_RGBA32F, GL_RGBA32UI };
+            for (int i = 0; i < 2; ++i) {
+                upload(m_Buffers[i], nullptr, 0);
+                gl::stateCache::get().bindTexture(GL_TEXTURE_BUFFER, m_Textures[i]);
+                glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_Buffers[i]);
+            }
+            glGenTextures(2, m_PoolTextures);
+        }
+
+        visibilityBuffer(const visibilityBuffer&) = delete;
+        visibilityBuffer& operator=(const visibilityBuffer&) = delete;
+
+        ~visibilityBuffer() {
+            destroyTargets();
+            gl::stateCache& state = gl::stateCache::get();
+            state.vertexArrayDeleted(m_EmptyVAO);
+            glDeleteVertexArrays(1, &m_EmptyVAO);
+            for (int i = 0; i < 2; ++i) {
+                state.textureDeleted(m_Textures[i]);
+                state.textureDeleted(m_PoolTextures[i]);
+                state.bufferDeleted(m_Buffers[i]);
+            }
+            glDeleteTextures(2, m_Textures);
+            glDeleteTextures(2, m_PoolTextures);
+            glDeleteBuffers(2, m_Buffers);
+            for (GLuint program : { m_Geometry.getProgram(), m_Classify.getProgram(), m_Composite.getProgram() }) {
+                state.programDeleted(program);
+                glDeleteProgram(program);
+            }
+        }
+
+        // Moves pending material compiles along and requests the missing ones. True when every
+        // object in `draws` has its shading variant linked and they fit in the material depth.
+        bool prepare(const std::vector<visibilityDraw>& draws) {
+            m_Materials.poll();
+            bool ready = true;
+            m_Objects.clear();
+            for (const visibilityDraw& d : draws) {
+                if (!m_Objects.insert(d.mesh).second) continue;
+                const uint64_t key = d.mesh->getPermutationKey();
+                m_Materials.get(key);
+                ready &= m_Materials.ready(key);
+            }
+            return ready && m_Objects.size() <= maxMaterials;
+        }
+
+        // Draws `draws` and writes color and depth to the bound framebuffer, over its viewport.
+        // Leaves that framebuffer bound, depth writes on and blending off. `environment`, if
+        // given, lights the materials like the forward path.
+        void render(const std::vector<visibilityDraw>& draws, const gl::environment* environment = nullptr) {
+            static const gl::uniformID viewportID = gl::internUniform("visibilityViewport");
+            static const gl::uniformID materialDepthID = gl::internUniform("materialDepth");
+
+            auto start = std::chrono::high_resolution_clock::now();
+            m_Stats = {};
+            m_Stats.mode = shadingMode::Visibility;
+            if (draws.empty()) return;
+
+            gl::stateCache& state = gl::stateCache::get();
+            const gl::frameData& frame = gl::sceneUniforms::get().frame.get();
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_SceneFBO);
+            glGetIntegerv(GL_VIEWPORT, m_Viewport);
+            resize(std::max(m_Viewport[0] + m_Viewport[2], 1), std::max(m_Viewport[1] + m_Viewport[3], 1));
+
+            build(draws, frame.viewProjection);
+            bindGeometry();
+
+            GLint depthFunc;
+            glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+            const bool depthTest = state.isEnabled(GL_DEPTH_TEST);
+            const GLboolean scissorTest = glIsEnabled(GL_SCISSOR_TEST);
+            GLint scissor[4];
+            glGetIntegerv(GL_SCISSOR_BOX, scissor);
+
+            // Positions only: draw record and triangle of the nearest surface
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_FBO);
+            const GLuint none[4] = { ~0u, ~0u, 0u, 0u };
+            const GLfloat far = 1.0f, zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            state.depthMask(true);
+            glClearBufferuiv(GL_COLOR, 0, none);
+            glClearBufferfv(GL_DEPTH, 0, &far);
+            state.disable(GL_BLEND);
+            state.enable(GL_DEPTH_TEST);
+            state.depthFunc(GL_LESS);
+            state.useProgram(m_Geometry.getProgram());
+            state.bindVertexArray(gl::geometryPool::get().getPositionVAO());
+            for (const materialPass& pass : m_Passes) {
+                const gl::meshRange& range = pass.mesh->getRange();
+                m_DrawBase.upload(static_cast<int>(pass.first));
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, range.offset(), static_cast<GLsizei>(pass.count), range.baseVertex);
+            }
+
+            // Material numbers into the 16-bit depth
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_ShadeFBO);
+            glClearBufferfv(GL_COLOR, 0, zero);
+            glClearBufferfv(GL_DEPTH, 0, &far);
+            state.bindTexture(VISIBILITY_UNIT, GL_TEXTURE_2D, m_Visibility);
+            state.bindVertexArray(m_EmptyVAO);
+            state.depthFunc(GL_ALWAYS);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            state.useProgram(m_Classify.getProgram());
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+            // One pass per material over its pixels only
+            const glm::vec4 viewport(m_Viewport[0], m_Viewport[1], 1.0f / std::max(m_Viewport[2], 1), 1.0f / std::max(m_Viewport[3], 1));
+            state.depthFunc(GL_EQUAL);
+            state.depthMask(false);
+            glEnable(GL_SCISSOR_TEST);
+            for (uint32_t m = 0; m < m_Passes.size(); ++m) {
+                const materialPass& pass = m_Passes[m];
+                if (pass.scissor.z <= pass.scissor.x || pass.scissor.w <= pass.scissor.y) continue;
+                glScissor(pass.scissor.x, pass.scissor.y, pass.scissor.z - pass.scissor.x, pass.scissor.w - pass.scissor.y);
+
+                GLuint program = m_Materials.use(pass.mesh->getPermutationKey());
+                if (environment) environment->bind(program);
+                const gl::programReflection& uniforms = gl::programReflection::get(program);
+                pass.mesh->bindMaterial(program);
+                pass.mesh->uploadLights();
+                glUniform4fv(uniforms.location(viewportID), 1, &viewport.x);
+                glUniform1f(uniforms.location(materialDepthID), float(m + 1) / 65535.0f);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+                m_Stats.materialPasses++;
+            }
+            if (!scissorTest) glDisable(GL_SCISSOR_TEST);
+            glScissor(scissor[0], scissor[1], scissor[2], scissor[3]);
+
+            // Gamma and geometry depth into the scene framebuffer
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_SceneFBO);
+            state.depthFunc(GL_ALWAYS);
+            state.depthMask(true);
+            state.bindTexture(0, GL_TEXTURE_2D, m_Color);
+            state.bindTexture(1, GL_TEXTURE_2D, m_Depth);
+            state.useProgram(m_Composite.getProgram());
+            m_Accumulation.upload();
+            m_CompositeDepth.upload();
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            state.depthFunc(static_cast<GLenum>(depthFunc));
+            state.setEnabled(GL_DEPTH_TEST, depthTest);
+
+            // Geometry writes visibility and depth; classification reads visibility and writes
+            // the material depth; shading reads visibility, tests the material depth and writes
+            // color; composite reads color and depth and writes color and depth
+            const uint64_t pixels = uint64_t(m_Viewport[2]) * uint64_t(m_Viewport[3]);
+            m_Stats.width = m_Viewport[2];
+            m_Stats.height = m_Viewport[3];
+            m_Stats.bytesPerPixel = bytesPerPixel;
+            m_Stats.frameBytes = pixels * (bytesPerPixel + (8 + 2) + (8 + 2 + 8) + (8 + 4 + 4 + 4));
+            m_Stats.resolveMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // The per-material shading variants
+        gl::shaderLibrary& materials() { return m_Materials; }
+
+        const GLuint getDepth() const { return m_Depth; }
+
+        // For the last render()
+        const shadingStats& stats() const { return m_Stats; }
+    };
+
+}
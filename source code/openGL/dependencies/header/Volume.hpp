@@ -0,0 +1,500 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <gtc/type_ptr.hpp>
+
+#include <Window.hpp>
+#include <Utils.hpp>
+#include <Jobs.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#define VOLUME_BRICK_SIZE 8
+#define VOLUME_OPACITY_CUTOFF 0.99f
+
+namespace gl {
+
+    struct volumeSettings {
+        float stepSize = 1.0f;                      // base step in voxels
+        float adaptiveFactor = 4.0f;                // step multiplier inside homogeneous bricks
+        float densityScale = 0.05f;                 // extinction per voxel at density 1
+        float emptyThreshold = 1.0f / 255.0f;       // bricks at or below this max density are skipped
+        float opacityCutoff = VOLUME_OPACITY_CUTOFF;
+        float depthSharpness = 400.0f;              // depth-aware upsampling falloff
+        bool skipEmptySpace = true;
+        bool halfResolution = true;
+        glm::vec3 color = glm::vec3(1.0f);
+    };
+
+    struct volumeStats {
+        uint64_t rays = 0;
+        uint64_t samples = 0;
+        uint64_t skippedBricks = 0;
+        uint64_t earlyTerminations = 0;
+        double milliseconds = 0.0;
+    };
+
+    // CPU side of a volume: R8 densities plus a coarse min/max occupancy grid.
+    // Needs no GL context, so the reference raymarcher runs headless.
+    class volumeData {
+    private:
+        int m_Width = 0, m_Height = 0, m_Depth = 0;
+        std::vector<unsigned char> m_Density;
+
+        glm::ivec3 m_Bricks{ 0 };
+        std::vector<unsigned char> m_Occupancy; // interleaved min, max per brick
+
+        unsigned char voxel(int x, int y, int z) const {
+            x = std::clamp(x, 0, m_Width - 1);
+            y = std::clamp(y, 0, m_Height - 1);
+            z = std::clamp(z, 0, m_Depth - 1);
+            return m_Density[(size_t(z) * m_Height + y) * m_Width + x];
+        }
+
+        void buildOccupancy() {
+            m_Bricks = glm::ivec3(
+                (m_Width + VOLUME_BRICK_SIZE - 1) / VOLUME_BRICK_SIZE,
+                (m_Height + VOLUME_BRICK_SIZE - 1) / VOLUME_BRICK_SIZE,
+                (m_Depth + VOLUME_BRICK_SIZE - 1) / VOLUME_BRICK_SIZE);
+            m_Occupancy.assign(size_t(m_Bricks.x) * m_Bricks.y * m_Bricks.z * 2, 0);
+
+            // One voxel apron on each side keeps the range conservative for trilinear lookups
+            jobPool::get().parallelFor(m_Bricks.z, 1, [this](size_t begin, size_t end) {
+                for (int bz = (int)begin; bz < (int)end; ++bz)
+                for (int by = 0; by < m_Bricks.y; ++by)
+                for (int bx = 0; bx < m_Bricks.x; ++bx) {
+                    unsigned char lo = 255, hi = 0;
+                    for (int z = bz * VOLUME_BRICK_SIZE - 1; z <= (bz + 1) * VOLUME_BRICK_SIZE; ++z)
+                    for (int y = by * VOLUME_BRICK_SIZE - 1; y <= (by + 1) * VOLUME_BRICK_SIZE; ++y)
+                    for (int x = bx * VOLUME_BRICK_SIZE - 1; x <= (bx + 1) * VOLUME_BRICK_SIZE; ++x) {
+                        unsigned char v = voxel(x, y, z);
+                        lo = std::min(lo, v);
+                        hi = std::max(hi, v);
+                    }
+                    size_t i = ((size_t(bz) * m_Bricks.y + by) * m_Bricks.x + bx) * 2;
+                    m_Occupancy[i] = lo;
+                    m_Occupancy[i + 1] = hi;
+                }
+            });
+        }
+
+        // Bricks are VOLUME_BRICK_SIZE voxels wide, so the last one on an axis whose size is not
+        // a multiple of it reaches past 1 in volume space
+        glm::ivec3 brickAt(const glm::vec3& p) const {
+            glm::ivec3 brick(glm::floor(p * glm::vec3(m_Width, m_Height, m_Depth) / float(VOLUME_BRICK_SIZE)));
+            return glm::clamp(brick, glm::ivec3(0), m_Bricks - 1);
+        }
+
+        float brickExit(const glm::vec3& origin, const glm::vec3& dir, const glm::ivec3& brick) const {
+            glm::vec3 size(m_Width, m_Height, m_Depth);
+            float exitT = std::numeric_limits<float>::max();
+            for (int a = 0; a < 3; ++a) {
+                if (std::abs(dir[a]) <= 1e-20f) continue;
+                float bound = (dir[a] > 0.0f ? brick[a] + 1 : brick[a]) * float(VOLUME_BRICK_SIZE) / size[a];
+                exitT = std::min(exitT, (bound - origin[a]) / dir[a]);
+            }
+            return exitT;
+        }
+    public:
+        volumeData() = default;
+
+        volumeData(std::vector<unsigned char> density, int width, int height, int depth)
+            : m_Width(width), m_Height(height), m_Depth(depth), m_Density(std::move(density))
+        {
+            if (m_Density.size() != size_t(width) * height * depth)
+                throw std::runtime_error("Volume density size does not match dimensions");
+            buildOccupancy();
+        }
+
+        // One grayscale image per slice, same layout the texture3D path expects
+        volumeData(const std::vector<std::string>& paths) {
+            if (paths.empty()) throw std::runtime_error("No paths provided for volume");
+
+            for (size_t i = 0; i < paths.size(); i++) {
+                int w, h, c;
+                unsigned char* slice = stbi_load(paths[i].c_str(), &w, &h, &c, 1);
+                if (!slice) throw std::runtime_error("Failed to load slice: " + paths[i]);
+
+                if (i == 0) { m_Width = w; m_Height = h; }
+                else if (w != m_Width || h != m_Height) {
+                    stbi_image_free(slice);
+                    throw std::runtime_error("Slice dimensions mismatch: " + paths[i]);
+                }
+
+                m_Density.insert(m_Density.end(), slice, slice + size_t(w) * h);
+                stbi_image_free(slice);
+            }
+            m_Depth = static_cast<int>(paths.size());
+            buildOccupancy();
+        }
+
+        const int getWidth() const { return m_Width; }
+
+        const int getHeight() const { return m_Height; }
+
+        const int getDepth() const { return m_Depth; }
+
+        const glm::ivec3 getBrickCount() const { return m_Bricks; }
+
+        const std::vector<unsigned char>& getDensity() const { return m_Density; }
+
+        const std::vector<unsigned char>& getOccupancy() const { return m_Occupancy; }
+
+        // min, max density of a brick in [0, 1]
+        glm::vec2 brickRange(const glm::ivec3& brick) const {
+            size_t i = ((size_t(brick.z) * m_Bricks.y + brick.y) * m_Bricks.x + brick.x) * 2;
+            return glm::vec2(m_Occupancy[i], m_Occupancy[i + 1]) / 255.0f;
+        }
+
+        // Trilinear lookup with clamp-to-edge, p in [0, 1]^3 (texel centres at (i + 0.5) / size)
+        float sample(const glm::vec3& p) const {
+            glm::vec3 pos = p * glm::vec3(m_Width, m_Height, m_Depth) - 0.5f;
+            glm::vec3 base = glm::floor(pos);
+            glm::vec3 f = pos - base;
+            int x = (int)base.x, y = (int)base.y, z = (int)base.z;
+
+            float c00 = glm::mix((float)voxel(x, y, z), (float)voxel(x + 1, y, z), f.x);
+            float c10 = glm::mix((float)voxel(x, y + 1, z), (float)voxel(x + 1, y + 1, z), f.x);
+            float c01 = glm::mix((float)voxel(x, y, z + 1), (float)voxel(x + 1, y, z + 1), f.x);
+            float c11 = glm::mix((float)voxel(x, y + 1, z + 1), (float)voxel(x + 1, y + 1, z + 1), f.x);
+
+            return glm::mix(glm::mix(c00, c10, f.y), glm::mix(c01, c11, f.y), f.z) / 255.0f;
+        }
+
+        // Reference for volume_frag.glsl: ray p(t) = origin + t * dir in volume space, t in [0, tLimit].
+        // Returns premultiplied colour and coverage.
+        glm::vec4 raymarch(const glm::vec3& origin, const glm::vec3& dir, float tLimit, const volumeSettings& settings, volumeStats* stats = nullptr) const {
+            float tEnter = 0.0f, tExit = tLimit;
+            for (int a = 0; a < 3; ++a) {
+                if (std::abs(dir[a]) <= 1e-20f) {
+                    if (origin[a] < 0.0f || origin[a] > 1.0f) return glm::vec4(0.0f);
+                    continue;
+                }
+                float t0 = (0.0f - origin[a]) / dir[a];
+                float t1 = (1.0f - origin[a]) / dir[a];
+                tEnter = std::max(tEnter, std::min(t0, t1));
+                tExit = std::min(tExit, std::max(t0, t1));
+            }
+
+            if (stats) stats->rays++;
+
+            glm::vec4 acc(0.0f);
+            if (tEnter >= tExit) return acc;
+
+            float voxelLength = glm::length(dir * glm::vec3(m_Width, m_Height, m_Depth));
+            float dt = settings.stepSize / voxelLength;
+
+            float t = tEnter;
+            while (t < tExit) {
+                glm::vec3 p = origin + t * dir;
+                glm::ivec3 brick = brickAt(p);
+                glm::vec2 range = brickRange(brick);
+                float exitT = brickExit(origin, dir, brick);
+
+                if (settings.skipEmptySpace && range.y <= settings.emptyThreshold) {
+                    if (stats) stats->skippedBricks++;
+                    t = std::max(exitT, t + dt * 1e-3f);
+                    continue;
+                }
+
+                float h = 1.0f - (range.y - range.x);
+                float stepT = dt * glm::mix(1.0f, settings.adaptiveFactor, h * h);
+                stepT = std::max(dt, std::min(stepT, exitT - t));
+
+                float d = sample(p);
+                float alpha = 1.0f - std::exp(-d * settings.densityScale * stepT * voxelLength);
+                acc += glm::vec4(settings.color * alpha, alpha) * (1.0f - acc.a);
+                if (stats) stats->samples++;
+
+                if (acc.a >= settings.opacityCutoff) {
+                    if (stats) stats->earlyTerminations++;
+                    break;
+                }
+                t += stepT;
+            }
+            return acc;
+        }
+
+        // Full-frame CPU render, rows spread over the job pool. sceneDepth (optional) is
+        // width * height window depth values in [0, 1], row 0 at the bottom like GL.
+        std::vector<glm::vec4> render(int width, int height, const glm::mat4& view, const glm::mat4& proj, const glm::mat4& model,
+            const volumeSettings& settings, volumeStats* stats = nullptr, const float* sceneDepth = nullptr) const
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+
+            std::vector<glm::vec4> image(size_t(width) * height);
+            glm::mat4 invViewProj = glm::inverse(proj * view);
+            glm::mat4 invModel = glm::inverse(model);
+
+            std::atomic<uint64_t> rays{ 0 }, samples{ 0 }, skipped{ 0 }, terminated{ 0 };
+
+            jobPool::get().parallelFor(height, 8, [&](size_t begin, size_t end) {
+                volumeStats local;
+                for (int y = (int)begin; y < (int)end; ++y) {
+                    for (int x = 0; x < width; ++x) {
+                        glm::vec2 ndc((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f);
+                        float depth = sceneDepth ? sceneDepth[size_t(y) * width + x] : 1.0f;
+
+                        glm::vec4 nearW = invViewProj * glm::vec4(ndc, -1.0f, 1.0f);
+                        glm::vec4 farW = invViewProj * glm::vec4(ndc, depth * 2.0f - 1.0f, 1.0f);
+                        glm::vec3 origin = glm::vec3(invModel * glm::vec4(glm::vec3(nearW) / nearW.w, 1.0f));
+                        glm::vec3 dir = glm::vec3(invModel * glm::vec4(glm::vec3(farW) / farW.w, 1.0f)) - origin;
+
+                        image[size_t(y) * width + x] = raymarch(origin, dir, 1.0f, settings, &local);
+                    }
+                }
+                rays += local.rays;
+                samples += local.samples;
+                skipped += local.skippedBricks;
+                terminated += local.earlyTerminations;
+            });
+
+            if (stats) {
+                stats->rays = rays;
+                stats->samples = samples;
+                stats->skippedBricks = skipped;
+                stats->earlyTerminations = terminated;
+                stats->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            }
+            return image;
+        }
+    };
+
+    // GPU raymarcher over a unit cube placed by `model`. Composites premultiplied
+    // onto whatever framebuffer is bound, optionally at half resolution.
+    class volume {
+    private:
+        volumeData m_Data;
+        volumeSettings m_Settings;
+
+        gl::texture3D m_DensityTex;
+        gl::texture3D m_OccupancyTex;
+
+        gl::shader m_Raymarch;
+        gl::shader m_Upsample;
+
+        // Most of these hold still between frames, so their uploads are elided
+        struct raymarchUniforms {
+            gl::uniform<gl::sampler> density, occupancy, sceneDepth;
+            gl::uniform<bool> hasSceneDepth, skipEmptySpace;
+            gl::uniform<glm::mat4> invViewProj, invModel;
+            gl::uniform<glm::vec3> volumeSize, brickCount, volumeColor;
+            gl::uniform<float> brickSize, stepSize, adaptiveFactor, densityScale, emptyThreshold, opacityCutoff;
+
+            raymarchUniforms(GLuint program)
+                : density(program, "density", { 0 }), occupancy(program, "occupancy", { 1 }), sceneDepth(program, "sceneDepth", { 2 }),
+                hasSceneDepth(program, "hasSceneDepth"), skipEmptySpace(program, "skipEmptySpace"),
+                invViewProj(program, "invViewProj"), invModel(program, "invModel"),
+                volumeSize(program, "volumeSize"), brickCount(program, "brickCount"), volumeColor(program, "volumeColor"),
+                brickSize(program, "brickSize"), stepSize(program, "stepSize"), adaptiveFactor(program, "adaptiveFactor"), densityScale(program, "densityScale"),
+                emptyThreshold(program, "emptyThreshold"), opacityCutoff(program, "opacityCutoff")
+            {
+            }
+        } m_RaymarchUniforms;
+
+        struct upsampleUniforms {
+            gl::uniform<gl::sampler> lowColor, lowDepth, sceneDepth;
+            gl::uniform<bool> hasSceneDepth;
+            gl::uniform<glm::vec2> lowSize;
+            gl::uniform<float> depthSharpness;
+
+            upsampleUniforms(GLuint program)
+                : lowColor(program, "lowColor", { 0 }), lowDepth(program, "lowDepth", { 1 }), sceneDepth(program, "sceneDepth", { 2 }),
+                hasSceneDepth(program, "hasSceneDepth"), lowSize(program, "lowSize"), depthSharpness(program, "depthSharpness")
+            {
+            }
+        } m_UpsampleUniforms;
+
+        GLuint m_EmptyVAO = 0;
+        GLuint m_LowFBO = 0, m_LowColor = 0, m_LowDepth = 0;
+        int m_LowWidth = 0, m_LowHeight = 0;
+
+        void createLowTargets(int width, int height) {
+            if (width == m_LowWidth && height == m_LowHeight && m_LowFBO) return;
+            destroyLowTargets();
+
+            m_LowWidth = width;
+            m_LowHeight = height;
+
+            glGenTextures(1, &m_LowColor);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_2D, m_LowColor);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glGenTextures(1, &m_LowDepth);
+            gl::stateCache::get().bindTexture(GL_TEXTURE_2D, m_LowDepth);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glGenFramebuffers(1, &m_LowFBO);
+            glBindFramebuffer(GL_FRAMEBUFFER, m_LowFBO);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_LowColor, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_LowDepth, 0);
+            GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+            glDrawBuffers(2, buffers);
+
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                throw std::runtime_error("Volume half-res framebuffer incomplete");
+        }
+
+        void destroyLowTargets() {
+            if (m_LowFBO) glDeleteFramebuffers(1, &m_LowFBO);
+            for (GLuint texture : { m_LowColor, m_LowDepth }) {
+                if (!texture) continue;
+                gl::stateCache::get().textureDeleted(texture);
+                glDeleteTextures(1, &texture);
+            }
+            m_LowFBO = m_LowColor = m_LowDepth = 0;
+            m_LowWidth = m_LowHeight = 0;
+        }
+
+        void raymarchPass(const glm::mat4& invViewProj, const glm::mat4& invModel, GLuint sceneDepth) {
+            gl::stateCache& state = gl::stateCache::get();
+            GLuint program = m_Raymarch.getProgram();
+            state.useProgram(program);
+
+            raymarchUniforms& u = m_RaymarchUniforms;
+            m_DensityTex.bind(GL_TEXTURE0);
+            u.density.upload();
+            m_OccupancyTex.bind(GL_TEXTURE1);
+            u.occupancy.upload();
+            state.bindTexture(2, GL_TEXTURE_2D, sceneDepth);
+            u.sceneDepth.upload();
+            u.hasSceneDepth.upload(sceneDepth != 0);
+
+            u.invViewProj.upload(invViewProj);
+            u.invModel.upload(invModel);
+
+            u.volumeSize.upload(glm::vec3(m_Data.getWidth(), m_Data.getHeight(), m_Data.getDepth()));
+            u.brickCount.upload(glm::vec3(m_Data.getBrickCount()));
+            u.brickSize.upload(float(VOLUME_BRICK_SIZE));
+            u.stepSize.upload(m_Settings.stepSize);
+            u.adaptiveFactor.upload(m_Settings.adaptiveFactor);
+            u.densityScale.upload(m_Settings.densityScale);
+            u.emptyThreshold.upload(m_Settings.emptyThreshold);
+            u.opacityCutoff.upload(m_Settings.opacityCutoff);
+            u.skipEmptySpace.upload(m_Settings.skipEmptySpace);
+            u.volumeColor.upload(m_Settings.color);
+
+            state.bindVertexArray(m_EmptyVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+
+        void upsamplePass(GLuint sceneDepth) {
+            gl::stateCache& state = gl::stateCache::get();
+            state.useProgram(m_Upsample.getProgram());
+
+            upsampleUniforms& u = m_UpsampleUniforms;
+            state.bindTexture(0, GL_TEXTURE_2D, m_LowColor);
+            u.lowColor.upload();
+            state.bindTexture(1, GL_TEXTURE_2D, m_LowDepth);
+            u.lowDepth.upload();
+            state.bindTexture(2, GL_TEXTURE_2D, sceneDepth);
+            u.sceneDepth.upload();
+            u.hasSceneDepth.upload(sceneDepth != 0);
+            u.lowSize.upload(glm::vec2(m_LowWidth, m_LowHeight));
+            u.depthSharpness.upload(m_Settings.depthSharpness);
+
+            state.bindVertexArray(m_EmptyVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+    public:
+        volume(volumeData data, const volumeSettings& settings = {})
+            : m_Data(std::move(data)), m_Settings(settings),
+            m_DensityTex(m_Data.getDensity().data(), m_Data.getWidth(), m_Data.getHeight(), m_Data.getDepth(), GL_R8, GL_RED, GL_LINEAR, (GLuint)-1),
+            m_OccupancyTex(m_Data.getOccupancy().data(), m_Data.getBrickCount().x, m_Data.getBrickCount().y, m_Data.getBrickCount().z, GL_RG8, GL_RG, GL_NEAREST, (GLuint)-1),
+            m_Raymarch("resource/shader/fullscreen_vert.glsl", "resource/shader/volume_frag.glsl"),
+            m_Upsample("resource/shader/fullscreen_vert.glsl", "resource/shader/upsample_frag.glsl"),
+            m_RaymarchUniforms(m_Raymarch.getProgram()), m_UpsampleUniforms(m_Upsample.getProgram())
+        {
+            glGenVertexArrays(1, &m_EmptyVAO);
+        }
+
+        volume(const volume&) = delete;
+        volume& operator=(const volume&) = delete;
+
+        ~volume() {
+            destroyLowTargets();
+            gl::stateCache& state = gl::stateCache::get();
+            if (m_EmptyVAO) {
+                state.vertexArrayDeleted(m_EmptyVAO);
+                glDeleteVertexArrays(1, &m_EmptyVAO);
+            }
+            state.programDeleted(m_Raymarch.getProgram());
+            state.programDeleted(m_Upsample.getProgram());
+            glDeleteProgram(m_Raymarch.getProgram());
+            glDeleteProgram(m_Upsample.getProgram());
+        }
+
+        volumeSettings& settings() { return m_Settings; }
+
+        const volumeData& data() const { return m_Data; }
+
+        // sceneDepth: optional depth texture of the opaque scene, clips rays and drives the upsampling
+        void draw(const gl::window& window, const glm::mat4& view, const glm::mat4& proj, const glm::mat4& model, GLuint sceneDepth = 0) {
+            GLint prevFBO, prevViewport[4], prevProgram;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFBO);
+            glGetIntegerv(GL_VIEWPORT, prevViewport);
+            glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+            gl::stateCache& state = gl::stateCache::get();
+            bool depthTest = state.isEnabled(GL_DEPTH_TEST);
+            bool blend = state.isEnabled(GL_BLEND);
+            bool cull = state.isEnabled(GL_CULL_FACE);
+
+            state.disable(GL_DEPTH_TEST);
+            state.disable(GL_CULL_FACE);
+            state.depthMask(false);
+
+            glm::mat4 invViewProj = glm::inverse(proj * view);
+            glm::mat4 invModel = glm::inverse(model);
+
+            int width = window.getWidth(), height = window.getHeight();
+
+            if (m_Settings.halfResolution) {
+                createLowTargets(std::max(1, width / 2), std::max(1, height / 2));
+
+                glBindFramebuffer(GL_FRAMEBUFFER, m_LowFBO);
+                glViewport(0, 0, m_LowWidth, m_LowHeight);
+                glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+                glClear(GL_COLOR_BUFFER_BIT);
+                state.disable(GL_BLEND);
+                raymarchPass(invViewProj, invModel, sceneDepth);
+
+                glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
+                glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+                state.enable(GL_BLEND);
+                state.blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+                upsamplePass(sceneDepth);
+            }
+            else {
+                state.enable(GL_BLEND);
+                state.blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+                raymarchPass(invViewProj, invModel, sceneDepth);
+            }
+
+            state.depthMask(true);
+            state.setEnabled(GL_DEPTH_TEST, depthTest);
+            state.setEnabled(GL_CULL_FACE, cull);
+            state.setEnabled(GL_BLEND, blend);
+            state.useProgram(prevProgram);
+        }
+    };
+
+}
@@ -7,6 +7,9 @@
 #include <gtc/matrix_transform.hpp>  
 #include <gtc/type_ptr.hpp>  
 
+#include <StateCache.hpp>
+#include <RingBuffer.hpp>
+
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
@@ -22,6 +25,15 @@
 #define ENABLE_ADAPTIVE_VSYNC -1
 #define DISABLE_VSYNC 0
 
+// Context the window asks for first; 3.3 core is the fallback when the driver refuses it.
+// 4.3 brings glMultiDrawElementsIndirect (gl::renderQueue), set 3.3 to skip the attempt.
+#ifndef WINDOW_GL_VERSION_MAJOR
+
+	#define WINDOW_GL_VERSION_MAJOR 4
+	#define WINDOW_GL_VERSION_MINOR 3
+
+#endif // WINDOW_GL_VERSION_MAJOR
+
 namespace gl {
 
 	class camera;
@@ -100,6 +112,7 @@ namespace gl {
 		float currentFrame;
 		float lastFrame;
 		int m_Vsync;
+		int m_GLMajor, m_GLMinor;
 		double scrollX;
 		double scrollY;
 		int mouseButton;
@@ -116,11 +129,20 @@ namespace gl {
 			glEnable(GL_DEPTH_TEST);
 			glDepthMask(GL_TRUE);
 			glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-			glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-			glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 			glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-			m_Window = glfwCreateWindow(width, height, name, monitor, share);
+			const int versions[][2] = { { WINDOW_GL_VERSION_MAJOR, WINDOW_GL_VERSION_MINOR }, { 3, 3 } };
+			m_Window = nullptr;
+			for (const auto& version : versions) {
+				glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+				glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+				m_Window = glfwCreateWindow(width, height, name, monitor, share);
+				if (m_Window) {
+					m_GLMajor = version[0];
+					m_GLMinor = version[1];
+					break;
+				}
+			}
 
 			if (!m_Window) { 
 				ifinit = false;
@@ -156,6 +178,9 @@ namespace gl {
 
 		inline GLFWwindow* getWindow() const { return m_Window; }
 
+		// Version the context was created with, e.g. 43 or 33
+		inline const int getGLVersion() const { return m_GLMajor * 10 + m_GLMinor; }
+
 		inline const GLuint getShader() const { return m_Shader; }
 
 		inline const float getTargetAspect() const { return m_TargetAspect; }
@@ -230,6 +255,8 @@ namespace gl {
 
 		void swapBuffers() {
 			glfwSwapBuffers(m_Window);
+			gl::stateCache::get().endFrame();
+			gl::ringBuffer::endFrameAll();
 		}
 
 		void linkShader(GLuint shaderProgram) {
@@ -238,25 +265,25 @@ namespace gl {
 		}
 
 		void drawArray(GLuint shaderProgram, GLuint VAO, GLenum mode, GLint first, GLsizei count) {
-			glUseProgram(shaderProgram);
-			glBindVertexArray(VAO);
+			gl::stateCache::get().useProgram(shaderProgram);
+			gl::stateCache::get().bindVertexArray(VAO);
 			glDrawArrays(mode, first, count);
 		}
 
 		void drawElements(GLuint shaderProgram, GLuint VAO, GLsizei count, const GLvoid* indices) {
-			glUseProgram(shaderProgram);
-			glBindVertexArray(VAO);
+			gl::stateCache::get().useProgram(shaderProgram);
+			gl::stateCache::get().bindVertexArray(VAO);
 			glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, indices);
 		}
 
 		void drawElements(GLuint VAO, GLsizei count, const GLvoid* indices) {
-			glBindVertexArray(VAO);
+			gl::stateCache::get().bindVertexArray(VAO);
 			glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, indices);
 		}
 
 		void drawElementsWithTexture3D(GLuint VAO, GLsizei count, const GLvoid* indices, GLuint texture) {
-			glBindTexture(GL_TEXTURE_3D, texture);
-			glBindVertexArray(VAO);
+			gl::stateCache::get().bindTexture(GL_TEXTURE_3D, texture);
+			gl::stateCache::get().bindVertexArray(VAO);
 			glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, indices);
 		}
 
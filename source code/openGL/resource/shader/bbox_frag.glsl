@@ -0,0 +1,6 @@
+#version 330 core
+
+// Color writes are masked off while boxes are tested; only the depth test counts
+void main()
+{
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+#include "uniforms.glsl"
+
+// World-space box of an occlusion query
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+// Unit cube as one 14 vertex triangle strip, no vertex buffer needed
+void main()
+{
+    int bit = 1 << gl_VertexID;
+    vec3 corner = vec3((0x287A & bit) != 0, (0x02AF & bit) != 0, (0x31E3 & bit) != 0);
+    gl_Position = viewProjection * vec4(mix(boxMin, boxMax, corner), 1.0);
+}
@@ -0,0 +1,33 @@
+// Clustered scene lights built by gl::clusteredLights. Needs uniforms.glsl and pbr.glsl
+// included first. Each cell of the view-space froxel grid holds an offset and a count into
+// clusterLightIndices, and every light is two texels of clusterLightData: position and
+// radius, then color and point shadow slot + 1.
+
+#include "pointshadows.glsl"
+
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLightIndices;
+uniform samplerBuffer clusterLightData;
+
+// Lights of the cell this fragment falls in
+vec3 clusteredLights(vec3 N, vec3 V, vec3 P, vec3 albedo, float metallic, float roughness, vec3 F0)
+{
+    vec3 Lo = vec3(0.0);
+    if (clusterSize.w == 0) return Lo;
+
+    vec2 uv = (gl_FragCoord.xy - clusterViewport.xy) * clusterViewport.zw;
+    float depth = max(-(view * vec4(P, 1.0)).z, 1e-6);
+    ivec2 tile = clamp(ivec2(uv * vec2(clusterSize.xy)), ivec2(0), clusterSize.xy - 1);
+    int slice = clamp(int(log(depth) * clusterDepth.x + clusterDepth.y), 0, clusterSize.z - 1);
+
+    uvec2 range = texelFetch(clusterGrid, (slice * clusterSize.y + tile.y) * clusterSize.x + tile.x).rg;
+    for (uint i = 0u; i < range.y; i++) {
+        int light = int(texelFetch(clusterLightIndices, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(clusterLightData, 2 * light);
+        vec4 colorShadow = texelFetch(clusterLightData, 2 * light + 1);
+
+        float window = lightWindow(distance(positionRadius.xyz, P), positionRadius.w);
+        if (window > 0.0) Lo += pointLight(N, V, P, albedo, metallic, roughness, F0, positionRadius.xyz, colorShadow.rgb) * window * pointShadow(int(colorShadow.w) - 1, P, N);
+    }
+    return Lo;
+}
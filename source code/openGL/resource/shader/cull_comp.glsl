@@ -0,0 +1,116 @@
+#version 430 core
+layout(local_size_x = 64) in;
+
+// GPU culling for gl::renderQueue. Each invocation tests one instance's box against the
+// frustum and, in phase 1, the Hi-Z pyramid, then appends the instance to its command:
+// instanceCount is bumped atomically and the instance copied to baseInstance + slot.
+//
+// Phase 0 draws what was visible last frame. Phase 1 runs after the Hi-Z pyramid is built
+// from that depth, records this frame's visibility and draws only what phase 0 missed.
+
+struct instanceData {
+    mat4 model;
+    vec4 color;
+};
+
+struct cullBounds {
+    vec4 boxMin;        // model space
+    vec4 boxMax;
+    uint instance;      // into the instance stream, after streamBase
+    uint command;
+    uint history;       // stable slot in the visibility history
+    uint pad;
+};
+
+struct drawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Instances { instanceData instances[]; };
+layout(std430, binding = 1) readonly buffer Bounds { cullBounds bounds[]; };
+layout(std430, binding = 2) buffer Commands { drawCommand commands[]; };
+layout(std430, binding = 3) writeonly buffer Visible { instanceData visible[]; };
+layout(std430, binding = 4) buffer History { uint history[]; };
+
+layout(binding = 0) uniform sampler2D hiZ;
+
+uniform mat4 viewProjection;
+uniform vec4 planes[6];
+uniform uint count;
+uniform uint streamBase;
+uniform uint commandBase;
+uniform int phase;
+
+// Nearest depth of the box against the farthest depth under its screen rectangle, read
+// from the level where that rectangle spans at most 2x2 texels
+bool occluded(vec3 lo, vec3 hi)
+{
+    vec2 rectMin = vec2(1.0), rectMax = vec2(0.0);
+    float nearest = 1.0;
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = vec3((i & 1) != 0 ? hi.x : lo.x, (i & 2) != 0 ? hi.y : lo.y, (i & 4) != 0 ? hi.z : lo.z);
+        vec4 clip = viewProjection * vec4(corner, 1.0);
+        if (clip.w <= 0.0) return false;
+        vec3 ndc = clip.xyz / clip.w;
+        rectMin = min(rectMin, ndc.xy * 0.5 + 0.5);
+        rectMax = max(rectMax, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    rectMin = clamp(rectMin, 0.0, 1.0);
+    rectMax = clamp(rectMax, 0.0, 1.0);
+
+    ivec2 baseSize = textureSize(hiZ, 0);
+    vec2 extent = (rectMax - rectMin) * vec2(baseSize);
+    int levels = textureQueryLevels(hiZ);
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, levels - 1);
+
+    // Same floor sizes the pyramid was built with; textureSize with a dynamic lod is not
+    // reliable on every driver
+    ivec2 levelSize = max(baseSize >> level, ivec2(1));
+    ivec2 first = min(ivec2(rectMin * vec2(baseSize)) >> level, levelSize - 1);
+    ivec2 last = min(ivec2(rectMax * vec2(baseSize)) >> level, levelSize - 1);
+
+    float farthest = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            farthest = max(farthest, texelFetch(hiZ, ivec2(x, y), level).r);
+    return nearest > farthest;
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= count) return;
+
+    cullBounds b = bounds[i];
+    instanceData data = instances[streamBase + b.instance];
+
+    // World box around the transformed model box
+    vec3 center = (b.boxMin.xyz + b.boxMax.xyz) * 0.5;
+    vec3 extents = (b.boxMax.xyz - b.boxMin.xyz) * 0.5;
+    vec3 worldCenter = (data.model * vec4(center, 1.0)).xyz;
+    mat3 m = mat3(data.model);
+    vec3 worldExtents = abs(m[0]) * extents.x + abs(m[1]) * extents.y + abs(m[2]) * extents.z;
+
+    bool visibleNow = true;
+    for (int p = 0; p < 6; ++p)
+        if (dot(planes[p].xyz, worldCenter) + planes[p].w + dot(abs(planes[p].xyz), worldExtents) < 0.0) visibleNow = false;
+
+    bool visibleBefore = history[b.history] != 0u;
+    if (phase == 0) {
+        if (!visibleNow || !visibleBefore) return;
+    }
+    else {
+        if (visibleNow) visibleNow = !occluded(worldCenter - worldExtents, worldCenter + worldExtents);
+        history[b.history] = visibleNow ? 1u : 0u;
+        if (!visibleNow || visibleBefore) return;
+    }
+
+    uint command = commandBase + b.command;
+    uint slot = atomicAdd(commands[command].instanceCount, 1u);
+    visible[commands[command].baseInstance + slot] = data;
+}
@@ -0,0 +1,20 @@
+#version 330 core
+out vec4 FragColor;
+
+// Last pass of gl::gBuffer and gl::visibilityBuffer: gamma-encodes the accumulated light
+// into the scene framebuffer and writes the geometry depth along with it, so forward passes
+// afterwards depth test against it
+
+uniform sampler2D accumulation;
+uniform sampler2D gbufferDepth;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbufferDepth, pixel, 0).r;
+    if (depth == 1.0) discard;
+
+    vec3 color = texelFetch(accumulation, pixel, 0).rgb;
+    FragColor = vec4(pow(color, vec3(1.0 / 2.2)), 1.0);
+    gl_FragDepth = depth;
+}
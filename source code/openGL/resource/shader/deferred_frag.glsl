@@ -0,0 +1,29 @@
+#version 330 core
+out vec4 FragColor;
+
+// Full-screen lighting pass of gl::gBuffer: ambient, emission, the sun and, unless light
+// volumes draw them, the clustered scene lights. Writes linear HDR into the accumulation target.
+
+#include "uniforms.glsl"
+#include "pbr.glsl"
+#include "ibl.glsl"
+#include "clusters.glsl"
+#include "shadows.glsl"
+#include "gbuffer.glsl"
+
+uniform bool clusteredLighting;
+
+void main()
+{
+    surface s = readSurface(ivec2(gl_FragCoord.xy));
+    if (s.depth == 1.0) discard;
+
+    vec3 V = normalize(camPos - s.position);
+    vec3 F0 = mix(vec3(0.04), s.albedo, s.metallic);
+
+    vec3 color = ambientLight(s.normal, V, s.albedo, s.metallic, s.roughness, F0, s.ao) + s.emission;
+    color += sunLight(s.normal, V, s.position, s.albedo, s.metallic, s.roughness, F0);
+    if (clusteredLighting) color += clusteredLights(s.normal, V, s.position, s.albedo, s.metallic, s.roughness, F0);
+
+    FragColor = vec4(color, 1.0);
+}
@@ -1,72 +1,131 @@
 #version 330 core
+
+// DEFERRED writes the surface to gl::gBuffer's targets instead of shading it
+#ifdef DEFERRED
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec2 outNormal;
+layout(location = 2) out vec4 outMaterial;
+layout(location = 3) out vec3 outEmissive;
+#else
 out vec4 FragColor;
+#endif
+
+// Material features. gl::shaderLibrary defines PERMUTATION plus only the features a
+// material uses; a plain gl::shader compiles the full-featured version.
+#ifndef PERMUTATION
+#define HAS_BASE_COLOR_MAP
+#define HAS_NORMAL_MAP
+#define HAS_METALLIC_ROUGHNESS_MAP
+#define HAS_OCCLUSION_MAP
+#define HAS_EMISSIVE
+#endif
 
 in vec2 TexCoords;
 in vec3 FragPos;
 in mat3 TBN;
+#ifdef INSTANCED
+in vec4 InstanceColor;
+#endif
 
+#ifdef HAS_BASE_COLOR_MAP
 uniform sampler2D baseColor;
+#endif
+#ifdef HAS_NORMAL_MAP
 uniform sampler2D normal;
+#endif
+#ifdef HAS_METALLIC_ROUGHNESS_MAP
 uniform sampler2D metallicRoughness;
+#endif
+#ifdef HAS_OCCLUSION_MAP
 uniform sampler2D occlusion;
+#endif
+#ifdef HAS_EMISSIVE
 uniform sampler2D emissive;
+#endif
 
-uniform vec3 camPos;
-
-#define MAX_LIGHTS 8
-uniform int numLights;
-uniform vec3 lightPos[MAX_LIGHTS];
-uniform vec3 lightColor[MAX_LIGHTS];
+#include "uniforms.glsl"
+#include "pbr.glsl"
+#include "ibl.glsl"
+#include "clusters.glsl"
+#include "shadows.glsl"
+#include "octahedral.glsl"
 
 // Get normal from normal map using TBN
 vec3 getNormalFromMap()
 {
+#ifdef HAS_NORMAL_MAP
     vec3 tangentNormal = texture(normal, TexCoords).xyz * 2.0 - 1.0;
     return normalize(TBN * tangentNormal);
+#else
+    return normalize(TBN[2]);
+#endif
 }
 
 void main()
 {
-    vec3 albedo = pow(texture(baseColor, TexCoords).rgb, vec3(2.2));
-    float metallic  = texture(metallicRoughness, TexCoords).b;
-    float roughness = texture(metallicRoughness, TexCoords).g;
-    float ao        = texture(occlusion, TexCoords).r;
-    vec3 emissive   = texture(emissive, TexCoords).rgb;
+#ifdef HAS_BASE_COLOR_MAP
+    vec4 base = texture(baseColor, TexCoords);
+#else
+    vec4 base = vec4(1.0);
+#endif
+#ifdef INSTANCED
+    base *= InstanceColor;
+#endif
+    vec3 albedo = pow(base.rgb, vec3(2.2));
+
+#ifdef HAS_METALLIC_ROUGHNESS_MAP
+    vec2 metalRough = texture(metallicRoughness, TexCoords).bg;
+    float metallic  = metalRough.x;
+    float roughness = metalRough.y;
+#else
+    float metallic  = 0.0;
+    float roughness = 1.0;
+#endif
+
+#ifdef HAS_OCCLUSION_MAP
+    float ao = texture(occlusion, TexCoords).r;
+#else
+    float ao = 1.0;
+#endif
+
+#ifdef HAS_EMISSIVE
+    vec3 emission = texture(emissive, TexCoords).rgb;
+#else
+    vec3 emission = vec3(0.0);
+#endif
 
     vec3 N = getNormalFromMap();
     vec3 V = normalize(camPos - FragPos);
 
+    vec3 F0 = mix(vec3(0.04), albedo, metallic);
     vec3 Lo = vec3(0.0);
 
-    for (int i = 0; i < numLights; i++) {
-        vec3 L = normalize(lightPos[i] - FragPos);
-        vec3 H = normalize(V + L);
-
-        float distance = length(lightPos[i] - FragPos);
-        float attenuation = 1.0 / (distance * distance);
-        vec3 radiance = lightColor[i] * attenuation;
-
-        float NDF = pow(max(dot(N, H), 0.0), 2.0) * (roughness * roughness);
-        float G = max(dot(N, V), 0.0) * max(dot(N, L), 0.0);
-
-        vec3 F0 = mix(vec3(0.04), albedo, metallic);
-        vec3 F = F0 + (1.0 - F0) * pow(1.0 - max(dot(H, V), 0.0), 5.0);
-
-        vec3 numerator = NDF * G * F;
-        float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.001;
-        vec3 specular = numerator / denominator;
-
-        vec3 kS = F;
-        vec3 kD = (vec3(1.0) - kS) * (1.0 - metallic);
+    // A constant count lets the compiler unroll the loop per permutation
+#ifdef LIGHT_COUNT
+    const int lightCount = LIGHT_COUNT;
+#else
+    int lightCount = numLights;
+#endif
 
-        float NdotL = max(dot(N, L), 0.0);
-        Lo += (kD * albedo / 3.14159 + specular) * radiance * NdotL;
+    for (int i = 0; i < lightCount; i++) {
+        Lo += pointLight(N, V, FragPos, albedo, metallic, roughness, F0, lightPos[i], lightColor[i]) * pointShadow(lightShadow[i], FragPos, N);
     }
 
-    vec3 ambient = ao * albedo * 0.03;
-    vec3 color = ambient + Lo + emissive;
+#ifdef DEFERRED
+    // The object's own lights ride along with its emission; scene lights, the sun and
+    // ambient are added by the lighting pass
+    outAlbedo = vec4(base.rgb, 1.0);
+    outNormal = octEncode(N);
+    outMaterial = vec4(metallic, roughness, ao, 1.0);
+    outEmissive = emission + Lo;
+#else
+    Lo += clusteredLights(N, V, FragPos, albedo, metallic, roughness, F0);
+    Lo += sunLight(N, V, FragPos, albedo, metallic, roughness, F0);
+
+    vec3 ambient = ambientLight(N, V, albedo, metallic, roughness, F0, ao);
+    vec3 color = ambient + Lo + emission;
     color = pow(color, vec3(1.0/2.2));
 
-    float alpha = texture(baseColor, TexCoords).a;
-    FragColor = vec4(color, alpha);
+    FragColor = vec4(color, base.a);
+#endif
 }
@@ -0,0 +1,43 @@
+// Reading side of gl::gBuffer. The targets are the same size as the framebuffer the
+// scene is drawn to, so gl_FragCoord addresses them directly. Needs uniforms.glsl.
+
+#include "octahedral.glsl"
+
+uniform sampler2D gbufferAlbedo;        // base color (gamma), unused
+uniform sampler2D gbufferNormal;        // octahedral world normal
+uniform sampler2D gbufferMaterial;      // metallic, roughness, ao, unused
+uniform sampler2D gbufferEmissive;      // emission plus the object's own lights, linear
+uniform sampler2D gbufferDepth;
+
+uniform mat4 inverseViewProjection;
+uniform vec4 gbufferViewport;           // origin in pixels, reciprocal size
+
+struct surface {
+    vec3 position;
+    vec3 normal;
+    vec3 albedo;
+    float metallic;
+    float roughness;
+    float ao;
+    vec3 emission;
+    float depth;
+};
+
+surface readSurface(ivec2 pixel)
+{
+    surface s;
+    s.depth = texelFetch(gbufferDepth, pixel, 0).r;
+
+    vec2 uv = (vec2(pixel) + 0.5 - gbufferViewport.xy) * gbufferViewport.zw;
+    vec4 world = inverseViewProjection * vec4(vec3(uv, s.depth) * 2.0 - 1.0, 1.0);
+    s.position = world.xyz / world.w;
+
+    s.normal = octDecode(texelFetch(gbufferNormal, pixel, 0).rg);
+    s.albedo = pow(texelFetch(gbufferAlbedo, pixel, 0).rgb, vec3(2.2));
+    vec3 material = texelFetch(gbufferMaterial, pixel, 0).rgb;
+    s.metallic = material.r;
+    s.roughness = material.g;
+    s.ao = material.b;
+    s.emission = texelFetch(gbufferEmissive, pixel, 0).rgb;
+    return s;
+}
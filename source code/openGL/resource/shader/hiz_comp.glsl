@@ -0,0 +1,35 @@
+#version 430 core
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// One level of the Hi-Z pyramid: level 0 copies the scene depth, every other level keeps
+// the farthest of the texels below it. Odd sizes fold the extra row/column into the last
+// texel, so a texel never covers less than the pixels under it.
+layout(binding = 0) uniform sampler2D sceneDepth;
+layout(binding = 0, r32f) uniform readonly image2D srcLevel;
+layout(binding = 1, r32f) uniform writeonly image2D dstLevel;
+
+uniform int level;
+
+void main()
+{
+    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 dstSize = imageSize(dstLevel);
+    if (any(greaterThanEqual(dst, dstSize))) return;
+
+    if (level == 0) {
+        imageStore(dstLevel, dst, vec4(texelFetch(sceneDepth, dst, 0).r));
+        return;
+    }
+
+    ivec2 srcSize = imageSize(srcLevel);
+    ivec2 first = dst * 2;
+    ivec2 last = min(first + 1, srcSize - 1);
+    if (dst.x == dstSize.x - 1) last.x = srcSize.x - 1;
+    if (dst.y == dstSize.y - 1) last.y = srcSize.y - 1;
+
+    float farthest = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            farthest = max(farthest, imageLoad(srcLevel, ivec2(x, y)).r);
+    imageStore(dstLevel, dst, vec4(farthest));
+}
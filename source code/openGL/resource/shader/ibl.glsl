@@ -0,0 +1,42 @@
+// Image-based lighting (gl::environment)
+
+uniform bool hasEnvironment;
+uniform vec3 shCoeffs[9];
+uniform samplerCube prefilterMap;
+uniform sampler2D brdfLUT;
+uniform float prefilterLevels;
+
+// L2 spherical harmonics, coefficients already hold irradiance / pi
+vec3 irradianceSH(vec3 n)
+{
+    vec3 e = shCoeffs[0] * 0.282095
+        + shCoeffs[1] * 0.488603 * n.y
+        + shCoeffs[2] * 0.488603 * n.z
+        + shCoeffs[3] * 0.488603 * n.x
+        + shCoeffs[4] * 1.092548 * n.x * n.y
+        + shCoeffs[5] * 1.092548 * n.y * n.z
+        + shCoeffs[6] * 0.315392 * (3.0 * n.z * n.z - 1.0)
+        + shCoeffs[7] * 1.092548 * n.x * n.z
+        + shCoeffs[8] * 0.546274 * (n.x * n.x - n.y * n.y);
+    return max(e, vec3(0.0));
+}
+
+vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+{
+    return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(1.0 - cosTheta, 5.0);
+}
+
+vec3 ambientLight(vec3 N, vec3 V, vec3 albedo, float metallic, float roughness, vec3 F0, float ao)
+{
+    if (!hasEnvironment) return ao * albedo * 0.03;
+
+    float NdotV = max(dot(N, V), 0.0);
+    vec3 F = fresnelSchlickRoughness(NdotV, F0, roughness);
+    vec3 kD = (vec3(1.0) - F) * (1.0 - metallic);
+
+    vec3 R = reflect(-V, N);
+    vec3 prefiltered = textureLod(prefilterMap, R, roughness * prefilterLevels).rgb;
+    vec2 brdf = texture(brdfLUT, vec2(NdotV, roughness)).rg;
+
+    return (kD * irradianceSH(N) * albedo + prefiltered * (F * brdf.x + brdf.y)) * ao;
+}
@@ -0,0 +1,32 @@
+#version 330 core
+out vec4 FragColor;
+
+// One light on the G-buffer surfaces behind its volume's front. Back faces are drawn with
+// GL_GREATER, so only surfaces in front of the volume's far side get here; the view-depth
+// bounds of the sphere then reject the ones in front of it before any shading.
+
+#include "uniforms.glsl"
+#include "pbr.glsl"
+#include "clusters.glsl"
+#include "gbuffer.glsl"
+
+flat in int Light;
+
+void main()
+{
+    vec4 positionRadius = texelFetch(clusterLightData, 2 * Light);
+    surface s = readSurface(ivec2(gl_FragCoord.xy));
+
+    float lightDepth = -(view * vec4(positionRadius.xyz, 1.0)).z;
+    float surfaceDepth = -(view * vec4(s.position, 1.0)).z;
+    if (abs(surfaceDepth - lightDepth) > positionRadius.w) discard;
+
+    float window = lightWindow(distance(positionRadius.xyz, s.position), positionRadius.w);
+    if (window <= 0.0) discard;
+
+    vec3 V = normalize(camPos - s.position);
+    vec3 F0 = mix(vec3(0.04), s.albedo, s.metallic);
+    vec4 colorShadow = texelFetch(clusterLightData, 2 * Light + 1);
+    float shadow = pointShadow(int(colorShadow.w) - 1, s.position, s.normal);
+    FragColor = vec4(pointLight(s.normal, V, s.position, s.albedo, s.metallic, s.roughness, F0, positionRadius.xyz, colorShadow.rgb) * window * shadow, 1.0);
+}
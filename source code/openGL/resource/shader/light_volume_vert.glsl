@@ -0,0 +1,19 @@
+#version 330 core
+
+// Box around one scene light per instance, for gl::gBuffer's light volume pass
+
+#include "uniforms.glsl"
+
+uniform samplerBuffer clusterLightData;
+
+flat out int Light;
+
+void main()
+{
+    vec4 positionRadius = texelFetch(clusterLightData, 2 * gl_InstanceID);
+    int bit = 1 << gl_VertexID;
+    vec3 corner = vec3((0x287A & bit) != 0, (0x02AF & bit) != 0, (0x31E3 & bit) != 0) * 2.0 - 1.0;
+
+    Light = gl_InstanceID;
+    gl_Position = viewProjection * vec4(positionRadius.xyz + corner * positionRadius.w, 1.0);
+}
@@ -0,0 +1,21 @@
+// Octahedral unit vector encoding (Cigolle et al. 2014), mapped to [0, 1] for unorm targets
+
+vec2 octWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : octWrap(n.xy);
+    return e * 0.5 + 0.5;
+}
+
+vec3 octDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) n.xy = octWrap(n.xy);
+    return normalize(n);
+}
@@ -0,0 +1,40 @@
+// Shared PBR lighting, #include'd by the forward and deferred shading shaders
+
+#define PI 3.14159
+
+// Light of `radiance` arriving from direction L
+vec3 directLight(vec3 N, vec3 V, vec3 L, vec3 albedo, float metallic, float roughness, vec3 F0, vec3 radiance)
+{
+    vec3 H = normalize(V + L);
+
+    float NDF = pow(max(dot(N, H), 0.0), 2.0) * (roughness * roughness);
+    float G = max(dot(N, V), 0.0) * max(dot(N, L), 0.0);
+
+    vec3 F = F0 + (1.0 - F0) * pow(1.0 - max(dot(H, V), 0.0), 5.0);
+
+    vec3 numerator = NDF * G * F;
+    float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.001;
+    vec3 specular = numerator / denominator;
+
+    vec3 kS = F;
+    vec3 kD = (vec3(1.0) - kS) * (1.0 - metallic);
+
+    float NdotL = max(dot(N, L), 0.0);
+    return (kD * albedo / PI + specular) * radiance * NdotL;
+}
+
+// Contribution of one point light at world position P
+vec3 pointLight(vec3 N, vec3 V, vec3 P, vec3 albedo, float metallic, float roughness, vec3 F0, vec3 lightPosition, vec3 lightColor)
+{
+    float distance = length(lightPosition - P);
+    float attenuation = 1.0 / (distance * distance);
+    return directLight(N, V, normalize(lightPosition - P), albedo, metallic, roughness, F0, lightColor * attenuation);
+}
+
+// Smooth cutoff so a light with a finite radius reaches exactly zero at its edge
+float lightWindow(float distance, float radius)
+{
+    float ratio = distance / radius;
+    float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+    return window * window;
+}
@@ -0,0 +1,60 @@
+// Point-light shadows from gl::pointShadows. Needs uniforms.glsl included first. Each
+// shadowed light has six cube faces in pointShadowAtlas and five texels of pointShadowData:
+// position and far plane; near plane, face scale, tile scale and normal offset; then the
+// atlas origin of each face's tile, two per texel.
+
+uniform sampler2DShadow pointShadowAtlas;
+uniform samplerBuffer pointShadowData;
+
+// Face order +X, -X, +Y, -Y, +Z, -Z with GL cube map orientations, as gl::pointShadows draws
+const vec3 shadowFaceUp[6] = vec3[6](vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0));
+
+int shadowFace(vec3 L, out float depth)
+{
+    vec3 a = abs(L);
+    if (a.x >= a.y && a.x >= a.z) {
+        depth = a.x;
+        return L.x < 0.0 ? 1 : 0;
+    }
+    if (a.y >= a.z) {
+        depth = a.y;
+        return L.y < 0.0 ? 3 : 2;
+    }
+    depth = a.z;
+    return L.z < 0.0 ? 5 : 4;
+}
+
+// Fraction of the light in atlas slot `slot` reaching world position P; 1 without a slot
+float pointShadow(int slot, vec3 P, vec3 N)
+{
+    if (slot < 0) return 1.0;
+    int base = slot * 5;
+    vec4 positionFar = texelFetch(pointShadowData, base);
+    vec4 params = texelFetch(pointShadowData, base + 1);
+
+    // Move the lookup along the normal by a few texels of the face it lands on
+    float depth;
+    shadowFace(P - positionFar.xyz, depth);
+    vec3 L = P + N * depth * params.w - positionFar.xyz;
+    int face = shadowFace(L, depth);
+    float near = params.x, far = positionFar.w;
+    if (depth >= far) return 1.0;       // the light has faded out there
+
+    vec3 forward = vec3(0.0);
+    forward[face / 2] = (face & 1) == 0 ? 1.0 : -1.0;
+    vec3 side = normalize(cross(forward, shadowFaceUp[face]));
+    vec3 up = cross(side, forward);
+
+    vec4 origins = texelFetch(pointShadowData, base + 2 + face / 2);
+    vec2 origin = (face & 1) == 0 ? origins.xy : origins.zw;
+    vec2 uv = origin + (vec2(dot(L, side), dot(L, up)) / depth * params.y * 0.5 + 0.5) * params.z;
+
+    float reference = ((far + near) / (far - near) - 2.0 * far * near / ((far - near) * depth)) * 0.5 + 0.5;
+
+    vec2 texel = 1.0 / vec2(textureSize(pointShadowAtlas, 0));
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(pointShadowAtlas, vec3(uv + vec2(x, y) * texel, reference));
+    return lit / 9.0;
+}
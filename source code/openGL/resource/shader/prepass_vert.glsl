@@ -0,0 +1,24 @@
+#version 330 core
+
+// Depth pre-pass of gl::depthPrePass over the geometry pool's position stream. The main
+// pass tests GL_EQUAL against this depth, so gl_Position is invariant and computed with the
+// same expression as vert.glsl; change one and the other has to follow.
+
+layout(location = 0) in vec3 aPos;
+
+#include "uniforms.glsl"
+
+uniform samplerBuffer depthModels;      // 4 texels, the matrix columns, per record
+uniform int drawBase;
+
+invariant gl_Position;
+
+void main()
+{
+    int base = (drawBase + gl_InstanceID) * 4;
+    mat4 world = mat4(texelFetch(depthModels, base), texelFetch(depthModels, base + 1),
+        texelFetch(depthModels, base + 2), texelFetch(depthModels, base + 3));
+
+    vec3 FragPos = vec3(world * vec4(aPos, 1.0));
+    gl_Position = viewProjection * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,18 @@
+#version 330 core
+
+// Depth-only caster pass of gl::depthDraws over the geometry pool's position stream.
+// Instance i of a draw takes its model matrix from record drawBase + i.
+
+layout(location = 0) in vec3 aPos;
+
+uniform samplerBuffer depthModels;      // 4 texels, the matrix columns, per record
+uniform mat4 depthViewProjection;
+uniform int drawBase;
+
+void main()
+{
+    int base = (drawBase + gl_InstanceID) * 4;
+    mat4 model = mat4(texelFetch(depthModels, base), texelFetch(depthModels, base + 1),
+        texelFetch(depthModels, base + 2), texelFetch(depthModels, base + 3));
+    gl_Position = depthViewProjection * model * vec4(aPos, 1.0);
+}
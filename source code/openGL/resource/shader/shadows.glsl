@@ -0,0 +1,39 @@
+// Directional light with cascaded shadows from gl::cascadedShadows. #include after
+// uniforms.glsl and pbr.glsl.
+
+uniform sampler2DArrayShadow shadowMap;
+
+// Fraction of the sun reaching world position P: 1 outside the shadowed distance
+float cascadedShadow(vec3 P, vec3 N)
+{
+    int cascadeCount = int(sunDirection.w);
+    float depth = -(view * vec4(P, 1.0)).z;
+    int cascade = cascadeCount;
+    for (int i = 0; i < cascadeCount; i++) {
+        if (depth < cascadeSplits[i]) {
+            cascade = i;
+            break;
+        }
+    }
+    if (cascade == cascadeCount) return 1.0;
+
+    // Pushing the lookup along the normal by a few texels hides acne without peter-panning
+    vec3 offset = N * cascadeTexels[cascade] * shadowParams.y;
+    vec3 coord = (cascadeMatrices[cascade] * vec4(P + offset, 1.0)).xyz;
+
+    // 3x3 taps of bilinear comparisons
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowMap, vec4(coord.xy + vec2(x, y) * shadowParams.x, float(cascade), coord.z));
+    return lit / 9.0;
+}
+
+// The sun's contribution, nothing when gl::cascadedShadows has no light
+vec3 sunLight(vec3 N, vec3 V, vec3 P, vec3 albedo, float metallic, float roughness, vec3 F0)
+{
+    if (sunDirection.w == 0.0) return vec3(0.0);
+    vec3 L = sunDirection.xyz;
+    if (dot(N, L) <= 0.0) return vec3(0.0);
+    return directLight(N, V, L, albedo, metallic, roughness, F0, sunColor.rgb) * cascadedShadow(P, N);
+}
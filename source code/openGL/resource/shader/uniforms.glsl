@@ -0,0 +1,38 @@
+// Shared uniform blocks, bound to fixed binding points by gl::assignReservedBlocks.
+// Layouts mirror gl::frameData, gl::lightData, gl::clusterData and gl::shadowData in
+// UniformBuffer.hpp.
+#define MAX_LIGHTS 8
+#define SHADOW_CASCADES 4
+
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 camPos;
+    float time;
+};
+
+layout(std140) uniform LightData {
+    vec3 lightPos[MAX_LIGHTS];
+    vec3 lightColor[MAX_LIGHTS];
+    int lightShadow[MAX_LIGHTS];
+    int numLights;
+};
+
+// Filled by gl::clusteredLights, see clusters.glsl
+layout(std140) uniform ClusterData {
+    ivec4 clusterSize;
+    vec4 clusterDepth;
+    vec4 clusterViewport;
+};
+
+// Filled by gl::cascadedShadows, see shadows.glsl. sunDirection.w is the cascade count,
+// 0 when there is no directional light.
+layout(std140) uniform ShadowData {
+    mat4 cascadeMatrices[SHADOW_CASCADES];
+    vec4 cascadeSplits;
+    vec4 cascadeTexels;
+    vec4 sunDirection;
+    vec4 sunColor;
+    vec4 shadowParams;
+};
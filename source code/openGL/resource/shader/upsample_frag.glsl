@@ -0,0 +1,43 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 ScreenUV;
+
+uniform sampler2D lowColor;     // premultiplied half-res result
+uniform sampler2D lowDepth;     // scene depth seen by each half-res pixel
+uniform sampler2D sceneDepth;
+uniform bool hasSceneDepth;
+uniform vec2 lowSize;
+uniform float depthSharpness;
+
+// Depth-aware upsampling: bilinear weights, damped where the half-res
+// sample saw a different surface than this full-res pixel
+void main()
+{
+    if (!hasSceneDepth) {
+        FragColor = texture(lowColor, ScreenUV);
+        return;
+    }
+
+    float depth = texture(sceneDepth, ScreenUV).r;
+
+    vec2 pos = ScreenUV * lowSize - 0.5;
+    ivec2 base = ivec2(floor(pos));
+    vec2 f = fract(pos);
+    ivec2 maxTexel = ivec2(lowSize) - 1;
+
+    vec4 sum = vec4(0.0);
+    float weightSum = 0.0;
+    for (int y = 0; y < 2; ++y) {
+        for (int x = 0; x < 2; ++x) {
+            ivec2 texel = clamp(base + ivec2(x, y), ivec2(0), maxTexel);
+            float bilinear = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y);
+            float d = texelFetch(lowDepth, texel, 0).r;
+            float w = bilinear / (1e-4 + abs(depth - d) * depthSharpness);
+            sum += texelFetch(lowColor, texel, 0) * w;
+            weightSum += w;
+        }
+    }
+
+    FragColor = weightSum > 0.0 ? sum / weightSum : texture(lowColor, ScreenUV);
+}
@@ -9,19 +9,42 @@ out vec2 TexCoords;
 out vec3 FragPos;
 out mat3 TBN;
 
+#include "uniforms.glsl"
+
+// gl::depthPrePass lays down depth with prepass_vert.glsl and tests GL_EQUAL against it
+invariant gl_Position;
+
+#ifdef INSTANCED
+// Per-instance data streamed by gl::instanceStream; the matrix occupies locations 6-9
+layout(location = 6) in mat4 aInstanceModel;
+layout(location = 10) in vec4 aInstanceColor;
+out vec4 InstanceColor;
+#else
+// Changes every draw, so it stays a plain uniform rather than a block
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#endif
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+#ifdef INSTANCED
+    mat4 world = aInstanceModel;
+#else
+    mat4 world = model;
+#endif
+
+    FragPos = vec3(world * vec4(aPos, 1.0));
+    gl_Position = viewProjection * vec4(FragPos, 1.0);
 
-    vec3 T = normalize(mat3(model) * aTangent);
-    vec3 N = normalize(mat3(model) * aNormal);
+    // Inverse transpose keeps normals perpendicular under non-uniform scale. Computed here
+    // so instances don't need a second matrix streamed per instance.
+    mat3 normalMatrix = transpose(inverse(mat3(world)));
+    vec3 T = normalize(mat3(world) * aTangent);
+    vec3 N = normalize(normalMatrix * aNormal);
     vec3 B = normalize(cross(N, T));
     TBN = mat3(T, B, N);
 
     TexCoords = aTexCoords;
+#ifdef INSTANCED
+    InstanceColor = aInstanceColor;
+#endif
 }
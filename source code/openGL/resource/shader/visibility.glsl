@@ -0,0 +1,110 @@
+// Shared by the gl::visibilityBuffer passes. A pixel of the visibility target holds the draw
+// record and the triangle within that draw; the rest is fetched from the geometry pool.
+
+uniform usampler2D visibility;
+uniform samplerBuffer visibilityDraws;      // per draw: 4 model matrix columns, color
+uniform usamplerBuffer visibilityDrawInfo;  // per draw: first index, base vertex, material
+uniform samplerBuffer geometryVertices;     // gl::vertex as 11 floats
+uniform usamplerBuffer geometryIndices;
+
+uniform vec4 visibilityViewport;            // origin in pixels, reciprocal size
+
+const uint noDraw = 0xFFFFFFFFu;
+const int vertexFloats = 11;
+
+mat4 drawModel(int draw)
+{
+    int base = draw * 5;
+    return mat4(texelFetch(visibilityDraws, base), texelFetch(visibilityDraws, base + 1),
+        texelFetch(visibilityDraws, base + 2), texelFetch(visibilityDraws, base + 3));
+}
+
+vec4 drawColor(int draw)
+{
+    return texelFetch(visibilityDraws, draw * 5 + 4);
+}
+
+// Everything frag.glsl gets from vert.glsl, rebuilt for one pixel
+struct visibleSurface {
+    vec3 position;
+    mat3 TBN;
+    vec2 uv;
+    vec2 uvDx;      // screen-space derivatives for textureGrad
+    vec2 uvDy;
+    vec4 color;
+};
+
+vec3 vertexVec3(int v, int offset)
+{
+    int base = v * vertexFloats + offset;
+    return vec3(texelFetch(geometryVertices, base).r, texelFetch(geometryVertices, base + 1).r, texelFetch(geometryVertices, base + 2).r);
+}
+
+vec2 vertexVec2(int v, int offset)
+{
+    int base = v * vertexFloats + offset;
+    return vec2(texelFetch(geometryVertices, base).r, texelFetch(geometryVertices, base + 1).r);
+}
+
+// Perspective-correct barycentrics of `ndc` plus their change per pixel in x and y
+// (Schied and Dachsbacher 2015)
+void barycentrics(vec4 p0, vec4 p1, vec4 p2, vec2 ndc, vec2 pixelSize, out vec3 lambda, out vec3 ddx, out vec3 ddy)
+{
+    vec3 invW = 1.0 / vec3(p0.w, p1.w, p2.w);
+    vec2 ndc0 = p0.xy * invW.x, ndc1 = p1.xy * invW.y, ndc2 = p2.xy * invW.z;
+
+    float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+    vec3 dx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+    vec3 dy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+    float dxSum = dx.x + dx.y + dx.z, dySum = dy.x + dy.y + dy.z;
+
+    vec2 delta = ndc - ndc0;
+    float interpInvW = invW.x + delta.x * dxSum + delta.y * dySum;
+    lambda = (vec3(invW.x, 0.0, 0.0) + delta.x * dx + delta.y * dy) / interpInvW;
+
+    dx *= pixelSize.x;
+    dy *= pixelSize.y;
+    dxSum *= pixelSize.x;
+    dySum *= pixelSize.y;
+    ddx = (lambda * interpInvW + dx) / (interpInvW + dxSum) - lambda;
+    ddy = (lambda * interpInvW + dy) / (interpInvW + dySum) - lambda;
+}
+
+visibleSurface readVisible(uvec2 id, ivec2 pixel)
+{
+    int draw = int(id.x);
+    uvec4 info = texelFetch(visibilityDrawInfo, draw);
+    int first = int(info.x) + int(id.y) * 3;
+    int baseVertex = int(info.y);
+    int v0 = baseVertex + int(texelFetch(geometryIndices, first).r);
+    int v1 = baseVertex + int(texelFetch(geometryIndices, first + 1).r);
+    int v2 = baseVertex + int(texelFetch(geometryIndices, first + 2).r);
+
+    mat4 world = drawModel(draw);
+    vec3 w0 = vec3(world * vec4(vertexVec3(v0, 0), 1.0));
+    vec3 w1 = vec3(world * vec4(vertexVec3(v1, 0), 1.0));
+    vec3 w2 = vec3(world * vec4(vertexVec3(v2, 0), 1.0));
+
+    vec2 ndc = ((vec2(pixel) + 0.5 - visibilityViewport.xy) * visibilityViewport.zw) * 2.0 - 1.0;
+    vec3 lambda, ddx, ddy;
+    barycentrics(viewProjection * vec4(w0, 1.0), viewProjection * vec4(w1, 1.0), viewProjection * vec4(w2, 1.0), ndc, 2.0 * visibilityViewport.zw, lambda, ddx, ddy);
+
+    visibleSurface s;
+    s.position = mat3(w0, w1, w2) * lambda;
+
+    vec2 uv0 = vertexVec2(v0, 6), uv1 = vertexVec2(v1, 6), uv2 = vertexVec2(v2, 6);
+    s.uv = mat3x2(uv0, uv1, uv2) * lambda;
+    s.uvDx = mat3x2(uv0, uv1, uv2) * ddx;
+    s.uvDy = mat3x2(uv0, uv1, uv2) * ddy;
+
+    // Same frame as vert.glsl, built from the interpolated model-space vectors
+    vec3 normal = mat3(vertexVec3(v0, 3), vertexVec3(v1, 3), vertexVec3(v2, 3)) * lambda;
+    vec3 tangent = mat3(vertexVec3(v0, 8), vertexVec3(v1, 8), vertexVec3(v2, 8)) * lambda;
+    mat3 normalMatrix = transpose(inverse(mat3(world)));
+    vec3 T = normalize(mat3(world) * tangent);
+    vec3 N = normalize(normalMatrix * normal);
+    s.TBN = mat3(T, normalize(cross(N, T)), N);
+
+    s.color = drawColor(draw);
+    return s;
+}
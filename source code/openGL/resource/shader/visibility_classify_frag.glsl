@@ -0,0 +1,14 @@
+#version 330 core
+
+// Writes each covered pixel's material as depth, so every material pass of
+// gl::visibilityBuffer depth tests GL_EQUAL against it and only shades its own pixels
+
+#include "uniforms.glsl"
+#include "visibility.glsl"
+
+void main()
+{
+    uvec2 id = texelFetch(visibility, ivec2(gl_FragCoord.xy), 0).rg;
+    if (id.x == noDraw) discard;
+    gl_FragDepth = float(texelFetch(visibilityDrawInfo, int(id.x)).z) / 65535.0;
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+// Draw record and triangle of the nearest surface; gl_PrimitiveID restarts every instance
+layout(location = 0) out uvec2 Visibility;
+
+flat in uint Draw;
+
+void main()
+{
+    Visibility = uvec2(Draw, uint(gl_PrimitiveID));
+}
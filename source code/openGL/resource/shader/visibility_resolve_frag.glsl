@@ -0,0 +1,98 @@
+#version 330 core
+out vec4 FragColor;
+
+// One material of gl::visibilityBuffer, shading each of its pixels once with frag.glsl's
+// material model. Built per material permutation by a gl::shaderLibrary; writes linear HDR.
+
+#ifndef PERMUTATION
+#define HAS_BASE_COLOR_MAP
+#define HAS_NORMAL_MAP
+#define HAS_METALLIC_ROUGHNESS_MAP
+#define HAS_OCCLUSION_MAP
+#define HAS_EMISSIVE
+#endif
+
+#ifdef HAS_BASE_COLOR_MAP
+uniform sampler2D baseColor;
+#endif
+#ifdef HAS_NORMAL_MAP
+uniform sampler2D normal;
+#endif
+#ifdef HAS_METALLIC_ROUGHNESS_MAP
+uniform sampler2D metallicRoughness;
+#endif
+#ifdef HAS_OCCLUSION_MAP
+uniform sampler2D occlusion;
+#endif
+#ifdef HAS_EMISSIVE
+uniform sampler2D emissive;
+#endif
+
+#include "uniforms.glsl"
+#include "pbr.glsl"
+#include "ibl.glsl"
+#include "clusters.glsl"
+#include "shadows.glsl"
+#include "visibility.glsl"
+
+// Explicit gradients: neighbouring pixels may belong to other triangles or materials
+#define SAMPLE(map) textureGrad(map, s.uv, s.uvDx, s.uvDy)
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    visibleSurface s = readVisible(texelFetch(visibility, pixel, 0).rg, pixel);
+
+#ifdef HAS_BASE_COLOR_MAP
+    vec4 base = SAMPLE(baseColor) * s.color;
+#else
+    vec4 base = s.color;
+#endif
+    vec3 albedo = pow(base.rgb, vec3(2.2));
+
+#ifdef HAS_METALLIC_ROUGHNESS_MAP
+    vec2 metalRough = SAMPLE(metallicRoughness).bg;
+    float metallic  = metalRough.x;
+    float roughness = metalRough.y;
+#else
+    float metallic  = 0.0;
+    float roughness = 1.0;
+#endif
+
+#ifdef HAS_OCCLUSION_MAP
+    float ao = SAMPLE(occlusion).r;
+#else
+    float ao = 1.0;
+#endif
+
+#ifdef HAS_EMISSIVE
+    vec3 emission = SAMPLE(emissive).rgb;
+#else
+    vec3 emission = vec3(0.0);
+#endif
+
+#ifdef HAS_NORMAL_MAP
+    vec3 N = normalize(s.TBN * (SAMPLE(normal).xyz * 2.0 - 1.0));
+#else
+    vec3 N = s.TBN[2];
+#endif
+    vec3 V = normalize(camPos - s.position);
+
+    vec3 F0 = mix(vec3(0.04), albedo, metallic);
+    vec3 Lo = vec3(0.0);
+
+#ifdef LIGHT_COUNT
+    const int lightCount = LIGHT_COUNT;
+#else
+    int lightCount = numLights;
+#endif
+
+    for (int i = 0; i < lightCount; i++) {
+        Lo += pointLight(N, V, s.position, albedo, metallic, roughness, F0, lightPos[i], lightColor[i]) * pointShadow(lightShadow[i], s.position, N);
+    }
+    Lo += clusteredLights(N, V, s.position, albedo, metallic, roughness, F0);
+    Lo += sunLight(N, V, s.position, albedo, metallic, roughness, F0);
+
+    vec3 ambient = ambientLight(N, V, albedo, metallic, roughness, F0, ao);
+    FragColor = vec4(ambient + Lo + emission, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+// Full-screen triangle at one material's depth, see visibility_classify_frag.glsl
+
+uniform float materialDepth;
+
+void main()
+{
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(pos * 2.0 - 1.0, materialDepth * 2.0 - 1.0, 1.0);
+}
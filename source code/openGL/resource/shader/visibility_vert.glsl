@@ -0,0 +1,19 @@
+#version 330 core
+
+// Geometry pass of gl::visibilityBuffer: positions only, one instance per draw record
+
+layout(location = 0) in vec3 aPos;
+
+#include "uniforms.glsl"
+#include "visibility.glsl"
+
+uniform int drawBase;
+
+flat out uint Draw;
+
+void main()
+{
+    int draw = drawBase + gl_InstanceID;
+    Draw = uint(draw);
+    gl_Position = viewProjection * (drawModel(draw) * vec4(aPos, 1.0));
+}
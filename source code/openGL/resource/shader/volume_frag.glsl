@@ -0,0 +1,96 @@
+#version 330 core
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out float RayDepth;
+
+in vec2 ScreenUV;
+
+uniform sampler3D density;      // R8 voxels
+uniform sampler3D occupancy;    // RG8 min/max per brick
+uniform sampler2D sceneDepth;
+uniform bool hasSceneDepth;
+
+uniform mat4 invViewProj;       // clip -> world
+uniform mat4 invModel;          // world -> volume [0,1]^3
+
+uniform vec3 volumeSize;        // voxels per axis
+uniform vec3 brickCount;
+uniform float brickSize;        // voxels per brick edge, VOLUME_BRICK_SIZE
+uniform float stepSize;         // base step in voxels
+uniform float adaptiveFactor;
+uniform float densityScale;
+uniform float emptyThreshold;
+uniform float opacityCutoff;
+uniform bool skipEmptySpace;
+uniform vec3 volumeColor;
+
+// Must match gl::volumeData::raymarch on the CPU
+float brickExit(vec3 origin, vec3 dir, vec3 brick)
+{
+    vec3 bmin = brick * brickSize / volumeSize;
+    vec3 bmax = (brick + 1.0) * brickSize / volumeSize;
+    vec3 bound = mix(bmin, bmax, step(0.0, dir));
+    vec3 safeDir = mix(vec3(1e-20), dir, greaterThan(abs(dir), vec3(1e-20)));
+    vec3 t = (bound - origin) / safeDir;
+    t = mix(vec3(1e20), t, greaterThan(abs(dir), vec3(1e-20)));
+    return min(t.x, min(t.y, t.z));
+}
+
+void main()
+{
+    float depth = hasSceneDepth ? texture(sceneDepth, ScreenUV).r : 1.0;
+    RayDepth = depth;
+
+    vec2 ndc = ScreenUV * 2.0 - 1.0;
+    vec4 nearW = invViewProj * vec4(ndc, -1.0, 1.0);
+    vec4 farW  = invViewProj * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+
+    vec3 origin = (invModel * vec4(nearW.xyz / nearW.w, 1.0)).xyz;
+    vec3 dir    = (invModel * vec4(farW.xyz / farW.w, 1.0)).xyz - origin;
+
+    // Slab test against the unit cube, t in [0, 1] spans near plane -> scene depth
+    vec3 invDir = 1.0 / mix(vec3(1e-20), dir, greaterThan(abs(dir), vec3(1e-20)));
+    vec3 t0 = (vec3(0.0) - origin) * invDir;
+    vec3 t1 = (vec3(1.0) - origin) * invDir;
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1);
+    float tEnter = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+    float tExit  = min(min(tmax.x, tmax.y), min(tmax.z, 1.0));
+
+    vec4 acc = vec4(0.0);
+    if (tEnter >= tExit) {
+        FragColor = acc;
+        return;
+    }
+
+    float voxelLength = length(dir * volumeSize);
+    float dt = stepSize / voxelLength;
+    ivec3 maxBrick = ivec3(brickCount) - 1;
+
+    float t = tEnter;
+    while (t < tExit) {
+        vec3 p = origin + t * dir;
+        ivec3 brick = clamp(ivec3(floor(p * volumeSize / brickSize)), ivec3(0), maxBrick);
+        vec2 range = texelFetch(occupancy, brick, 0).rg;
+        float exitT = brickExit(origin, dir, vec3(brick));
+
+        if (skipEmptySpace && range.y <= emptyThreshold) {
+            t = max(exitT, t + dt * 1e-3);
+            continue;
+        }
+
+        // Larger steps where the brick is nearly homogeneous, never past its exit
+        float h = 1.0 - (range.y - range.x);
+        float stepT = dt * mix(1.0, adaptiveFactor, h * h);
+        stepT = max(dt, min(stepT, exitT - t));
+
+        float d = texture(density, p).r;
+        float alpha = 1.0 - exp(-d * densityScale * stepT * voxelLength);
+        acc.rgb += (1.0 - acc.a) * volumeColor * alpha;
+        acc.a   += (1.0 - acc.a) * alpha;
+
+        if (acc.a >= opacityCutoff) break;
+        t += stepT;
+    }
+
+    FragColor = acc;
+}
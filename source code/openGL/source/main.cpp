@@ -2,34 +2,49 @@
 #include <window.hpp>
 #include <Utils.hpp>
 #include <Mesh.hpp>
+#include <RenderQueue.hpp>
+#include <Environment.hpp>
 
+#include <filesystem>
 #include <iostream>
+#include <memory>
 //#include <windows.h>
 
 #define WEAPON_OFFSET glm::vec3(-0.3f, -0.35f, 0.2f)
+#define ENVIRONMENT_PATH "resource/texture/environment.hdr"
 
 int main() {
     if (!glfwInit()) return -1;
 
     gl::window window(1920, 1080, "window");
     if (!window) throw std::runtime_error("error init window");
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    glDisable(GL_BLEND);
-    glEnable(GL_DEPTH_TEST);
+    gl::stateCache& state = gl::stateCache::get();
+    state.enable(GL_CULL_FACE);
+    state.cullFace(GL_BACK);
+    state.disable(GL_BLEND);
+    state.enable(GL_DEPTH_TEST);
 
     window.vsync(ENABLE_ADAPTIVE_VSYNC);    
 
     if (glewInit() != GLEW_OK) return -1;
 
-    gl::shader shader("resource/shader/vert.glsl", "resource/shader/frag.glsl");
-
-    shader.useProgram();
+    // Each model draws with the shader permutation matching its material
+    gl::shaderLibrary shaders("resource/shader/vert.glsl", "resource/shader/frag.glsl");
 
     gl::object awp("resource/model/awp.glb");
     gl::object model("resource/model/player.glb");
 
-    gl::player player(gl::camera(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), shader.getProgram()));
+    // Draws are collected per frame, frustum culled, sorted by state and merged into instanced calls
+    gl::renderQueue queue;
+
+    // Image-based lighting from an equirectangular HDR, when one is present; prefiltered on
+    // the first launch and read from the cache after that
+    std::unique_ptr<gl::environment> environment;
+    if (std::filesystem::exists(gl::getShaderPath(ENVIRONMENT_PATH)))
+        environment = std::make_unique<gl::environment>(ENVIRONMENT_PATH);
+    queue.setEnvironment(environment.get());
+
+    gl::player player(gl::camera(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), shaders.getFallback()));
 
     unsigned char zoom = 0;
     bool ifpress = false;
@@ -54,14 +69,17 @@ int main() {
         // update the projection matrix
         player.setFov(glm::mix(player.getFov(), fov, 15.0f * window.getDeltaTime()), (float)window.getWidth() / (float)window.getHeight());
 
-        player.update(window, shader);
+        shaders.poll();
+        player.update(window);
+
+        queue.submit(model, glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(0.0f));
 
-        // Draw cube
-        model.draw(shader.getProgram(), glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(0.0f));
+        // Drawn first with its own fixed FOV, so the world it covers is rejected by depth
+        queue.submitViewModel(awp, gl::getItemModel(player.getCam(), WEAPON_OFFSET, glm::vec3(1.0f)));
 
-        awp.draw(shader.getProgram(), gl::getItemModel(player.getCam(), WEAPON_OFFSET, glm::vec3(1.0f)));
+        queue.submit(awp, glm::vec3(10.0f), glm::vec3(1.0f), glm::vec3(0.0f));
 
-        awp.draw(shader.getProgram(), glm::vec3(10.0f), glm::vec3(1.0f), glm::vec3(0.0f));
+        queue.flush(shaders);
 
         window.swapBuffers();
     }
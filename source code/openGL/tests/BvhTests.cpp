@@ -0,0 +1,270 @@
+// Checks every query of the BVH in Bvh.hpp against a linear scan over the same boxes,
+// through builds, refits, inserts and removals. Needs no GL context; exits non-zero on
+// the first failed check. With --bench it instead times build, refit and each query at
+// 1k, 100k and 1M objects.
+
+#include <Bvh.hpp>
+
+#include <gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (condition) return;
+    std::printf("FAILED: %s\n", what);
+    failures++;
+}
+
+static std::mt19937 rng(7);
+
+static float random(float lo, float hi) { return std::uniform_real_distribution<float>(lo, hi)(rng); }
+
+// Boxes of 0.2 to 6 units in a world `scale` times the default size
+static gl::aabb randomBox(float scale = 1.0f) {
+    gl::aabb box;
+    glm::vec3 center(random(-100.0f, 100.0f) * scale, random(-20.0f, 20.0f) * scale, random(-100.0f, 100.0f) * scale);
+    box.expand(center - glm::vec3(random(0.1f, 3.0f), random(0.1f, 3.0f), random(0.1f, 3.0f)));
+    box.expand(center + glm::vec3(random(0.1f, 3.0f), random(0.1f, 3.0f), random(0.1f, 3.0f)));
+    return box;
+}
+
+static float distance2(const gl::aabb& box, const glm::vec3& point) {
+    glm::vec3 d = glm::max(glm::max(box.min - point, point - box.max), glm::vec3(0.0f));
+    return glm::dot(d, d);
+}
+
+// Zero direction components are a tiny step in their sign, as in gl::bvh::raycast: a ray
+// lying in a face plane is inside the slab when that step points into the box
+static bool slab(const gl::aabb& box, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& t) {
+    double enter = 0.0, exit = maxDistance;
+    for (int a = 0; a < 3; ++a) {
+        double d = direction[a] != 0.0f ? direction[a] : std::signbit(direction[a]) ? -1e-20 : 1e-20;
+        double t1 = (double(box.min[a]) - origin[a]) / d, t2 = (double(box.max[a]) - origin[a]) / d;
+        enter = std::max(enter, std::min(t1, t2));
+        exit = std::min(exit, std::max(t1, t2));
+    }
+    t = float(enter);
+    return enter <= exit;
+}
+
+// Nearest hit of a scan, or false
+static bool raycastScan(const std::vector<gl::aabb>& boxes, const std::vector<bool>& alive, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& closest) {
+    bool any = false;
+    float t;
+    closest = maxDistance;
+    for (uint32_t id = 0; id < boxes.size(); ++id)
+        if (alive[id] && slab(boxes[id], origin, direction, maxDistance, t) && t <= closest) {
+            closest = t;
+            any = true;
+        }
+    return any;
+}
+
+// The tree's answers must equal a scan over the boxes still alive
+static void queriesMatchScan(const gl::bvh& tree, const std::vector<gl::aabb>& boxes, const std::vector<bool>& alive, const char* what) {
+    std::vector<uint32_t> got, expected;
+    unsigned mismatches = 0, results = 0, axisHits = 0;
+
+    for (int i = 0; i < 32; ++i) {
+        glm::vec3 eye(random(-80.0f, 80.0f), random(-10.0f, 10.0f), random(-80.0f, 80.0f));
+        glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(random(-1.0f, 1.0f), random(-0.3f, 0.3f), random(-1.0f, 1.0f)), glm::vec3(0, 1, 0));
+        gl::frustum f = gl::frustum::fromMatrix(glm::perspective(glm::radians(random(30.0f, 90.0f)), 1.5f, 0.1f, random(20.0f, 150.0f)) * view);
+        tree.query(f, got);
+        expected.clear();
+        for (uint32_t id = 0; id < boxes.size(); ++id)
+            if (alive[id] && f.intersects(boxes[id])) expected.push_back(id);
+        std::sort(got.begin(), got.end());
+        mismatches += got != expected;
+        results += static_cast<unsigned>(expected.size());
+
+        glm::vec3 center(random(-100.0f, 100.0f), random(-20.0f, 20.0f), random(-100.0f, 100.0f));
+        float radius = random(1.0f, 30.0f);
+        tree.query(center, radius, got);
+        expected.clear();
+        for (uint32_t id = 0; id < boxes.size(); ++id)
+            if (alive[id] && distance2(boxes[id], center) <= radius * radius) expected.push_back(id);
+        std::sort(got.begin(), got.end());
+        mismatches += got != expected;
+        results += static_cast<unsigned>(expected.size());
+
+        glm::vec3 origin(random(-100.0f, 100.0f), random(-20.0f, 20.0f), random(-100.0f, 100.0f));
+        glm::vec3 direction(random(-1.0f, 1.0f), random(-0.2f, 0.2f), random(-1.0f, 1.0f));
+        gl::bvhHit hit;
+        bool any = tree.raycast(origin, direction, 200.0f, hit);
+        float closest;
+        bool expectedAny = raycastScan(boxes, alive, origin, direction, 200.0f, closest);
+        mismatches += any != expectedAny || (any && std::abs(hit.distance - closest) > 1e-3f);
+
+        // Axis-aligned, starting in the face plane of a live box, where 0 * 1/0 used to make
+        // the slab test NaN; the zero component's sign points into the box, so it must hit
+        uint32_t target = std::uniform_int_distribution<uint32_t>(0, static_cast<uint32_t>(boxes.size() - 1))(rng);
+        while (!alive[target]) target = (target + 1) % boxes.size();
+        const gl::aabb& box = boxes[target];
+        const int axis = i % 3, across = (axis + 1) % 3;
+        glm::vec3 start = box.center();
+        start[across] = i & 4 ? box.max[across] : box.min[across];
+        start[axis] = box.min[axis] - random(0.5f, 20.0f);
+        glm::vec3 along(0.0f);
+        along[axis] = 1.0f;
+        along[across] = i & 4 ? -0.0f : 0.0f;
+        any = tree.raycast(start, along, 200.0f, hit);
+        expectedAny = raycastScan(boxes, alive, start, along, 200.0f, closest);
+        mismatches += !any || !expectedAny || std::abs(hit.distance - closest) > 1e-3f;
+        axisHits += any;
+
+        float nearest2 = 25.0f * 25.0f;
+        expectedAny = false;
+        for (uint32_t id = 0; id < boxes.size(); ++id)
+            if (alive[id] && distance2(boxes[id], center) < nearest2) {
+                nearest2 = distance2(boxes[id], center);
+                expectedAny = true;
+            }
+        any = tree.nearest(center, 25.0f, hit);
+        mismatches += any != expectedAny || (any && std::abs(hit.distance - std::sqrt(nearest2)) > 1e-3f);
+    }
+
+    std::printf("%s: %zu objects, %u nodes, %u objects found, %u axis-aligned hits, %u mismatches\n", what, tree.size(), static_cast<unsigned>(tree.nodeCount()), results, axisHits, mismatches);
+    check(results > 0, what);
+    check(axisHits == 32, what);
+    check(mismatches == 0, what);
+}
+
+static double millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Random boxes at the density of the tests, so the world grows with the count. Before the
+// refit 10% of the objects move, 1% are removed and 0.5% inserted, which stays under the
+// rebuild threshold. Query times are averages over 1000 random queries of each kind.
+static void bench(size_t count) {
+    const float scale = std::cbrt(float(count) / 5000.0f);
+    gl::bvh tree;
+    std::vector<gl::aabb> boxes(count);
+    for (gl::aabb& box : boxes) tree.insert(box = randomBox(scale));
+
+    auto start = std::chrono::high_resolution_clock::now();
+    tree.build();
+    const double build = millisecondsSince(start);
+
+    for (size_t id = 0; id < count; id += 10) {
+        glm::vec3 offset(random(-2.0f, 2.0f), random(-0.5f, 0.5f), random(-2.0f, 2.0f));
+        boxes[id].min += offset;
+        boxes[id].max += offset;
+        tree.update(static_cast<uint32_t>(id), boxes[id]);
+    }
+    for (size_t id = 1; id < count; id += 100) tree.remove(static_cast<uint32_t>(id));
+    for (size_t i = 0; i < count / 200; ++i) tree.insert(randomBox(scale));
+    start = std::chrono::high_resolution_clock::now();
+    tree.refit();
+    const double refit = millisecondsSince(start);
+
+    const int queries = 1000;
+    std::vector<gl::frustum> frusta;
+    std::vector<glm::vec3> points, directions;
+    for (int i = 0; i < queries; ++i) {
+        glm::vec3 eye = glm::vec3(random(-80.0f, 80.0f), random(-10.0f, 10.0f), random(-80.0f, 80.0f)) * scale;
+        glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(random(-1.0f, 1.0f), random(-0.3f, 0.3f), random(-1.0f, 1.0f)), glm::vec3(0, 1, 0));
+        frusta.push_back(gl::frustum::fromMatrix(glm::perspective(glm::radians(60.0f), 1.5f, 0.1f, 100.0f) * view));
+        points.push_back(glm::vec3(random(-100.0f, 100.0f), random(-20.0f, 20.0f), random(-100.0f, 100.0f)) * scale);
+        directions.push_back(glm::vec3(random(-1.0f, 1.0f), random(-0.2f, 0.2f), random(-1.0f, 1.0f)));
+    }
+
+    std::vector<uint32_t> out;
+    gl::bvhHit hit;
+    size_t found = 0;
+    double times[4];
+    start = std::chrono::high_resolution_clock::now();
+    for (const gl::frustum& f : frusta) {
+        tree.query(f, out);
+        found += out.size();
+    }
+    times[0] = millisecondsSince(start);
+    start = std::chrono::high_resolution_clock::now();
+    for (const glm::vec3& p : points) {
+        tree.query(p, 10.0f, out);
+        found += out.size();
+    }
+    times[1] = millisecondsSince(start);
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < queries; ++i) found += tree.raycast(points[i], directions[i], 200.0f, hit);
+    times[2] = millisecondsSince(start);
+    start = std::chrono::high_resolution_clock::now();
+    for (const glm::vec3& p : points) found += tree.nearest(p, 25.0f, hit);
+    times[3] = millisecondsSince(start);
+
+    std::printf("%8zu  %9.2f ms  %8.2f ms  %9.2f us  %8.2f us  %8.2f us  %8.2f us  (%zu results)\n", count, build, refit,
+        times[0] * 1000.0 / queries, times[1] * 1000.0 / queries, times[2] * 1000.0 / queries, times[3] * 1000.0 / queries, found);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::strcmp(argv[1], "--bench") == 0) {
+        std::printf("%8s%14s%13s%14s%13s%13s%13s\n", "objects", "build", "refit", "frustum", "radius", "ray", "nearest");
+        for (size_t count : { size_t(1000), size_t(100000), size_t(1000000) }) bench(count);
+        return 0;
+    }
+
+    gl::bvh tree;
+    std::vector<gl::aabb> boxes;
+    std::vector<bool> alive;
+    for (int i = 0; i < 5000; ++i) {
+        boxes.push_back(randomBox());
+        check(tree.insert(boxes.back()) == boxes.size() - 1, "ids are handed out in order");
+        alive.push_back(true);
+    }
+    queriesMatchScan(tree, boxes, alive, "pending only");
+    tree.build();
+    queriesMatchScan(tree, boxes, alive, "built");
+
+    // Moved objects are seen after a refit, which keeps the topology
+    const size_t nodes = tree.nodeCount();
+    for (uint32_t id = 0; id < boxes.size(); id += 3) {
+        glm::vec3 offset(random(-5.0f, 5.0f), random(-1.0f, 1.0f), random(-5.0f, 5.0f));
+        boxes[id].min += offset;
+        boxes[id].max += offset;
+        tree.update(id, boxes[id]);
+    }
+    tree.refit();
+    check(tree.nodeCount() == nodes, "refit keeps the nodes");
+    queriesMatchScan(tree, boxes, alive, "refit");
+
+    // A few removals and inserts stay below the rebuild threshold and are found anyway
+    for (uint32_t id = 1; id < boxes.size(); id += 97) {
+        tree.remove(id);
+        alive[id] = false;
+    }
+    for (int i = 0; i < 40; ++i) {
+        gl::aabb box = randomBox();
+        uint32_t id = tree.insert(box);
+        if (id >= boxes.size()) {
+            boxes.resize(id + 1);
+            alive.resize(id + 1, false);
+        }
+        boxes[id] = box;
+        alive[id] = true;
+    }
+    tree.refit();
+    queriesMatchScan(tree, boxes, alive, "inserts and removals");
+
+    // Past the threshold refit() rebuilds
+    for (uint32_t id = 0; id < boxes.size(); id += 2) {
+        if (!alive[id]) continue;
+        tree.remove(id);
+        alive[id] = false;
+    }
+    tree.refit();
+    queriesMatchScan(tree, boxes, alive, "rebuilt");
+
+    tree.clear();
+    check(tree.size() == 0 && tree.nodeCount() == 0, "clear empties the tree");
+
+    std::printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+// CPU cost of submitting gl::object::draw: 10k calls on one model with 4 lights, through a
+// plain gl::shader, timed from the first call to the last (glFinish excluded), best of 5.
+// Needs a GL context, which it gets from a hidden window; run from the directory holding
+// /resource. Only uses API that predates uniform reflection, so the same file builds
+// against older trees for before/after figures.
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <Window.hpp>
+#include <Utils.hpp>
+#include <Mesh.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#define DRAW_BENCH_MODEL "resource/model/awp.glb"
+#define DRAW_BENCH_DRAWS 10000
+
+int main() {
+    if (!glfwInit()) return 1;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    gl::window window(64, 64, "draw bench");
+    if (glewInit() != GLEW_OK) return 1;
+
+    gl::shader shader("resource/shader/vert.glsl", "resource/shader/frag.glsl");
+    gl::object model(DRAW_BENCH_MODEL);
+    for (int i = 0; i < 4; ++i) model.addLight(glm::vec3(float(i)), glm::vec3(1.0f));
+
+    // Warm up caches and driver state
+    glm::mat4 transform(1.0f);
+    for (int i = 0; i < 1000; ++i) model.draw(shader.getProgram(), transform);
+    glFinish();
+
+    double best = 1e9;
+    for (int repeat = 0; repeat < 5; ++repeat) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < DRAW_BENCH_DRAWS; ++i) {
+            transform[3][0] = float(i % 3) * 0.1f;
+            model.draw(shader.getProgram(), transform);
+        }
+        double submit = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        glFinish();
+        std::printf("  run %d: %.2f ms\n", repeat, submit);
+        best = std::min(best, submit);
+    }
+
+    GLenum error = glGetError();
+    std::printf("%d draws of %s: %.2f ms submit (best of 5), glGetError 0x%x\n", DRAW_BENCH_DRAWS, DRAW_BENCH_MODEL, best, error);
+    return error == GL_NO_ERROR ? 0 : 1;
+}
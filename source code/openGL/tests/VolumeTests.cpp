@@ -0,0 +1,74 @@
+// Checks the CPU reference raymarcher of Volume.hpp (volume_frag.glsl mirrors it).
+// Needs no GL context; exits non-zero on the first failed check.
+
+#include <Volume.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (condition) return;
+    std::printf("FAILED: %s\n", what);
+    failures++;
+}
+
+// A ball of full density at `centre` (in voxels) inside an otherwise empty volume
+static gl::volumeData ball(int width, int height, int depth, const glm::vec3& centre, float radius) {
+    std::vector<unsigned char> density(size_t(width) * height * depth, 0);
+    for (int z = 0; z < depth; ++z)
+    for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+        if (glm::length(glm::vec3(x, y, z) + 0.5f - centre) <= radius)
+            density[(size_t(z) * height + y) * width + x] = 255;
+    }
+    return gl::volumeData(std::move(density), width, height, depth);
+}
+
+// Skipping empty bricks must not change what a ray accumulates
+static void skipMatchesFullMarch(const gl::volumeData& data, const char* what) {
+    gl::volumeSettings full;
+    full.skipEmptySpace = false;
+    full.densityScale = 0.5f;
+    gl::volumeSettings skip = full;
+    skip.skipEmptySpace = true;
+
+    gl::volumeStats stats;
+    float worst = 0.0f, densest = 0.0f;
+    for (int j = 0; j < 16; ++j)
+    for (int i = 0; i < 16; ++i) {
+        glm::vec2 uv((i + 0.5f) / 16.0f, (j + 0.5f) / 16.0f);
+        const glm::vec3 rays[][2] = {
+            { glm::vec3(-0.1f, uv.x, uv.y), glm::vec3(1.2f, 0.0f, 0.0f) },
+            { glm::vec3(uv.x, 1.1f, uv.y), glm::vec3(0.0f, -1.2f, 0.0f) },
+            { glm::vec3(uv.x, uv.y, -0.1f), glm::vec3(0.3f, -0.2f, 1.2f) },
+        };
+        for (const auto& ray : rays) {
+            float a = data.raymarch(ray[0], ray[1], 1.0f, full).a;
+            float b = data.raymarch(ray[0], ray[1], 1.0f, skip, &stats).a;
+            worst = std::max(worst, std::abs(a - b));
+            densest = std::max(densest, a);
+        }
+    }
+
+    std::printf("%s: max coverage %.3f, largest skip difference %.4f, %llu bricks skipped\n",
+        what, densest, worst, (unsigned long long)stats.skippedBricks);
+    check(densest > 0.5f, what);
+    check(worst < 0.02f, what);
+    check(stats.skippedBricks > 0, what);
+}
+
+int main() {
+    // Bricks are 8 voxels wide, so 20 leaves a partial brick on every axis
+    gl::volumeData partial = ball(20, 20, 20, glm::vec3(12.0f, 11.0f, 12.5f), 2.5f);
+    check(partial.getBrickCount() == glm::ivec3(3), "20^3 volume has 3 bricks per axis");
+    skipMatchesFullMarch(partial, "20^3 volume");
+
+    skipMatchesFullMarch(ball(37, 16, 9, glm::vec3(30.0f, 5.0f, 4.5f), 3.5f), "37x16x9 volume");
+    skipMatchesFullMarch(ball(32, 32, 32, glm::vec3(20.0f, 12.0f, 9.0f), 4.0f), "32^3 volume");
+
+    std::printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}